@@ -11,8 +11,21 @@
  *  \brief  VRAM memory allocator
  *
  * Internal use, used to handle VRAM when other function requests memory.
+ *
+ * Chunks are kept in a doubly linked list sorted by address. Free chunks are
+ * also linked in segregated lists (one per power of two size class), and all
+ * chunks are indexed in an array sorted by start address so that they can be
+ * found with a binary search. Chunk structs are taken from a pool that grows
+ * in blocks, so splitting a chunk doesn't need to call malloc() every time.
+ *
+ * Allocations use the free chunk with the lowest address that fits, like when
+ * all chunks were walked in order. The size classes are only used to skip free
+ * chunks that are too small.
  */
 
+#include <stddef.h>
+#include <stdio.h>
+
 //------------------------------------------------------------------------------
 
 typedef enum {
@@ -26,12 +39,35 @@ typedef struct {
 
 	ne_chunk_state status;	// used, free or locked
 	void *start, *end;	// pointers to the start and end of the pool
+
+	// Links of the free list of the size class of this chunk. Only valid
+	// if the chunk is free.
+	void *free_previous, *free_next;
+
+	// Owner of the chunk (slot of the texture or palette, -1 if unknown)
+	// and label given by the caller (NULL if none). Only valid if the chunk
+	// isn't free.
+	int owner;
+	const char *label;
 } NEChunk;
 
+// Number of entries of the free chunk histogram. Entry N counts free chunks
+// with a size between 2^(N + 4) and 2^(N + 5) - 1 bytes. Smaller chunks are
+// counted in the first entry, bigger chunks in the last one.
+#define NE_MEM_HISTOGRAM_SIZE	16
+
 typedef struct {
 	// Values in bytes. Total memory does not include locked memory
 	size_t Free, Used, Total, Locked;
 	unsigned int FreePercent; // Locked memory doesn't count
+
+	size_t LargestFree; // Size of the biggest free chunk in bytes
+	unsigned int FreeChunks; // Number of free chunks
+	unsigned int FreeHistogram[NE_MEM_HISTOGRAM_SIZE];
+
+	// Percentage of free memory that isn't part of the biggest free chunk.
+	// It is 0 if all free memory is contiguous.
+	unsigned int FragmentationPercent;
 } NEMemInfo;
 
 //------------------------------------------------------------------------------
@@ -40,14 +76,51 @@ void NE_AllocInit(NEChunk **first_element, void *start, void *end);
 void NE_AllocEnd(NEChunk *first_element);
 
 void *NE_Alloc(NEChunk *first_element, size_t size, unsigned int align);
+
+// Like NE_Alloc(), but the allocated memory must be between "range_start" and
+// "range_end". The lowest address that fits is used.
+void *NE_AllocRange(NEChunk *first_element, size_t size, unsigned int align,
+		    void *range_start, void *range_end);
 void NE_Free(NEChunk *first_element, void *pointer);
 
 void NE_Lock(NEChunk *first_element, void *pointer);
 void NE_Unlock(NEChunk *first_element, void *pointer);
 
-//int NE_GetSize(NEChunk *first_chunk, void *pointer);
+int NE_GetSize(NEChunk *first_element, void *pointer);
 void NE_MemGetInformation(NEChunk *first_element, NEMemInfo *info);
 
+// Sets the owner tag of a chunk that isn't free. "label" isn't copied, it must
+// remain valid while the chunk is in use.
+void NE_AllocSetOwner(NEChunk *first_element, void *pointer, int owner,
+		      const char *label);
+
+// Writes one line of text per chunk to "file". The pool is divided in banks of
+// "bank_size" bytes starting at "bank_base". Banks are named with consecutive
+// letters starting at "bank_name". Chunks that cross a bank boundary are split.
+// Format: "<bank> <offset> <size> <F|U|L> <owner> <label>", with the offset
+// (relative to the start of the bank) and the size in hexadecimal.
+void NE_AllocDump(NEChunk *first_element, FILE *file, void *bank_base,
+		  size_t bank_size, char bank_name);
+
+// Functions used to defragment memory. The allocator doesn't know how to copy
+// the data, it only updates the lists.
+
+// Returns the start of the first used chunk placed after "pointer" (or after
+// the start of the pool if it is NULL) that has a free chunk right before it.
+// The start of that free chunk is returned in "free_start". Returns NULL if
+// there are no more chunks like that.
+void *NE_AllocNextMovable(NEChunk *first_element, void *pointer,
+			  void **free_start);
+
+// Moves the used chunk that starts at "pointer" so that it starts at
+// "new_pointer", which must be inside the free chunk right before it. Returns 1
+// on success, 0 on error.
+int NE_AllocMove(NEChunk *first_element, void *pointer, void *new_pointer);
+
+// Returns the start of the free chunk right before the used chunk that starts
+// at "pointer", or NULL if the chunk before it isn't free.
+void *NE_AllocFreeBefore(NEChunk *first_element, void *pointer);
+
 //----------------------------------------------------------------------------
 
 #endif // NE_ALLOC__
@@ -36,10 +36,20 @@ typedef enum {
 
 #define NE_MAX_FRAMES 128	/*! \def #define NE_MAX_FRAMES 128 */
 
+/*! \struct NE_BakedFrames
+ *  \brief  Display lists of some frames of an animation. They are shared by
+ *          the model and its clones. See NE_ModelAnimBakeFrames().
+ */
+typedef struct {
+	int refs;		// Number of models using the display lists
+	int first, last;	// Frames that have been converted
+	u32 *lists[];		// Display list of each frame
+} NE_BakedFrames;
+
 /*! \struct NE_AnimData
  *  \brief  Holds information of an animation.
  */
-typedef struct {
+typedef struct NE_AnimData {
 	// Pointer to the file/data
 	u32 *fileptrtr;
 
@@ -51,6 +61,14 @@ typedef struct {
 	int speed[NE_MAX_FRAMES];
 	s8 direction;
 	int nextframetime;
+	// Display lists of the frames drawn without interpolation, or NULL. See
+	// NE_ModelAnimBakeFrames().
+	NE_BakedFrames *baked;
+	// Animation blended with this one, or NULL. Only the fields of the
+	// current frame and speed are used. See NE_ModelAnimBlendStart().
+	struct NE_AnimData *blend;
+	f32 blendweight;	// 0 = only this animation, 1.0 = only "blend"
+	f32 blendfade;		// Added to blendweight on each update
 } NE_AnimData;
 
 /*! \struct NE_Input
@@ -227,7 +245,8 @@ typedef enum {
 	NE_UPDATE_GUI = 1,		/*!< Updates NE_GUI. */
 	NE_UPDATE_ANIMATIONS = 1 << 1,	/*!< Updates animated models. */
 	NE_UPDATE_PHYSICS = 1 << 2,	/*!< Updates the physics engine. */
-	NE_CAN_SKIP_VBL = 1 << 3	/*!< Allows Nitro Engine to skip the VBL wait if CPU load is greater than 100. */
+	NE_CAN_SKIP_VBL = 1 << 3,	/*!< Allows Nitro Engine to skip the VBL wait if CPU load is greater than 100. */
+	NE_UPDATE_PALETTE_ANIMATIONS = 1 << 4 /*!< Updates palette animations. */
 } NE_UpdateFlags;
 
 /*! \fn    void NE_WaitForVBL(NE_UpdateFlags flags);
@@ -22,6 +22,13 @@
 
 #define NE_DEFAULT_MODELS 512	/*! \def #define NE_DEFAULT_MODELS 512 */
 
+/*! \def   #define NE_MAX_BONES 24
+ *  \brief Max. number of bones of a skinned model. Each bone uses a slot of
+ *         the matrix stack, and the slots before them are left for
+ *         MATRIX_PUSH.
+ */
+#define NE_MAX_BONES 24
+
 /*! \struct NE_Model
  *  \brief  Holds information of a model.
  */
@@ -30,7 +37,7 @@ typedef struct {
 	bool iscloned;
 	// Use linear interpolation between frames or not (animated models)
 	bool anim_interpolate;
-	int modeltype;		// Animated or not
+	int modeltype;		// Static, animated or skinned
 	u32 *meshdata;		// Display list or NE_AnimData struct
 	NE_Material *texture;
 	int x, y, z;		// f32
@@ -43,7 +50,8 @@ typedef struct {
  */
 typedef enum {
 	NE_Static,		/*!< Not animated. */
-	NE_Animated		/*!< Animated. */
+	NE_Animated,		/*!< Animated (NEA file). */
+	NE_Skinned		/*!< Animated with bones (NEB file). */
 } NE_ModelType;
 
 /*! \fn    NE_Model *NE_ModelCreate(NE_ModelType type);
@@ -237,11 +245,104 @@ void NE_ModelAnimSetFrame(NE_Model *model, int frame);
  */
 void NE_ModelAnimInterpolate(NE_Model *model, bool interpolate);
 
+/*! \fn    int NE_ModelAnimBlendStart(NE_Model *model, int min, int start,
+ *                                     int max, NE_AnimationTypes type,
+ *                                     int speed, f32 weight);
+ *  \brief Starts a second animation that is blended with the current one of
+ *         an animated model. Returns 1 on success.
+ *  \param model Pointer to the model. A NEA file must have been loaded.
+ *  \param min Lowest frame possible.
+ *  \param start Start frame.
+ *  \param max Highest frame.
+ *  \param type Animation tipe. [ NE_ANIM_LOOP/NE_ANIM_ONESHOT/NE_ANIM_UPDOWN ]
+ *  \param speed Animation speed. 0 = stop, 1 = slow, 64 = max speed;
+ *  \param weight Weight of the second animation. [0, inttof32(1)]
+ *
+ * Both animations are updated by NE_ModelAnimateAll(), and they can use
+ * different frames of the file. They are blended while the vertices are sent,
+ * so drawing the model costs a bit more than drawing it with interpolation, but
+ * much less than drawing it twice. Baked frames aren't used while blending.
+ * The other NE_ModelAnim functions only affect the first animation.
+ */
+int NE_ModelAnimBlendStart(NE_Model *model, int min, int start, int max,
+			   NE_AnimationTypes type, int speed, f32 weight);
+
+/*! \fn    int NE_ModelAnimCrossfade(NE_Model *model, int min, int start,
+ *                                    int max, NE_AnimationTypes type,
+ *                                    int speed, int duration);
+ *  \brief Changes the animation of an animated model smoothly. Returns 1 on
+ *         success.
+ *  \param model Pointer to the model. A NEA file must have been loaded.
+ *  \param min Lowest frame possible.
+ *  \param start Start frame.
+ *  \param max Highest frame.
+ *  \param type Animation tipe. [ NE_ANIM_LOOP/NE_ANIM_ONESHOT/NE_ANIM_UPDOWN ]
+ *  \param speed Animation speed. 0 = stop, 1 = slow, 64 = max speed;
+ *  \param duration Number of calls to NE_ModelAnimateAll() of the change.
+ *
+ * The new animation is started with NE_ModelAnimBlendStart() and its weight
+ * goes from 0 to 1. When it reaches 1 it replaces the current animation. If
+ * there was a blended animation, it is replaced by the new one.
+ */
+int NE_ModelAnimCrossfade(NE_Model *model, int min, int start, int max,
+			  NE_AnimationTypes type, int speed, int duration);
+
+/*! \fn    void NE_ModelAnimBlendSetWeight(NE_Model *model, f32 weight);
+ *  \brief Sets the weight of the second animation of an animated model, and
+ *         stops any crossfade.
+ *  \param model Pointer to the model.
+ *  \param weight New weight. 0 = only the first animation, inttof32(1) = only
+ *         the second one.
+ *
+ * Like the time between frames, the weight is used in steps of 1/64 when the
+ * model is drawn.
+ */
+void NE_ModelAnimBlendSetWeight(NE_Model *model, f32 weight);
+
+/*! \fn    void NE_ModelAnimBlendStop(NE_Model *model);
+ *  \brief Stops the second animation of an animated model. Only the first one
+ *         is drawn after this.
+ *  \param model Pointer to the model.
+ */
+void NE_ModelAnimBlendStop(NE_Model *model);
+
+/*! \fn    int NE_ModelAnimBakeFrames(NE_Model *model, int first, int last);
+ *  \brief Converts some frames of an animated model into display lists.
+ *         Returns 1 on success.
+ *  \param model Pointer to the model. A NEA file must have been loaded.
+ *  \param first First frame to convert.
+ *  \param last Last frame to convert.
+ *
+ * When interpolation is disabled (see NE_ModelAnimInterpolate()), frames that
+ * have been converted are sent to the GPU with DMA, the same way as static
+ * models, instead of sending each vertex with the CPU. The result is the same.
+ *
+ * Each frame uses around 19 bytes of RAM per vertex, so only convert the frames
+ * that are drawn without interpolation. Models cloned after calling this
+ * function share the display lists. They are deleted when the model and all its
+ * clones have been deleted, have loaded another NEA file or have called
+ * NE_ModelAnimFreeBakedFrames(). Baking the frames again only affects this
+ * model.
+ */
+int NE_ModelAnimBakeFrames(NE_Model *model, int first, int last);
+
+/*! \fn    void NE_ModelAnimFreeBakedFrames(NE_Model *model);
+ *  \brief Deletes the display lists created by NE_ModelAnimBakeFrames().
+ *  \param model Pointer to the model.
+ *
+ * Clones of the model keep using the display lists until they call this
+ * function too, or until they are deleted.
+ */
+void NE_ModelAnimFreeBakedFrames(NE_Model *model);
+
 /*! \fn    int NE_ModelLoadNEA(NE_Model *model, void *pointer);
  *  \brief Loads every frame of a NEA file in RAM to an animated model. Returns
  *         1 if no error happened.
  *  \param model Pointer to the model.
  *  \param pointer Pointer to the file.
+ *
+ * NEA files of version 2 and 3 are supported. Version 3 files are smaller and
+ * faster to draw, see md2_to_nea.
  */
 int NE_ModelLoadNEA(NE_Model *model, void *pointer);
 
@@ -250,9 +351,35 @@ int NE_ModelLoadNEA(NE_Model *model, void *pointer);
  *         1 if no error happened.
  *  \param model Pointer to the model.
  *  \param path Path to the file.
+ *
+ * NEA files of version 2 and 3 are supported. Version 3 files are smaller and
+ * faster to draw, see md2_to_nea.
  */
 int NE_ModelLoadNEAFAT(NE_Model *model, char *path);
 
+/*! \fn    int NE_ModelLoadNEB(NE_Model *model, void *pointer);
+ *  \brief Loads a NEB file in RAM to a skinned model. Returns 1 if no error
+ *         happened.
+ *  \param model Pointer to the model.
+ *  \param pointer Pointer to the file.
+ *
+ * NEB files are created by md5_to_neb. Each vertex is attached to one bone.
+ * The matrices of the bones are calculated when the model is drawn and they
+ * are stored in the matrix stack, so the model uses the slots from
+ * (30 - number of bones) to 30. Frames are animated with the same functions
+ * as models with NEA files, and interpolation between them can be disabled
+ * with NE_ModelAnimInterpolate() too.
+ */
+int NE_ModelLoadNEB(NE_Model *model, void *pointer);
+
+/*! \fn    int NE_ModelLoadNEBFAT(NE_Model *model, char *path);
+ *  \brief Loads a NEB file in FAT to a skinned model. Returns 1 if no error
+ *         happened.
+ *  \param model Pointer to the model.
+ *  \param path Path to the file.
+ */
+int NE_ModelLoadNEBFAT(NE_Model *model, char *path);
+
 /*! \fn    void NE_ModelDeleteAll(void);
  *  \brief Deletes all models.
  */
@@ -9,6 +9,8 @@
 
 #include <nds.h>
 
+#include "NEAlloc.h"
+
 /*! \file   NEPalette.h
  *  \brief  Functions for loading, using and deleting palettes. */
 
@@ -82,12 +84,92 @@ int NE_PaletteFreeMem(void);
  */
 int NE_PaletteFreeMemPercent(void);
 
-/*! \fn    void NE_PaletteDefragMem(void);
- *  \brief Defragment memory used for palettes.
+/*! \fn    int NE_PaletteDefragMem(void);
+ *  \brief Defragment memory used for palettes. Returns the number of bytes
+ *         added to the free space at the end of palette VRAM.
+ *
+ * All palettes are moved towards the start of palette VRAM, respecting the
+ * alignment of their format. Use this DURING VBL, palettes can't be used by the
+ * GPU while they are being moved. If there are too many palettes to move during
+ * one VBL, use NE_PaletteDefragMemStep() instead.
+ */
+int NE_PaletteDefragMem(void);
+
+/*! \fn    int NE_PaletteMemGetInformation(NEMemInfo *info);
+ *  \brief Fills a NEMemInfo struct with the state of palette memory (free and
+ *         used memory, largest free block, fragmentation...). Returns 1 on
+ *         success, 0 on error.
+ *  \param info Struct to fill.
+ */
+int NE_PaletteMemGetInformation(NEMemInfo *info);
+
+/*! \fn    void NE_PaletteDedupEnable(bool enable);
+ *  \brief Enables or disables deduplication of palettes.
+ *  \param enable true to enable it, false to disable it (default).
+ *
+ * When it is enabled, NE_PaletteLoad() calculates a hash of the palette. If a
+ * palette with the same colors and format was loaded while deduplication was
+ * enabled, the new NE_Palette shares it instead of using more VRAM. The colors
+ * are compared before sharing it, not only the hash. If the upload queue is
+ * enabled, VRAM isn't read back, so only palettes that are still in the queue
+ * can be shared. Shared palettes are deleted when the last NE_Palette that uses
+ * them is deleted.
  *
- *  WARNING: This function is currently not working.
+ * Shared palettes are copied on write: NE_PaletteModificationStart() and
+ * palette animations give the modified NE_Palette its own copy first, so the
+ * rest of them aren't affected. Modified palettes are never shared again.
  */
-void NE_PaletteDefragMem(void);
+void NE_PaletteDedupEnable(bool enable);
+
+/*! \fn    int NE_PaletteDedupBytesSaved(void);
+ *  \brief Returns the number of bytes of VRAM that deduplication is saving.
+ */
+int NE_PaletteDedupBytesSaved(void);
+
+/*! \fn    void NE_PaletteSetOwnerLabel(const char *label);
+ *  \brief Sets the label that is saved with the VRAM allocated by the next
+ *         calls to NE_PaletteLoad(). It is shown by NE_PaletteDumpMemMap().
+ *  \param label Label. It isn't copied, so it must remain valid. NULL to stop
+ *         labelling allocations.
+ */
+void NE_PaletteSetOwnerLabel(const char *label);
+
+/*! \fn    void NE_PaletteDumpMemMap(FILE *file);
+ *  \brief Writes the map of palette VRAM (bank E) to a file as text.
+ *  \param file File to write to.
+ *
+ * One line is written per block of memory:
+ *
+ *     <bank> <offset> <size> <state> [<slot> <label>]
+ *
+ * The offset (relative to the start of the bank) and the size are in
+ * hexadecimal. The state is F (free), U (used) or L (locked). Used and locked
+ * blocks also show the slot of the palette that owns them and the label set
+ * with NE_PaletteSetOwnerLabel() ("-" if there isn't one).
+ */
+void NE_PaletteDumpMemMap(FILE *file);
+
+/*! \fn    int NE_PaletteDefragMemStep(int max_bytes);
+ *  \brief Defragment part of the memory used for palettes. Returns the number
+ *         of bytes moved, 0 when there is nothing left to move.
+ *  \param max_bytes Max number of bytes to copy during this call.
+ *
+ * At least one palette is moved in each call, even if it is bigger than
+ * "max_bytes". Call it once per frame DURING VBL until it returns 0.
+ *
+ * It does nothing if a palette is being modified with
+ * NE_PaletteModificationStart().
+ */
+int NE_PaletteDefragMemStep(int max_bytes);
+
+/*! \fn    bool NE_PaletteIsReady(NE_Palette *pal);
+ *  \brief Returns true if a palette is in VRAM and it can be used.
+ *  \param pal Palette.
+ *
+ * Palettes may take some time to be copied to VRAM if the upload queue is
+ * enabled. See NE_TextureUploadQueueEnable().
+ */
+bool NE_PaletteIsReady(NE_Palette *pal);
 
 /*! \fn    void NE_PaletteSystemEnd(void);
  *  \brief Terminate palette system, frees memory used by it and prevent any
@@ -101,6 +183,10 @@ void NE_PaletteSystemEnd(void);
  *
  * Use this during VBL. You must use NE_PaletteModificationEnd() when you
  * finish. If you don't, the GPU won't be able to render textures to the screen.
+ *
+ * If the palette is shared with other NE_Palette structs thanks to dedup, it
+ * is copied first. It returns NULL if there isn't enough memory for the copy,
+ * or if the shared palette is still in the upload queue.
  */
 void *NE_PaletteModificationStart(NE_Palette *pal);
 
@@ -120,6 +206,120 @@ void NE_PaletteRGB256SetColor(u8 colorindex, u16 color);
  */
 void NE_PaletteModificationEnd(void);
 
+/*! \def   #define NE_MAX_PALETTE_ANIMATIONS 32 */
+#define NE_MAX_PALETTE_ANIMATIONS 32
+
+/*! \enum  NE_PaletteAnimType
+ *  \brief Ways of animating a range of colors of a palette.
+ */
+typedef enum {
+	NE_PaletteAnimNone,		/*!< Not animated. */
+	NE_PaletteAnimRotate,		/*!< Colors rotate inside the range. */
+	NE_PaletteAnimKeyframes		/*!< Colors are taken from a table. */
+} NE_PaletteAnimType;
+
+/*! \struct NE_PaletteAnim
+ *  \brief  Animation of a range of colors of a palette.
+ *
+ * Don't modify the fields directly, use the NE_PaletteAnim functions.
+ */
+typedef struct {
+	NE_Palette *palette;
+	int first;			/*!< First color of the range. */
+	int count;			/*!< Number of colors of the range. */
+	NE_PaletteAnimType type;
+	const u16 *colors;		/*!< Colors of the range, or table. */
+	int num_keyframes;
+	int delay;			/*!< Frames per step. */
+	bool reverse;
+	bool interpolate;
+	bool paused;
+	int step;			/*!< Current rotation or keyframe. */
+	int timer;			/*!< Frames since the last step. */
+	bool dirty;			/*!< "buffer" hasn't been copied. */
+	u16 *buffer;			/*!< Colors to copy to VRAM. */
+} NE_PaletteAnim;
+
+/*! \fn    NE_PaletteAnim *NE_PaletteAnimCreate(NE_Palette *pal, int first,
+ *                                             int count);
+ *  \brief Creates an animation for a range of colors of a palette. Returns a
+ *         pointer to it, or NULL on error.
+ *  \param pal Palette. It can be loaded later.
+ *  \param first First color of the range.
+ *  \param count Number of colors of the range.
+ *
+ * The colors aren't modified until NE_PaletteAnimSetRotation() or
+ * NE_PaletteAnimSetKeyframes() is used.
+ *
+ * It fails if the range doesn't fit in the palette. If the palette isn't loaded
+ * yet, this is checked before copying the colors to VRAM instead, and the
+ * colors aren't copied if the range doesn't fit.
+ */
+NE_PaletteAnim *NE_PaletteAnimCreate(NE_Palette *pal, int first, int count);
+
+/*! \fn    void NE_PaletteAnimSetRotation(NE_PaletteAnim *anim,
+ *                                       const u16 *colors, int delay,
+ *                                       bool reverse);
+ *  \brief Rotates the colors of the range (color cycling).
+ *  \param anim Animation.
+ *  \param colors Colors of the range ("count" colors). They aren't copied, so
+ *         they must remain valid.
+ *  \param delay Frames between steps. In each step the colors move one
+ *         position towards the end of the range, and the last one goes to
+ *         the start.
+ *  \param reverse If true, colors move towards the start of the range.
+ */
+void NE_PaletteAnimSetRotation(NE_PaletteAnim *anim, const u16 *colors,
+			       int delay, bool reverse);
+
+/*! \fn    void NE_PaletteAnimSetKeyframes(NE_PaletteAnim *anim,
+ *                                        const u16 *table, int num_keyframes,
+ *                                        int delay, bool interpolate);
+ *  \brief Takes the colors of the range from a table of keyframes.
+ *  \param anim Animation.
+ *  \param table "num_keyframes" sets of "count" colors. It isn't copied, so it
+ *         must remain valid.
+ *  \param num_keyframes Number of keyframes. After the last one, the animation
+ *         goes back to the first one.
+ *  \param delay Frames per keyframe.
+ *  \param interpolate If true, colors fade from one keyframe to the next one
+ *         instead of changing at once. The range is copied to VRAM every frame
+ *         in this case.
+ */
+void NE_PaletteAnimSetKeyframes(NE_PaletteAnim *anim, const u16 *table,
+				int num_keyframes, int delay, bool interpolate);
+
+/*! \fn    void NE_PaletteAnimPause(NE_PaletteAnim *anim, bool pause);
+ *  \brief Pauses or resumes an animation.
+ *  \param anim Animation.
+ *  \param pause true to pause it, false to resume it.
+ */
+void NE_PaletteAnimPause(NE_PaletteAnim *anim, bool pause);
+
+/*! \fn    void NE_PaletteAnimDelete(NE_PaletteAnim *anim);
+ *  \brief Deletes an animation. The colors of the palette aren't restored.
+ *  \param anim Animation.
+ */
+void NE_PaletteAnimDelete(NE_PaletteAnim *anim);
+
+/*! \fn    void NE_PaletteAnimUpdateAll(void);
+ *  \brief Advances all palette animations one frame.
+ *
+ * It only calculates the new colors in RAM, it can be used at any time. It is
+ * called by NE_WaitForVBL() if NE_UPDATE_PALETTE_ANIMATIONS is used.
+ */
+void NE_PaletteAnimUpdateAll(void);
+
+/*! \fn    int NE_PaletteAnimVBL(void);
+ *  \brief Copies the colors of all palette animations that have changed to
+ *         VRAM with DMA. Returns the number of bytes copied.
+ *
+ * It is called by NE_WaitForVBL(). If you don't use that function, call this
+ * one right after every VBL. Animations of palettes that aren't in VRAM yet
+ * are copied when they are ready.
+ */
+int NE_PaletteAnimVBL(void);
+
 /*! @} */
 
 #endif // NE_PALETTE_H__
@@ -8,6 +8,8 @@
 #define NE_TEXTURE_H__
 
 #include <nds.h>
+
+#include "NEAlloc.h"
 #include "NEPalette.h"
 
 /*! \file   NETexture.h
@@ -32,11 +34,60 @@
  */
 typedef struct {
 	int texindex;
+	bool dedup;	// The texture was shared by deduplication when loading it
 	u32 color;
 	u32 diffuse, ambient, specular, emission;
 	bool vtxcolor, useshininess;
+	// Palette used instead of the one of the texture, or NULL
+	NE_Palette *palette;
+	// Rectangle of the texture used by sub-materials, in texels
+	bool subrect;
+	s16 subx, suby, subw, subh;
 } NE_Material;
 
+/*! \struct NE_AtlasRect
+ *  \brief  Rectangle of an image packed in an atlas by nitro_atlas_packer.
+ *
+ * The rectangle table file is a 32-bit number of rectangles followed by the
+ * rectangles.
+ */
+typedef struct {
+	u16 page;		// Index of the page of the atlas
+	u16 x, y;		// Position in the page, in texels
+	u16 width, height;	// Size, in texels
+	u16 reserved;
+} NE_AtlasRect;
+
+/*! \def   #define NE_CANVAS_DIRTY_RANGES 4
+ *  \brief Max number of ranges of modified rows saved by a canvas. Ranges that
+ *         don't fit are merged.
+ */
+#define NE_CANVAS_DIRTY_RANGES 4
+
+/*! \def   #define NE_MAX_CANVASES 16
+ *  \brief Max number of canvases that can exist at the same time.
+ */
+#define NE_MAX_CANVASES 16
+
+/*! \struct NE_Canvas
+ *  \brief  Texture that can be drawn at any time. See NE_CanvasCreate().
+ */
+typedef struct {
+	NE_Material *material;	// Material that shows the canvas, or NULL
+	void *shadow;		// Copy of the texture in RAM
+	int type;
+	int sizex, sizey;	// Size of the canvas, in texels
+	int realx;		// Width of the texture in VRAM, in texels
+	size_t size;		// Size of the texture, in bytes
+	int slot[2];		// Copies of the texture in VRAM
+	int front;		// Copy used by the material
+	bool update;		// Copy to VRAM in the next NE_CanvasVBL()
+	// Rows modified since each copy was updated
+	int num_dirty[2];
+	s16 dirty_start[2][NE_CANVAS_DIRTY_RANGES];
+	s16 dirty_end[2][NE_CANVAS_DIRTY_RANGES];
+} NE_Canvas;
+
 /*! \fn    NE_Material *NE_MaterialCreate(void);
  *  \brief Returns a pointer to a new NE_Material struct.
  */
@@ -81,10 +132,58 @@ int NE_MaterialTexLoadFAT(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
  *  \param sizeY (sizeX, sizeY) Texture size. It doesn't need to be a power of 2
  *  \param param Parameters of the texture.
  *  \param texture Pointer to the texture.
+ *
+ * If the width isn't a power of 2, each row is padded up to the next power of
+ * 2 while the texture is copied to VRAM. The padding texels are set to 0 (or
+ * to 0x8000 in GL_RGB textures, which get the alpha bit set).
  */
 int NE_MaterialTexLoad(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type, int sizeX,
 		       int sizeY, int param, void *texture);
 
+/*! \fn    int NE_MaterialTexLoadCompressed(NE_Material *tex, int sizeX,
+ *                                          int sizeY, int param, void *texels,
+ *                                          void *indices);
+ *  \brief Load a texture in 4x4 texel compressed format (GL_COMPRESSED) from
+ *         RAM and set it to a NE_Material struct. Returns 1 if OK, 0 if error.
+ *  \param tex Material.
+ *  \param sizeX Texture width. It must be a power of 2.
+ *  \param sizeY Texture height. It must be a multiple of 4.
+ *  \param param Parameters of the texture.
+ *  \param texels Pointer to the texels (2 bits per texel).
+ *  \param indices Pointer to the palette index data (16 bits per block).
+ *
+ * The texels are placed in VRAM_A or VRAM_C, and the index data in the part of
+ * VRAM_B that corresponds to them, as required by the hardware. Both banks must
+ * be enabled in NE_TextureSystemReset(). NE_TextureDefragMem() moves the
+ * texels and the index data together so that they keep matching. The placement
+ * policy set by NE_TextureSetPreferredBanks() doesn't apply to them.
+ *
+ * The palette has to be loaded with NE_PaletteLoad() with format GL_COMPRESSED
+ * and assigned with NE_MaterialTexSetPal(). Use nitro_texture_converter with
+ * format TEX4X4 to generate all three files.
+ */
+int NE_MaterialTexLoadCompressed(NE_Material *tex, int sizeX, int sizeY,
+				 int param, void *texels, void *indices);
+
+/*! \fn    int NE_MaterialTexLoadCompressedFAT(NE_Material *tex, int sizeX,
+ *                                             int sizeY, int param,
+ *                                             char *texels_path,
+ *                                             char *indices_path);
+ *  \brief Load a texture in 4x4 texel compressed format from FAT and set it to
+ *         a NE_Material struct. Returns 1 if OK, 0 if error.
+ *  \param tex Material.
+ *  \param sizeX Texture width. It must be a power of 2.
+ *  \param sizeY Texture height. It must be a multiple of 4.
+ *  \param param Parameters of the texture.
+ *  \param texels_path Path of the texels file.
+ *  \param indices_path Path of the palette index data file.
+ *
+ * See NE_MaterialTexLoadCompressed().
+ */
+int NE_MaterialTexLoadCompressedFAT(NE_Material *tex, int sizeX, int sizeY,
+				    int param, char *texels_path,
+				    char *indices_path);
+
 /*! \fn    void NE_MaterialTexClone(NE_Material *source, NE_Material *dest);
  *  \brief Copies the texture of a material into another material. You can
  *         delete them as usual.
@@ -93,12 +192,81 @@ int NE_MaterialTexLoad(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type, int sizeX,
  */
 void NE_MaterialTexClone(NE_Material *source, NE_Material *dest);
 
+/*! \fn    NE_Material *NE_MaterialCreateSub(NE_Material *page, int x, int y,
+ *                                       int width, int height);
+ *  \brief Creates a material that uses a rectangle of the texture of another
+ *         material, like an image packed in an atlas. Returns NULL on error.
+ *  \param page Material with the texture of the atlas page.
+ *  \param x (x, y) Upper - left corner of the rectangle, in texels.
+ *  \param y (x, y) Upper - left corner of the rectangle, in texels.
+ *  \param width Width of the rectangle, in texels.
+ *  \param height Height of the rectangle, in texels.
+ *
+ * The texture is shared with "page", it isn't copied. The new material acts as
+ * if it had a texture of size (width, height): NE_TextureGetSizeX() and
+ * NE_TextureGetSizeY() return that size, and the texture coordinates used by
+ * NE_2DDrawTexturedQuad(), sprites and models are moved to the rectangle with
+ * the texture matrix when the material is used. Texture coordinates outside of
+ * the rectangle show the rest of the page, so the texture of the page shouldn't
+ * use GL_TEXTURE_WRAP_S or GL_TEXTURE_WRAP_T.
+ *
+ * It must be deleted with NE_MaterialDelete().
+ */
+NE_Material *NE_MaterialCreateSub(NE_Material *page, int x, int y, int width,
+				  int height);
+
+/*! \fn    NE_Material *NE_MaterialCreateSubFromAtlas(NE_Material **pages,
+ *                                                int num_pages,
+ *                                                const void *rects,
+ *                                                int index);
+ *  \brief Creates a sub-material from an entry of a rectangle table created by
+ *         nitro_atlas_packer. Returns NULL on error.
+ *  \param pages Array of materials with the textures of the atlas pages.
+ *  \param num_pages Number of elements of "pages". It fails if the rectangle
+ *         is in a page outside of the array, or if that page is NULL.
+ *  \param rects Rectangle table (the contents of the "_rects.bin" file).
+ *  \param index Index of the rectangle in the table.
+ *
+ * See NE_MaterialCreateSub().
+ */
+NE_Material *NE_MaterialCreateSubFromAtlas(NE_Material **pages, int num_pages,
+					   const void *rects, int index);
+
+/*! \fn    void NE_MaterialSetSubRect(NE_Material *tex, int x, int y,
+ *                                    int width, int height);
+ *  \brief Changes the rectangle of the texture used by a sub-material. This
+ *         can be used to animate sprites with frames packed in an atlas.
+ *  \param tex Material.
+ *  \param x (x, y) Upper - left corner of the rectangle, in texels.
+ *  \param y (x, y) Upper - left corner of the rectangle, in texels.
+ *  \param width Width of the rectangle, in texels.
+ *  \param height Height of the rectangle, in texels.
+ */
+void NE_MaterialSetSubRect(NE_Material *tex, int x, int y, int width,
+			   int height);
+
 /*! \fn    void NE_MaterialTexSetPal(NE_Material *tex, NE_Palette *pal);
  *  \brief Set palete to a texture.
  *  \param tex Material with the texture.
  *  \param pal Palette. */
 void NE_MaterialTexSetPal(NE_Material *tex, NE_Palette *pal);
 
+/*! \fn    void NE_MaterialSetPalette(NE_Material *tex, NE_Palette *pal);
+ *  \brief Set a palette to a material. It is used instead of the palette of
+ *         the texture.
+ *  \param tex Material.
+ *  \param pal Palette. NULL to use the palette of the texture again.
+ *
+ * NE_MaterialTexSetPal() changes the palette of the texture, so it affects all
+ * materials that share it (see NE_MaterialTexClone()). This function only
+ * affects one material, so the same texture can be drawn with different
+ * palettes (team colors, damage variants...) without loading it again:
+ *
+ *     NE_MaterialTexClone(red_player, blue_player);
+ *     NE_MaterialSetPalette(blue_player, blue_palette);
+ */
+void NE_MaterialSetPalette(NE_Material *tex, NE_Palette *pal);
+
 /*! \fn    void NE_MaterialUse(NE_Material *tex);
  *  \brief Set next models to be drawn next to use the material.
  *  \param tex Material to be used.
@@ -164,26 +332,339 @@ int NE_TextureFreeMem(void);
  */
 int NE_TextureFreeMemPercent(void);
 
+/*! \fn    int NE_TextureMemGetInformation(NEMemInfo *info);
+ *  \brief Fills a NEMemInfo struct with the state of texture memory (free and
+ *         used memory, largest free block, fragmentation...). Returns 1 on
+ *         success, 0 on error.
+ *  \param info Struct to fill.
+ *
+ * If a texture fails to load even if there is enough free memory, check the
+ * largest free block. NE_TextureDefragMem() can help in that case.
+ */
+int NE_TextureMemGetInformation(NEMemInfo *info);
+
+/*! \fn    void NE_TextureSetOwnerLabel(const char *label);
+ *  \brief Sets the label that is saved with the VRAM allocated by the next
+ *         calls to NE_MaterialTexLoad(). It is shown by NE_TextureDumpMemMap().
+ *  \param label Label. It isn't copied, so it must remain valid. NULL to stop
+ *         labelling allocations.
+ */
+void NE_TextureSetOwnerLabel(const char *label);
+
+/*! \fn    void NE_TextureDumpMemMap(FILE *file);
+ *  \brief Writes the map of texture VRAM (banks A to D) to a file as text.
+ *  \param file File to write to.
+ *
+ * The format is the same as the one of NE_PaletteDumpMemMap(). The slot of used
+ * blocks is the one of the texture.
+ */
+void NE_TextureDumpMemMap(FILE *file);
+
+/*! \fn    void NE_TextureSetPreferredBanks(NE_VRAMBankFlags banks);
+ *  \brief Sets the banks where the next textures will be loaded if possible.
+ *  \param banks Preferred banks. 0 to remove the preference.
+ *
+ * Textures are always loaded in the lowest bank with enough free space. First,
+ * the preferred banks are checked, then the ones that aren't evacuable (see
+ * NE_TextureSetEvacuableBanks()), then the evacuable ones. A texture is only
+ * allowed to span several banks if it doesn't fit in any of them (see
+ * NE_TextureAllowBankSpan()).
+ */
+void NE_TextureSetPreferredBanks(NE_VRAMBankFlags banks);
+
+/*! \fn    void NE_TextureSetEvacuableBanks(NE_VRAMBankFlags banks);
+ *  \brief Sets the banks that should be kept as empty as possible.
+ *  \param banks Evacuable banks. 0 to allow using all banks normally.
+ *
+ * Textures are only loaded in these banks if there is no space anywhere else
+ * (or if they are also preferred banks), and NE_TextureDefragMem() doesn't move
+ * textures into them. This is useful to keep banks C and D empty so that they
+ * can be used for dual 3D mode or display capture later.
+ */
+void NE_TextureSetEvacuableBanks(NE_VRAMBankFlags banks);
+
+/*! \fn    void NE_TextureAllowBankSpan(bool allow);
+ *  \brief Sets if textures are allowed to span the boundary between two banks.
+ *  \param allow true to allow it (default), false to forbid it.
+ *
+ * If a texture doesn't fit in any bank and this is allowed, it is loaded
+ * across several consecutive banks.
+ */
+void NE_TextureAllowBankSpan(bool allow);
+
+/*! \fn    int NE_TextureTransientArenaInit(int size);
+ *  \brief Reserves texture VRAM for short-lived textures. Returns 1 on success,
+ *         0 on error.
+ *  \param size Size of the arena in bytes.
+ *
+ * The arena is a ring buffer. Loading a texture in it is just a pointer bump,
+ * and the memory is reclaimed automatically once the GPU has finished drawing
+ * the last frame that used it. This keeps textures that are created and
+ * destroyed all the time (like HUD elements or procedurally drawn textures)
+ * away from the rest of textures, so that they don't fragment texture VRAM.
+ *
+ * The memory of the arena is locked, so it isn't counted as free or used by
+ * NE_TextureFreeMem() and it isn't moved by NE_TextureDefragMem().
+ */
+int NE_TextureTransientArenaInit(int size);
+
+/*! \fn    void NE_TextureTransientArenaEnd(void);
+ *  \brief Returns the memory of the transient arena to the texture allocator.
+ *
+ * Textures loaded in the arena stop being valid. Their materials still have to
+ * be deleted with NE_MaterialDelete().
+ */
+void NE_TextureTransientArenaEnd(void);
+
+/*! \fn    int NE_MaterialTexLoadTransient(NE_Material *tex,
+ *                                         GL_TEXTURE_TYPE_ENUM type,
+ *                                         int sizeX, int sizeY, int param,
+ *                                         void *texture);
+ *  \brief Loads a texture in the transient arena and assigns it to a material.
+ *         Returns 1 on success, 0 on error.
+ *  \param tex Material.
+ *  \param type Texture type.
+ *  \param sizeX Texture width. It must be a power of 2.
+ *  \param sizeY Texture height.
+ *  \param param Parameters of the texture.
+ *  \param texture Pointer to the texture data.
+ *
+ * The data is copied to VRAM by the upload queue during the next VBL, even if
+ * the queue is disabled, so the material is drawn without texture during the
+ * frame in which it is loaded (see NE_MaterialTexIsReady()). The texture stays
+ * in VRAM while the material is used every frame. After a frame in which it
+ * isn't used, its memory is reclaimed and the material is drawn without
+ * texture until a texture is loaded again.
+ *
+ * Memory is reclaimed in the same order in which textures are loaded, so a
+ * texture that is used for a long time keeps the memory of the textures loaded
+ * after it. The previous texture of the material is removed (or deleted if no
+ * other material uses it), but the material itself is kept, so the same
+ * material can be reused.
+ */
+int NE_MaterialTexLoadTransient(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
+				int sizeX, int sizeY, int param, void *texture);
+
+/*! \fn    void NE_TextureTransientFence(void);
+ *  \brief Marks the end of a frame for the transient arena.
+ *
+ * The memory of the textures that weren't used by the frame that the GPU is
+ * going to draw is reclaimed. It is called by NE_WaitForVBL(). If you don't
+ * use that function, call this one right after every VBL, after
+ * NE_TextureUploadQueueVBL() and before NE_TextureResidencyNextFrame().
+ */
+void NE_TextureTransientFence(void);
+
+/*! \fn    int NE_TextureTransientFreeMem(void);
+ *  \brief Returns the free space in the transient arena.
+ */
+int NE_TextureTransientFreeMem(void);
+
+/*! \struct NE_TextureResidencyStats
+ *  \brief  Statistics of the residency manager of managed textures.
+ */
+typedef struct {
+	u32 hits;		/*!< Uses of textures that were in VRAM. */
+	u32 misses;		/*!< Uses of textures that weren't in VRAM. */
+	u32 evictions;		/*!< Textures removed from VRAM to make space. */
+	u32 uploaded_bytes;	/*!< Bytes copied to VRAM to reload textures. */
+} NE_TextureResidencyStats;
+
+/*! \fn    int NE_MaterialTexLoadManaged(NE_Material *tex,
+ *                                       GL_TEXTURE_TYPE_ENUM type,
+ *                                       int sizeX, int sizeY, int param,
+ *                                       void *texture);
+ *  \brief Loads a managed texture to a material. Returns 1 on success, 0 on
+ *         error.
+ *  \param tex Material.
+ *  \param type Texture type.
+ *  \param sizeX Texture width.
+ *  \param sizeY Texture height.
+ *  \param param Parameters of the texture.
+ *  \param texture Pointer to the texture data. It isn't copied, it must remain
+ *         valid until the material is deleted.
+ *
+ * Managed textures don't need to be in VRAM all the time. When there isn't
+ * enough VRAM to load a texture, the least recently used managed textures are
+ * evicted from VRAM. When a managed texture that isn't in VRAM is used with
+ * NE_MaterialUse(), it is drawn without texture, and it is loaded again from
+ * the original data by NE_TextureResidencyNextFrame() after the next VBL (if
+ * the upload budget of the frame allows it, see
+ * NE_TextureResidencySetBudget()). Textures are never copied to VRAM while the
+ * frame is being drawn.
+ *
+ * Textures used during the current or the previous frame are never evicted,
+ * as the GPU may still need them.
+ */
+int NE_MaterialTexLoadManaged(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
+			      int sizeX, int sizeY, int param, void *texture);
+
+/*! \fn    int NE_MaterialTexLoadManagedFAT(NE_Material *tex,
+ *                                          GL_TEXTURE_TYPE_ENUM type,
+ *                                          int sizeX, int sizeY, int param,
+ *                                          char *path);
+ *  \brief Loads a managed texture from FAT to a material. Returns 1 on
+ *         success, 0 on error.
+ *  \param tex Material.
+ *  \param type Texture type.
+ *  \param sizeX Texture width.
+ *  \param sizeY Texture height.
+ *  \param param Parameters of the texture.
+ *  \param path Path of the texture. The file is loaded again from FAT every
+ *         time the texture has to be reloaded, so no RAM is used to keep it.
+ *
+ * See NE_MaterialTexLoadManaged().
+ */
+int NE_MaterialTexLoadManagedFAT(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
+				 int sizeX, int sizeY, int param, char *path);
+
+/*! \fn    void NE_TextureResidencySetBudget(int max_bytes);
+ *  \brief Sets the max number of bytes of managed textures that can be
+ *         reloaded in one frame.
+ *  \param max_bytes Max number of bytes. 0 means no limit (default).
+ *
+ * One texture is always allowed to be reloaded each frame, even if it is bigger
+ * than the budget.
+ */
+void NE_TextureResidencySetBudget(int max_bytes);
+
+/*! \fn    void NE_TextureResidencyNextFrame(void);
+ *  \brief Tells the residency manager that a new frame has started.
+ *
+ * Managed textures that were used while they weren't in VRAM are loaded again.
+ * It is called by NE_WaitForVBL(). If you don't use that function, call this
+ * one right after every VBL.
+ */
+void NE_TextureResidencyNextFrame(void);
+
+/*! \fn    void NE_TextureResidencyGetStats(NE_TextureResidencyStats *stats);
+ *  \brief Gets the statistics of the residency manager.
+ *  \param stats Pointer to a struct to fill.
+ */
+void NE_TextureResidencyGetStats(NE_TextureResidencyStats *stats);
+
+/*! \fn    void NE_TextureResidencyResetStats(void);
+ *  \brief Sets all statistics of the residency manager to 0.
+ */
+void NE_TextureResidencyResetStats(void);
+
+/*! \fn    void NE_TextureUploadQueueEnable(bool enable);
+ *  \brief Enables or disables the upload queue.
+ *  \param enable true to enable it, false to disable it (default).
+ *
+ * When the queue is enabled, NE_MaterialTexLoad() and NE_PaletteLoad() (and
+ * the functions that use them) reserve VRAM and return right away. The data is
+ * saved in RAM and copied to VRAM with DMA during the next VBL, so textures
+ * being drawn are never disabled in the middle of a frame. Until then,
+ * materials are drawn without texture. Use NE_MaterialTexIsReady() and
+ * NE_PaletteIsReady() to check if the copy has finished.
+ *
+ * When the queue is disabled, all queued copies are done right away.
+ */
+void NE_TextureUploadQueueEnable(bool enable);
+
+/*! \fn    void NE_TextureUploadQueueSetBudget(int max_bytes);
+ *  \brief Sets the max number of bytes copied from the upload queue per VBL.
+ *  \param max_bytes Max number of bytes. 0 means no limit (default).
+ */
+void NE_TextureUploadQueueSetBudget(int max_bytes);
+
+/*! \fn    int NE_TextureUploadQueueFlush(int max_bytes);
+ *  \brief Copies queued textures and palettes to VRAM. Returns the number of
+ *         bytes copied.
+ *  \param max_bytes Max number of bytes to copy. At least one texture or
+ *         palette is always copied, even if it is bigger than this.
+ *
+ * Call it only during VBL.
+ */
+int NE_TextureUploadQueueFlush(int max_bytes);
+
+/*! \fn    void NE_TextureUploadQueueVBL(void);
+ *  \brief Copies queued textures and palettes to VRAM using the budget set
+ *         with NE_TextureUploadQueueSetBudget().
+ *
+ * It is called by NE_WaitForVBL(). If you don't use that function, call this
+ * one right after every VBL.
+ */
+void NE_TextureUploadQueueVBL(void);
+
+/*! \fn    int NE_TextureUploadQueuePending(void);
+ *  \brief Returns the number of bytes waiting in the upload queue.
+ */
+int NE_TextureUploadQueuePending(void);
+
+/*! \fn    bool NE_MaterialTexIsReady(NE_Material *tex);
+ *  \brief Returns true if the texture of a material is in VRAM and it can be
+ *         used.
+ *  \param tex Material.
+ */
+bool NE_MaterialTexIsReady(NE_Material *tex);
+
+/*! \fn    void NE_TextureDedupEnable(bool enable);
+ *  \brief Enables or disables deduplication of textures.
+ *  \param enable true to enable it, false to disable it (default).
+ *
+ * When it is enabled, NE_MaterialTexLoad() calculates a hash of the texture
+ * data. If a texture with the same data, format, size and parameters was
+ * loaded while deduplication was enabled, the new material shares it instead
+ * of using more VRAM, like with NE_MaterialTexClone(). The hash is only used to
+ * find candidates: the data in VRAM (or in the upload queue) is compared with
+ * the new texture before sharing it. If the upload queue is enabled, VRAM isn't
+ * read back, so only textures that are still in the queue can be shared.
+ * Textures modified with NE_TextureDrawingStart() aren't shared.
+ *
+ * Materials that share a texture also share its palette, so don't use it for
+ * textures that will be assigned different palettes.
+ */
+void NE_TextureDedupEnable(bool enable);
+
+/*! \fn    int NE_TextureDedupBytesSaved(void);
+ *  \brief Returns the number of bytes of VRAM that deduplication is saving.
+ */
+int NE_TextureDedupBytesSaved(void);
+
 /*! \fn    void NE_TextureDefragMem(void);
  *  \brief Defragment VRAM used by textures. It may take some time to finish.
  *
- * WARNING: This function doesn't currently work.
+ * All textures are moved towards the start of texture VRAM. Use this DURING
+ * VBL, textures can't be used by the GPU while they are being moved. If there
+ * are too many textures to move during one VBL, use NE_TextureDefragMemStep()
+ * instead.
  */
 void NE_TextureDefragMem(void);
 
+/*! \fn    int NE_TextureDefragMemStep(int max_bytes);
+ *  \brief Defragment part of the VRAM used by textures. Returns the number of
+ *         bytes moved, 0 when there is nothing left to move.
+ *  \param max_bytes Max number of bytes to copy during this call.
+ *
+ * It moves textures towards the start of texture VRAM until "max_bytes" would
+ * be exceeded. At least one texture is moved in each call, even if it is bigger
+ * than "max_bytes", so that the defragmentation always progresses. Call it once
+ * per frame DURING VBL until it returns 0.
+ *
+ * Compressed textures (GL_COMPRESSED) are moved together with their index data,
+ * so they only move as far as the free space before both of them allows.
+ *
+ * Don't call it while a texture is being drawn with NE_TextureDrawingStart().
+ */
+int NE_TextureDefragMemStep(int max_bytes);
+
 /*! \fn    void NE_TextureSystemEnd(void);
  *  \brief Terminates texture and palette system and frees memory used by them.
  */
 void NE_TextureSystemEnd(void);
 
 /*! \fn    int NE_TextureGetSizeX(NE_Material *tex);
- *  \brief Returns used X size of texture.
+ *  \brief Returns used X size of texture. For sub-materials, it returns the
+ *         width of their rectangle.
  *  \param tex Material.
  */
 int NE_TextureGetSizeX(NE_Material *tex);
 
 /*! \fn    int NE_TextureGetSizeY(NE_Material *tex);
- *  \brief Returns used Y size of texture.
+ *  \brief Returns used Y size of texture. For sub-materials, it returns the
+ *         height of their rectangle.
  *  \param tex Material.
  */
 int NE_TextureGetSizeY(NE_Material *tex);
@@ -245,6 +726,9 @@ void NE_MaterialSetDefaultPropierties(u32 diffuse, u32 ambient, u32 specular,
  *
  * Use this DURING VBL. YOU MUST USE NE_TextureDrawingEnd() WHEN YOU FINISH
  * DRAWING. IF YOU DON'T, GPU WON'T BE ABLE TO RENDER ANY TEXTURE TO SCREEN.
+ *
+ * If "tex" is a sub-material, the whole page is drawn, and coordinates are
+ * relative to the page, not to the rectangle of the sub-material.
  */
 void *NE_TextureDrawingStart(NE_Material *tex);
 
@@ -268,6 +752,61 @@ void NE_TexturePutPixelRGBA(u32 x, u32 y, u16 color);
  */
 void NE_TexturePutPixelRGB256(u32 x, u32 y, u8 palettecolor);
 
+/*! \fn    void NE_TextureDrawSpan(int x, int y, int length, u32 value);
+ *  \brief Sets a horizontal line of texels of the active texture to "value".
+ *  \param x (x, y) Coordinates of the leftmost texel.
+ *  \param y (x, y) Coordinates of the leftmost texel.
+ *  \param length Number of texels.
+ *  \param value Value of the texels: a RGB15 color with bit 15 set for GL_RGBA
+ *         textures, a palette index for paletted textures (with the alpha in
+ *         the top bits for GL_RGB32_A3 and GL_RGB8_A5).
+ *
+ * This works with all formats except for GL_COMPRESSED. Texels outside of the
+ * texture are ignored. Use this DURING VBL.
+ */
+void NE_TextureDrawSpan(int x, int y, int length, u32 value);
+
+/*! \fn    void NE_TextureDrawRect(int x, int y, int w, int h, u32 value);
+ *  \brief Sets a rectangle of texels of the active texture to "value".
+ *  \param x (x, y) Upper - left corner.
+ *  \param y (x, y) Upper - left corner.
+ *  \param w Width.
+ *  \param h Height.
+ *  \param value Value of the texels. See NE_TextureDrawSpan().
+ *
+ * Big rectangles are filled with DMA. Use this DURING VBL.
+ */
+void NE_TextureDrawRect(int x, int y, int w, int h, u32 value);
+
+/*! \fn    void NE_TextureDrawImage(int x, int y, const void *image, int w,
+ *                                  int h, int key);
+ *  \brief Copies an image in RAM to the active texture.
+ *  \param x (x, y) Upper - left corner of the destination.
+ *  \param y (x, y) Upper - left corner of the destination.
+ *  \param image Image. It must have the format of the texture and it must be
+ *         aligned to 4 bytes. Rows aren't padded, like in textures.
+ *  \param w Width of the image.
+ *  \param h Height of the image.
+ *  \param key Texels of the image with this value aren't copied. Use -1 to
+ *         copy all of them.
+ *
+ * Use this DURING VBL.
+ */
+void NE_TextureDrawImage(int x, int y, const void *image, int w, int h,
+			 int key);
+
+/*! \fn    void NE_TextureDrawLine(int x1, int y1, int x2, int y2, u32 value);
+ *  \brief Draws a line in the active texture.
+ *  \param x1 (x1, y1) First point.
+ *  \param y1 (x1, y1) First point.
+ *  \param x2 (x2, y2) Last point.
+ *  \param y2 (x2, y2) Last point.
+ *  \param value Value of the texels. See NE_TextureDrawSpan().
+ *
+ * Use this DURING VBL.
+ */
+void NE_TextureDrawLine(int x1, int y1, int x2, int y2, u32 value);
+
 /*! \fn    void NE_TextureDrawingEnd(void);
  *  \brief Ends texture drawing.
  *
@@ -275,6 +814,81 @@ void NE_TexturePutPixelRGB256(u32 x, u32 y, u8 palettecolor);
  */
 void NE_TextureDrawingEnd(void);
 
+/*! \fn    NE_Canvas *NE_CanvasCreate(NE_Material *tex,
+ *                                    GL_TEXTURE_TYPE_ENUM type, int sizeX,
+ *                                    int sizeY, int param,
+ *                                    const void *texture);
+ *  \brief Creates a canvas and shows it with a material. Returns NULL on
+ *         error.
+ *  \param tex Material.
+ *  \param type Texture type. GL_COMPRESSED isn't supported.
+ *  \param sizeX Width.
+ *  \param sizeY Height.
+ *  \param param Parameters of the texture.
+ *  \param texture Initial contents of the canvas, aligned to 4 bytes, or NULL
+ *         to clear it.
+ *
+ * A canvas is a texture that is drawn in RAM and copied to VRAM during VBL after
+ * NE_CanvasUpdate() is called. It uses two copies of the texture in VRAM: the
+ * material uses one while the other one is updated, so drawing doesn't stop
+ * the GPU from reading textures, and only the modified rows are copied.
+ *
+ * The material keeps using the last updated copy after NE_CanvasDelete(). If
+ * the material is deleted first, the canvas is detached from it and it can
+ * still be drawn, but it isn't shown anymore.
+ */
+NE_Canvas *NE_CanvasCreate(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
+			   int sizeX, int sizeY, int param,
+			   const void *texture);
+
+/*! \fn    void NE_CanvasDelete(NE_Canvas *canvas);
+ *  \brief Deletes a canvas. Delete all canvases before resetting or ending the
+ *         texture system.
+ *  \param canvas Canvas.
+ */
+void NE_CanvasDelete(NE_Canvas *canvas);
+
+/*! \fn    void *NE_CanvasDrawingStart(NE_Canvas *canvas);
+ *  \brief Enables drawing for a canvas. Returns a pointer to the data in RAM.
+ *  \param canvas Canvas.
+ *
+ * This works like NE_TextureDrawingStart(), but it can be used at any time. All
+ * drawing functions mark the rows they modify so that NE_CanvasUpdate() copies
+ * them to VRAM. If you modify the data directly, use NE_CanvasMarkDirty(). Use
+ * NE_TextureDrawingEnd() when you finish.
+ */
+void *NE_CanvasDrawingStart(NE_Canvas *canvas);
+
+/*! \fn    void NE_CanvasMarkDirty(NE_Canvas *canvas, int x, int y, int w,
+ *                                 int h);
+ *  \brief Marks a rectangle of a canvas as modified.
+ *  \param canvas Canvas.
+ *  \param x (x, y) Upper - left corner.
+ *  \param y (x, y) Upper - left corner.
+ *  \param w Width.
+ *  \param h Height.
+ */
+void NE_CanvasMarkDirty(NE_Canvas *canvas, int x, int y, int w, int h);
+
+/*! \fn    void NE_CanvasUpdate(NE_Canvas *canvas);
+ *  \brief Shows the current contents of a canvas from the next frame.
+ *  \param canvas Canvas.
+ *
+ * It can be used at any time. The modified rows are copied to the copy in VRAM
+ * that isn't being used by NE_CanvasVBL(), and then the material uses that
+ * copy. Canvases that are being drawn wait until NE_TextureDrawingEnd().
+ */
+void NE_CanvasUpdate(NE_Canvas *canvas);
+
+/*! \fn    int NE_CanvasVBL(void);
+ *  \brief Copies all canvases with pending updates to VRAM. Returns the number
+ *         of bytes copied.
+ *
+ * It is called by NE_WaitForVBL() after NE_TextureUploadQueueVBL(). If you
+ * don't use that function, call this one right after every VBL.
+ */
+int NE_CanvasVBL(void);
+
 /*! @} */
 
 #endif // NE_TEXTURE_H__
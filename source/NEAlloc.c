@@ -9,450 +9,601 @@
 #include "NEMain.h"
 #include "NEAlloc.h"
 
+// Number of chunk structs that are allocated at once by the pool
+#define NE_ALLOC_POOL_CHUNKS	32
+
+// Free chunks are sorted in lists depending on the position of the highest bit
+// set in their size. VRAM pools are never bigger than 512 KB, so 20 classes are
+// enough. Any bigger chunk goes to the last class anyway.
+#define NE_ALLOC_SIZE_CLASSES	20
+
+// Initial number of entries of the address index
+#define NE_ALLOC_INDEX_SIZE	64
+
+typedef struct ne_chunk_pool_block {
+	struct ne_chunk_pool_block *next;
+	NEChunk chunks[NE_ALLOC_POOL_CHUNKS];
+} ne_chunk_pool_block;
+
+// The first chunk of the list is never deleted (when two chunks are joined, the
+// one with the lowest address is kept), so it is embedded in the struct that
+// holds the rest of the state of the allocator. The pointer to the first chunk
+// that is given to the user is also a pointer to this struct.
+typedef struct {
+	NEChunk first;
+
+	// Free chunks sorted by size class
+	NEChunk *free_list[NE_ALLOC_SIZE_CLASSES];
+
+	// All chunks sorted by start address
+	NEChunk **index;
+	int index_count, index_size;
+
+	// Pool of chunk structs
+	ne_chunk_pool_block *pool_blocks;
+	NEChunk *pool_free;
+} ne_allocator_t;
+
+static inline ne_allocator_t *ne_alloc_get(NEChunk *first_chunk)
+{
+	return (ne_allocator_t *)first_chunk;
+}
+
+static inline size_t ne_chunk_size(NEChunk *chunk)
+{
+	return (uintptr_t)chunk->end - (uintptr_t)chunk->start;
+}
+
+static int ne_alloc_size_class(size_t size)
+{
+	if (size == 0)
+		return 0;
+
+	int size_class = 31 - __builtin_clz((unsigned int)size);
+
+	if (size_class >= NE_ALLOC_SIZE_CLASSES)
+		size_class = NE_ALLOC_SIZE_CLASSES - 1;
+
+	return size_class;
+}
+
+//------------------------------------------------------------------------------
+
+static NEChunk *ne_chunk_new(ne_allocator_t *alloc)
+{
+	if (alloc->pool_free == NULL) {
+		ne_chunk_pool_block *block = malloc(sizeof(ne_chunk_pool_block));
+		if (block == NULL)
+			return NULL;
+
+		block->next = alloc->pool_blocks;
+		alloc->pool_blocks = block;
+
+		for (int i = 0; i < NE_ALLOC_POOL_CHUNKS; i++) {
+			block->chunks[i].next = alloc->pool_free;
+			alloc->pool_free = &block->chunks[i];
+		}
+	}
+
+	NEChunk *chunk = alloc->pool_free;
+	alloc->pool_free = chunk->next;
+
+	return chunk;
+}
+
+static void ne_chunk_release(ne_allocator_t *alloc, NEChunk *chunk)
+{
+	chunk->next = alloc->pool_free;
+	alloc->pool_free = chunk;
+}
+
+// Insert "new_chunk" in the address list right after "chunk"
+static void ne_chunk_link_after(NEChunk *chunk, NEChunk *new_chunk)
+{
+	NEChunk *next_chunk = chunk->next;
+
+	new_chunk->previous = chunk;
+	new_chunk->next = next_chunk;
+
+	if (next_chunk != NULL)
+		next_chunk->previous = new_chunk;
+
+	chunk->next = new_chunk;
+}
+
+// Remove a chunk from the address list. It can't be the first chunk.
+static void ne_chunk_unlink(NEChunk *chunk)
+{
+	NEChunk *previous_chunk = chunk->previous;
+	NEChunk *next_chunk = chunk->next;
+
+	previous_chunk->next = next_chunk;
+
+	if (next_chunk != NULL)
+		next_chunk->previous = previous_chunk;
+}
+
+//------------------------------------------------------------------------------
+
+// The size of the chunk must not change while it is in a free list, or it
+// won't be possible to remove it from the right list later.
+
+static void ne_free_list_add(ne_allocator_t *alloc, NEChunk *chunk)
+{
+	int size_class = ne_alloc_size_class(ne_chunk_size(chunk));
+	NEChunk *head = alloc->free_list[size_class];
+
+	chunk->free_previous = NULL;
+	chunk->free_next = head;
+
+	if (head != NULL)
+		head->free_previous = chunk;
+
+	alloc->free_list[size_class] = chunk;
+}
+
+static void ne_free_list_remove(ne_allocator_t *alloc, NEChunk *chunk)
+{
+	NEChunk *previous_chunk = chunk->free_previous;
+	NEChunk *next_chunk = chunk->free_next;
+
+	if (previous_chunk != NULL) {
+		previous_chunk->free_next = next_chunk;
+	} else {
+		int size_class = ne_alloc_size_class(ne_chunk_size(chunk));
+		alloc->free_list[size_class] = next_chunk;
+	}
+
+	if (next_chunk != NULL)
+		next_chunk->free_previous = previous_chunk;
+}
+
+//------------------------------------------------------------------------------
+
+// Returns the position of the first entry of the index with a start address
+// greater than or equal to the given one.
+static int ne_index_search(ne_allocator_t *alloc, void *pointer)
+{
+	int low = 0;
+	int high = alloc->index_count;
+
+	while (low < high) {
+		int middle = (low + high) >> 1;
+
+		if ((uintptr_t)alloc->index[middle]->start < (uintptr_t)pointer)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+static NEChunk *ne_index_find(ne_allocator_t *alloc, void *pointer)
+{
+	int pos = ne_index_search(alloc, pointer);
+
+	if (pos < alloc->index_count && alloc->index[pos]->start == pointer)
+		return alloc->index[pos];
+
+	return NULL;
+}
+
+// Makes sure that there is space for "count" more entries in the index
+static int ne_index_reserve(ne_allocator_t *alloc, int count)
+{
+	if (alloc->index_count + count <= alloc->index_size)
+		return 1;
+
+	int new_size = alloc->index_size << 1;
+	NEChunk **new_index = realloc(alloc->index,
+				      new_size * sizeof(NEChunk *));
+	if (new_index == NULL)
+		return 0;
+
+	alloc->index = new_index;
+	alloc->index_size = new_size;
+
+	return 1;
+}
+
+// There must be space in the index for the new entry (see ne_index_reserve())
+static void ne_index_insert(ne_allocator_t *alloc, NEChunk *chunk)
+{
+	int pos = ne_index_search(alloc, chunk->start);
+
+	memmove(&alloc->index[pos + 1], &alloc->index[pos],
+		(alloc->index_count - pos) * sizeof(NEChunk *));
+
+	alloc->index[pos] = chunk;
+	alloc->index_count++;
+}
+
+static void ne_index_remove(ne_allocator_t *alloc, NEChunk *chunk)
+{
+	int pos = ne_index_search(alloc, chunk->start);
+
+	NE_Assert(pos < alloc->index_count && alloc->index[pos] == chunk,
+		  "Possible index corruption");
+
+	alloc->index_count--;
+
+	memmove(&alloc->index[pos], &alloc->index[pos + 1],
+		(alloc->index_count - pos) * sizeof(NEChunk *));
+}
+
+//------------------------------------------------------------------------------
+
 void NE_AllocInit(NEChunk **first_chunk, void *start, void *end)
 {
 	NE_AssertPointer(first_chunk, "NULL pointer");
 	NE_Assert(end > start, "End must be after the start");
 
-	*first_chunk = malloc(sizeof(NEChunk));
-	NE_AssertPointer(*first_chunk, "Couldn't allocate chunk");
+	*first_chunk = NULL;
+
+	ne_allocator_t *alloc = calloc(1, sizeof(ne_allocator_t));
+	NE_AssertPointer(alloc, "Couldn't allocate allocator");
+	if (alloc == NULL)
+		return;
+
+	alloc->index = malloc(NE_ALLOC_INDEX_SIZE * sizeof(NEChunk *));
+	NE_AssertPointer(alloc->index, "Couldn't allocate index");
+	if (alloc->index == NULL) {
+		free(alloc);
+		return;
+	}
+	alloc->index_size = NE_ALLOC_INDEX_SIZE;
+
+	NEChunk *chunk = &alloc->first;
+
+	chunk->previous = NULL;
+	chunk->status = NE_STATE_FREE;
+	chunk->start = start;
+	chunk->end = end;
+	chunk->next = NULL;
+	chunk->owner = -1;
+	chunk->label = NULL;
 
-	(*first_chunk)->previous = NULL;
-	(*first_chunk)->status = NE_STATE_FREE;
-	(*first_chunk)->start = start;
-	(*first_chunk)->end = end;
-	(*first_chunk)->next = NULL;
+	ne_index_insert(alloc, chunk);
+	ne_free_list_add(alloc, chunk);
+
+	*first_chunk = chunk;
 }
 
 void NE_AllocEnd(NEChunk *first_chunk)
 {
 	NE_AssertPointer(first_chunk, "NULL pointer");
 
-	NEChunk *chunk_search, *chunk_current = first_chunk;
+	ne_allocator_t *alloc = ne_alloc_get(first_chunk);
 
-	while (1) {
-		chunk_search = chunk_current->next;
-		free(chunk_current);
-		if (chunk_search == NULL)
-			break;
-		chunk_current = chunk_search;
+	ne_chunk_pool_block *block = alloc->pool_blocks;
+	while (block != NULL) {
+		ne_chunk_pool_block *next_block = block->next;
+		free(block);
+		block = next_block;
+	}
+
+	free(alloc->index);
+	free(alloc);
+}
+
+// Returns true if the range of memory between "start" and "end" has enough
+// space for the requested size after aligning the start address. The aligned
+// address is returned in "result".
+static bool ne_range_fits(uintptr_t start, uintptr_t end, size_t size,
+			  unsigned int align, uintptr_t *result)
+{
+	if (end <= start || end - start < size)
+		return false;
+
+	// If it is already aligned, we're done
+	if ((start & (align - 1)) == 0) {
+		*result = start;
+		return true;
 	}
 
-	return;
+	// If not, check if even with disalignment there is enough space
+	uintptr_t aligned_start = (start & ~(uintptr_t)(align - 1)) + align;
+
+	if (aligned_start + size > end)
+		return false;
+
+	*result = aligned_start;
+	return true;
+}
+
+static bool ne_chunk_fits(NEChunk *chunk, size_t size, unsigned int align,
+			  uintptr_t *result)
+{
+	return ne_range_fits((uintptr_t)chunk->start, (uintptr_t)chunk->end,
+			     size, align, result);
+}
+
+// Allocates "size" bytes at "address" inside the free chunk "chunk"
+static void *ne_chunk_allocate(ne_allocator_t *alloc, NEChunk *chunk,
+			       uintptr_t address, size_t size)
+{
+	uintptr_t chunk_start = (uintptr_t)chunk->start;
+	uintptr_t chunk_end = (uintptr_t)chunk->end;
+	uintptr_t used_end = address + size;
+
+	//
+	// |               FREE                | NEXT |
+	// +-----------------------------------+------+
+	// |             NOT USED              | USED |
+	//
+	// |  FREE  |   USED   |     TAIL      | NEXT |
+	// +~~~~~~~~+----------+---------------+------+
+	// |NOT USED|   USED   |   NOT USED    | USED |
+	//
+	// The first part only exists if the free chunk isn't aligned, the
+	// tail only exists if there is more space than requested.
+
+	bool needs_head = (address != chunk_start);
+	bool needs_tail = (used_end != chunk_end);
+
+	// Get everything needed before modifying the lists so that it is
+	// possible to fail cleanly.
+
+	if (!ne_index_reserve(alloc, 2))
+		return NULL;
+
+	NEChunk *used_chunk = chunk;
+	NEChunk *tail_chunk = NULL;
+
+	if (needs_head) {
+		used_chunk = ne_chunk_new(alloc);
+		if (used_chunk == NULL)
+			return NULL;
+	}
+
+	if (needs_tail) {
+		tail_chunk = ne_chunk_new(alloc);
+		if (tail_chunk == NULL) {
+			if (needs_head)
+				ne_chunk_release(alloc, used_chunk);
+			return NULL;
+		}
+	}
+
+	ne_free_list_remove(alloc, chunk);
+
+	if (needs_head) {
+		chunk->end = (void *)address;
+		used_chunk->start = (void *)address;
+		ne_chunk_link_after(chunk, used_chunk);
+		ne_index_insert(alloc, used_chunk);
+
+		// The first part is still free
+		ne_free_list_add(alloc, chunk);
+	}
+
+	used_chunk->status = NE_STATE_USED;
+	used_chunk->end = (void *)used_end;
+	used_chunk->owner = -1;
+	used_chunk->label = NULL;
+
+	if (needs_tail) {
+		tail_chunk->status = NE_STATE_FREE;
+		tail_chunk->start = (void *)used_end;
+		tail_chunk->end = (void *)chunk_end;
+		ne_chunk_link_after(used_chunk, tail_chunk);
+		ne_index_insert(alloc, tail_chunk);
+		ne_free_list_add(alloc, tail_chunk);
+	}
+
+	return used_chunk->start;
 }
 
 void *NE_Alloc(NEChunk *first_chunk, size_t size, unsigned int align)
 {
 	NE_AssertPointer(first_chunk, "NULL pointer");
 
+	// Empty chunks would have the same start address as the next one
+	if (size == 0)
+		return NULL;
+
 	// Minimum alignment...
 	if (align < 4)
 		align = 4;
 
-	NEChunk *chunk_search = first_chunk;
+	ne_allocator_t *alloc = ne_alloc_get(first_chunk);
 
-	for ( ; chunk_search != NULL; chunk_search = chunk_search->next) {
+	NEChunk *best_chunk = NULL;
+	uintptr_t best_address = 0;
 
-		// Skip non-free chunks
-		if (chunk_search->status != NE_STATE_FREE)
-			continue;
+	// Only free chunks of the classes that may have a big enough chunk are
+	// checked. Chunks in the first class may be smaller than the requested
+	// size, and alignment may make a chunk unusable, so they have to be
+	// checked. The chunk with the lowest address is used so that memory is
+	// filled from the start, like when the whole list of chunks was walked.
+	for (int c = ne_alloc_size_class(size); c < NE_ALLOC_SIZE_CLASSES; c++) {
+		NEChunk *chunk = alloc->free_list[c];
+		for ( ; chunk != NULL; chunk = chunk->free_next) {
+			uintptr_t address;
 
-		// Let's check if we can allocate here.
-		NEChunk *free_chunk = chunk_search;
+			if (!ne_chunk_fits(chunk, size, align, &address))
+				continue;
 
-		uintptr_t free_chunk_start = (uintptr_t)free_chunk->start;
-		uintptr_t free_chunk_end = (uintptr_t)free_chunk->end;
+			if (best_chunk == NULL || address < best_address) {
+				best_chunk = chunk;
+				best_address = address;
+			}
+		}
+	}
 
-		size_t chunk_size = free_chunk_end - free_chunk_start;
+	if (best_chunk != NULL) {
+		void *pointer = ne_chunk_allocate(alloc, best_chunk,
+						  best_address, size);
+		NE_AssertPointer(pointer, "Couldn't allocate chunk");
+		return pointer;
+	}
 
-		// If this chunk doesn't have enough space, simply skip it
-		if (chunk_size < size)
-			continue;
+	// No more chunks... Not enough free space.
+	return NULL;
+}
 
-		// If we only have the space requested, it can be easy
-		if (chunk_size == size) {
-			// If it is already aligned, we're done
-			if ((free_chunk_start & (align - 1)) == 0) {
-				free_chunk->status = NE_STATE_USED;
-				return free_chunk->start;
-			}
+void *NE_AllocRange(NEChunk *first_chunk, size_t size, unsigned int align,
+		    void *range_start, void *range_end)
+{
+	NE_AssertPointer(first_chunk, "NULL pointer");
 
-			// If not, there isn't enough space in this chunk.
-			// Continue with the next one.
-			continue;
-		}
+	if (size == 0)
+		return NULL;
 
-		// If we have more space than requested
-
-		// If it is aligned...
-		if ((free_chunk_start & (align - 1)) == 0) {
-			// Get next chunk and create a new one.
-			NEChunk *next_chunk = free_chunk->next;
-			NEChunk *new_chunk = malloc(sizeof(NEChunk));
-			NE_AssertPointer(new_chunk,
-					 "Couldn't allocate chunk. (1)");
-
-			// Set as used
-			free_chunk->status = NE_STATE_USED;
-
-			// Set as free
-			new_chunk->status = NE_STATE_FREE;
-
-			// Now, free will point to new, and new will point to
-			// next.
-
-			//
-			// |      FREE       | NEXT |
-			// +-----------------+------+
-			// |    NOT USED     | USED |
-			//
-			// | FREE |   NEW    | NEXT |
-			// +------+----------+------+
-			// | USED | NOT USED | USED |
-
-			if (next_chunk != NULL) {
-				// If this is not last chunk...
-				new_chunk->next = next_chunk;
-				next_chunk->previous = new_chunk;
-
-				// Shouldn't be free
-				NE_Assert(next_chunk->status != NE_STATE_FREE,
-					  "Possible list corruption. (1)");
-			} else {
-				new_chunk->next = NULL;
-			}
+	if (align < 4)
+		align = 4;
+
+	ne_allocator_t *alloc = ne_alloc_get(first_chunk);
 
-			new_chunk->previous = free_chunk;
-			free_chunk->next = new_chunk;
-
-			// Now, set pointers...
-			new_chunk->end = free_chunk->end;
-
-			free_chunk->end = (void *)(free_chunk_start + size);
-
-			new_chunk->start = free_chunk->end;
-
-			// Ready!!
-			return free_chunk->start;
-		} else {
-			// If we need to align it, it is a bit more
-			// complicated... Check if even with disalignment we can
-			// create room for this
-			uintptr_t end_ptr = (free_chunk_start & (~(align - 1)))
-					  + align + size;
-
-			if (end_ptr < free_chunk_end) {
-				// Get chunks adjacent to this one, and create 2
-				// new chunks
-				NEChunk *next_chunk = free_chunk->next;
-				NEChunk *new_chunk = malloc(sizeof(NEChunk));
-				NEChunk *new2_chunk = malloc(sizeof(NEChunk));
-				NE_AssertPointer(new_chunk,
-						 "Couldn't allocate chunk. (2)");
-				NE_AssertPointer(new2_chunk,
-						 "Couldn't allocate chunk. (3)");
-
-				// Set as used
-				new_chunk->status = NE_STATE_USED;
-
-				// Set as free
-				new2_chunk->status = NE_STATE_FREE;
-
-				// |         FREE         | NEXT |
-				// +----------------------+------+
-				// |      NOT USED        | USED |
-				//
-				// |  FREE  |NEW | NEW 2  | NEXT |
-				// +~~~~~~~~+----+--------+------+
-				// |NOT USED|USED|NOT USED| USED |
-
-				free_chunk->next = new_chunk;
-				new_chunk->previous = free_chunk;
-
-				new_chunk->next = new2_chunk;
-				new2_chunk->previous = new_chunk;
-
-				if (next_chunk != NULL) {
-					// If this is not last chunk...
-					new2_chunk->next = next_chunk;
-					next_chunk->previous = new2_chunk;
-
-					// Shouldn't be free
-					NE_Assert(next_chunk->status != NE_STATE_FREE,
-						  "Possible list corruption. (2)");
-				} else {
-					new2_chunk->next = NULL;
-				}
-
-				// Now, set pointers acording to the size...
-				new2_chunk->end = free_chunk->end;
-
-				free_chunk->end = (void *)((free_chunk_start & ~(align - 1)) + align);
-				new_chunk->start = free_chunk->end;
-				new_chunk->end = (void *)((uintptr_t)new_chunk->start + size);
-				new2_chunk->start = new_chunk->end;
-
-				// Ready!!
-				return new_chunk->start;
-			} else if (end_ptr == free_chunk_end) {
-				// Easy case
-
-				// Get chunks next to this, and create 2 new ones.
-				NEChunk *next_chunk = free_chunk->next;
-				NEChunk *new_chunk = malloc(sizeof(NEChunk));
-				NE_AssertPointer(new_chunk,
-						 "NE_Alloc: Couldn't allocate chunk. (4)");
-
-				// Set as used
-				new_chunk->status = NE_STATE_USED;
-
-				// |         FREE         | NEXT |
-				// +----------------------+------+
-				// |      NOT USED        | USED |
-				//
-				// |  FREE  |     NEW     | NEXT |
-				// +~~~~~~~~+-------------+------+
-				// |NOT USED|     USED    | USED |
-
-				free_chunk->next = new_chunk;
-				new_chunk->previous = free_chunk;
-
-				if (next_chunk != NULL) {
-					// If this is not last chunk...
-					new_chunk->next = next_chunk;
-					next_chunk->previous = new_chunk;
-
-					// Shouldn't be free
-					NE_Assert(next_chunk->status != NE_STATE_FREE,
-						  "Possible list corruption. (3)");
-				} else {
-					new_chunk->next = NULL;
-				}
-
-				// Now, set pointers acording to the size...
-				new_chunk->end = free_chunk->end;
-
-				free_chunk->end = (void *)((free_chunk_start & ~(align - 1)) + align);
-				new_chunk->start = free_chunk->end;
-
-				// Ready!!
-				return new_chunk->start;
+	NEChunk *best_chunk = NULL;
+	uintptr_t best_address = 0;
+
+	// Like NE_Alloc(), the chunk with the lowest address is used
+	for (int c = ne_alloc_size_class(size); c < NE_ALLOC_SIZE_CLASSES; c++) {
+		NEChunk *chunk = alloc->free_list[c];
+		for ( ; chunk != NULL; chunk = chunk->free_next) {
+			uintptr_t start = (uintptr_t)chunk->start;
+			uintptr_t end = (uintptr_t)chunk->end;
+			uintptr_t address;
+
+			// Only use the part of the chunk inside the range
+			if (start < (uintptr_t)range_start)
+				start = (uintptr_t)range_start;
+			if (end > (uintptr_t)range_end)
+				end = (uintptr_t)range_end;
+
+			if (!ne_range_fits(start, end, size, align, &address))
+				continue;
+
+			if (best_chunk == NULL || address < best_address) {
+				best_chunk = chunk;
+				best_address = address;
 			}
 		}
 	}
 
-	// No more chunks... Not enough free space.
-	return NULL;
+	if (best_chunk == NULL)
+		return NULL;
+
+	void *pointer = ne_chunk_allocate(alloc, best_chunk, best_address,
+					  size);
+	NE_AssertPointer(pointer, "Couldn't allocate chunk");
+	return pointer;
 }
 
 void NE_Free(NEChunk *first_chunk, void *pointer)
 {
 	NE_AssertPointer(first_chunk, "NULL pointer");
 
-	NEChunk *chunk_search = first_chunk;
+	ne_allocator_t *alloc = ne_alloc_get(first_chunk);
 
 	// Look for the chunk that corresponds to the given pointer
-	while (1) {
-		// Check if we have reached the end of the list
-		if (chunk_search == NULL) {
-			NE_DebugPrint("Chunk not found");
-			return;
-		}
-
-		// If this is the chunk we're looking for, exit loop
-		if (chunk_search->start == pointer)
-			break;
-
-		chunk_search = chunk_search->next;
+	NEChunk *chunk = ne_index_find(alloc, pointer);
+	if (chunk == NULL) {
+		NE_DebugPrint("Chunk not found");
+		return;
 	}
 
 	// If the specified chunk is free or locked, it can't be freed.
-	if (chunk_search->status != NE_STATE_USED)
+	if (chunk->status != NE_STATE_USED)
 		return;
 
 	// Chunk found. Free it.
-	chunk_search->status = NE_STATE_FREE;
-
-	// Now, check if we can join this free chunk with the previous or the
-	// next one
-	NEChunk *previous_chunk = chunk_search->previous;
-	NEChunk *next_chunk = chunk_search->next;
-
-	// Check the previous one
-	if (previous_chunk && previous_chunk->status == NE_STATE_FREE) {
-		// We can join them
-		//
-		// | PREVIOUS | FREEING  | NEXT |
-		// +----------+----------+------+
-		// | NOT USED | NOT USED | ???? |
-		//
-		// |       PREVIOUS      | NEXT |
-		// +---------------------+------+
-		// |       NOT USED      | ???? |
-
-		if (next_chunk) {
-			// First, join the previous and the next
-			next_chunk->previous = previous_chunk;
-			previous_chunk->next = next_chunk;
-		} else {
-			previous_chunk->next = NULL;
-		}
+	chunk->status = NE_STATE_FREE;
+	chunk->owner = -1;
+	chunk->label = NULL;
 
-		// Expand the previous one
-		previous_chunk->end = chunk_search->end;
-
-		// Delete current chunk
-		free(chunk_search);
-
-		// Check the next one
-		if (next_chunk && next_chunk->status == NE_STATE_FREE) {
-			// We can join them
-
-			// |      PREVIOUS      |   NEXT   | NEXT_NEXT |
-			// +--------------------+----------+-----------+
-			// |      NOT USED      | NOT USED |   USED    |
-			//
-			// |            PREVIOUS           | NEXT_NEXT |
-			// +-------------------------------+-----------+
-			// |            NOT USED           |   USED    |
-
-			NEChunk *next_next_chunk = next_chunk->next;
-
-			if (next_next_chunk) {
-				// Next Next shouldn't be free. If not,
-				// something bad is happening here.
-				NE_Assert(next_next_chunk->status != NE_STATE_FREE,
-					  "Possible list corruption. (1)");
-
-				// First, join the previous and the next next
-				next_next_chunk->previous = previous_chunk;
-				previous_chunk->next = next_next_chunk;
-			} else {
-				previous_chunk->next = NULL;
-			}
+	// Now, check if we can join this free chunk with the next or the
+	// previous one. The chunk with the lowest address is always kept.
 
-			// Expand the previous one
-			previous_chunk->end = next_chunk->end;
+	// | PREVIOUS | FREEING  |   NEXT   |
+	// +----------+----------+----------+
+	// | ???????? | NOT USED | ???????? |
 
-			// Delete next chunk
-			free(next_chunk);
-		}
+	NEChunk *next_chunk = chunk->next;
+	if (next_chunk != NULL && next_chunk->status == NE_STATE_FREE) {
+		ne_free_list_remove(alloc, next_chunk);
+		ne_index_remove(alloc, next_chunk);
+		ne_chunk_unlink(next_chunk);
 
-		// Done!
-		return;
+		chunk->end = next_chunk->end;
+
+		ne_chunk_release(alloc, next_chunk);
+
+		next_chunk = chunk->next;
+		NE_Assert(next_chunk == NULL
+			  || next_chunk->status != NE_STATE_FREE,
+			  "Possible list corruption. (1)");
 	}
 
-	// Check the next one
-	if (next_chunk && next_chunk->status == NE_STATE_FREE) {
-		// We can join them
-
-		// |   FREE   |   NEXT   | NEXT NEXT |
-		// +----------+----------+-----------+
-		// | NOT USED | NOT USED |   USED    |
-		//
-		// |         FREE        | NEXT NEXT |
-		// +---------------------+-----------+
-		// |       NOT USED      |   USED    |
-
-		NEChunk *next_next_chunk = next_chunk->next;
-
-		if (next_next_chunk) {
-			// Next Next should be used or locked. If not,
-			// something bad is happening here.
-			NE_Assert(next_next_chunk->status != NE_STATE_FREE,
-				  "Possible list corruption. (2)");
-
-			// First, join the free and the next next
-			next_next_chunk->previous = chunk_search;
-			chunk_search->next = next_next_chunk;
-		} else {
-			chunk_search->next = NULL;
-		}
+	NEChunk *previous_chunk = chunk->previous;
+	if (previous_chunk != NULL && previous_chunk->status == NE_STATE_FREE) {
+		ne_free_list_remove(alloc, previous_chunk);
+		ne_index_remove(alloc, chunk);
+		ne_chunk_unlink(chunk);
 
-		// Expand the free one
-		chunk_search->end = next_chunk->end;
+		previous_chunk->end = chunk->end;
 
-		// Delete next chunk
-		free(next_chunk);
+		ne_chunk_release(alloc, chunk);
 
-		// Done!
-		return;
+		chunk = previous_chunk;
+		previous_chunk = chunk->previous;
+		NE_Assert(previous_chunk == NULL
+			  || previous_chunk->status != NE_STATE_FREE,
+			  "Possible list corruption. (2)");
 	}
 
-	// We've done everything we can after freeing the chunk, exit
+	ne_free_list_add(alloc, chunk);
 }
 
 void NE_Lock(NEChunk *first_chunk, void *pointer)
 {
 	NE_AssertPointer(first_chunk, "NULL pointer");
 
-	NEChunk *chunk_search = first_chunk;
-
-	while (1) {
-		if (chunk_search->start == pointer) {
-			// Found!
-			chunk_search->status = NE_STATE_LOCKED;
+	ne_allocator_t *alloc = ne_alloc_get(first_chunk);
 
-			return;
-		}
+	NEChunk *chunk = ne_index_find(alloc, pointer);
+	if (chunk == NULL)
+		return;
 
-		if (chunk_search->next == NULL)
-			return;
+	if (chunk->status == NE_STATE_FREE)
+		ne_free_list_remove(alloc, chunk);
 
-		chunk_search = chunk_search->next;
-	}
+	chunk->status = NE_STATE_LOCKED;
 }
 
 void NE_Unlock(NEChunk *first_chunk, void *pointer)
 {
 	NE_AssertPointer(first_chunk, "NULL pointer");
 
-	NEChunk *chunk_search = first_chunk;
-
-	while (1) {
-		if (chunk_search->start == pointer) {
-			// Found!
-			if (chunk_search->status == NE_STATE_LOCKED) {
-				chunk_search->status = NE_STATE_USED;
-			}
-
-			return;
-		}
+	ne_allocator_t *alloc = ne_alloc_get(first_chunk);
 
-		if (chunk_search->next == NULL)
-			return;
+	NEChunk *chunk = ne_index_find(alloc, pointer);
+	if (chunk == NULL)
+		return;
 
-		chunk_search = chunk_search->next;
-	}
+	if (chunk->status == NE_STATE_LOCKED)
+		chunk->status = NE_STATE_USED;
 }
 
-/*
 int NE_GetSize(NEChunk *first_chunk, void *pointer)
 {
 	NE_AssertPointer(first_chunk, "NULL pointer");
 
-	NEChunk *chunk_search = first_chunk;
-
-	while (1) {
-		if(chunk_search->start == pointer) {
-			// Found!
-			return (int)(chunk_search->end - chunk_search->start);
-		}
-
-		if (chunk_search->next == NULL)
-			return 0;
+	NEChunk *chunk = ne_index_find(ne_alloc_get(first_chunk), pointer);
+	if (chunk == NULL)
+		return 0;
 
-		chunk_search = chunk_search->next;
-	}
+	return (int)ne_chunk_size(chunk);
 }
-*/
 
 void NE_MemGetInformation(NEChunk *first_chunk, NEMemInfo *info)
 {
 	NE_AssertPointer(first_chunk, "NULL list pointer");
 	NE_AssertPointer(info, "NULL info pointer");
 
-	info->Free = info->Used = info->Total = info->Locked = 0;
+	memset(info, 0, sizeof(NEMemInfo));
 
 	NEChunk *chunk_search = first_chunk;
 
@@ -462,9 +613,23 @@ void NE_MemGetInformation(NEChunk *first_chunk, NEMemInfo *info)
 
 		switch (chunk_search->status) {
 		case NE_STATE_FREE:
+		{
 			info->Free += size;
 			info->Total += size;
+
+			if (size > info->LargestFree)
+				info->LargestFree = size;
+
+			info->FreeChunks++;
+
+			int entry = ne_alloc_size_class(size) - 4;
+			if (entry < 0)
+				entry = 0;
+			else if (entry >= NE_MEM_HISTOGRAM_SIZE)
+				entry = NE_MEM_HISTOGRAM_SIZE - 1;
+			info->FreeHistogram[entry]++;
 			break;
+		}
 		case NE_STATE_USED:
 			info->Used += size;
 			info->Total += size;
@@ -478,5 +643,215 @@ void NE_MemGetInformation(NEChunk *first_chunk, NEMemInfo *info)
 		}
 	}
 
-	info->FreePercent = (info->Free * 100) / info->Total;
+	if (info->Total > 0)
+		info->FreePercent = (info->Free * 100) / info->Total;
+
+	if (info->Free > 0) {
+		info->FragmentationPercent =
+			((info->Free - info->LargestFree) * 100) / info->Free;
+	}
+}
+
+void NE_AllocSetOwner(NEChunk *first_chunk, void *pointer, int owner,
+		      const char *label)
+{
+	NE_AssertPointer(first_chunk, "NULL list pointer");
+
+	NEChunk *chunk = ne_index_find(ne_alloc_get(first_chunk), pointer);
+	if (chunk == NULL || chunk->status == NE_STATE_FREE) {
+		NE_DebugPrint("Chunk not found");
+		return;
+	}
+
+	chunk->owner = owner;
+	chunk->label = label;
+}
+
+void NE_AllocDump(NEChunk *first_chunk, FILE *file, void *bank_base,
+		  size_t bank_size, char bank_name)
+{
+	NE_AssertPointer(first_chunk, "NULL list pointer");
+	NE_AssertPointer(file, "NULL file pointer");
+	NE_Assert(bank_size > 0, "Invalid bank size");
+
+	const char state_char[] = { 'F', 'U', 'L' };
+
+	NEChunk *chunk = first_chunk;
+
+	for ( ; chunk != NULL; chunk = chunk->next) {
+		uintptr_t start = (uintptr_t)chunk->start;
+		uintptr_t end = (uintptr_t)chunk->end;
+
+		while (start < end) {
+			uintptr_t offset = start - (uintptr_t)bank_base;
+			unsigned int bank = offset / bank_size;
+			uintptr_t bank_end = (uintptr_t)bank_base
+					   + (bank + 1) * bank_size;
+			uintptr_t part_end = end < bank_end ? end : bank_end;
+
+			fprintf(file, "%c %05X %05X %c",
+				bank_name + bank,
+				(unsigned int)(offset - bank * bank_size),
+				(unsigned int)(part_end - start),
+				state_char[chunk->status]);
+
+			if (chunk->status != NE_STATE_FREE) {
+				fprintf(file, " %d %s", chunk->owner,
+					chunk->label ? chunk->label : "-");
+			}
+
+			fputc('\n', file);
+
+			start = part_end;
+		}
+	}
+}
+
+void *NE_AllocNextMovable(NEChunk *first_chunk, void *pointer,
+			  void **free_start)
+{
+	NE_AssertPointer(first_chunk, "NULL list pointer");
+	NE_AssertPointer(free_start, "NULL pointer");
+
+	ne_allocator_t *alloc = ne_alloc_get(first_chunk);
+
+	int pos = 0;
+
+	if (pointer != NULL) {
+		pos = ne_index_search(alloc, pointer);
+		if (pos < alloc->index_count
+		    && alloc->index[pos]->start == pointer)
+			pos++;
+	}
+
+	for ( ; pos < alloc->index_count; pos++) {
+		NEChunk *chunk = alloc->index[pos];
+		NEChunk *previous_chunk = chunk->previous;
+
+		if (chunk->status != NE_STATE_USED)
+			continue;
+
+		if (previous_chunk == NULL
+		    || previous_chunk->status != NE_STATE_FREE)
+			continue;
+
+		*free_start = previous_chunk->start;
+		return chunk->start;
+	}
+
+	return NULL;
+}
+
+int NE_AllocMove(NEChunk *first_chunk, void *pointer, void *new_pointer)
+{
+	NE_AssertPointer(first_chunk, "NULL list pointer");
+
+	ne_allocator_t *alloc = ne_alloc_get(first_chunk);
+
+	NEChunk *chunk = ne_index_find(alloc, pointer);
+	if (chunk == NULL) {
+		NE_DebugPrint("Chunk not found");
+		return 0;
+	}
+
+	if (chunk->status != NE_STATE_USED) {
+		NE_DebugPrint("Chunk not in use");
+		return 0;
+	}
+
+	NEChunk *previous_chunk = chunk->previous;
+	if (previous_chunk == NULL || previous_chunk->status != NE_STATE_FREE
+	    || (uintptr_t)new_pointer < (uintptr_t)previous_chunk->start
+	    || (uintptr_t)new_pointer >= (uintptr_t)chunk->start) {
+		NE_DebugPrint("Invalid destination");
+		return 0;
+	}
+
+	// | PREVIOUS |   CHUNK  |   NEXT   |
+	// +----------+----------+----------+
+	// | NOT USED |   USED   | ???????? |
+	//
+	// | PREV |   CHUNK  |  TAIL  | NEXT |
+	// +------+----------+--------+------+
+	// |  NU  |   USED   |NOT USED| ???? |
+	//
+	// If the next chunk is free, it is expanded instead of creating a new
+	// tail chunk.
+
+	uintptr_t new_start = (uintptr_t)new_pointer;
+	uintptr_t new_end = new_start + ne_chunk_size(chunk);
+	uintptr_t old_end = (uintptr_t)chunk->end;
+
+	NEChunk *next_chunk = chunk->next;
+	bool next_is_free = (next_chunk != NULL)
+			    && (next_chunk->status == NE_STATE_FREE);
+	NEChunk *tail_chunk = NULL;
+
+	if (!next_is_free) {
+		if (!ne_index_reserve(alloc, 1))
+			return 0;
+
+		tail_chunk = ne_chunk_new(alloc);
+		if (tail_chunk == NULL)
+			return 0;
+	}
+
+	// The order of the chunks in the index doesn't change, so it is only
+	// needed to update it when a chunk is deleted.
+
+	ne_free_list_remove(alloc, previous_chunk);
+
+	if ((uintptr_t)previous_chunk->start == new_start) {
+		// The previous chunk would be empty. Use it for the data that
+		// is being moved and delete the current one instead, as the
+		// first chunk of the list can't be deleted.
+		previous_chunk->owner = chunk->owner;
+		previous_chunk->label = chunk->label;
+
+		ne_index_remove(alloc, chunk);
+		ne_chunk_unlink(chunk);
+		ne_chunk_release(alloc, chunk);
+
+		chunk = previous_chunk;
+		chunk->status = NE_STATE_USED;
+	} else {
+		previous_chunk->end = (void *)new_start;
+		ne_free_list_add(alloc, previous_chunk);
+
+		chunk->start = (void *)new_start;
+	}
+
+	chunk->end = (void *)new_end;
+
+	if (next_is_free) {
+		ne_free_list_remove(alloc, next_chunk);
+		next_chunk->start = (void *)new_end;
+		ne_free_list_add(alloc, next_chunk);
+	} else {
+		tail_chunk->status = NE_STATE_FREE;
+		tail_chunk->start = (void *)new_end;
+		tail_chunk->end = (void *)old_end;
+		ne_chunk_link_after(chunk, tail_chunk);
+		ne_index_insert(alloc, tail_chunk);
+		ne_free_list_add(alloc, tail_chunk);
+	}
+
+	return 1;
+}
+
+void *NE_AllocFreeBefore(NEChunk *first_chunk, void *pointer)
+{
+	NE_AssertPointer(first_chunk, "NULL list pointer");
+
+	ne_allocator_t *alloc = ne_alloc_get(first_chunk);
+
+	NEChunk *chunk = ne_index_find(alloc, pointer);
+	if (chunk == NULL)
+		return NULL;
+
+	NEChunk *previous_chunk = chunk->previous;
+	if (previous_chunk == NULL || previous_chunk->status != NE_STATE_FREE)
+		return NULL;
+
+	return previous_chunk->start;
 }
@@ -516,6 +516,8 @@ void NE_WaitForVBL(NE_UpdateFlags flags)
 		NE_ModelAnimateAll();
 	if (flags & NE_UPDATE_PHYSICS)
 		NE_PhysicsUpdateAll();
+	if (flags & NE_UPDATE_PALETTE_ANIMATIONS)
+		NE_PaletteAnimUpdateAll();
 
 	NE_CPUPercent = div32(ne_cpucount * 100, 263);
 	if (flags & NE_CAN_SKIP_VBL) {
@@ -529,6 +531,15 @@ void NE_WaitForVBL(NE_UpdateFlags flags)
 
 	swiWaitForVBlank();
 	ne_cpucount = 0;
+
+	// Copy queued textures and palettes while VRAM isn't being used
+	NE_TextureUploadQueueVBL();
+	NE_CanvasVBL();
+	NE_PaletteAnimVBL();
+
+	// The GPU has finished drawing the previous frame
+	NE_TextureTransientFence();
+	NE_TextureResidencyNextFrame();
 }
 
 int NE_GetCPUPercent(void)
@@ -38,7 +38,7 @@ NE_Model *NE_ModelCreate(NE_ModelType type)
 
 	model->sx = model->sy = model->sz = inttof32(1);
 
-	if (type == NE_Animated) {
+	if (type == NE_Animated || type == NE_Skinned) {
 		model->meshdata = calloc(1, sizeof(NE_AnimData));
 		NE_AssertPointer(model->meshdata,
 				 "Couldn't allocate animation data.");
@@ -75,14 +75,22 @@ void NE_ModelDelete(NE_Model *model)
 		i++;
 	}
 
+	// Clones have their own reference to the display lists
+	if (model->modeltype == NE_Animated)
+		NE_ModelAnimFreeBakedFrames(model);
+
+	// Clones have their own blended animation too
+	if (model->modeltype == NE_Animated)
+		NE_ModelAnimBlendStop(model);
+
 	if (!model->iscloned && model->meshfromfat) {
-		if (model->modeltype == NE_Animated)
-			free(((NE_AnimData *) model->meshdata)->fileptrtr);
-		else /* if (model->modeltype == NE_Static) */
+		if (model->modeltype == NE_Static)
 			free(model->meshdata);
+		else
+			free(((NE_AnimData *) model->meshdata)->fileptrtr);
 	}
 
-	if (model->modeltype == NE_Animated)
+	if (model->modeltype != NE_Static)
 		free(model->meshdata);	//Free animation data
 
 	free(model);
@@ -145,31 +153,221 @@ void NE_ModelSetMaterial(NE_Model *model, NE_Material *material)
 
 //------------------------------------------------------------------------------
 
-static void __ne_drawanimatedmodel_interpolate(NE_AnimData *anim)
+// Interpolation of the vertices of animated models. Each component is:
+//
+//     a + (((b - a) * time) >> 6)
+//
+// which is calculated as (a * (64 - time) + b * time) >> 6. It's the same value,
+// as a * 64 doesn't change the bits that are shifted out, but it can be done
+// with the halfword multiplies of the ARM946E-S with both weights packed in a
+// register: SMULBB for frame one and SMLABT for frame two. On other CPUs the C
+// versions are used, which are the reference of the DSP code.
+#ifdef __arm__
+# define NE_SMULBB(a, b) ({ \
+	s32 result_; \
+	asm ("smulbb %0, %1, %2" : "=r" (result_) : "r" (a), "r" (b)); \
+	result_; \
+})
+# define NE_SMLABT(a, b, acc) ({ \
+	s32 result_; \
+	asm ("smlabt %0, %1, %2, %3" : "=r" (result_) \
+	     : "r" (a), "r" (b), "r" (acc)); \
+	result_; \
+})
+# define NE_SMLABB(a, b, acc) ({ \
+	s32 result_; \
+	asm ("smlabb %0, %1, %2, %3" : "=r" (result_) \
+	     : "r" (a), "r" (b), "r" (acc)); \
+	result_; \
+})
+# define NE_KERNEL ARM_CODE ITCM_CODE __attribute__((noinline))
+#else
+# define NE_SMULBB(a, b) ((s32)(s16)(a) * (s32)(s16)(b))
+# define NE_SMLABT(a, b, acc) ((s32)(s16)(a) * ((s32)(b) >> 16) + (acc))
+# define NE_SMLABB(a, b, acc) ((s32)(s16)(a) * (s32)(s16)(b) + (acc))
+# define NE_KERNEL
+#endif
+
+#define NE_LERP(a, b, weights) \
+	(NE_SMLABT(b, weights, NE_SMULBB(a, weights)) >> 6)
+
+// Blended animations use four frames, two of each animation. The weights are
+// packed in the same way, but they go from 0 to 4096 and they add up to 4096.
+#define NE_BLEND(a1, a2, b1, b2, weights_a, weights_b) \
+	(NE_SMLABT(b2, weights_b, NE_SMLABB(b1, weights_b, \
+		   NE_SMLABT(a2, weights_a, NE_SMULBB(a1, weights_a)))) >> 12)
+
+// It runs from ITCM in ARM mode, the rest of the library is Thumb code in main
+// RAM. "weights" is (64 - time) in the bottom halfword and time in the top one.
+//
+// Estimated cost per vertex: about 62 ARM instructions (5 LDRH, 14 LDRSH, 12
+// multiplies, 4 stores to GFX registers), around 65-70 cycles on the ARM946E-S
+// if the model is in the data cache. The previous C loop needed around 100
+// Thumb instructions, with 6 MUL and the extra moves needed by Thumb code.
+// This hasn't been measured on hardware. See tests/model_interpolation.
+static NE_KERNEL void ne_interpolate_vertices(const u16 *frame_one_ptr,
+					      const u16 *frame_two_ptr,
+					      u32 vtxcount, const s16 *vtx,
+					      const s16 *norm,
+					      const s16 *texcoords,
+					      s32 weights)
 {
-	int frame_one = anim->currframe;
-	int frame_two = anim->currframe + anim->direction;
-	u32 time = anim->nextframetime;
+	for (u32 i = 0; i < vtxcount; i++) {
+		const s16 *a, *b;
+
+		// Texture coordinates are taken from the first frame
+		a = &texcoords[frame_one_ptr[0] * 2];
+		GFX_TEX_COORD = ((s32) a[0]) | (((s32) a[1]) << 16);
+
+		a = &norm[frame_one_ptr[1] * 3];
+		b = &norm[frame_two_ptr[1] * 3];
+		u32 nx = NE_LERP(a[0], b[0], weights);
+		u32 ny = NE_LERP(a[1], b[1], weights);
+		u32 nz = NE_LERP(a[2], b[2], weights);
+		GFX_NORMAL = ((nx & 0x3FF) << 20) | ((ny & 0x3FF) << 10)
+			     | (nz & 0x3FF);
+
+		a = &vtx[frame_one_ptr[2] * 3];
+		b = &vtx[frame_two_ptr[2] * 3];
+		u32 x = NE_LERP(a[0], b[0], weights);
+		u32 y = NE_LERP(a[1], b[1], weights);
+		u32 z = NE_LERP(a[2], b[2], weights);
+		GFX_VERTEX16 = (x & 0xFFFF) | (y << 16);
+		GFX_VERTEX16 = z & 0xFFFF;
+
+		frame_one_ptr += 3;
+		frame_two_ptr += 3;
+	}
+}
+
+// NEA v3 files. Texture coordinates and the position used by each vertex are
+// shared by all frames. Each frame is a word with the shifts of the x, y and z
+// deltas (8 bits each), followed by a word per position: x, y and z deltas from
+// the base pose (s8) and the index of the normal in the table of normals, that
+// are stored ready to be sent to GFX_NORMAL.
+typedef struct {
+	u32 magic;
+	u32 version;
+	u32 num_frames;
+	u32 num_vertices;
+	u32 num_positions;
+	u32 offset_frames;	// Offsets from the start of the file
+	u32 offset_base;	// s16 x, y, z per position
+	u32 offset_norm;	// u32 per normal
+	u32 offset_st;		// u32 per vertex
+	u32 offset_index;	// u16 per vertex
+} ne_nea3_header_t;
+
+// Signed field of "bits" bits that starts at bit "first"
+#define NE_SIGNED_FIELD(value, first, bits) \
+	(((s32)((value) << (32 - (first) - (bits)))) >> (32 - (bits)))
+
+// Position of a vertex from the base pose and its delta in a frame
+#define NE_NEA3_COORD(base, delta, first, shift) \
+	((base) + (s32)((u32)NE_SIGNED_FIELD(delta, first, 8) << (shift)))
+
+static inline const u32 *ne_nea3_frame(const ne_nea3_header_t *header,
+				       int frame)
+{
+	return (const u32 *)((u8 *)header + header->offset_frames)
+	       + frame * (header->num_positions + 1);
+}
+
+static NE_KERNEL void ne_interpolate_vertices_nea3(const ne_nea3_header_t *header,
+						   const u32 *frame_one,
+						   const u32 *frame_two,
+						   s32 weights)
+{
+	const s16 *base = (const s16 *)((u8 *)header + header->offset_base);
+	const u32 *norm = (const u32 *)((u8 *)header + header->offset_norm);
+	const u32 *texcoords = (const u32 *)((u8 *)header + header->offset_st);
+	const u16 *index = (const u16 *)((u8 *)header + header->offset_index);
+
+	u32 shift_one = *frame_one++;
+	u32 shift_two = *frame_two++;
+	u32 sx1 = shift_one & 0xFF, sy1 = (shift_one >> 8) & 0xFF;
+	u32 sz1 = (shift_one >> 16) & 0xFF;
+	u32 sx2 = shift_two & 0xFF, sy2 = (shift_two >> 8) & 0xFF;
+	u32 sz2 = (shift_two >> 16) & 0xFF;
+
+	for (u32 i = 0; i < header->num_vertices; i++) {
+		u32 pos = index[i];
+		u32 d1 = frame_one[pos];
+		u32 d2 = frame_two[pos];
+		const s16 *b = &base[pos * 3];
+
+		GFX_TEX_COORD = texcoords[i];
+
+		u32 n1 = norm[d1 >> 24];
+		u32 n2 = norm[d2 >> 24];
+		u32 nx = NE_LERP(NE_SIGNED_FIELD(n1, 20, 10),
+				 NE_SIGNED_FIELD(n2, 20, 10), weights);
+		u32 ny = NE_LERP(NE_SIGNED_FIELD(n1, 10, 10),
+				 NE_SIGNED_FIELD(n2, 10, 10), weights);
+		u32 nz = NE_LERP(NE_SIGNED_FIELD(n1, 0, 10),
+				 NE_SIGNED_FIELD(n2, 0, 10), weights);
+		GFX_NORMAL = ((nx & 0x3FF) << 20) | ((ny & 0x3FF) << 10)
+			     | (nz & 0x3FF);
+
+		u32 x = NE_LERP(NE_NEA3_COORD(b[0], d1, 0, sx1),
+				NE_NEA3_COORD(b[0], d2, 0, sx2), weights);
+		u32 y = NE_LERP(NE_NEA3_COORD(b[1], d1, 8, sy1),
+				NE_NEA3_COORD(b[1], d2, 8, sy2), weights);
+		u32 z = NE_LERP(NE_NEA3_COORD(b[2], d1, 16, sz1),
+				NE_NEA3_COORD(b[2], d2, 16, sz2), weights);
+		GFX_VERTEX16 = (x & 0xFFFF) | (y << 16);
+		GFX_VERTEX16 = z & 0xFFFF;
+	}
+}
+
+// Returns the frame that comes after the current one
+static int ne_anim_next_frame(const NE_AnimData *anim)
+{
+	int frame = anim->currframe + anim->direction;
 
-	if (anim->direction < 0 && frame_two < anim->startframe) {
+	if (anim->direction < 0 && frame < anim->startframe) {
 		if (anim->animtype == NE_ANIM_LOOP)
-			frame_two = anim->endframe;
+			frame = anim->endframe;
 		else if (anim->animtype == NE_ANIM_UPDOWN)
-			frame_two = anim->currframe + 1;
+			frame = anim->currframe + 1;
 		else if (anim->animtype == NE_ANIM_ONESHOT)
-			frame_two = frame_one;
-	} else if (anim->direction > 0 && frame_two > anim->endframe) {
+			frame = anim->currframe;
+	} else if (anim->direction > 0 && frame > anim->endframe) {
 		if (anim->animtype == NE_ANIM_LOOP)
-			frame_two = anim->startframe;
+			frame = anim->startframe;
 		else if (anim->animtype == NE_ANIM_UPDOWN)
-			frame_two = anim->currframe - 1;
+			frame = anim->currframe - 1;
 		else if (anim->animtype == NE_ANIM_ONESHOT)
-			frame_two = frame_one;
+			frame = anim->currframe;
 	}
 
+	return frame;
+}
+
+static void __ne_drawanimatedmodel_interpolate(NE_AnimData *anim)
+{
+	int frame_one = anim->currframe;
+	int frame_two = ne_anim_next_frame(anim);
+	s32 time = anim->nextframetime;
+
 	u32 *fileptr = anim->fileptrtr + 2;
 	NE_Assert(frame_one < *fileptr && frame_two < *fileptr,
 		  "Drawing nonexistent frame.");
+
+	s32 weights = ((u32)time << 16) | ((64 - time) & 0xFFFF);
+
+	if (anim->fileptrtr[1] == 3) {
+		const ne_nea3_header_t *header = (void *)anim->fileptrtr;
+
+		GFX_BEGIN = GL_TRIANGLES;
+
+		ne_interpolate_vertices_nea3(header,
+					     ne_nea3_frame(header, frame_one),
+					     ne_nea3_frame(header, frame_two),
+					     weights);
+		return;
+	}
+
 	fileptr++;
 	u32 vtxcount = *fileptr++;
 	u16 *framearrayptr = (u16 *) ((int)anim->fileptrtr + (int)*fileptr++);
@@ -182,66 +380,64 @@ static void __ne_drawanimatedmodel_interpolate(NE_AnimData *anim)
 
 	GFX_BEGIN = GL_TRIANGLES;
 
-	for (u32 i = 0; i < vtxcount; i++) {
-		s32 vector[3];
-		s16 *frame_one_anim, *frame_two_anim;
+	ne_interpolate_vertices(frame_one_ptr, frame_two_ptr, vtxcount,
+				vtxarrayptr, normarrayptr, texcoordsarrayptr,
+				weights);
 
-		// Texture coordinates
-		// -------------------
+	// GFX_END = 0;
+}
 
-		frame_one_anim = &texcoordsarrayptr[*frame_one_ptr * 2];
-		GFX_TEX_COORD = ((s32) * frame_one_anim) |
-				(((s32) * (frame_one_anim + 1)) << 16);
-		frame_one_ptr++;
-		frame_two_ptr++;
+static void __ne_drawanimatedmodel_nea3_nointerpolate(const ne_nea3_header_t *header,
+						      int frame)
+{
+	const s16 *base = (const s16 *)((u8 *)header + header->offset_base);
+	const u32 *norm = (const u32 *)((u8 *)header + header->offset_norm);
+	const u32 *texcoords = (const u32 *)((u8 *)header + header->offset_st);
+	const u16 *index = (const u16 *)((u8 *)header + header->offset_index);
 
-		// Normal
-		// ------
+	const u32 *frame_ptr = ne_nea3_frame(header, frame);
+	u32 shift = *frame_ptr++;
+	u32 sx = shift & 0xFF, sy = (shift >> 8) & 0xFF;
+	u32 sz = (shift >> 16) & 0xFF;
 
-		frame_one_anim = &normarrayptr[*frame_one_ptr * 3];
-		frame_two_anim = &normarrayptr[*frame_two_ptr * 3];
-		for (int j = 0; j < 3; j++) {
-			vector[j] = (s32) *frame_one_anim;
-			vector[j] += (((s32) *frame_two_anim -
-				       (s32) *frame_one_anim) * time) >> 6;
-			vector[j] &= 0x3FF;
-			frame_one_anim++;
-			frame_two_anim++;
-		}
-		GFX_NORMAL = (vector[0] << 20) | (vector[1] << 10) | vector[2];
-		frame_one_ptr++;
-		frame_two_ptr++;
+	GFX_BEGIN = GL_TRIANGLES;
 
-		// Vertex
-		// ------
+	for (u32 i = 0; i < header->num_vertices; i++) {
+		u32 pos = index[i];
+		u32 d = frame_ptr[pos];
+		const s16 *b = &base[pos * 3];
 
-		frame_one_anim = &vtxarrayptr[*frame_one_ptr * 3];
-		frame_two_anim = &vtxarrayptr[*frame_two_ptr * 3];
-		for (int j = 0; j < 3; j++) {
-			vector[j] = (s32) *frame_one_anim;
-			vector[j] += (((s32) *frame_two_anim -
-				       (s32) *frame_one_anim) * time) >> 6;
-			vector[j] &= 0xFFFF;
-			frame_one_anim++;
-			frame_two_anim++;
-		}
-		GFX_VERTEX16 = vector[0] | (vector[1] << 16);
-		GFX_VERTEX16 = vector[2];
-		frame_one_ptr++;
-		frame_two_ptr++;
-	}
+		GFX_TEX_COORD = texcoords[i];
+		GFX_NORMAL = norm[d >> 24];
 
-	// GFX_END = 0;
+		u32 x = NE_NEA3_COORD(b[0], d, 0, sx);
+		u32 y = NE_NEA3_COORD(b[1], d, 8, sy);
+		u32 z = NE_NEA3_COORD(b[2], d, 16, sz);
+		GFX_VERTEX16 = (x & 0xFFFF) | (y << 16);
+		GFX_VERTEX16 = z & 0xFFFF;
+	}
 }
 
 static void __ne_drawanimatedmodel_nointerpolate(NE_AnimData *anim)
 {
 	int frame = anim->currframe;
+	NE_BakedFrames *baked = anim->baked;
+
+	if (baked != NULL && frame >= baked->first && frame <= baked->last) {
+		glCallList(baked->lists[frame - baked->first]);
+		return;
+	}
 
 	u32 *fileptr = anim->fileptrtr + 2;
 	NE_Assert(frame < *fileptr, "Drawing nonexistent frame");
 	fileptr++;
 
+	if (anim->fileptrtr[1] == 3) {
+		__ne_drawanimatedmodel_nea3_nointerpolate((void *)anim->fileptrtr,
+							  frame);
+		return;
+	}
+
 	u32 vtxcount = *fileptr++;
 	u16 *framearrayptr = (u16 *) ((int)anim->fileptrtr + (int)*fileptr++);
 	s16 *vtxarrayptr = (s16 *) ((int)anim->fileptrtr + (int)*fileptr++);
@@ -291,6 +487,304 @@ static void __ne_drawanimatedmodel_nointerpolate(NE_AnimData *anim)
 	// GFX_END = 0;
 }
 
+// Blended draws. Each component is the weighted sum of the two frames of each
+// animation, so both animations and the blend between them are calculated in
+// the same pass, with two more multiplies per component than an interpolated
+// draw.
+static NE_KERNEL void ne_blend_vertices(const u16 *const frame_ptr[4],
+					u32 vtxcount, const s16 *vtx,
+					const s16 *norm, const s16 *texcoords,
+					s32 weights_a, s32 weights_b)
+{
+	const u16 *a1 = frame_ptr[0], *a2 = frame_ptr[1];
+	const u16 *b1 = frame_ptr[2], *b2 = frame_ptr[3];
+
+	for (u32 i = 0; i < vtxcount; i++) {
+		const s16 *p, *q, *r, *s;
+
+		// Texture coordinates are taken from the first frame
+		p = &texcoords[a1[0] * 2];
+		GFX_TEX_COORD = ((s32) p[0]) | (((s32) p[1]) << 16);
+
+		p = &norm[a1[1] * 3];
+		q = &norm[a2[1] * 3];
+		r = &norm[b1[1] * 3];
+		s = &norm[b2[1] * 3];
+		u32 nx = NE_BLEND(p[0], q[0], r[0], s[0], weights_a, weights_b);
+		u32 ny = NE_BLEND(p[1], q[1], r[1], s[1], weights_a, weights_b);
+		u32 nz = NE_BLEND(p[2], q[2], r[2], s[2], weights_a, weights_b);
+		GFX_NORMAL = ((nx & 0x3FF) << 20) | ((ny & 0x3FF) << 10)
+			     | (nz & 0x3FF);
+
+		p = &vtx[a1[2] * 3];
+		q = &vtx[a2[2] * 3];
+		r = &vtx[b1[2] * 3];
+		s = &vtx[b2[2] * 3];
+		u32 x = NE_BLEND(p[0], q[0], r[0], s[0], weights_a, weights_b);
+		u32 y = NE_BLEND(p[1], q[1], r[1], s[1], weights_a, weights_b);
+		u32 z = NE_BLEND(p[2], q[2], r[2], s[2], weights_a, weights_b);
+		GFX_VERTEX16 = (x & 0xFFFF) | (y << 16);
+		GFX_VERTEX16 = z & 0xFFFF;
+
+		a1 += 3;
+		a2 += 3;
+		b1 += 3;
+		b2 += 3;
+	}
+}
+
+static NE_KERNEL void ne_blend_vertices_nea3(const ne_nea3_header_t *header,
+					     const u32 *const frame_ptr[4],
+					     s32 weights_a, s32 weights_b)
+{
+	const s16 *base = (const s16 *)((u8 *)header + header->offset_base);
+	const u32 *norm = (const u32 *)((u8 *)header + header->offset_norm);
+	const u32 *texcoords = (const u32 *)((u8 *)header + header->offset_st);
+	const u16 *index = (const u16 *)((u8 *)header + header->offset_index);
+
+	const u32 *frames[4];
+	u32 sx[4], sy[4], sz[4];
+
+	for (int j = 0; j < 4; j++) {
+		u32 shift = frame_ptr[j][0];
+
+		frames[j] = frame_ptr[j] + 1;
+		sx[j] = shift & 0xFF;
+		sy[j] = (shift >> 8) & 0xFF;
+		sz[j] = (shift >> 16) & 0xFF;
+	}
+
+	for (u32 i = 0; i < header->num_vertices; i++) {
+		u32 pos = index[i];
+		u32 d[4], n[4];
+		const s16 *b = &base[pos * 3];
+
+		for (int j = 0; j < 4; j++) {
+			d[j] = frames[j][pos];
+			n[j] = norm[d[j] >> 24];
+		}
+
+		GFX_TEX_COORD = texcoords[i];
+
+		u32 nx = NE_BLEND(NE_SIGNED_FIELD(n[0], 20, 10),
+				  NE_SIGNED_FIELD(n[1], 20, 10),
+				  NE_SIGNED_FIELD(n[2], 20, 10),
+				  NE_SIGNED_FIELD(n[3], 20, 10),
+				  weights_a, weights_b);
+		u32 ny = NE_BLEND(NE_SIGNED_FIELD(n[0], 10, 10),
+				  NE_SIGNED_FIELD(n[1], 10, 10),
+				  NE_SIGNED_FIELD(n[2], 10, 10),
+				  NE_SIGNED_FIELD(n[3], 10, 10),
+				  weights_a, weights_b);
+		u32 nz = NE_BLEND(NE_SIGNED_FIELD(n[0], 0, 10),
+				  NE_SIGNED_FIELD(n[1], 0, 10),
+				  NE_SIGNED_FIELD(n[2], 0, 10),
+				  NE_SIGNED_FIELD(n[3], 0, 10),
+				  weights_a, weights_b);
+		GFX_NORMAL = ((nx & 0x3FF) << 20) | ((ny & 0x3FF) << 10)
+			     | (nz & 0x3FF);
+
+		u32 x = NE_BLEND(NE_NEA3_COORD(b[0], d[0], 0, sx[0]),
+				 NE_NEA3_COORD(b[0], d[1], 0, sx[1]),
+				 NE_NEA3_COORD(b[0], d[2], 0, sx[2]),
+				 NE_NEA3_COORD(b[0], d[3], 0, sx[3]),
+				 weights_a, weights_b);
+		u32 y = NE_BLEND(NE_NEA3_COORD(b[1], d[0], 8, sy[0]),
+				 NE_NEA3_COORD(b[1], d[1], 8, sy[1]),
+				 NE_NEA3_COORD(b[1], d[2], 8, sy[2]),
+				 NE_NEA3_COORD(b[1], d[3], 8, sy[3]),
+				 weights_a, weights_b);
+		u32 z = NE_BLEND(NE_NEA3_COORD(b[2], d[0], 16, sz[0]),
+				 NE_NEA3_COORD(b[2], d[1], 16, sz[1]),
+				 NE_NEA3_COORD(b[2], d[2], 16, sz[2]),
+				 NE_NEA3_COORD(b[2], d[3], 16, sz[3]),
+				 weights_a, weights_b);
+		GFX_VERTEX16 = (x & 0xFFFF) | (y << 16);
+		GFX_VERTEX16 = z & 0xFFFF;
+	}
+}
+
+static void __ne_drawanimatedmodel_blend(NE_AnimData *anim, bool interpolate)
+{
+	NE_AnimData *blend = anim->blend;
+	int frames[4] = {
+		anim->currframe, ne_anim_next_frame(anim),
+		blend->currframe, ne_anim_next_frame(blend)
+	};
+
+	for (int j = 0; j < 4; j++) {
+		NE_Assert(frames[j] < anim->fileptrtr[2],
+			  "Drawing nonexistent frame.");
+	}
+
+	// Without interpolation only the current frames are used
+	s32 time_a = interpolate ? anim->nextframetime : 0;
+	s32 time_b = interpolate ? blend->nextframetime : 0;
+
+	// The weight of each frame is the product of the weight of its animation
+	// and its weight inside the animation, all of them from 0 to 64. This way
+	// they are exact and they always add up to 4096.
+	s32 weight = anim->blendweight >> 6;
+	s32 weights_a = ((u32)(time_a * (64 - weight)) << 16)
+			| (((64 - time_a) * (64 - weight)) & 0xFFFF);
+	s32 weights_b = ((u32)(time_b * weight) << 16)
+			| (((64 - time_b) * weight) & 0xFFFF);
+
+	GFX_BEGIN = GL_TRIANGLES;
+
+	if (anim->fileptrtr[1] == 3) {
+		const ne_nea3_header_t *header = (void *)anim->fileptrtr;
+		const u32 *frame_ptr[4];
+
+		for (int j = 0; j < 4; j++)
+			frame_ptr[j] = ne_nea3_frame(header, frames[j]);
+
+		ne_blend_vertices_nea3(header, frame_ptr, weights_a, weights_b);
+		return;
+	}
+
+	u32 *fileptr = anim->fileptrtr + 3;
+	u32 vtxcount = *fileptr++;
+	u16 *framearrayptr = (u16 *) ((int)anim->fileptrtr + (int)*fileptr++);
+	s16 *vtxarrayptr = (s16 *) ((int)anim->fileptrtr + (int)*fileptr++);
+	s16 *normarrayptr = (s16 *) ((int)anim->fileptrtr + (int)*fileptr++);
+	s16 *texcoordsarrayptr = (s16 *) ((int)anim->fileptrtr + (int)*fileptr);
+
+	const u16 *frame_ptr[4];
+
+	for (int j = 0; j < 4; j++)
+		frame_ptr[j] = framearrayptr + vtxcount * 3 * frames[j];
+
+	ne_blend_vertices(frame_ptr, vtxcount, vtxarrayptr, normarrayptr,
+			  texcoordsarrayptr, weights_a, weights_b);
+}
+
+// NEB files. Bones are sorted so that parents come before their children. The
+// matrix of each bone is stored in slot "first_slot + bone" of the position
+// matrix stack, and the display lists of the bones restore those slots before
+// sending the vertices of each bone.
+typedef struct {
+	u32 magic;
+	u32 version;
+	u32 num_frames;
+	u32 num_vertices;
+	u32 num_bones;
+	u32 first_slot;
+	u32 offset_bones;	// Offsets from the start of the file
+	u32 offset_frames;
+} ne_skeleton_header_t;
+
+typedef struct {
+	s32 parent;		// -1 if it's a root bone
+	u32 offset_list;	// Display list of the bone or 0
+} ne_skeleton_bone_t;
+
+// Transformation of a bone relative to its parent in a frame
+typedef struct {
+	s16 t[3];		// v16
+	s16 q[4];		// x, y, z, w (f32)
+	s16 padding;
+} ne_skeleton_key_t;
+
+// Interpolates the transformation of a bone between two frames and converts it
+// into a 4x3 matrix for MATRIX_MULT4x3.
+static void ne_skeleton_bone_matrix(const ne_skeleton_key_t *one,
+				    const ne_skeleton_key_t *two, s32 weights,
+				    s32 *m)
+{
+	// Take the shortest path between both rotations
+	s32 dot = one->q[0] * two->q[0] + one->q[1] * two->q[1]
+		  + one->q[2] * two->q[2] + one->q[3] * two->q[3];
+	s32 sign = (dot < 0) ? -1 : 1;
+
+	s32 x = NE_LERP(one->q[0], sign * two->q[0], weights);
+	s32 y = NE_LERP(one->q[1], sign * two->q[1], weights);
+	s32 z = NE_LERP(one->q[2], sign * two->q[2], weights);
+	s32 w = NE_LERP(one->q[3], sign * two->q[3], weights);
+
+	// The interpolated quaternion isn't normalized, this is compensated by
+	// dividing by its squared length.
+	s32 len2 = (x * x + y * y + z * z + w * w) >> 12;
+	s32 s = divf32(inttof32(2), len2);
+
+	s32 xs = mulf32(x, s), ys = mulf32(y, s), zs = mulf32(z, s);
+	s32 wx = mulf32(w, xs), wy = mulf32(w, ys), wz = mulf32(w, zs);
+	s32 xx = mulf32(x, xs), xy = mulf32(x, ys), xz = mulf32(x, zs);
+	s32 yy = mulf32(y, ys), yz = mulf32(y, zs), zz = mulf32(z, zs);
+
+	// The hardware multiplies row vectors, so each row is the rotated axis
+	m[0] = inttof32(1) - (yy + zz);
+	m[1] = xy + wz;
+	m[2] = xz - wy;
+
+	m[3] = xy - wz;
+	m[4] = inttof32(1) - (xx + zz);
+	m[5] = yz + wx;
+
+	m[6] = xz + wy;
+	m[7] = yz - wx;
+	m[8] = inttof32(1) - (xx + yy);
+
+	m[9] = NE_LERP(one->t[0], two->t[0], weights);
+	m[10] = NE_LERP(one->t[1], two->t[1], weights);
+	m[11] = NE_LERP(one->t[2], two->t[2], weights);
+}
+
+static void __ne_drawskinnedmodel(NE_AnimData *anim, bool interpolate)
+{
+	const ne_skeleton_header_t *header = (void *)anim->fileptrtr;
+	const ne_skeleton_bone_t *bones =
+		(const ne_skeleton_bone_t *)((u8 *)header + header->offset_bones);
+	const ne_skeleton_key_t *frames =
+		(const ne_skeleton_key_t *)((u8 *)header + header->offset_frames);
+
+	int frame_one = anim->currframe;
+	int frame_two = frame_one;
+	s32 time = 0;
+
+	if (interpolate) {
+		frame_two = ne_anim_next_frame(anim);
+		time = anim->nextframetime;
+	}
+
+	NE_Assert(frame_one < header->num_frames
+		  && frame_two < header->num_frames,
+		  "Drawing nonexistent frame.");
+
+	s32 weights = ((u32)time << 16) | ((64 - time) & 0xFFFF);
+
+	const ne_skeleton_key_t *keys_one = &frames[frame_one * header->num_bones];
+	const ne_skeleton_key_t *keys_two = &frames[frame_two * header->num_bones];
+
+	// The slot before the bones holds the matrix of the model. The matrix of
+	// each bone is the matrix of its parent multiplied by its own one.
+	u32 model_slot = header->first_slot - 1;
+	MATRIX_STORE = model_slot;
+
+	for (u32 i = 0; i < header->num_bones; i++) {
+		s32 m[12];
+
+		ne_skeleton_bone_matrix(&keys_one[i], &keys_two[i], weights, m);
+
+		if (bones[i].parent < 0)
+			MATRIX_RESTORE = model_slot;
+		else
+			MATRIX_RESTORE = header->first_slot + bones[i].parent;
+
+		for (int j = 0; j < 12; j++)
+			MATRIX_MULT4x3 = m[j];
+
+		MATRIX_STORE = header->first_slot + i;
+	}
+
+	for (u32 i = 0; i < header->num_bones; i++) {
+		if (bones[i].offset_list == 0)
+			continue;
+
+		glCallList((u32 *)((u8 *)header + bones[i].offset_list));
+	}
+}
+
 //---------------------------------------------------------
 
 // Internal use... see below
@@ -302,7 +796,7 @@ void NE_ModelDraw(NE_Model *model)
 	NE_AssertPointer(model, "NULL pointer");
 	if (model->meshdata == NULL)
 		return;
-	if (model->modeltype == NE_Animated)
+	if (model->modeltype != NE_Static)
 		if (((NE_AnimData *) model->meshdata)->fileptrtr == NULL)
 			return;
 
@@ -337,10 +831,16 @@ void NE_ModelDraw(NE_Model *model)
 
 	if (model->modeltype == NE_Static) {
 		glCallList(model->meshdata);
+	} else if (model->modeltype == NE_Skinned) {
+		__ne_drawskinnedmodel((void *) model->meshdata,
+				      model->anim_interpolate);
 	} else { // if(model->modeltype == NE_Animated)
 		NE_AnimData *anim = (void *) model->meshdata;
 
-		if (model->anim_interpolate)
+		if (anim->blend != NULL)
+			__ne_drawanimatedmodel_blend(anim,
+						     model->anim_interpolate);
+		else if (model->anim_interpolate)
 			__ne_drawanimatedmodel_interpolate(anim);
 		else
 			__ne_drawanimatedmodel_nointerpolate(anim);
@@ -356,9 +856,34 @@ void NE_ModelClone(NE_Model *dest, NE_Model *source)
 	NE_Assert(dest->modeltype == source->modeltype,
 		  "Different model types");
 
-	if (dest->modeltype == NE_Animated) {
+	if (dest->modeltype != NE_Static) {
+		NE_AnimData *anim = (void *)dest->meshdata;
+
+		if (dest->modeltype == NE_Animated) {
+			NE_ModelAnimBlendStop(dest);
+			NE_ModelAnimFreeBakedFrames(dest);
+		}
+
 		swiCopy(source->meshdata, dest->meshdata,
 			(sizeof(NE_AnimData) >> 2) | COPY_MODE_WORD);
+
+		// The display lists are kept until all models stop using them
+		if (anim->baked != NULL)
+			anim->baked->refs++;
+
+		// The blended animation isn't shared
+		if (anim->blend != NULL) {
+			NE_AnimData *blend = malloc(sizeof(NE_AnimData));
+			if (blend != NULL) {
+				swiCopy(anim->blend, blend,
+					(sizeof(NE_AnimData) >> 2)
+					| COPY_MODE_WORD);
+			} else {
+				NE_DebugPrint("Not enough memory");
+			}
+			anim->blend = blend;
+		}
+
 		dest->iscloned = true;
 		dest->texture = source->texture;
 	} else {
@@ -408,6 +933,114 @@ void NE_ModelSetRot(NE_Model *model, int rx, int ry, int rz)
 	model->rz = rz;
 }
 
+static void ne_anim_set_speed(NE_AnimData *anim, int speed)
+{
+	for (int i = 0; i < NE_MAX_FRAMES; i++)
+		anim->speed[i] = abs(speed);
+
+	anim->direction = ((speed >= 0) ? 1 : -1);
+}
+
+static void ne_anim_start(NE_AnimData *anim, int min, int start, int max,
+			  NE_AnimationTypes type, int speed)
+{
+	anim->animtype = type;
+	anim->currframe = start;
+	anim->startframe = min;
+	anim->endframe = max;
+	anim->nextframetime = 0;
+	ne_anim_set_speed(anim, speed);
+}
+
+// Moves the current frame of an animation
+static void ne_anim_advance(NE_AnimData *anim)
+{
+	anim->nextframetime += anim->speed[anim->currframe];
+
+	if (abs(anim->nextframetime) <= 64)
+		return;
+
+	anim->nextframetime = 0;
+
+	switch (anim->animtype) {
+	case NE_ANIM_LOOP:
+		if (anim->currframe == anim->startframe
+			&& anim->direction < 0) {
+			anim->currframe = anim->endframe;
+		} else if (anim->currframe == anim->endframe
+				&& anim->direction > 0) {
+			anim->currframe = anim->startframe;
+		} else {
+			if (anim->direction > 0)
+				anim->currframe++;
+			else
+				anim->currframe--;
+		}
+		break;
+
+	case NE_ANIM_ONESHOT:
+		if (anim->currframe == anim->startframe
+			&& anim->direction < 0) {
+			ne_anim_set_speed(anim, 0);
+		} else if (anim->currframe == anim->endframe
+				&& anim->direction > 0) {
+			ne_anim_set_speed(anim, 0);
+		} else {
+			if (anim->direction > 0)
+				anim->currframe++;
+			else
+				anim->currframe--;
+		}
+		break;
+
+	case NE_ANIM_UPDOWN:
+		if (anim->currframe == anim->startframe
+			&& anim->direction < 0) {
+			anim->direction *= -1;
+			anim->currframe++;
+		} else if (anim->currframe == anim->endframe
+				&& anim->direction > 0) {
+			anim->direction *= -1;
+			anim->currframe--;
+		} else {
+			if (anim->direction > 0)
+				anim->currframe++;
+			else
+				anim->currframe--;
+		}
+		break;
+	}
+}
+
+// Updates the blended animation of a model. When a crossfade ends, the blended
+// animation replaces the one of the model.
+static void ne_anim_blend_update(NE_AnimData *anim)
+{
+	NE_AnimData *blend = anim->blend;
+
+	ne_anim_advance(blend);
+
+	if (anim->blendfade == 0)
+		return;
+
+	anim->blendweight += anim->blendfade;
+	if (anim->blendweight < inttof32(1))
+		return;
+
+	anim->animtype = blend->animtype;
+	anim->currframe = blend->currframe;
+	anim->startframe = blend->startframe;
+	anim->endframe = blend->endframe;
+	anim->direction = blend->direction;
+	anim->nextframetime = blend->nextframetime;
+	memcpy(anim->speed, blend->speed, sizeof(anim->speed));
+
+	free(blend);
+	anim->blend = NULL;
+	anim->blendweight = 0;
+	anim->blendfade = 0;
+}
+
 void NE_ModelAnimateAll(void)
 {
 	if (!ne_model_system_inited)
@@ -417,67 +1050,16 @@ void NE_ModelAnimateAll(void)
 		if (NE_ModelPointers[i] == NULL)
 			continue;
 
-		if (NE_ModelPointers[i]->modeltype != NE_Animated)
+		if (NE_ModelPointers[i]->modeltype == NE_Static)
 			continue;
 
 		NE_AnimData *anim =
 		    (NE_AnimData *) (NE_ModelPointers[i]->meshdata);
 
-		anim->nextframetime += anim->speed[anim->currframe];
-
-		if (abs(anim->nextframetime) <= 64)
-			continue;
-
-		anim->nextframetime = 0;
-
-		switch (anim->animtype) {
-		case NE_ANIM_LOOP:
-			if (anim->currframe == anim->startframe
-				&& anim->direction < 0) {
-				anim->currframe = anim->endframe;
-			} else if (anim->currframe == anim->endframe
-					&& anim->direction > 0) {
-				anim->currframe = anim->startframe;
-			} else {
-				if (anim->direction > 0)
-					anim->currframe++;
-				else
-					anim->currframe--;
-			}
-			break;
-
-		case NE_ANIM_ONESHOT:
-			if (anim->currframe == anim->startframe
-				&& anim->direction < 0) {
-				NE_ModelAnimSetSpeed(NE_ModelPointers[i], 0);
-			} else if (anim->currframe == anim->endframe
-					&& anim->direction > 0) {
-				NE_ModelAnimSetSpeed(NE_ModelPointers[i], 0);
-			} else {
-				if (anim->direction > 0)
-					anim->currframe++;
-				else
-					anim->currframe--;
-			}
-			break;
+		ne_anim_advance(anim);
 
-		case NE_ANIM_UPDOWN:
-			if (anim->currframe == anim->startframe
-				&& anim->direction < 0) {
-				anim->direction *= -1;
-				anim->currframe++;
-			} else if (anim->currframe == anim->endframe
-					&& anim->direction > 0) {
-				anim->direction *= -1;
-				anim->currframe--;
-			} else {
-				if (anim->direction > 0)
-					anim->currframe++;
-				else
-					anim->currframe--;
-			}
-			break;
-		}
+		if (anim->blend != NULL)
+			ne_anim_blend_update(anim);
 	}
 }
 
@@ -485,38 +1067,23 @@ void NE_ModelAnimStart(NE_Model *model, int min, int start, int max,
 		       NE_AnimationTypes type, int speed)
 {
 	NE_AssertPointer(model, "NULL pointer");
-	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
-
-	NE_AnimData *anim = (void *)model->meshdata;
-
-	anim->animtype = type;
-	anim->currframe = start;
-	anim->startframe = min;
-	anim->endframe = max;
-	anim->nextframetime = 0;
-	anim->direction = ((speed >= 0) ? 1 : -1);
+	NE_Assert(model->modeltype != NE_Static, "Not an animated model");
 
-	for (int i = 0; i < NE_MAX_FRAMES; i++)
-		anim->speed[i] = abs(speed);
+	ne_anim_start((void *)model->meshdata, min, start, max, type, speed);
 }
 
 void NE_ModelAnimSetSpeed(NE_Model *model, int speed)
 {
 	NE_AssertPointer(model, "NULL pointer");
-	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
-
-	NE_AnimData *anim = (void *)model->meshdata;
-
-	for (int i = 0; i < NE_MAX_FRAMES; i++)
-		anim->speed[i] = abs(speed);
+	NE_Assert(model->modeltype != NE_Static, "Not an animated model");
 
-	anim->direction = ((speed >= 0) ? 1 : -1);
+	ne_anim_set_speed((void *)model->meshdata, speed);
 }
 
 void NE_ModelAnimSetFrameSpeed(NE_Model *model, int frame, int speed)
 {
 	NE_AssertPointer(model, "NULL pointer");
-	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
+	NE_Assert(model->modeltype != NE_Static, "Not an animated model");
 
 	NE_AnimData *anim = (void *)model->meshdata;
 	anim->speed[frame] = speed;
@@ -525,7 +1092,7 @@ void NE_ModelAnimSetFrameSpeed(NE_Model *model, int frame, int speed)
 int NE_ModelAnimGetFrame(NE_Model *model)
 {
 	NE_AssertPointer(model, "NULL pointer");
-	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
+	NE_Assert(model->modeltype != NE_Static, "Not an animated model");
 	NE_AnimData *anim = (void *)model->meshdata;
 	return anim->currframe;
 }
@@ -533,7 +1100,7 @@ int NE_ModelAnimGetFrame(NE_Model *model)
 void NE_ModelAnimSetFrame(NE_Model *model, int frame)
 {
 	NE_AssertPointer(model, "NULL pointer");
-	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
+	NE_Assert(model->modeltype != NE_Static, "Not an animated model");
 
 	NE_AnimData *anim = (void *)model->meshdata;
 	anim->currframe = frame;
@@ -543,10 +1110,264 @@ void NE_ModelAnimSetFrame(NE_Model *model, int frame)
 void NE_ModelAnimInterpolate(NE_Model *model, bool interpolate)
 {
 	NE_AssertPointer(model, "NULL pointer");
-	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
+	NE_Assert(model->modeltype != NE_Static, "Not an animated model");
 	model->anim_interpolate = interpolate;
 }
 
+int NE_ModelAnimBlendStart(NE_Model *model, int min, int start, int max,
+			   NE_AnimationTypes type, int speed, f32 weight)
+{
+	NE_AssertPointer(model, "NULL pointer");
+	NE_Assert(model->modeltype == NE_Animated, "Not a NEA model");
+
+	NE_AnimData *anim = (void *)model->meshdata;
+
+	if (anim->blend == NULL) {
+		anim->blend = calloc(1, sizeof(NE_AnimData));
+		if (anim->blend == NULL) {
+			NE_DebugPrint("Not enough memory");
+			return 0;
+		}
+	}
+
+	ne_anim_start(anim->blend, min, start, max, type, speed);
+	NE_ModelAnimBlendSetWeight(model, weight);
+
+	return 1;
+}
+
+int NE_ModelAnimCrossfade(NE_Model *model, int min, int start, int max,
+			  NE_AnimationTypes type, int speed, int duration)
+{
+	if (duration <= 0) {
+		NE_ModelAnimBlendStop(model);
+		NE_ModelAnimStart(model, min, start, max, type, speed);
+		return 1;
+	}
+
+	if (NE_ModelAnimBlendStart(model, min, start, max, type, speed, 0) == 0)
+		return 0;
+
+	NE_AnimData *anim = (void *)model->meshdata;
+	anim->blendfade = (inttof32(1) + duration - 1) / duration;
+
+	return 1;
+}
+
+void NE_ModelAnimBlendSetWeight(NE_Model *model, f32 weight)
+{
+	NE_AssertPointer(model, "NULL pointer");
+	NE_Assert(model->modeltype == NE_Animated, "Not a NEA model");
+
+	NE_AnimData *anim = (void *)model->meshdata;
+
+	if (weight < 0)
+		weight = 0;
+	else if (weight > inttof32(1))
+		weight = inttof32(1);
+
+	anim->blendweight = weight;
+	anim->blendfade = 0;
+}
+
+void NE_ModelAnimBlendStop(NE_Model *model)
+{
+	NE_AssertPointer(model, "NULL pointer");
+	NE_Assert(model->modeltype == NE_Animated, "Not a NEA model");
+
+	NE_AnimData *anim = (void *)model->meshdata;
+
+	free(anim->blend);
+	anim->blend = NULL;
+	anim->blendweight = 0;
+	anim->blendfade = 0;
+}
+
+// Adds a command to a display list of packed commands. "header" is the index of
+// the word with the IDs of the current group of 4 commands.
+static void ne_displaylist_add(u32 *list, int *size, int *header,
+			       int *numcommands, u32 command, const u32 *params,
+			       int numparams)
+{
+	if ((*numcommands & 3) == 0) {
+		*header = (*size)++;
+		list[*header] = 0; // Unused commands are NOPs
+	}
+
+	list[*header] |= command << ((*numcommands & 3) * 8);
+	(*numcommands)++;
+
+	for (int i = 0; i < numparams; i++)
+		list[(*size)++] = params[i];
+}
+
+// Gets the parameters of the commands of a vertex of a NEA v2 or v3 file: the
+// texture coordinates, the normal and the two words of the position.
+static inline void ne_model_frame_vertex(NE_AnimData *anim, int frame, u32 i,
+					 u32 *params)
+{
+	if (anim->fileptrtr[1] == 3) {
+		const ne_nea3_header_t *header = (void *)anim->fileptrtr;
+		const s16 *base = (const s16 *)((u8 *)header + header->offset_base);
+		const u32 *norm = (const u32 *)((u8 *)header + header->offset_norm);
+		const u32 *texcoords = (const u32 *)((u8 *)header + header->offset_st);
+		const u16 *index = (const u16 *)((u8 *)header + header->offset_index);
+
+		const u32 *frame_ptr = ne_nea3_frame(header, frame);
+		u32 shift = *frame_ptr++;
+		u32 pos = index[i];
+		u32 d = frame_ptr[pos];
+		const s16 *b = &base[pos * 3];
+
+		u32 x = NE_NEA3_COORD(b[0], d, 0, shift & 0xFF);
+		u32 y = NE_NEA3_COORD(b[1], d, 8, (shift >> 8) & 0xFF);
+		u32 z = NE_NEA3_COORD(b[2], d, 16, (shift >> 16) & 0xFF);
+
+		params[0] = texcoords[i];
+		params[1] = norm[d >> 24];
+		params[2] = (x & 0xFFFF) | (y << 16);
+		params[3] = z & 0xFFFF;
+		return;
+	}
+
+	u32 *fileptr = anim->fileptrtr + 3;
+	u32 vtxcount = *fileptr++;
+	u16 *framearrayptr = (u16 *) ((int)anim->fileptrtr + (int)*fileptr++);
+	s16 *vtxarrayptr = (s16 *) ((int)anim->fileptrtr + (int)*fileptr++);
+	s16 *normarrayptr = (s16 *) ((int)anim->fileptrtr + (int)*fileptr++);
+	s16 *texcoordsarrayptr = (s16 *) ((int)anim->fileptrtr + (int)*fileptr);
+
+	u16 *frame_ptr = (u16 *) ((int)framearrayptr
+				  + (vtxcount * 6 * frame) + i * 6);
+	s16 *frame_anim;
+
+	frame_anim = &texcoordsarrayptr[frame_ptr[0] * 2];
+	params[0] = ((s32) *frame_anim) | (((s32) *(frame_anim + 1)) << 16);
+
+	frame_anim = &normarrayptr[frame_ptr[1] * 3];
+	params[1] = ((frame_anim[0] & 0x3FF) << 20)
+		    | ((frame_anim[1] & 0x3FF) << 10)
+		    | (frame_anim[2] & 0x3FF);
+
+	frame_anim = &vtxarrayptr[frame_ptr[2] * 3];
+	params[2] = (frame_anim[0] & 0xFFFF)
+		    | ((u32)(frame_anim[1] & 0xFFFF) << 16);
+	params[3] = frame_anim[2] & 0xFFFF;
+}
+
+// Creates a display list that sends the same commands as
+// __ne_drawanimatedmodel_nointerpolate() for the given frame.
+static u32 *ne_model_bake_frame(NE_AnimData *anim, int frame)
+{
+	u32 vtxcount = anim->fileptrtr[3];
+
+	// One command to start the triangles and 3 per vertex, in groups of 4,
+	// plus 4 words of parameters per vertex and the size of the list.
+	int numcommands = 1 + vtxcount * 3;
+	int maxsize = 1 + (numcommands + 3) / 4 + 1 + vtxcount * 4;
+
+	u32 *list = malloc(maxsize * sizeof(u32));
+	if (list == NULL)
+		return NULL;
+
+	int size = 1;
+	int header = 0;
+	numcommands = 0;
+
+	u32 params[4];
+
+	params[0] = GL_TRIANGLES;
+	ne_displaylist_add(list, &size, &header, &numcommands, FIFO_BEGIN,
+			   params, 1);
+
+	for (u32 i = 0; i < vtxcount; i++) {
+		ne_model_frame_vertex(anim, frame, i, params);
+
+		ne_displaylist_add(list, &size, &header, &numcommands,
+				   FIFO_TEX_COORD, &params[0], 1);
+		ne_displaylist_add(list, &size, &header, &numcommands,
+				   FIFO_NORMAL, &params[1], 1);
+		ne_displaylist_add(list, &size, &header, &numcommands,
+				   FIFO_VERTEX16, &params[2], 2);
+	}
+
+	// The first word is the number of words of the list
+	list[0] = size - 1;
+
+	DC_FlushRange(list, size * sizeof(u32));
+
+	return list;
+}
+
+int NE_ModelAnimBakeFrames(NE_Model *model, int first, int last)
+{
+	NE_AssertPointer(model, "NULL pointer");
+	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
+	NE_Assert(!model->iscloned, "Can't bake frames of a cloned model");
+
+	NE_AnimData *anim = (void *)model->meshdata;
+	if (anim->fileptrtr == NULL) {
+		NE_DebugPrint("No NEA file loaded");
+		return 0;
+	}
+
+	int numframes = anim->fileptrtr[2];
+	if (first < 0 || last >= numframes || first > last) {
+		NE_DebugPrint("Invalid frame range");
+		return 0;
+	}
+
+	NE_ModelAnimFreeBakedFrames(model);
+
+	NE_BakedFrames *baked = malloc(sizeof(NE_BakedFrames)
+				       + (last - first + 1) * sizeof(u32 *));
+	if (baked == NULL) {
+		NE_DebugPrint("Not enough memory");
+		return 0;
+	}
+
+	for (int i = first; i <= last; i++) {
+		baked->lists[i - first] = ne_model_bake_frame(anim, i);
+		if (baked->lists[i - first] != NULL)
+			continue;
+
+		NE_DebugPrint("Not enough memory");
+		for (int j = first; j < i; j++)
+			free(baked->lists[j - first]);
+		free(baked);
+		return 0;
+	}
+
+	baked->refs = 1;
+	baked->first = first;
+	baked->last = last;
+	anim->baked = baked;
+
+	return 1;
+}
+
+void NE_ModelAnimFreeBakedFrames(NE_Model *model)
+{
+	NE_AssertPointer(model, "NULL pointer");
+	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
+
+	NE_AnimData *anim = (void *)model->meshdata;
+	NE_BakedFrames *baked = anim->baked;
+	if (baked == NULL)
+		return;
+
+	anim->baked = NULL;
+
+	// Clones share the display lists of the original model
+	baked->refs--;
+	if (baked->refs > 0)
+		return;
+
+	for (int i = baked->first; i <= baked->last; i++)
+		free(baked->lists[i - baked->first]);
+	free(baked);
+}
+
 int NE_ModelLoadNEAFAT(NE_Model *model, char *path)
 {
 	if (!ne_model_system_inited)
@@ -556,6 +1377,8 @@ int NE_ModelLoadNEAFAT(NE_Model *model, char *path)
 	NE_AssertPointer(path, "NULL path pointer");
 	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
 
+	NE_ModelAnimFreeBakedFrames(model);
+
 	if (model->meshfromfat)
 		free(((NE_AnimData *) model->meshdata)->fileptrtr);
 
@@ -573,8 +1396,8 @@ int NE_ModelLoadNEAFAT(NE_Model *model, char *path)
 	}
 
 	// Check version
-	if (pointer[1] != 2) {
-		NE_DebugPrint("NEA file version is %ld, should be 2",
+	if (pointer[1] != 2 && pointer[1] != 3) {
+		NE_DebugPrint("NEA file version is %ld, should be 2 or 3",
 			      pointer[1]);
 		free(pointer);
 		return 0;
@@ -594,6 +1417,8 @@ int NE_ModelLoadNEA(NE_Model *model, void *pointer)
 	NE_AssertPointer(pointer, "NULL data pointer");
 	NE_Assert(model->modeltype == NE_Animated, "Not an animated model");
 
+	NE_ModelAnimFreeBakedFrames(model);
+
 	if (model->meshfromfat)
 		free(((NE_AnimData *) model->meshdata)->fileptrtr);
 
@@ -611,10 +1436,92 @@ int NE_ModelLoadNEA(NE_Model *model, void *pointer)
 	ptr++;
 
 	// Check version
-	if (*ptr != 2) {
-		NE_DebugPrint("NEA file version is %ld, should be 2", *ptr);
+	if (*ptr != 2 && *ptr != 3) {
+		NE_DebugPrint("NEA file version is %ld, should be 2 or 3",
+			      *ptr);
+		return 0;
+	}
+	((NE_AnimData *) model->meshdata)->fileptrtr = pointer;
+
+	return 1;
+}
+
+// Checks the header of a NEB file. Returns 1 if it can be used.
+static int ne_model_check_neb(const u32 *pointer)
+{
+	const ne_skeleton_header_t *header = (const void *)pointer;
+
+	// Check file type ('NEBM') - NEB file
+	if (header->magic != 1296188750) {
+		NE_DebugPrint("Not a NEB file");
+		return 0;
+	}
+
+	if (header->version != 1) {
+		NE_DebugPrint("NEB file version is %ld, should be 1",
+			      header->version);
 		return 0;
 	}
+
+	if (header->num_bones > NE_MAX_BONES
+	    || header->first_slot < 31 - NE_MAX_BONES
+	    || header->first_slot + header->num_bones > 31) {
+		NE_DebugPrint("NEB file uses %ld bones, the max. is %d",
+			      header->num_bones, NE_MAX_BONES);
+		return 0;
+	}
+
+	return 1;
+}
+
+int NE_ModelLoadNEBFAT(NE_Model *model, char *path)
+{
+	if (!ne_model_system_inited)
+		return 0;
+
+	NE_AssertPointer(model, "NULL model pointer");
+	NE_AssertPointer(path, "NULL path pointer");
+	NE_Assert(model->modeltype == NE_Skinned, "Not a skinned model");
+
+	if (model->meshfromfat)
+		free(((NE_AnimData *) model->meshdata)->fileptrtr);
+
+	model->iscloned = 0;
+	model->meshfromfat = true;
+	((NE_AnimData *) model->meshdata)->fileptrtr = NULL;
+
+	u32 *pointer = (u32 *) NE_FATLoadData(path);
+	NE_AssertPointer(pointer, "Couldn't load file from FAT");
+
+	if (!ne_model_check_neb(pointer)) {
+		free(pointer);
+		return 0;
+	}
+
+	((NE_AnimData *) model->meshdata)->fileptrtr = pointer;
+
+	return 1;
+}
+
+int NE_ModelLoadNEB(NE_Model *model, void *pointer)
+{
+	if (!ne_model_system_inited)
+		return 0;
+
+	NE_AssertPointer(model, "NULL model pointer");
+	NE_AssertPointer(pointer, "NULL data pointer");
+	NE_Assert(model->modeltype == NE_Skinned, "Not a skinned model");
+
+	if (model->meshfromfat)
+		free(((NE_AnimData *) model->meshdata)->fileptrtr);
+
+	model->iscloned = 0;
+	model->meshfromfat = false;
+	((NE_AnimData *) model->meshdata)->fileptrtr = NULL;
+
+	if (!ne_model_check_neb(pointer))
+		return 0;
+
 	((NE_AnimData *) model->meshdata)->fileptrtr = pointer;
 
 	return 1;
@@ -4,6 +4,8 @@
 //
 // This file is part of Nitro Engine
 
+#include <limits.h>
+
 #include "NEMain.h"
 #include "NEAlloc.h"
 
@@ -12,6 +14,13 @@
 typedef struct {
 	u16 *pointer;
 	int format;
+	bool pending;	// Waiting in the upload queue
+	int uses;	// Number of NE_Palette structs using this palette
+
+	// Deduplication information. The hash is 0 if it hasn't been calculated.
+	u64 hash;
+	int numcolor;
+	int dedup_refs;	// Palettes sharing this one thanks to dedup
 } ne_palinfo_t;
 
 static ne_palinfo_t *NE_PalInfo = NULL;
@@ -23,6 +32,27 @@ static bool ne_palette_system_inited = false;
 
 static int NE_MAX_PALETTES;
 
+// Internal functions of the upload queue, see NETexture.c
+int __NE_UploadQueueAdd(bool palette, int slot, void *dest, const void *data,
+			size_t size, bool set_alpha);
+void __NE_UploadQueueCancel(void *start, void *end);
+bool __NE_UploadDataEquals(bool palette, const void *dest, const void *data,
+			   size_t size);
+
+u64 __NE_HashData(const void *data, size_t size);
+
+// If true, palettes with the same data share the same VRAM
+static bool ne_palette_dedup = false;
+
+// Label saved with the VRAM allocated for new palettes
+static const char *ne_palette_owner_label = NULL;
+
+// Palette being modified with NE_PaletteModificationStart()
+static u16 *palette_adress = NULL;
+static int palette_format;
+
+static NE_PaletteAnim *ne_palette_anims[NE_MAX_PALETTE_ANIMATIONS];
+
 NE_Palette *NE_PaletteCreate(void)
 {
 	if (!ne_palette_system_inited)
@@ -66,23 +96,64 @@ int NE_PaletteLoadFAT(NE_Palette *pal, char *path, int format)
 	return ret;
 }
 
-int NE_PaletteLoad(NE_Palette *pal, u16 *pointer, u16 numcolor, int format)
+// Removes the palette from a NE_Palette struct, and deletes it if no other
+// struct is using it.
+static void ne_palette_release(NE_Palette *pal)
 {
-	if (!ne_palette_system_inited)
-		return 0;
+	if (pal->index == NE_NO_PALETTE)
+		return;
 
-	NE_AssertPointer(pal, "NULL pointer");
+	ne_palinfo_t *info = &NE_PalInfo[pal->index];
 
-	if (pal->index != NE_NO_PALETTE) {
-		NE_DebugPrint("Palette already loaded");
-		NE_PaletteDelete(pal);
+	pal->index = NE_NO_PALETTE;
+
+	info->uses--;
+	if (info->dedup_refs > 0)
+		info->dedup_refs--;
+
+	if (info->uses > 0)
+		return;
+
+	if (info->pending) {
+		__NE_UploadQueueCancel(info->pointer, info->pointer + 1);
+		info->pending = false;
 	}
 
+	NE_Free(NE_PalAllocList, (void *)info->pointer);
+	info->pointer = NULL;
+	info->hash = 0;
+}
+
+// Returns a loaded palette created from the same data. The hash is only used to
+// find candidates, the colors are compared before sharing the palette.
+static int ne_palette_find_duplicate(u64 hash, const u16 *pointer, int numcolor,
+				     int format)
+{
+	for (int i = 0; i < NE_MAX_PALETTES; i++) {
+		ne_palinfo_t *info = &NE_PalInfo[i];
+
+		if (info->pointer == NULL || info->hash != hash)
+			continue;
+
+		if (info->numcolor != numcolor || info->format != format)
+			continue;
+
+		if (__NE_UploadDataEquals(true, info->pointer, pointer,
+					  numcolor << 1))
+			return i;
+	}
+
+	return NE_NO_PALETTE;
+}
+
+// Finds a free slot and allocates VRAM for a palette in it. The caller has to
+// fill the rest of the fields of the slot.
+static int ne_palette_alloc_slot(int numcolor, int format)
+{
 	int slot = NE_NO_PALETTE;
 
 	for (int i = 0; i < NE_MAX_PALETTES; i++) {
 		if (NE_PalInfo[i].pointer == NULL) {
-			pal->index = i;
 			slot = i;
 			break;
 		}
@@ -90,17 +161,111 @@ int NE_PaletteLoad(NE_Palette *pal, u16 *pointer, u16 numcolor, int format)
 
 	if (slot == NE_NO_PALETTE) {
 		NE_DebugPrint("No free lots");
-		return 0;
+		return NE_NO_PALETTE;
 	}
 
 	NE_PalInfo[slot].pointer = NE_Alloc(NE_PalAllocList, numcolor << 1,
 					    1 << (4 - (format == GL_RGB4)));
 	if (NE_PalInfo[slot].pointer == NULL) {
 		NE_DebugPrint("Not enough memory");
-		return 0;
+		return NE_NO_PALETTE;
 	}
 
+	NE_AllocSetOwner(NE_PalAllocList, NE_PalInfo[slot].pointer, slot,
+			 ne_palette_owner_label);
+
 	NE_PalInfo[slot].format = format;
+	NE_PalInfo[slot].pending = false;
+	NE_PalInfo[slot].uses = 1;
+	NE_PalInfo[slot].hash = 0;
+	NE_PalInfo[slot].numcolor = numcolor;
+	NE_PalInfo[slot].dedup_refs = 0;
+
+	return slot;
+}
+
+// Called before the colors of a palette are modified. If other NE_Palette
+// structs share it thanks to dedup, this one gets its own copy so that the
+// rest aren't affected. Returns 0 if the copy can't be made.
+static int ne_palette_make_private(NE_Palette *pal)
+{
+	int old = pal->index;
+	ne_palinfo_t *info = &NE_PalInfo[old];
+
+	if (info->uses == 1) {
+		// The colors won't match the hash after this, so don't let
+		// new palettes share this one.
+		info->hash = 0;
+		return 1;
+	}
+
+	// The colors are still in the upload queue, not in VRAM
+	if (info->pending) {
+		NE_DebugPrint("Shared palette not uploaded yet");
+		return 0;
+	}
+
+	int slot = ne_palette_alloc_slot(info->numcolor, info->format);
+	if (slot == NE_NO_PALETTE)
+		return 0;
+
+	// Allow CPU and DMA accesses to VRAM_E
+	vramSetBankE(VRAM_E_LCD);
+	dmaCopyHalfWords(3, info->pointer, NE_PalInfo[slot].pointer,
+			 info->numcolor << 1);
+	vramSetBankE(VRAM_E_TEX_PALETTE);
+
+	info->uses--;
+	if (info->dedup_refs > 0)
+		info->dedup_refs--;
+
+	pal->index = slot;
+
+	return 1;
+}
+
+int NE_PaletteLoad(NE_Palette *pal, u16 *pointer, u16 numcolor, int format)
+{
+	if (!ne_palette_system_inited)
+		return 0;
+
+	NE_AssertPointer(pal, "NULL pointer");
+
+	if (pal->index != NE_NO_PALETTE) {
+		NE_DebugPrint("Palette already loaded");
+		ne_palette_release(pal);
+	}
+
+	// If the same palette is already loaded, share it
+	u64 hash = 0;
+	if (ne_palette_dedup) {
+		hash = __NE_HashData(pointer, numcolor << 1);
+
+		int shared = ne_palette_find_duplicate(hash, pointer, numcolor,
+						       format);
+		if (shared != NE_NO_PALETTE) {
+			pal->index = shared;
+			NE_PalInfo[shared].uses++;
+			NE_PalInfo[shared].dedup_refs++;
+			return 1;
+		}
+	}
+
+	int slot = ne_palette_alloc_slot(numcolor, format);
+	if (slot == NE_NO_PALETTE)
+		return 0;
+
+	pal->index = slot;
+
+	NE_PalInfo[slot].hash = hash;
+
+	// If the upload queue is enabled, the palette is copied later
+	if (__NE_UploadQueueAdd(true, slot,
+				NE_PalInfo[slot].pointer, pointer,
+				numcolor << 1, false)) {
+		NE_PalInfo[slot].pending = true;
+		return 1;
+	}
 
 	// Allow CPU writes to VRAM_E
 	vramSetBankE(VRAM_E_LCD);
@@ -118,13 +283,16 @@ void NE_PaletteDelete(NE_Palette *pal)
 
 	NE_AssertPointer(pal, "NULL pointer");
 
-	// If there is an asigned palette...
-	if (pal->index != NE_NO_PALETTE) {
-		NE_Free(NE_PalAllocList,
-			(void *)NE_PalInfo[pal->index].pointer);
-		NE_PalInfo[pal->index].pointer = NULL;
+	// Animations of this palette stop modifying it
+	for (int i = 0; i < NE_MAX_PALETTE_ANIMATIONS; i++) {
+		if (ne_palette_anims[i] != NULL
+		    && ne_palette_anims[i]->palette == pal)
+			ne_palette_anims[i]->palette = NULL;
 	}
 
+	// If there is an asigned palette...
+	ne_palette_release(pal);
+
 	for (int i = 0; i < NE_MAX_PALETTES; i++) {
 		if (NE_UserPalette[i] == pal) {
 			NE_UserPalette[i] = NULL;
@@ -191,41 +359,191 @@ int NE_PaletteFreeMemPercent(void)
 	return Info.FreePercent;
 }
 
-void NE_PaletteDefragMem(void)
+int NE_PaletteMemGetInformation(NEMemInfo *info)
+{
+	if (!ne_palette_system_inited)
+		return 0;
+
+	NE_AssertPointer(info, "NULL pointer");
+
+	NE_MemGetInformation(NE_PalAllocList, info);
+
+	return 1;
+}
+
+void NE_PaletteDedupEnable(bool enable)
 {
-	NE_Assert(0, "This function doesn't work");
-	return;
+	ne_palette_dedup = enable;
+}
+
+int NE_PaletteDedupBytesSaved(void)
+{
+	if (!ne_palette_system_inited)
+		return 0;
+
+	int saved = 0;
+
+	for (int i = 0; i < NE_MAX_PALETTES; i++) {
+		ne_palinfo_t *info = &NE_PalInfo[i];
+
+		if (info->dedup_refs == 0 || info->pointer == NULL)
+			continue;
+
+		saved += NE_GetSize(NE_PalAllocList, info->pointer)
+			 * info->dedup_refs;
+	}
+
+	return saved;
+}
 
-	// TODO: Fix
+void NE_PaletteSetOwnerLabel(const char *label)
+{
+	ne_palette_owner_label = label;
+}
 
-	/*
+void NE_PaletteDumpMemMap(FILE *file)
+{
 	if (!ne_palette_system_inited)
 		return;
 
-	vramSetBankE(VRAM_E_LCD);
-	bool ok = false;
-	while (!ok) {
-		ok = true;
-		int i;
-		for (i = 0; i < NE_MAX_PALETTES; i++) {
-			int size = NE_GetSize(NE_PalAllocList, (void*)NE_PalInfo[i].pointer);
+	NE_AllocDump(NE_PalAllocList, file, VRAM_E, 64 * 1024, 'E');
+}
 
-			NE_Free(NE_PalAllocList, (void*)NE_PalInfo[i].pointer);
-			void *pointer = NE_Alloc(NE_PalAllocList, size,
-						 1 << (4 - (NE_PalInfo[i].format == GL_RGB4)));
+static int ne_palette_find_slot(void *address)
+{
+	for (int i = 0; i < NE_MAX_PALETTES; i++) {
+		if (NE_PalInfo[i].pointer == address)
+			return i;
+	}
 
-			NE_AssertPointer(pointer, "Couldn't reallocate palette");
+	return NE_NO_PALETTE;
+}
+
+// Size of the free chunk at the end of palette VRAM, which is where all the
+// free space ends up after defragmenting it.
+static int ne_palette_tail_free_size(void)
+{
+	NEChunk *chunk = NE_PalAllocList;
 
-			if ((int)pointer != (int)NE_PalInfo[i].pointer) {
-				dmaCopy((void*)NE_PalInfo[i].pointer, pointer, size);
+	while (chunk->next != NULL)
+		chunk = chunk->next;
 
-				NE_PalInfo[i].pointer = (void*)pointer;
-				ok = false;
-			}
+	if (chunk->status != NE_STATE_FREE)
+		return 0;
+
+	return (uintptr_t)chunk->end - (uintptr_t)chunk->start;
+}
+
+int NE_PaletteDefragMemStep(int max_bytes)
+{
+	if (!ne_palette_system_inited)
+		return 0;
+
+	if (palette_adress != NULL) {
+		NE_DebugPrint("Can't defragment while a palette is modified");
+		return 0;
+	}
+
+	int moved = 0;
+	bool bank_unlocked = false;
+
+	void *pointer = NULL;
+
+	while (1) {
+		void *free_start;
+
+		// Look for the next palette with free space right before it
+		pointer = NE_AllocNextMovable(NE_PalAllocList, pointer,
+					      &free_start);
+		if (pointer == NULL)
+			break;
+
+		int slot = ne_palette_find_slot(pointer);
+		if (slot == NE_NO_PALETTE) {
+			NE_DebugPrint("Chunk without palette");
+			continue;
+		}
+
+		// The upload queue has the address of the palette
+		if (NE_PalInfo[slot].pending)
+			continue;
+
+		// RGB4 palettes need to be aligned to 8 bytes, the rest of them
+		// to 16 bytes. If the free space is too small to move this
+		// palette, skip it.
+		uintptr_t align = 1 << (4 - (NE_PalInfo[slot].format == GL_RGB4));
+		uintptr_t dest = ((uintptr_t)free_start + align - 1)
+			       & ~(align - 1);
+		if (dest >= (uintptr_t)pointer)
+			continue;
+
+		int size = NE_GetSize(NE_PalAllocList, pointer);
+
+		// Always move at least one palette so that the process can
+		// finish even if the budget is very small.
+		if (moved > 0 && moved + size > max_bytes)
+			break;
+
+		if (NE_AllocMove(NE_PalAllocList, pointer, (void *)dest) == 0)
+			break;
+
+		if (!bank_unlocked) {
+			// Allow CPU writes to VRAM_E
+			vramSetBankE(VRAM_E_LCD);
+			bank_unlocked = true;
 		}
+
+		// The destination is always before the source, so copying
+		// forwards is safe even if they overlap.
+		dmaCopyHalfWords(3, pointer, (void *)dest, size);
+
+		// NE_PaletteUse() reads the address from here, so the change
+		// is transparent for the user.
+		NE_PalInfo[slot].pointer = (u16 *)dest;
+
+		moved += size;
+
+		// Continue after the palette that has just been moved
+		pointer = (void *)dest;
 	}
-	vramSetBankE(VRAM_E_TEX_PALETTE);
-	*/
+
+	if (bank_unlocked)
+		vramSetBankE(VRAM_E_TEX_PALETTE);
+
+	return moved;
+}
+
+int NE_PaletteDefragMem(void)
+{
+	if (!ne_palette_system_inited)
+		return 0;
+
+	int free_before = ne_palette_tail_free_size();
+
+	// A single pass is enough to move everything as much as possible.
+	NE_PaletteDefragMemStep(INT_MAX);
+
+	return ne_palette_tail_free_size() - free_before;
+}
+
+bool NE_PaletteIsReady(NE_Palette *pal)
+{
+	NE_AssertPointer(pal, "NULL pointer");
+
+	if (pal->index == NE_NO_PALETTE)
+		return false;
+
+	return NE_PalInfo[pal->index].pointer != NULL
+	       && !NE_PalInfo[pal->index].pending;
+}
+
+// Called by the upload queue when a palette has been copied to VRAM
+void __NE_PaletteUploadDone(int slot)
+{
+	if (!ne_palette_system_inited || slot >= NE_MAX_PALETTES)
+		return;
+
+	NE_PalInfo[slot].pending = false;
 }
 
 void NE_PaletteSystemEnd(void)
@@ -233,6 +551,13 @@ void NE_PaletteSystemEnd(void)
 	if (!ne_palette_system_inited)
 		return;
 
+	__NE_UploadQueueCancel(VRAM_E, VRAM_F);
+
+	for (int i = 0; i < NE_MAX_PALETTE_ANIMATIONS; i++) {
+		if (ne_palette_anims[i] != NULL)
+			NE_PaletteAnimDelete(ne_palette_anims[i]);
+	}
+
 	NE_AllocEnd(NE_PalAllocList);
 
 	free(NE_PalInfo);
@@ -249,15 +574,16 @@ void NE_PaletteSystemEnd(void)
 
 //------------------------------------------------------------------------------
 
-static u16 *palette_adress = NULL;
-static int palette_format;
-
 void *NE_PaletteModificationStart(NE_Palette *pal)
 {
 	NE_AssertPointer(pal, "NULL pointer");
 	NE_Assert(pal->index != NE_NO_PALETTE, "No asigned palette");
 	NE_Assert(palette_adress == NULL, "Another palette already active");
 
+	// Don't modify the colors of other palettes that share this one
+	if (ne_palette_make_private(pal) == 0)
+		return NULL;
+
 	palette_adress = NE_PalInfo[pal->index].pointer;
 	palette_format = NE_PalInfo[pal->index].format;
 
@@ -284,3 +610,258 @@ void NE_PaletteModificationEnd(void)
 
 	palette_adress = NULL;
 }
+
+//------------------------------------------------------------------------------
+
+NE_PaletteAnim *NE_PaletteAnimCreate(NE_Palette *pal, int first, int count)
+{
+	if (!ne_palette_system_inited)
+		return NULL;
+
+	NE_AssertPointer(pal, "NULL pointer");
+
+	if (first < 0 || count <= 0 || first + count > 256) {
+		NE_DebugPrint("Invalid color range");
+		return NULL;
+	}
+
+	// If the palette is already loaded, the range must be inside it. If not,
+	// it is checked every time the colors are copied to VRAM.
+	if (pal->index != NE_NO_PALETTE
+	    && first + count > NE_PalInfo[pal->index].numcolor) {
+		NE_DebugPrint("Color range outside of the palette");
+		return NULL;
+	}
+
+	for (int i = 0; i < NE_MAX_PALETTE_ANIMATIONS; i++) {
+		if (ne_palette_anims[i] != NULL)
+			continue;
+
+		NE_PaletteAnim *anim = calloc(1, sizeof(NE_PaletteAnim));
+		NE_AssertPointer(anim, "Not enough memory");
+
+		anim->buffer = malloc(count << 1);
+		if (anim->buffer == NULL) {
+			free(anim);
+			NE_DebugPrint("Not enough memory");
+			return NULL;
+		}
+
+		anim->palette = pal;
+		anim->first = first;
+		anim->count = count;
+		anim->type = NE_PaletteAnimNone;
+
+		ne_palette_anims[i] = anim;
+		return anim;
+	}
+
+	NE_DebugPrint("No free slots");
+
+	return NULL;
+}
+
+// Calculates the colors of the current step of the animation
+static void ne_palette_anim_calculate(NE_PaletteAnim *anim)
+{
+	int count = anim->count;
+	u16 *out = anim->buffer;
+
+	if (anim->type == NE_PaletteAnimRotate) {
+		// With step s, color i goes to position i + s (or i - s)
+		int offset = anim->reverse ? anim->step : count - anim->step;
+		int split = count - offset;
+
+		memcpy(out, anim->colors + offset, split << 1);
+		memcpy(out + split, anim->colors, offset << 1);
+	} else if (anim->type == NE_PaletteAnimKeyframes) {
+		const u16 *a = anim->colors + anim->step * count;
+
+		if (!anim->interpolate || anim->timer == 0) {
+			memcpy(out, a, count << 1);
+		} else {
+			int next = anim->step + 1;
+			if (next == anim->num_keyframes)
+				next = 0;
+			const u16 *b = anim->colors + next * count;
+
+			// Blend factor from 0 to 256
+			int t = (anim->timer << 8) / anim->delay;
+
+			for (int i = 0; i < count; i++) {
+				int r0 = a[i] & 31, g0 = (a[i] >> 5) & 31;
+				int b0 = (a[i] >> 10) & 31;
+				int r1 = b[i] & 31, g1 = (b[i] >> 5) & 31;
+				int b1 = (b[i] >> 10) & 31;
+
+				int r = r0 + (((r1 - r0) * t) >> 8);
+				int g = g0 + (((g1 - g0) * t) >> 8);
+				int bl = b0 + (((b1 - b0) * t) >> 8);
+
+				out[i] = RGB15(r, g, bl) | (a[i] & BIT(15));
+			}
+		}
+	} else {
+		return;
+	}
+
+	anim->dirty = true;
+}
+
+void NE_PaletteAnimSetRotation(NE_PaletteAnim *anim, const u16 *colors,
+			       int delay, bool reverse)
+{
+	NE_AssertPointer(anim, "NULL pointer");
+	NE_AssertPointer(colors, "NULL colors pointer");
+	NE_Assert(delay > 0, "Delay must be positive");
+
+	anim->type = NE_PaletteAnimRotate;
+	anim->colors = colors;
+	anim->num_keyframes = 0;
+	anim->delay = delay;
+	anim->reverse = reverse;
+	anim->interpolate = false;
+	anim->step = 0;
+	anim->timer = 0;
+
+	ne_palette_anim_calculate(anim);
+}
+
+void NE_PaletteAnimSetKeyframes(NE_PaletteAnim *anim, const u16 *table,
+				int num_keyframes, int delay, bool interpolate)
+{
+	NE_AssertPointer(anim, "NULL pointer");
+	NE_AssertPointer(table, "NULL table pointer");
+	NE_Assert(num_keyframes > 0, "Invalid number of keyframes");
+	NE_Assert(delay > 0, "Delay must be positive");
+
+	anim->type = NE_PaletteAnimKeyframes;
+	anim->colors = table;
+	anim->num_keyframes = num_keyframes;
+	anim->delay = delay;
+	anim->reverse = false;
+	anim->interpolate = interpolate;
+	anim->step = 0;
+	anim->timer = 0;
+
+	ne_palette_anim_calculate(anim);
+}
+
+void NE_PaletteAnimPause(NE_PaletteAnim *anim, bool pause)
+{
+	NE_AssertPointer(anim, "NULL pointer");
+
+	anim->paused = pause;
+}
+
+void NE_PaletteAnimDelete(NE_PaletteAnim *anim)
+{
+	NE_AssertPointer(anim, "NULL pointer");
+
+	for (int i = 0; i < NE_MAX_PALETTE_ANIMATIONS; i++) {
+		if (ne_palette_anims[i] == anim) {
+			ne_palette_anims[i] = NULL;
+			free(anim->buffer);
+			free(anim);
+			return;
+		}
+	}
+
+	NE_DebugPrint("Animation not found");
+}
+
+void NE_PaletteAnimUpdateAll(void)
+{
+	for (int i = 0; i < NE_MAX_PALETTE_ANIMATIONS; i++) {
+		NE_PaletteAnim *anim = ne_palette_anims[i];
+
+		if (anim == NULL || anim->paused
+		    || anim->type == NE_PaletteAnimNone)
+			continue;
+
+		anim->timer++;
+
+		if (anim->timer >= anim->delay) {
+			anim->timer = 0;
+			anim->step++;
+
+			int steps = anim->type == NE_PaletteAnimRotate ?
+				    anim->count : anim->num_keyframes;
+			if (anim->step >= steps)
+				anim->step = 0;
+
+			ne_palette_anim_calculate(anim);
+		} else if (anim->interpolate) {
+			ne_palette_anim_calculate(anim);
+		}
+	}
+}
+
+int NE_PaletteAnimVBL(void)
+{
+	if (!ne_palette_system_inited)
+		return 0;
+
+	// The user is modifying a palette, VRAM_E is already mapped to LCD and
+	// it must stay like that.
+	if (palette_adress != NULL)
+		return 0;
+
+	int copied = 0;
+	bool bank_unlocked = false;
+
+	// Palettes shared thanks to dedup get their own copy before animating
+	// them. This is done first because it remaps VRAM_E.
+	for (int i = 0; i < NE_MAX_PALETTE_ANIMATIONS; i++) {
+		NE_PaletteAnim *anim = ne_palette_anims[i];
+
+		if (anim == NULL || !anim->dirty || anim->palette == NULL)
+			continue;
+
+		if (NE_PaletteIsReady(anim->palette))
+			ne_palette_make_private(anim->palette);
+	}
+
+	for (int i = 0; i < NE_MAX_PALETTE_ANIMATIONS; i++) {
+		NE_PaletteAnim *anim = ne_palette_anims[i];
+
+		if (anim == NULL || !anim->dirty || anim->palette == NULL)
+			continue;
+
+		// Wait until the palette is in VRAM
+		if (!NE_PaletteIsReady(anim->palette))
+			continue;
+
+		// It couldn't get its own copy, try again later
+		if (NE_PalInfo[anim->palette->index].uses > 1)
+			continue;
+
+		// The palette may have been replaced by a smaller one
+		ne_palinfo_t *info = &NE_PalInfo[anim->palette->index];
+		if (anim->first + anim->count > info->numcolor) {
+			NE_DebugPrint("Color range outside of the palette");
+			anim->dirty = false;
+			continue;
+		}
+
+		if (!bank_unlocked) {
+			// Allow CPU and DMA writes to VRAM_E
+			vramSetBankE(VRAM_E_LCD);
+			bank_unlocked = true;
+		}
+
+		int size = anim->count << 1;
+
+		DC_FlushRange(anim->buffer, size);
+		dmaCopyHalfWords(3, anim->buffer, info->pointer + anim->first,
+				 size);
+
+		anim->dirty = false;
+		copied += size;
+	}
+
+	if (bank_unlocked)
+		vramSetBankE(VRAM_E_TEX_PALETTE);
+
+	return copied;
+}
@@ -4,6 +4,8 @@
 //
 // This file is part of Nitro Engine
 
+#include <limits.h>
+
 #include "NEMain.h"
 #include "NEAlloc.h"
 
@@ -15,6 +17,27 @@ typedef struct {
 	NE_Palette *palette;
 	int uses;
 	int sizex, sizey;
+	bool transient; // Stored in the transient arena
+	int transient_entry; // Entry of the arena, -1 if the memory was reclaimed
+
+	// Residency information of managed textures. They can be evicted from
+	// VRAM and reloaded from RAM or FAT when they are used again.
+	bool managed;
+	void *source;	// Texture data in RAM, or NULL to use the path
+	char *path;	// Path of the texture in FAT
+	int load_type, load_param; // Arguments of the original load
+	u32 last_use;	// Frame in which the texture was last used
+	bool missed;	// Used while it wasn't in VRAM, reload it after VBL
+
+	bool pending;	// Waiting in the upload queue
+
+	// Palette index data of compressed textures, in slot 1. It must be at
+	// the address that corresponds to the address of the texels.
+	char *index_adress;
+
+	// Deduplication information. The hash is 0 if it hasn't been calculated.
+	u64 hash;
+	int dedup_refs;	// Materials sharing this texture thanks to dedup
 } ne_textureinfo_t;
 
 static ne_textureinfo_t *NE_Texture = NULL;
@@ -26,6 +49,68 @@ static bool ne_texture_system_inited = false;
 
 static int NE_MAX_TEXTURES;
 
+// True if the texture matrix has the translation of a sub-material
+static bool ne_texture_matrix_dirty = false;
+
+// Canvases updated by NE_CanvasVBL()
+static NE_Canvas *ne_canvases[NE_MAX_CANVASES];
+
+// Label saved with the VRAM allocated for new textures
+static const char *ne_texture_owner_label = NULL;
+
+// Placement policy of new textures. See NE_TextureSetPreferredBanks().
+static int ne_texture_preferred_banks = 0;
+static int ne_texture_evacuable_banks = 0;
+static bool ne_texture_bank_span = true;
+
+#define NE_VRAM_BANK_SIZE	(128 * 1024)
+
+// Transient arena. It is a ring buffer inside a locked chunk of texture VRAM.
+// Allocations are reclaimed in the same order they were done, once the texture
+// hasn't been used during the frame that the GPU is drawing. Offsets are
+// relative to the start of the arena.
+typedef struct {
+	int slot;	// NE_NO_TEXTURE if the texture has been deleted
+	size_t size;	// Including bytes wasted at the end of the arena
+	u32 last_use;	// Frame in which the texture was last used
+} ne_transient_entry_t;
+
+static uintptr_t ne_transient_base = 0;
+static size_t ne_transient_size = 0;
+static size_t ne_transient_head; // Offset of the next allocation
+static size_t ne_transient_used; // Bytes used by allocations not reclaimed
+// Ring buffer of allocations, from oldest to newest. It has one entry per
+// texture slot.
+static ne_transient_entry_t *ne_transient_entries = NULL;
+static int ne_transient_first, ne_transient_count;
+
+// Residency manager of managed textures
+static u32 ne_texture_frame = 0;
+static int ne_residency_budget = 0; // Max bytes reloaded per frame, 0 = no limit
+static int ne_residency_frame_bytes = 0; // Bytes reloaded during this frame
+static NE_TextureResidencyStats ne_residency_stats;
+
+// Upload queue. Entries are copied to VRAM in FIFO order.
+typedef struct ne_upload_entry {
+	struct ne_upload_entry *next;
+	bool palette;	// Palette or texture
+	int slot;
+	void *dest;
+	void *data;	// Copy of the data in RAM, owned by the queue
+	size_t size;
+} ne_upload_entry;
+
+static bool ne_upload_queue_enabled = false;
+static int ne_upload_queue_budget = 0; // Max bytes per flush, 0 = no limit
+static ne_upload_entry *ne_upload_queue_head = NULL;
+static ne_upload_entry *ne_upload_queue_tail = NULL;
+
+// Internal functions of the palette system
+void __NE_PaletteUploadDone(int slot);
+
+// If true, textures with the same data share the same VRAM
+static bool ne_texture_dedup = false;
+
 // Default material propierties
 static u32 ne_defaultdiffuse, ne_defaultambient;
 static u32 ne_defaultspecular, ne_defaultemission;
@@ -131,126 +216,103 @@ static const int __NE_TextureDepth[] = {
 	2,  // RGB4
 	4,  // RGB16
 	8,  // RGB256
-	0,  // Compressed
+	2,  // Compressed (texels only, the index data is stored apart)
 	8,  // RGB8_A5
 	16, // RGBA
 	16  // RGB
 };
 
-static int __NE_TextureResizeWidth(void *source, void *dest,
-				   GL_TEXTURE_TYPE_ENUM type, int height,
-				   int width, int newwidth)
+// Reads a 32-bit word of the source texture, which may not be a multiple of 4
+// bytes long. Bytes after the end of the texture are read as 0.
+static inline u32 ne_texture_load_word(const u8 *src, size_t size,
+				       size_t offset)
 {
-	NE_AssertPointer(source, "NULL source pointer");
-	NE_AssertPointer(dest, "NULL dest pointer");
-
-	int x, y;
-
-	int bits = __NE_TextureDepth[type];
-
-	if (bits == 16) {
-		// GL_RGBA or GL_RGB
-		// -----------------
-
-		// Cast to correct width
-		u16 *d = dest;
-		u16 *s = source;
-
-		for (y = 0; y < height; y++) {
-			for (x = 0; x < newwidth; x++) {
-				if (x < width)
-					*d = *s++;
-				d++;
-			}
-		}
-
-		return 1;
-
-	} else if (bits == 8) {
-		// GL_RGB256, GL_RGB32_A3 or GL_RGB8_A5
-		// ------------------------------------
-
-		// Cast to correct width
-		u8 *d = dest;
-		u8 *s = source;
-
-		for (y = 0; y < height; y++) {
-			for (x = 0; x < newwidth; x++) {
-				if (x < width)
-					*d = *s++;
-				d++;
-			}
-		}
-
-		return 1;
+	if (offset + 4 <= size)
+		return *(const u32 *)(src + offset);
 
-	} else if (bits == 4) {
-		// GL_RGB16
-		// --------
+	u32 value = 0;
+	for (size_t i = 0; offset + i < size; i++)
+		value |= src[offset + i] << (i * 8);
+	return value;
+}
 
-		// Cast to correct width
-		u8 *d = dest;
-		u8 *s = source;
-		int src_idx = 0;
-		int dst_idx = 0;
+// Returns "count" bits (1 to 32) of the source texture starting at bit "pos".
+// Texels are packed starting from the least significant bits, so this is just
+// a shift of one or two aligned words.
+static inline u32 ne_texture_read_bits(const u8 *src, size_t size, size_t pos,
+				       unsigned int count)
+{
+	size_t offset = (pos >> 3) & ~(size_t)3;
+	unsigned int shift = pos & 31;
 
-		for (y = 0; y < height; y++) {
-			for (x = 0; x < newwidth; x++) {
-				if (x < width) {
-					if (dst_idx == 0)
-						*d = 0;
+	u64 value = ne_texture_load_word(src, size, offset);
+	if (shift + count > 32)
+		value |= (u64)ne_texture_load_word(src, size, offset + 4) << 32;
 
-					*d |= ((*s >> (src_idx << 2)) & 0xF)
-						<< (dst_idx << 2);
+	value >>= shift;
 
-					if (src_idx == 1)
-						s++;
-					src_idx ^= 1;
-				}
+	if (count == 32)
+		return (u32)value;
+	return (u32)value & ((1U << count) - 1);
+}
 
-				if (dst_idx == 1)
-					d++;
+// Copies a texture of "width" texels per row to a destination with rows of
+// "newwidth" texels, filling the new texels with 0. Rows are copied one by one
+// and the destination is only written with 32-bit accesses (and one 16-bit
+// access at the end if needed), so it can be VRAM. Every word written is OR'ed
+// with "or_mask". The source must be aligned to 4 bytes. Returns the number of
+// bytes written.
+static size_t ne_texture_copy_padded(void *dest, const void *source, int bits,
+				     int width, int newwidth, int height,
+				     u32 or_mask)
+{
+	NE_AssertPointer(source, "NULL source pointer");
+	NE_AssertPointer(dest, "NULL dest pointer");
 
-				dst_idx ^= 1;
+	const u8 *src = source;
+	size_t row_bits = width * bits;
+	size_t dest_row_bits = newwidth * bits;
+	size_t src_size = (row_bits * height + 7) >> 3;
+
+	u32 *d = dest;
+	u32 word = 0;
+	unsigned int filled = 0;
+
+	for (int y = 0; y < height; y++) {
+		size_t src_pos = y * row_bits;
+		size_t col = 0;
+
+		// Rows of 2-bit textures of width 8 are only 16 bits long, so
+		// a word may contain the end of a row and the start of the next.
+		while (col < dest_row_bits) {
+			unsigned int n = 32 - filled;
+			if (n > dest_row_bits - col)
+				n = dest_row_bits - col;
+
+			if (col < row_bits) {
+				unsigned int m = n;
+				if (m > row_bits - col)
+					m = row_bits - col;
+				word |= ne_texture_read_bits(src, src_size,
+							     src_pos + col, m)
+					<< filled;
 			}
-		}
-
-		return 1;
-
-	} else if (bits == 2) {
-		// GL_RGB4
-		// -------
-
-		// Cast to correct width
-		u8 *d = dest;
-		u8 *s = source;
-		int src_idx = 0;
-		int dst_idx = 0;
-
-		for (y = 0; y < height; y++) {
-			for (x = 0; x < newwidth; x++) {
-				if (x < width) {
-					if (dst_idx == 0)
-						*d = 0;
 
-					*d |= ((*s >> (src_idx << 1)) & 0x3)
-						<< (dst_idx << 1);
+			filled += n;
+			col += n;
 
-					if (src_idx == 3)
-						s++;
-					src_idx = (src_idx + 1) & 3;
-				}
-
-				if (dst_idx == 3)
-					d++;
-				dst_idx = (dst_idx + 1) & 3;
+			if (filled == 32) {
+				*d++ = word | or_mask;
+				word = 0;
+				filled = 0;
 			}
 		}
-
-		return 1;
 	}
 
-	return 0;
+	if (filled > 0)
+		*(u16 *)d = word | or_mask;
+
+	return (dest_row_bits * height) >> 3;
 }
 
 static const int __NE_TextureSizeShift[] = {
@@ -259,7 +321,7 @@ static const int __NE_TextureSizeShift[] = {
 	3, // RGB4
 	2, // RGB16
 	1, // RGB256
-	0, // Compressed
+	3, // Compressed (texels only, the index data is stored apart)
 	1, // RGB8_A5
 	0, // RGBA
 	0, // RGB
@@ -267,281 +329,1257 @@ static const int __NE_TextureSizeShift[] = {
 
 //--------------------------------------------------------------
 
-int NE_MaterialTexLoad(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type, int sizeX,
-		       int sizeY, int param, void *texture)
+// Returns the banks that contain part of the given range of texture VRAM
+static int ne_texture_banks_of(uintptr_t address, size_t size)
 {
-	NE_AssertPointer(tex, "NULL material pointer");
+	int first = (address - (uintptr_t)VRAM_A) / NE_VRAM_BANK_SIZE;
+	int last = (address + size - 1 - (uintptr_t)VRAM_A) / NE_VRAM_BANK_SIZE;
 
-	// Check if texture exists
-	if (tex->texindex != NE_NO_TEXTURE) {
-		NE_MaterialDelete(tex);
-		tex = NE_MaterialCreate();
+	return ((2 << last) - 1) & ~((1 << first) - 1);
+}
+
+static void *ne_texture_alloc_in_banks(size_t size, int banks)
+{
+	for (int i = 0; i < 4; i++) {
+		if ((banks & (1 << i)) == 0)
+			continue;
+
+		uintptr_t start = (uintptr_t)VRAM_A + i * NE_VRAM_BANK_SIZE;
+		void *addr = NE_AllocRange(NE_TexAllocList, size, 8,
+					   (void *)start,
+					   (void *)(start + NE_VRAM_BANK_SIZE));
+		if (addr != NULL)
+			return addr;
 	}
 
-	// Get free slot
-	tex->texindex = NE_NO_TEXTURE;
-	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
-		if (NE_Texture[i].adress == NULL) {
-			tex->texindex = i;
-			break;
+	return NULL;
+}
+
+// Allocates texture VRAM following the placement policy. Textures are placed
+// in the lowest bank where they fit. Preferred banks are tried first, then the
+// ones that aren't evacuable, then the evacuable ones. Only if the texture
+// doesn't fit inside any bank, it is allowed to span several of them.
+static void *ne_texture_alloc(size_t size)
+{
+	int preferred = ne_texture_preferred_banks & NE_VRAM_ABCD;
+	int evacuable = ne_texture_evacuable_banks & ~preferred & NE_VRAM_ABCD;
+	int others = NE_VRAM_ABCD & ~preferred & ~evacuable;
+
+	void *addr = ne_texture_alloc_in_banks(size, preferred);
+	if (addr == NULL)
+		addr = ne_texture_alloc_in_banks(size, others);
+	if (addr == NULL)
+		addr = ne_texture_alloc_in_banks(size, evacuable);
+
+	if (addr != NULL || !ne_texture_bank_span)
+		return addr;
+
+	// Try to span groups of consecutive banks that aren't evacuable before
+	// using the whole VRAM.
+	int i = 0;
+	while (i < 4) {
+		if (evacuable & (1 << i)) {
+			i++;
+			continue;
 		}
-	}
 
-	if (tex->texindex == NE_NO_TEXTURE) {
-		NE_DebugPrint("No free slots");
-		tex->texindex = 0;
-		return 0;
-	}
+		int j = i;
+		while (j < 4 && !(evacuable & (1 << j)))
+			j++;
+
+		if (j - i > 1) {
+			uintptr_t start = (uintptr_t)VRAM_A + i * NE_VRAM_BANK_SIZE;
+			uintptr_t end = (uintptr_t)VRAM_A + j * NE_VRAM_BANK_SIZE;
+			addr = NE_AllocRange(NE_TexAllocList, size, 8,
+					     (void *)start, (void *)end);
+			if (addr != NULL)
+				return addr;
+		}
 
-	int slot = tex->texindex;
+		i = j;
+	}
 
-	// Save real size
-	NE_Texture[slot].sizex = sizeX;
-	NE_Texture[slot].sizey = sizeY;
+	return NE_AllocRange(NE_TexAllocList, size, 8, VRAM_A, VRAM_E);
+}
 
-	u32 size = 0;
+// Returns true if a texture can be moved from "old_address" to "new_address"
+// without breaking the placement policy.
+static bool ne_texture_move_allowed(uintptr_t old_address,
+				    uintptr_t new_address, size_t size)
+{
+	int old_banks = ne_texture_banks_of(old_address, size);
+	int new_banks = ne_texture_banks_of(new_address, size);
 
-	// If width is not a power of 2
-	bool invalidwidth = false;
-	if (__NE_GetValidSize(sizeX) != sizeX) {
-		invalidwidth = true;
-		// Width MUST be power of 2. This one has an invalid size...
-		// Let's expand the texture, load it to VRAM, and delete the
-		// temporary buffer...
+	// Don't fill evacuable banks with textures from other banks
+	if (new_banks & ne_texture_evacuable_banks & ~old_banks)
+		return false;
 
-		size = (__NE_GetValidSize(sizeX) * sizeY << 1) >>
-				__NE_TextureSizeShift[type];
+	// Don't make a texture span two banks if it didn't before
+	if (!ne_texture_bank_span && (new_banks & (new_banks - 1))
+	    && !(old_banks & (old_banks - 1)))
+		return false;
 
-		void *newbuffer = malloc(size);
-		NE_AssertPointer(newbuffer,
-				 "Not enough memory for temporary buffer");
+	return true;
+}
 
-		if (__NE_TextureResizeWidth(texture, newbuffer, type, sizeY,
-					sizeX, __NE_GetValidSize(sizeX)) == 0) {
-			free(newbuffer);
-			return 0;
-		}
-		// New width
-		sizeX = __NE_GetValidSize(sizeX);
+// Creates an entry of the upload queue with a buffer of "size" bytes for the
+// data, even if the queue is disabled. Returns NULL if there isn't enough
+// memory.
+static ne_upload_entry *ne_upload_entry_alloc(bool palette, int slot,
+					      void *dest, size_t size)
+{
+	ne_upload_entry *entry = malloc(sizeof(ne_upload_entry));
+	if (entry == NULL)
+		return NULL;
 
-		// Use new data
-		texture = newbuffer;
+	entry->data = malloc(size);
+	if (entry->data == NULL) {
+		free(entry);
+		return NULL;
 	}
-	//--------------------------------------------------------------
 
-	// Height doesn't need to be power of 2...
-	if (!invalidwidth)
-		size = (sizeX * sizeY << 1) >> __NE_TextureSizeShift[type];
-	// ... but we will have to cheat later and make the DS believe it is a
-	// power of 2.
+	entry->next = NULL;
+	entry->palette = palette;
+	entry->slot = slot;
+	entry->dest = dest;
+	entry->size = size;
 
-	u32 *addr = (u32 *) NE_Alloc(NE_TexAllocList, size, 8);
+	return entry;
+}
 
-	if (!addr) {
-		NE_DebugPrint("Not enough memory");
-		if (invalidwidth)
-			free(texture);	// Free temp data
-		return 0;
-	}
+// Like ne_upload_entry_alloc(), but it returns NULL if the queue is disabled
+static ne_upload_entry *ne_upload_queue_new(bool palette, int slot, void *dest,
+					    size_t size)
+{
+	if (!ne_upload_queue_enabled)
+		return NULL;
 
-	NE_Texture[slot].adress = (void *)addr;
-	// Initially only this material is using this texture
-	NE_Texture[slot].uses = 1;
+	return ne_upload_entry_alloc(palette, slot, dest, size);
+}
 
-	// unlock texture memory
-	u32 vramTemp = vramSetPrimaryBanks(VRAM_A_LCD, VRAM_B_LCD, VRAM_C_LCD,
-					   VRAM_D_LCD);
+// Adds an entry created by ne_upload_queue_new() to the end of the queue, once
+// its buffer has been filled.
+static void ne_upload_queue_push(ne_upload_entry *entry)
+{
+	// The copy is done with DMA, which doesn't see the data cache
+	DC_FlushRange(entry->data, entry->size);
 
-	// We do GL_RGB as GL_RGBA, but we set each alpha bit to 1 during the
-	// copy to VRAM.
-	if (type == GL_RGB) {
-		u16 *src = (u16 *) texture;
-		u16 *dest = (u16 *) addr;
-		NE_MaterialTexParam(tex, sizeX, __NE_GetValidSize(sizeY), addr,
-				    GL_RGBA, param);
+	if (ne_upload_queue_tail != NULL)
+		ne_upload_queue_tail->next = entry;
+	else
+		ne_upload_queue_head = entry;
+	ne_upload_queue_tail = entry;
+}
 
-		while (size--) {
-			*dest++ = *src | (1 << 15);
-			src++;
-		}
-	} else {
-		// For everything else, we do a straight copy
-		NE_MaterialTexParam(tex, sizeX, __NE_GetValidSize(sizeY), addr,
-				    type, param);
+// Adds a copy to the upload queue. The data is copied to a buffer in RAM, so it
+// doesn't need to remain valid. If "set_alpha" is true, the data is treated as
+// an array of 16-bit colors and the alpha bit of all of them is set. Returns 1
+// if the copy has been queued, 0 if the queue is disabled or there isn't
+// enough memory (the caller has to copy it right away in that case).
+int __NE_UploadQueueAdd(bool palette, int slot, void *dest, const void *data,
+			size_t size, bool set_alpha)
+{
+	ne_upload_entry *entry = ne_upload_queue_new(palette, slot, dest, size);
+	if (entry == NULL)
+		return 0;
 
-		swiCopy((u32 *) texture, addr, (size >> 2) | COPY_MODE_WORD);
+	if (set_alpha) {
+		const u16 *src = data;
+		u16 *dst = entry->data;
+		for (size_t i = 0; i < (size >> 1); i++)
+			dst[i] = src[i] | (1 << 15);
+	} else {
+		memcpy(entry->data, data, size);
 	}
 
-	vramRestorePrimaryBanks(vramTemp);
-	if (invalidwidth)
-		free(texture);	// Free temp data
+	ne_upload_queue_push(entry);
 
 	return 1;
 }
 
-void NE_MaterialTexClone(NE_Material *source, NE_Material *dest)
+// Removes all queued copies with a destination between "start" and "end"
+void __NE_UploadQueueCancel(void *start, void *end)
 {
-	NE_AssertPointer(source, "NULL source pointer");
-	NE_AssertPointer(dest, "NULL dest pointer");
-	NE_Assert(source->texindex != NE_NO_TEXTURE,
-		  "No texture asigned to source material");
-	// Increase count of materials using this texture
-	NE_Texture[source->texindex].uses++;
-	dest->texindex = source->texindex;
-}
+	ne_upload_entry **link = &ne_upload_queue_head;
+	ne_upload_entry *previous = NULL;
+
+	while (*link != NULL) {
+		ne_upload_entry *entry = *link;
+
+		if ((uintptr_t)entry->dest >= (uintptr_t)start
+		    && (uintptr_t)entry->dest < (uintptr_t)end) {
+			*link = entry->next;
+			free(entry->data);
+			free(entry);
+		} else {
+			previous = entry;
+			link = &entry->next;
+		}
+	}
 
-void NE_MaterialTexSetPal(NE_Material *tex, NE_Palette *pal)
-{
-	NE_AssertPointer(tex, "NULL material pointer");
-	NE_AssertPointer(pal, "NULL palette pointer");
-	NE_Assert(tex->texindex != NE_NO_TEXTURE,
-		  "No texture asigned to material");
-	NE_Texture[tex->texindex].palette = pal;
+	ne_upload_queue_tail = previous;
 }
 
-void NE_MaterialUse(NE_Material *tex)
+// Returns true if the data copied to "dest" is the same as "data". If the copy
+// is still in the upload queue, the queued data is compared. If not, VRAM is
+// read back, so the bank has to be mapped to the CPU for a moment. That is only
+// done if the queue is disabled, as loads are then expected to happen during
+// VBL anyway. With the queue enabled, data that can't be compared isn't equal.
+bool __NE_UploadDataEquals(bool palette, const void *dest, const void *data,
+			   size_t size)
 {
-	if (tex == NULL) {
-		GFX_TEX_FORMAT = 0;
-		GFX_COLOR = NE_White;
-		GFX_DIFFUSE_AMBIENT = ne_defaultdiffuse
-				    | (ne_defaultambient << 16)
-				    | (ne_defaultvtxcolor << 15);
-		GFX_SPECULAR_EMISSION = ne_defaultspecular
-				      | (ne_defaultemission << 16)
-				      | (ne_defaultuseshininess << 15);
-		return;
+	// The last queued copy to that address is the one that counts
+	ne_upload_entry *found = NULL;
+	for (ne_upload_entry *e = ne_upload_queue_head; e != NULL; e = e->next) {
+		if (e->palette == palette && e->dest == dest)
+			found = e;
 	}
 
-	GFX_DIFFUSE_AMBIENT = tex->diffuse | (tex->ambient << 16)
-			    | (tex->vtxcolor << 15);
-	GFX_SPECULAR_EMISSION = tex->specular | (tex->emission << 16)
-			      | (tex->useshininess << 15);
+	if (found != NULL)
+		return found->size == size && memcmp(found->data, data, size) == 0;
 
-	NE_Assert(tex->texindex != NE_NO_TEXTURE,
-		  "No texture asigned to material");
+	if (ne_upload_queue_enabled)
+		return false;
 
-	if (NE_Texture[tex->texindex].palette)
-		NE_PaletteUse(NE_Texture[tex->texindex].palette);
+	bool equal;
 
-	GFX_COLOR = (u32) tex->color;
-	GFX_TEX_FORMAT = NE_Texture[tex->texindex].param;
-	//GFX_TEX_COORD = GL_TEXTURE_WRAP_S | GL_TEXTURE_FLIP_S | GL_TEXTURE_WRAP_T | GL_TEXTURE_FLIP_T;
- 	//glTexParameter(0, GL_TEXTURE_WRAP_S);
+	if (palette) {
+		vramSetBankE(VRAM_E_LCD);
+		equal = memcmp(dest, data, size) == 0;
+		vramSetBankE(VRAM_E_TEX_PALETTE);
+	} else {
+		u32 vramTemp = vramSetPrimaryBanks(VRAM_A_LCD, VRAM_B_LCD,
+						   VRAM_C_LCD, VRAM_D_LCD);
+		equal = memcmp(dest, data, size) == 0;
+		vramRestorePrimaryBanks(vramTemp);
+	}
+
+	return equal;
 }
 
-extern bool NE_Dual;
+void NE_TextureUploadQueueSetBudget(int max_bytes)
+{
+	ne_upload_queue_budget = max_bytes;
+}
 
-void NE_TextureSystemReset(int texture_number, int palette_number,
-			   NE_VRAMBankFlags bank_flags)
+int NE_TextureUploadQueueFlush(int max_bytes)
 {
-	if (ne_texture_system_inited)
-		NE_TextureSystemEnd();
+	int copied = 0;
+	bool texture_banks_unlocked = false;
+	bool palette_bank_unlocked = false;
+	u32 vramTemp = 0;
 
-	if (texture_number < 1)
-		NE_MAX_TEXTURES = NE_DEFAULT_TEXTURES;
-	else
-		NE_MAX_TEXTURES = texture_number;
+	while (ne_upload_queue_head != NULL) {
+		ne_upload_entry *entry = ne_upload_queue_head;
 
-	NE_AllocInit(&NE_TexAllocList, (void *)VRAM_A, (void *)VRAM_E);
+		// Always copy at least one entry so that the queue progresses
+		if (copied > 0 && copied + (int)entry->size > max_bytes)
+			break;
 
-	NE_Assert((bank_flags & 0xF) != 0, "No VRAM banks selected");
+		if (!entry->palette) {
+			if (!texture_banks_unlocked) {
+				vramTemp = vramSetPrimaryBanks(VRAM_A_LCD,
+							       VRAM_B_LCD,
+							       VRAM_C_LCD,
+							       VRAM_D_LCD);
+				texture_banks_unlocked = true;
+			}
+		} else {
+			if (!palette_bank_unlocked) {
+				vramSetBankE(VRAM_E_LCD);
+				palette_bank_unlocked = true;
+			}
+		}
 
-	// Prevent user from not selecting any bank
-	if ((bank_flags & 0xF) == 0)
-		bank_flags = NE_VRAM_ABCD;
+		dmaCopyWords(3, entry->data, entry->dest, entry->size);
 
-	// VRAM_C and VRAM_D can't be used in dual 3D mode
-	if (NE_Dual)
-		bank_flags &= ~NE_VRAM_CD;
+		// Entries without slot are only part of a texture, like the
+		// index data of compressed textures.
+		if (entry->palette)
+			__NE_PaletteUploadDone(entry->slot);
+		else if (entry->slot != NE_NO_TEXTURE)
+			NE_Texture[entry->slot].pending = false;
 
-	// Now, configure allocation system. The buffer size always sees the
-	// four banks of VRAM. It is needed to allocate one chunk for each and
-	// lock the ones that aren't allowed to be used by Nitro Engine.
+		copied += entry->size;
 
-	NE_Alloc(NE_TexAllocList, 128 * 1024, 0);	// VRAM_A
-	NE_Alloc(NE_TexAllocList, 128 * 1024, 0);	// VRAM_B
-	NE_Alloc(NE_TexAllocList, 128 * 1024, 0);	// VRAM_C
-	NE_Alloc(NE_TexAllocList, 128 * 1024, 0);	// VRAM_D
+		ne_upload_queue_head = entry->next;
+		if (ne_upload_queue_head == NULL)
+			ne_upload_queue_tail = NULL;
 
-	if (bank_flags & NE_VRAM_A) {
-		vramSetBankA(VRAM_A_TEXTURE_SLOT0);
-		NE_Free(NE_TexAllocList, VRAM_A);
-	} else {
-		NE_Lock(NE_TexAllocList, VRAM_A);
+		free(entry->data);
+		free(entry);
 	}
 
-	if (bank_flags & NE_VRAM_B) {
-		vramSetBankB(VRAM_B_TEXTURE_SLOT1);
-		NE_Free(NE_TexAllocList, VRAM_B);
-	} else {
-		NE_Lock(NE_TexAllocList, VRAM_B);
-	}
+	if (texture_banks_unlocked)
+		vramRestorePrimaryBanks(vramTemp);
+	if (palette_bank_unlocked)
+		vramSetBankE(VRAM_E_TEX_PALETTE);
 
-	if (bank_flags & NE_VRAM_C) {
-		vramSetBankC(VRAM_C_TEXTURE_SLOT2);
-		NE_Free(NE_TexAllocList, VRAM_C);
-	} else {
-		NE_Lock(NE_TexAllocList, VRAM_C);
-	}
+	return copied;
+}
 
-	if (bank_flags & NE_VRAM_D) {
-		vramSetBankD(VRAM_D_TEXTURE_SLOT3);
-		NE_Free(NE_TexAllocList, VRAM_D);
-	} else {
-		NE_Lock(NE_TexAllocList, VRAM_D);
-	}
+void NE_TextureUploadQueueEnable(bool enable)
+{
+	// Don't leave anything behind
+	if (!enable)
+		NE_TextureUploadQueueFlush(INT_MAX);
 
-	NE_Texture = calloc(NE_MAX_TEXTURES, sizeof(ne_textureinfo_t));
-	NE_AssertPointer(NE_Texture, "Not enough memory");
-	NE_UserMaterials = calloc(NE_MAX_TEXTURES, sizeof(NE_UserMaterials));
-	NE_AssertPointer(NE_UserMaterials, "Not enough memory");
+	ne_upload_queue_enabled = enable;
+}
 
-	NE_PaletteSystemReset(palette_number);
+void NE_TextureUploadQueueVBL(void)
+{
+	if (ne_upload_queue_head == NULL)
+		return;
 
-	GFX_TEX_FORMAT = 0;
+	int budget = ne_upload_queue_budget;
+	if (budget <= 0)
+		budget = INT_MAX;
 
-	ne_texture_system_inited = true;
+	NE_TextureUploadQueueFlush(budget);
 }
 
-void NE_MaterialDelete(NE_Material *tex)
+int NE_TextureUploadQueuePending(void)
+{
+	int bytes = 0;
+
+	for (ne_upload_entry *e = ne_upload_queue_head; e != NULL; e = e->next)
+		bytes += e->size;
+
+	return bytes;
+}
+
+bool NE_MaterialTexIsReady(NE_Material *tex)
 {
 	NE_AssertPointer(tex, "NULL pointer");
 
-	// If there is an asigned texture
-	if (tex->texindex != NE_NO_TEXTURE) {
-		int slot = tex->texindex;
-		// A texture may be used by several materials
-		NE_Texture[slot].uses--;
-		// If this is the only material to use it, delete it
-		if (NE_Texture[slot].uses == 0) {
-			NE_Free(NE_TexAllocList, NE_Texture[slot].adress);
-			NE_Texture[slot].adress = NULL;
-			NE_Texture[slot].param = 0;
-			NE_Texture[slot].palette = 0;
-		}
-	}
+	if (tex->texindex == NE_NO_TEXTURE)
+		return false;
 
-	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
-		if (NE_UserMaterials[i] == tex) {
-			NE_UserMaterials[i] = NULL;
-			free(tex);
-			return;
-		}
-	}
+	ne_textureinfo_t *info = &NE_Texture[tex->texindex];
 
-	NE_DebugPrint("Object not found");
+	return info->adress != NULL && !info->pending;
 }
 
-int NE_TextureFreeMem(void)
+// FNV-1a hash. It never returns 0, which means "no hash".
+u64 __NE_HashData(const void *data, size_t size)
 {
-	if (!ne_texture_system_inited)
-		return 0;
+	const u8 *bytes = data;
+	u64 hash = 0xCBF29CE484222325ULL;
 
-	NEMemInfo Info;
-	NE_MemGetInformation(NE_TexAllocList, &Info);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ULL;
+	}
 
-	return Info.Free;
+	return hash == 0 ? 1 : hash;
+}
+
+// Returns a loaded texture created from the same data and arguments. Textures
+// with the same hash are compared with the data as it is stored in VRAM
+// (padded, and with the alpha bit set for GL_RGB), so a hash collision or a
+// texture that has been modified after loading it is never shared.
+static int ne_texture_find_duplicate(u64 hash, GL_TEXTURE_TYPE_ENUM type,
+				     int sizeX, int sizeY, int param,
+				     const void *texture)
+{
+	u8 *expected = NULL;
+	size_t size = 0;
+	int found = NE_NO_TEXTURE;
+
+	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
+		ne_textureinfo_t *info = &NE_Texture[i];
+
+		if (info->hash != hash || info->uses == 0)
+			continue;
+
+		if (info->managed || info->transient || info->adress == NULL)
+			continue;
+
+		if (info->load_type != type || info->load_param != param
+		    || info->sizex != sizeX || info->sizey != sizeY)
+			continue;
+
+		if (expected == NULL) {
+			int width = __NE_GetValidSize(sizeX);
+			size = (width * sizeY << 1) >> __NE_TextureSizeShift[type];
+			expected = malloc(size);
+			if (expected == NULL)
+				return NE_NO_TEXTURE;
+
+			ne_texture_copy_padded(expected, texture,
+					       __NE_TextureDepth[type], sizeX,
+					       width, sizeY,
+					       type == GL_RGB ? 0x80008000 : 0);
+		}
+
+		if (__NE_UploadDataEquals(false, info->adress, expected, size)) {
+			found = i;
+			break;
+		}
+	}
+
+	free(expected);
+
+	return found;
+}
+
+// Returns a texture slot that isn't used
+static int ne_texture_free_slot(void)
+{
+	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
+		// Transient textures lose their VRAM but keep their slot
+		if (NE_Texture[i].adress == NULL && !NE_Texture[i].managed
+		    && NE_Texture[i].uses == 0)
+			return i;
+	}
+
+	return NE_NO_TEXTURE;
+}
+
+// Removes the texture from a material, and deletes it if no other material is
+// using it.
+static void ne_material_tex_release(NE_Material *tex)
+{
+	// If there is an asigned texture
+	if (tex->texindex != NE_NO_TEXTURE) {
+		int slot = tex->texindex;
+		// A texture may be used by several materials
+		NE_Texture[slot].uses--;
+		// Only count materials that got the texture from deduplication
+		if (tex->dedup)
+			NE_Texture[slot].dedup_refs--;
+		// If this is the only material to use it, delete it. The memory
+		// of transient textures is reclaimed by NE_TextureTransientFence().
+		if (NE_Texture[slot].uses == 0) {
+			char *index_addr = NE_Texture[slot].index_adress;
+			if (NE_Texture[slot].pending) {
+				void *addr = NE_Texture[slot].adress;
+				__NE_UploadQueueCancel(addr, (char *)addr + 1);
+				if (index_addr != NULL)
+					__NE_UploadQueueCancel(index_addr,
+							       index_addr + 1);
+				NE_Texture[slot].pending = false;
+			}
+			if (NE_Texture[slot].adress != NULL
+			    && !NE_Texture[slot].transient)
+				NE_Free(NE_TexAllocList, NE_Texture[slot].adress);
+			// The entry is kept until the GPU stops using it
+			if (NE_Texture[slot].transient
+			    && NE_Texture[slot].adress != NULL) {
+				int entry = NE_Texture[slot].transient_entry;
+				ne_transient_entries[entry].slot = NE_NO_TEXTURE;
+			}
+			if (index_addr != NULL)
+				NE_Free(NE_TexAllocList, index_addr);
+			free(NE_Texture[slot].path);
+			NE_Texture[slot].adress = NULL;
+			NE_Texture[slot].index_adress = NULL;
+			NE_Texture[slot].param = 0;
+			NE_Texture[slot].palette = 0;
+			NE_Texture[slot].transient = false;
+			NE_Texture[slot].managed = false;
+			NE_Texture[slot].missed = false;
+			NE_Texture[slot].source = NULL;
+			NE_Texture[slot].path = NULL;
+			NE_Texture[slot].hash = 0;
+		}
+	}
+
+	tex->texindex = NE_NO_TEXTURE;
+	tex->dedup = false;
+}
+
+// Removes the least recently used managed texture from VRAM. Textures used
+// during this frame or the previous one may still be needed by the GPU, so
+// they aren't evicted. Returns 1 if a texture has been evicted, 0 if not.
+static int ne_texture_evict_lru(void)
+{
+	int lru = NE_NO_TEXTURE;
+
+	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
+		ne_textureinfo_t *info = &NE_Texture[i];
+
+		if (!info->managed || info->adress == NULL || info->pending)
+			continue;
+
+		if (info->last_use + 1 >= ne_texture_frame)
+			continue;
+
+		if (lru == NE_NO_TEXTURE || info->last_use < NE_Texture[lru].last_use)
+			lru = i;
+	}
+
+	if (lru == NE_NO_TEXTURE)
+		return 0;
+
+	NE_Free(NE_TexAllocList, NE_Texture[lru].adress);
+	NE_Texture[lru].adress = NULL;
+	NE_Texture[lru].param = 0;
+
+	ne_residency_stats.evictions++;
+
+	return 1;
+}
+
+// Allocates VRAM for a texture, evicting managed textures if needed
+static void *ne_texture_alloc_evicting(size_t size)
+{
+	while (1) {
+		void *addr = ne_texture_alloc(size);
+		if (addr != NULL)
+			return addr;
+
+		if (ne_texture_evict_lru() == 0)
+			return NULL;
+	}
+}
+
+// Copies a texture to VRAM and sets up the slot used by the material
+static int ne_texture_upload(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
+			     int sizeX, int sizeY, int param, void *texture)
+{
+	int slot = tex->texindex;
+
+	// Save real size
+	NE_Texture[slot].sizex = sizeX;
+	NE_Texture[slot].sizey = sizeY;
+
+	// Width MUST be a power of 2. If it isn't, the texture is expanded
+	// while it is copied, one row at a time, without temporary buffers.
+	int width = sizeX;
+	sizeX = __NE_GetValidSize(sizeX);
+	bool invalidwidth = width != sizeX;
+
+	// We do GL_RGB as GL_RGBA, but we set each alpha bit to 1 during the
+	// copy to VRAM.
+	u32 or_mask = type == GL_RGB ? 0x80008000 : 0;
+
+	// Height doesn't need to be power of 2, but we will have to cheat later
+	// and make the DS believe it is a power of 2.
+	u32 size = (sizeX * sizeY << 1) >> __NE_TextureSizeShift[type];
+
+	u32 *addr = (u32 *) ne_texture_alloc_evicting(size);
+
+	if (!addr) {
+		NE_DebugPrint("Not enough memory");
+		return 0;
+	}
+
+	NE_AllocSetOwner(NE_TexAllocList, addr, slot, ne_texture_owner_label);
+
+	NE_Texture[slot].adress = (void *)addr;
+
+	// If the upload queue is enabled, the texture is copied later. The
+	// queue keeps a copy of the data, which is expanded right there.
+	bool queued;
+	if (invalidwidth) {
+		ne_upload_entry *entry = ne_upload_queue_new(false, slot, addr,
+							     size);
+		queued = entry != NULL;
+		if (queued) {
+			ne_texture_copy_padded(entry->data, texture,
+					       __NE_TextureDepth[type], width,
+					       sizeX, sizeY, or_mask);
+			ne_upload_queue_push(entry);
+		}
+	} else {
+		queued = __NE_UploadQueueAdd(false, slot, addr, texture, size,
+					     type == GL_RGB);
+	}
+
+	if (queued) {
+		NE_MaterialTexParam(tex, sizeX, __NE_GetValidSize(sizeY), addr,
+				    type == GL_RGB ? GL_RGBA : type, param);
+		NE_Texture[slot].pending = true;
+		return 1;
+	}
+
+	// unlock texture memory
+	u32 vramTemp = vramSetPrimaryBanks(VRAM_A_LCD, VRAM_B_LCD, VRAM_C_LCD,
+					   VRAM_D_LCD);
+
+	if (invalidwidth) {
+		NE_MaterialTexParam(tex, sizeX, __NE_GetValidSize(sizeY), addr,
+				    type == GL_RGB ? GL_RGBA : type, param);
+
+		ne_texture_copy_padded(addr, texture, __NE_TextureDepth[type],
+				       width, sizeX, sizeY, or_mask);
+	} else if (type == GL_RGB) {
+		u16 *src = (u16 *) texture;
+		u16 *dest = (u16 *) addr;
+		NE_MaterialTexParam(tex, sizeX, __NE_GetValidSize(sizeY), addr,
+				    GL_RGBA, param);
+
+		for (u32 i = 0; i < (size >> 1); i++)
+			dest[i] = src[i] | (1 << 15);
+	} else {
+		// For everything else, we do a straight copy
+		NE_MaterialTexParam(tex, sizeX, __NE_GetValidSize(sizeY), addr,
+				    type, param);
+
+		swiCopy((u32 *) texture, addr, (size >> 2) | COPY_MODE_WORD);
+	}
+
+	vramRestorePrimaryBanks(vramTemp);
+
+	return 1;
+}
+
+int NE_MaterialTexLoad(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type, int sizeX,
+		       int sizeY, int param, void *texture)
+{
+	NE_AssertPointer(tex, "NULL material pointer");
+
+	if (type == GL_COMPRESSED) {
+		NE_DebugPrint("Use NE_MaterialTexLoadCompressed()");
+		return 0;
+	}
+
+	// Remove the previous texture, but keep the material
+	ne_material_tex_release(tex);
+
+	// If the same texture is already loaded, share it
+	u64 hash = 0;
+	int data_size = (sizeX * sizeY * __NE_TextureDepth[type]) >> 3;
+	if (ne_texture_dedup && data_size > 0) {
+		hash = __NE_HashData(texture, data_size);
+
+		int shared = ne_texture_find_duplicate(hash, type, sizeX, sizeY,
+						       param, texture);
+		if (shared != NE_NO_TEXTURE) {
+			tex->texindex = shared;
+			NE_Texture[shared].uses++;
+			NE_Texture[shared].dedup_refs++;
+			tex->dedup = true;
+			return 1;
+		}
+	}
+
+	// Get free slot
+	int slot = ne_texture_free_slot();
+	if (slot == NE_NO_TEXTURE) {
+		NE_DebugPrint("No free slots");
+		return 0;
+	}
+
+	tex->texindex = slot;
+
+	if (ne_texture_upload(tex, type, sizeX, sizeY, param, texture) == 0) {
+		tex->texindex = NE_NO_TEXTURE;
+		return 0;
+	}
+
+	// Initially only this material is using this texture
+	NE_Texture[slot].uses = 1;
+	NE_Texture[slot].load_type = type;
+	NE_Texture[slot].load_param = param;
+	NE_Texture[slot].hash = hash;
+	NE_Texture[slot].dedup_refs = 0;
+
+	return 1;
+}
+
+// Allocates VRAM for a compressed texture of "size" bytes of texels. The texels
+// must be in slot 0 or 2, and the index data (half the size of the texels) has
+// to be in slot 1, at the offset of the texels divided by 2. The first half of
+// slot 1 is used by slot 0, the second half by slot 2. Returns 1 on success, 0
+// if there isn't enough free space.
+static int ne_texture_alloc_compressed(size_t size, void **texels,
+				       void **indices)
+{
+	for (int bank = 0; bank < 4; bank += 2) {
+		uintptr_t base = (uintptr_t)VRAM_A + bank * NE_VRAM_BANK_SIZE;
+		uintptr_t end = base + NE_VRAM_BANK_SIZE;
+		uintptr_t index_base = (uintptr_t)VRAM_B
+				     + (bank / 2) * (NE_VRAM_BANK_SIZE / 2);
+		uintptr_t index_end = index_base + NE_VRAM_BANK_SIZE / 2;
+		uintptr_t offset = 0;
+
+		while (base + offset + size <= end) {
+			char *t = NE_AllocRange(NE_TexAllocList, size, 8,
+						(void *)(base + offset),
+						(void *)end);
+			if (t == NULL)
+				break;
+
+			offset = (uintptr_t)t - base;
+
+			uintptr_t index_addr = index_base + offset / 2;
+			char *i = NE_AllocRange(NE_TexAllocList, size / 2, 4,
+						(void *)index_addr,
+						(void *)index_end);
+			if (i == NULL) {
+				NE_Free(NE_TexAllocList, t);
+				break;
+			}
+
+			if ((uintptr_t)i == index_addr) {
+				*texels = t;
+				*indices = i;
+				return 1;
+			}
+
+			// The index data doesn't fit in the right place. The
+			// next try is the first offset where it would fit.
+			NE_Free(NE_TexAllocList, t);
+			NE_Free(NE_TexAllocList, i);
+			offset = ((uintptr_t)i - index_base) * 2;
+		}
+	}
+
+	return 0;
+}
+
+int NE_MaterialTexLoadCompressed(NE_Material *tex, int sizeX, int sizeY,
+				 int param, void *texels, void *indices)
+{
+	NE_AssertPointer(tex, "NULL material pointer");
+	NE_AssertPointer(texels, "NULL texels pointer");
+	NE_AssertPointer(indices, "NULL index data pointer");
+
+	if (__NE_GetValidSize(sizeX) != sizeX) {
+		NE_DebugPrint("Width must be a power of 2");
+		return 0;
+	}
+
+	if (sizeY <= 0 || (sizeY & 3) != 0) {
+		NE_DebugPrint("Height must be a multiple of 4");
+		return 0;
+	}
+
+	// Remove the previous texture, but keep the material
+	ne_material_tex_release(tex);
+
+	int slot = ne_texture_free_slot();
+	if (slot == NE_NO_TEXTURE) {
+		NE_DebugPrint("No free slots");
+		return 0;
+	}
+
+	// 2 bits per texel, and 16 bits of index data per block of 4x4 texels
+	size_t size = (sizeX * sizeY) >> 2;
+	void *addr, *index_addr;
+
+	while (ne_texture_alloc_compressed(size, &addr, &index_addr) == 0) {
+		if (ne_texture_evict_lru() == 0) {
+			NE_DebugPrint("Not enough memory");
+			return 0;
+		}
+	}
+
+	NE_AllocSetOwner(NE_TexAllocList, addr, slot, ne_texture_owner_label);
+	NE_AllocSetOwner(NE_TexAllocList, index_addr, slot,
+			 ne_texture_owner_label);
+
+	ne_textureinfo_t *info = &NE_Texture[slot];
+
+	tex->texindex = slot;
+	info->adress = addr;
+	info->index_adress = index_addr;
+	info->sizex = sizeX;
+	info->sizey = sizeY;
+	info->uses = 1;
+	info->load_type = GL_COMPRESSED;
+	info->load_param = param;
+	info->hash = 0;
+	info->dedup_refs = 0;
+
+	NE_MaterialTexParam(tex, sizeX, __NE_GetValidSize(sizeY), addr,
+			    GL_COMPRESSED, param);
+
+	// The texels are queued after the index data, so the texture is ready
+	// when the entry of the texels is copied.
+	if (__NE_UploadQueueAdd(false, NE_NO_TEXTURE, index_addr, indices,
+				size / 2, false)) {
+		if (__NE_UploadQueueAdd(false, slot, addr, texels, size,
+					false)) {
+			info->pending = true;
+			return 1;
+		}
+
+		__NE_UploadQueueCancel(index_addr, (char *)index_addr + 1);
+	}
+
+	u32 vramTemp = vramSetPrimaryBanks(VRAM_A_LCD, VRAM_B_LCD, VRAM_C_LCD,
+					   VRAM_D_LCD);
+
+	swiCopy(texels, addr, (size >> 2) | COPY_MODE_WORD);
+	swiCopy(indices, index_addr, (size >> 3) | COPY_MODE_WORD);
+
+	vramRestorePrimaryBanks(vramTemp);
+
+	return 1;
+}
+
+int NE_MaterialTexLoadCompressedFAT(NE_Material *tex, int sizeX, int sizeY,
+				    int param, char *texels_path,
+				    char *indices_path)
+{
+	NE_AssertPointer(tex, "NULL material pointer");
+	NE_AssertPointer(texels_path, "NULL path pointer");
+	NE_AssertPointer(indices_path, "NULL path pointer");
+
+	char *texels = NE_FATLoadData(texels_path);
+	NE_AssertPointer(texels, "Couldn't load file from FAT");
+
+	char *indices = NE_FATLoadData(indices_path);
+	if (indices == NULL) {
+		NE_DebugPrint("Couldn't load file from FAT");
+		free(texels);
+		return 0;
+	}
+
+	int ret = NE_MaterialTexLoadCompressed(tex, sizeX, sizeY, param,
+					       texels, indices);
+	free(texels);
+	free(indices);
+	return ret;
+}
+
+// Uploads a managed texture that isn't in VRAM
+static void ne_texture_reload(int slot)
+{
+	ne_textureinfo_t *info = &NE_Texture[slot];
+
+	// ne_texture_upload() only needs the slot of the material
+	NE_Material material = { 0 };
+	material.texindex = slot;
+
+	int size = (__NE_GetValidSize(info->sizex) * info->sizey << 1)
+		 >> __NE_TextureSizeShift[info->load_type];
+
+	// Always allow one upload per frame, even if it is bigger than the
+	// budget, or it would never be loaded.
+	if (ne_residency_budget > 0 && ne_residency_frame_bytes > 0
+	    && ne_residency_frame_bytes + size > ne_residency_budget)
+		return;
+
+	void *data = info->source;
+	if (data == NULL) {
+		data = NE_FATLoadData(info->path);
+		if (data == NULL)
+			return;
+	}
+
+	if (ne_texture_upload(&material, info->load_type, info->sizex,
+			      info->sizey, info->load_param, data)) {
+		ne_residency_frame_bytes += size;
+		ne_residency_stats.uploaded_bytes += size;
+	}
+
+	if (info->source == NULL)
+		free(data);
+}
+
+static int ne_material_tex_load_managed(NE_Material *tex,
+					GL_TEXTURE_TYPE_ENUM type,
+					int sizeX, int sizeY, int param,
+					void *texture, char *path)
+{
+	NE_AssertPointer(tex, "NULL material pointer");
+
+	if (type == GL_COMPRESSED) {
+		NE_DebugPrint("Compressed textures can't be managed");
+		return 0;
+	}
+
+	// Remove the previous texture, but keep the material
+	ne_material_tex_release(tex);
+
+	int slot = ne_texture_free_slot();
+	if (slot == NE_NO_TEXTURE) {
+		NE_DebugPrint("No free slots");
+		return 0;
+	}
+
+	ne_textureinfo_t *info = &NE_Texture[slot];
+
+	if (path != NULL) {
+		info->path = strdup(path);
+		if (info->path == NULL) {
+			NE_DebugPrint("Not enough memory");
+			return 0;
+		}
+	}
+
+	info->managed = true;
+	info->source = texture;
+	info->load_type = type;
+	info->load_param = param;
+	info->sizex = sizeX;
+	info->sizey = sizeY;
+	info->last_use = ne_texture_frame;
+	info->uses = 1;
+
+	tex->texindex = slot;
+
+	// Try to load it now. If there isn't enough VRAM, it will be loaded
+	// after it is used.
+	ne_texture_reload(slot);
+
+	return 1;
+}
+
+int NE_MaterialTexLoadManaged(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
+			      int sizeX, int sizeY, int param, void *texture)
+{
+	NE_AssertPointer(texture, "NULL texture pointer");
+
+	return ne_material_tex_load_managed(tex, type, sizeX, sizeY, param,
+					    texture, NULL);
+}
+
+int NE_MaterialTexLoadManagedFAT(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
+				 int sizeX, int sizeY, int param, char *path)
+{
+	NE_AssertPointer(path, "NULL path pointer");
+
+	return ne_material_tex_load_managed(tex, type, sizeX, sizeY, param,
+					    NULL, path);
+}
+
+void NE_TextureDedupEnable(bool enable)
+{
+	ne_texture_dedup = enable;
+}
+
+int NE_TextureDedupBytesSaved(void)
+{
+	if (!ne_texture_system_inited)
+		return 0;
+
+	int saved = 0;
+
+	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
+		ne_textureinfo_t *info = &NE_Texture[i];
+
+		if (info->dedup_refs == 0 || info->adress == NULL)
+			continue;
+
+		saved += NE_GetSize(NE_TexAllocList, info->adress)
+			 * info->dedup_refs;
+	}
+
+	return saved;
+}
+
+void NE_TextureResidencySetBudget(int max_bytes)
+{
+	ne_residency_budget = max_bytes;
+}
+
+void NE_TextureResidencyNextFrame(void)
+{
+	ne_texture_frame++;
+	ne_residency_frame_bytes = 0;
+
+	if (!ne_texture_system_inited)
+		return;
+
+	// Reload the textures that were used while they weren't in VRAM. This is
+	// done here, during VBL, instead of in NE_MaterialUse() so that textures
+	// aren't disabled while the frame is being drawn.
+	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
+		ne_textureinfo_t *info = &NE_Texture[i];
+
+		if (!info->managed || !info->missed)
+			continue;
+
+		if (info->adress == NULL)
+			ne_texture_reload(i);
+
+		// If it couldn't be reloaded, it will be retried after the
+		// next time it is used.
+		info->missed = false;
+	}
+}
+
+void NE_TextureResidencyGetStats(NE_TextureResidencyStats *stats)
+{
+	NE_AssertPointer(stats, "NULL pointer");
+
+	*stats = ne_residency_stats;
+}
+
+void NE_TextureResidencyResetStats(void)
+{
+	memset(&ne_residency_stats, 0, sizeof(ne_residency_stats));
+}
+
+void NE_MaterialTexClone(NE_Material *source, NE_Material *dest)
+{
+	NE_AssertPointer(source, "NULL source pointer");
+	NE_AssertPointer(dest, "NULL dest pointer");
+	NE_Assert(source->texindex != NE_NO_TEXTURE,
+		  "No texture asigned to source material");
+	// Increase count of materials using this texture
+	NE_Texture[source->texindex].uses++;
+	dest->texindex = source->texindex;
+	// Clones don't count as savings of deduplication
+	dest->dedup = false;
+}
+
+NE_Material *NE_MaterialCreateSub(NE_Material *page, int x, int y, int width,
+				  int height)
+{
+	NE_AssertPointer(page, "NULL page pointer");
+	NE_Assert(page->texindex != NE_NO_TEXTURE,
+		  "No texture asigned to page material");
+
+	NE_Material *mat = NE_MaterialCreate();
+	if (mat == NULL)
+		return NULL;
+
+	NE_MaterialTexClone(page, mat);
+	NE_MaterialSetSubRect(mat, x, y, width, height);
+	mat->palette = page->palette;
+
+	return mat;
+}
+
+NE_Material *NE_MaterialCreateSubFromAtlas(NE_Material **pages, int num_pages,
+					   const void *rects, int index)
+{
+	NE_AssertPointer(pages, "NULL pages pointer");
+	NE_AssertPointer(rects, "NULL rects pointer");
+
+	u32 count = *(const u32 *)rects;
+	if (index < 0 || (u32)index >= count) {
+		NE_DebugPrint("Invalid rectangle index");
+		return NULL;
+	}
+
+	const NE_AtlasRect *r = (const NE_AtlasRect *)((const u32 *)rects + 1);
+	r += index;
+
+	if (r->page >= num_pages || pages[r->page] == NULL) {
+		NE_DebugPrint("Invalid atlas page");
+		return NULL;
+	}
+
+	return NE_MaterialCreateSub(pages[r->page], r->x, r->y, r->width,
+				    r->height);
+}
+
+void NE_MaterialSetSubRect(NE_Material *tex, int x, int y, int width,
+			   int height)
+{
+	NE_AssertPointer(tex, "NULL pointer");
+	NE_Assert(width > 0 && height > 0, "Size must be positive");
+
+	tex->subrect = true;
+	tex->subx = x;
+	tex->suby = y;
+	tex->subw = width;
+	tex->subh = height;
+}
+
+void NE_MaterialTexSetPal(NE_Material *tex, NE_Palette *pal)
+{
+	NE_AssertPointer(tex, "NULL material pointer");
+	NE_AssertPointer(pal, "NULL palette pointer");
+	NE_Assert(tex->texindex != NE_NO_TEXTURE,
+		  "No texture asigned to material");
+	NE_Texture[tex->texindex].palette = pal;
+}
+
+void NE_MaterialSetPalette(NE_Material *tex, NE_Palette *pal)
+{
+	NE_AssertPointer(tex, "NULL material pointer");
+	tex->palette = pal;
+}
+
+void NE_MaterialUse(NE_Material *tex)
+{
+	if (tex == NULL) {
+		GFX_TEX_FORMAT = 0;
+		GFX_COLOR = NE_White;
+		GFX_DIFFUSE_AMBIENT = ne_defaultdiffuse
+				    | (ne_defaultambient << 16)
+				    | (ne_defaultvtxcolor << 15);
+		GFX_SPECULAR_EMISSION = ne_defaultspecular
+				      | (ne_defaultemission << 16)
+				      | (ne_defaultuseshininess << 15);
+		return;
+	}
+
+	GFX_DIFFUSE_AMBIENT = tex->diffuse | (tex->ambient << 16)
+			    | (tex->vtxcolor << 15);
+	GFX_SPECULAR_EMISSION = tex->specular | (tex->emission << 16)
+			      | (tex->useshininess << 15);
+
+	NE_Assert(tex->texindex != NE_NO_TEXTURE,
+		  "No texture asigned to material");
+
+	ne_textureinfo_t *info = &NE_Texture[tex->texindex];
+
+	if (info->transient && info->adress != NULL)
+		ne_transient_entries[info->transient_entry].last_use =
+			ne_texture_frame;
+
+	if (info->managed) {
+		info->last_use = ne_texture_frame;
+
+		if (info->adress != NULL) {
+			ne_residency_stats.hits++;
+		} else {
+			// It is drawn without texture, and it is reloaded by
+			// NE_TextureResidencyNextFrame() after VBL.
+			ne_residency_stats.misses++;
+			info->missed = true;
+		}
+	}
+
+	// The palette of the material has priority over the one of the texture
+	if (tex->palette)
+		NE_PaletteUse(tex->palette);
+	else if (NE_Texture[tex->texindex].palette)
+		NE_PaletteUse(NE_Texture[tex->texindex].palette);
+
+	GFX_COLOR = (u32) tex->color;
+
+	// The texture matrix of the last sub-material would move the texture
+	// coordinates of textures that use TEXGEN_TEXCOORD.
+	if (!tex->subrect && ne_texture_matrix_dirty) {
+		MATRIX_CONTROL = GL_TEXTURE;
+		MATRIX_IDENTITY = 0;
+		MATRIX_CONTROL = GL_MODELVIEW;
+		ne_texture_matrix_dirty = false;
+	}
+
+	// Textures waiting in the upload queue aren't ready to be used yet
+	if (NE_Texture[tex->texindex].pending) {
+		GFX_TEX_FORMAT = 0;
+	} else if (tex->subrect) {
+		// Move the texture coordinates to the rectangle of the
+		// sub-material. In this texgen mode the translation is
+		// multiplied by 1/16, and coordinates are in 1/16 of texel.
+		MATRIX_CONTROL = GL_TEXTURE;
+		MATRIX_IDENTITY = 0;
+		MATRIX_TRANSLATE = tex->subx << 16;
+		MATRIX_TRANSLATE = tex->suby << 16;
+		MATRIX_TRANSLATE = 0;
+		MATRIX_CONTROL = GL_MODELVIEW;
+		ne_texture_matrix_dirty = true;
+
+		// Replace the texgen mode of the texture, don't mix them
+		GFX_TEX_FORMAT = (NE_Texture[tex->texindex].param
+				  & ~(3U << 30)) | TEXGEN_TEXCOORD;
+	} else {
+		GFX_TEX_FORMAT = NE_Texture[tex->texindex].param;
+	}
+	//GFX_TEX_COORD = GL_TEXTURE_WRAP_S | GL_TEXTURE_FLIP_S | GL_TEXTURE_WRAP_T | GL_TEXTURE_FLIP_T;
+ 	//glTexParameter(0, GL_TEXTURE_WRAP_S);
+}
+
+extern bool NE_Dual;
+
+void NE_TextureSystemReset(int texture_number, int palette_number,
+			   NE_VRAMBankFlags bank_flags)
+{
+	if (ne_texture_system_inited)
+		NE_TextureSystemEnd();
+
+	if (texture_number < 1)
+		NE_MAX_TEXTURES = NE_DEFAULT_TEXTURES;
+	else
+		NE_MAX_TEXTURES = texture_number;
+
+	NE_AllocInit(&NE_TexAllocList, (void *)VRAM_A, (void *)VRAM_E);
+
+	NE_Assert((bank_flags & 0xF) != 0, "No VRAM banks selected");
+
+	// Prevent user from not selecting any bank
+	if ((bank_flags & 0xF) == 0)
+		bank_flags = NE_VRAM_ABCD;
+
+	// VRAM_C and VRAM_D can't be used in dual 3D mode
+	if (NE_Dual)
+		bank_flags &= ~NE_VRAM_CD;
+
+	// Now, configure allocation system. The buffer size always sees the
+	// four banks of VRAM. It is needed to allocate one chunk for each and
+	// lock the ones that aren't allowed to be used by Nitro Engine.
+
+	NE_Alloc(NE_TexAllocList, 128 * 1024, 0);	// VRAM_A
+	NE_Alloc(NE_TexAllocList, 128 * 1024, 0);	// VRAM_B
+	NE_Alloc(NE_TexAllocList, 128 * 1024, 0);	// VRAM_C
+	NE_Alloc(NE_TexAllocList, 128 * 1024, 0);	// VRAM_D
+
+	if (bank_flags & NE_VRAM_A) {
+		vramSetBankA(VRAM_A_TEXTURE_SLOT0);
+		NE_Free(NE_TexAllocList, VRAM_A);
+	} else {
+		NE_Lock(NE_TexAllocList, VRAM_A);
+	}
+
+	if (bank_flags & NE_VRAM_B) {
+		vramSetBankB(VRAM_B_TEXTURE_SLOT1);
+		NE_Free(NE_TexAllocList, VRAM_B);
+	} else {
+		NE_Lock(NE_TexAllocList, VRAM_B);
+	}
+
+	if (bank_flags & NE_VRAM_C) {
+		vramSetBankC(VRAM_C_TEXTURE_SLOT2);
+		NE_Free(NE_TexAllocList, VRAM_C);
+	} else {
+		NE_Lock(NE_TexAllocList, VRAM_C);
+	}
+
+	if (bank_flags & NE_VRAM_D) {
+		vramSetBankD(VRAM_D_TEXTURE_SLOT3);
+		NE_Free(NE_TexAllocList, VRAM_D);
+	} else {
+		NE_Lock(NE_TexAllocList, VRAM_D);
+	}
+
+	NE_Texture = calloc(NE_MAX_TEXTURES, sizeof(ne_textureinfo_t));
+	NE_AssertPointer(NE_Texture, "Not enough memory");
+	NE_UserMaterials = calloc(NE_MAX_TEXTURES, sizeof(NE_UserMaterials));
+	NE_AssertPointer(NE_UserMaterials, "Not enough memory");
+
+	NE_PaletteSystemReset(palette_number);
+
+	GFX_TEX_FORMAT = 0;
+
+	ne_texture_system_inited = true;
+}
+
+void NE_MaterialDelete(NE_Material *tex)
+{
+	NE_AssertPointer(tex, "NULL pointer");
+
+	ne_material_tex_release(tex);
+
+	// Canvases keep their copies in VRAM, but they can't switch the texture
+	// of this material anymore
+	for (int i = 0; i < NE_MAX_CANVASES; i++) {
+		if (ne_canvases[i] != NULL && ne_canvases[i]->material == tex)
+			ne_canvases[i]->material = NULL;
+	}
+
+	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
+		if (NE_UserMaterials[i] == tex) {
+			NE_UserMaterials[i] = NULL;
+			free(tex);
+			return;
+		}
+	}
+
+	NE_DebugPrint("Object not found");
+}
+
+int NE_TextureFreeMem(void)
+{
+	if (!ne_texture_system_inited)
+		return 0;
+
+	NEMemInfo Info;
+	NE_MemGetInformation(NE_TexAllocList, &Info);
+
+	return Info.Free;
 }
 
 int NE_TextureFreeMemPercent(void)
@@ -549,51 +1587,467 @@ int NE_TextureFreeMemPercent(void)
 	if (!ne_texture_system_inited)
 		return 0;
 
-	NEMemInfo Info;
-	NE_MemGetInformation(NE_TexAllocList, &Info);
+	NEMemInfo Info;
+	NE_MemGetInformation(NE_TexAllocList, &Info);
+
+	return Info.FreePercent;
+}
+
+int NE_TextureMemGetInformation(NEMemInfo *info)
+{
+	if (!ne_texture_system_inited)
+		return 0;
+
+	NE_AssertPointer(info, "NULL pointer");
+
+	NE_MemGetInformation(NE_TexAllocList, info);
+
+	return 1;
+}
+
+void NE_TextureSetOwnerLabel(const char *label)
+{
+	ne_texture_owner_label = label;
+}
+
+void NE_TextureSetPreferredBanks(NE_VRAMBankFlags banks)
+{
+	ne_texture_preferred_banks = banks;
+}
+
+void NE_TextureSetEvacuableBanks(NE_VRAMBankFlags banks)
+{
+	ne_texture_evacuable_banks = banks;
+}
+
+void NE_TextureAllowBankSpan(bool allow)
+{
+	ne_texture_bank_span = allow;
+}
+
+void NE_TextureDumpMemMap(FILE *file)
+{
+	if (!ne_texture_system_inited)
+		return;
+
+	NE_AllocDump(NE_TexAllocList, file, VRAM_A, 128 * 1024, 'A');
+}
+
+// Returns the slot of the texture placed at the given address
+static int ne_texture_find_slot(void *address)
+{
+	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
+		if (NE_Texture[i].adress == address
+		    || NE_Texture[i].index_adress == address)
+			return i;
+	}
+
+	return NE_NO_TEXTURE;
+}
+
+// Moves a compressed texture and its index data to lower addresses. The texels
+// can go as low as "dest", but the index data has to stay at the address that
+// corresponds to the new address of the texels, so that limits how much they
+// can move. Returns the number of bytes moved, or -1 if the budget is over.
+static int ne_texture_defrag_compressed(int slot, void *pointer, uintptr_t dest,
+					int moved, int max_bytes,
+					bool *banks_unlocked, u32 *vramTemp)
+{
+	ne_textureinfo_t *info = &NE_Texture[slot];
+
+	// The free space before the index data is also found by
+	// NE_AllocNextMovable(), but it can only move with the texels.
+	if (pointer != info->adress)
+		return 0;
+
+	uintptr_t texels = (uintptr_t)info->adress;
+	uintptr_t indices = (uintptr_t)info->index_adress;
+
+	// Texels in bank A use the first half of bank B for the index data,
+	// texels in bank C use the second half.
+	int bank = (texels - (uintptr_t)VRAM_A) / NE_VRAM_BANK_SIZE;
+	uintptr_t base = (uintptr_t)VRAM_A + bank * NE_VRAM_BANK_SIZE;
+	uintptr_t index_base = (uintptr_t)VRAM_B
+			     + (bank / 2) * (NE_VRAM_BANK_SIZE / 2);
+
+	void *index_free = NE_AllocFreeBefore(NE_TexAllocList,
+					      info->index_adress);
+	if (index_free == NULL)
+		return 0;
+
+	// Lowest address of the texels that keeps the index data inside the
+	// free space right before it.
+	uintptr_t new_texels = base;
+	if ((uintptr_t)index_free > index_base)
+		new_texels += ((uintptr_t)index_free - index_base) * 2;
+	if (new_texels < dest)
+		new_texels = dest;
+	new_texels = (new_texels + 7) & ~(uintptr_t)7;
+
+	if (new_texels >= texels)
+		return 0;
+
+	uintptr_t new_indices = index_base + (new_texels - base) / 2;
+
+	int size = NE_GetSize(NE_TexAllocList, info->adress);
+	int index_size = NE_GetSize(NE_TexAllocList, info->index_adress);
+
+	if (moved > 0 && moved + size + index_size > max_bytes)
+		return -1;
+
+	if (NE_AllocMove(NE_TexAllocList, info->index_adress,
+			 (void *)new_indices) == 0)
+		return -1;
+
+	if (NE_AllocMove(NE_TexAllocList, info->adress,
+			 (void *)new_texels) == 0) {
+		// This only happens if there isn't enough RAM for the list of
+		// chunks. The index data hasn't been copied yet, so the texture
+		// can't be used anymore.
+		NE_DebugPrint("Compressed texture lost while moving it");
+		return -1;
+	}
+
+	if (!*banks_unlocked) {
+		*vramTemp = vramSetPrimaryBanks(VRAM_A_LCD, VRAM_B_LCD,
+						VRAM_C_LCD, VRAM_D_LCD);
+		*banks_unlocked = true;
+	}
+
+	// The destinations are always before the sources
+	dmaCopyHalfWords(3, (void *)texels, (void *)new_texels, size);
+	dmaCopyHalfWords(3, (void *)indices, (void *)new_indices, index_size);
+
+	info->adress = (void *)new_texels;
+	info->index_adress = (void *)new_indices;
+	info->param &= 0xFFFF0000;
+	info->param |= (new_texels >> 3) & 0xFFFF;
+
+	return size + index_size;
+}
+
+int NE_TextureDefragMemStep(int max_bytes)
+{
+	if (!ne_texture_system_inited)
+		return 0;
+
+	int moved = 0;
+	bool banks_unlocked = false;
+	u32 vramTemp = 0;
+
+	void *pointer = NULL;
+
+	while (1) {
+		void *free_start;
+
+		// Look for the next texture with free space right before it
+		pointer = NE_AllocNextMovable(NE_TexAllocList, pointer,
+					      &free_start);
+		if (pointer == NULL)
+			break;
+
+		// Textures must be aligned to 8 bytes. If the free space is too
+		// small to move this texture, skip it.
+		uintptr_t dest = ((uintptr_t)free_start + 7) & ~(uintptr_t)7;
+		if (dest >= (uintptr_t)pointer)
+			continue;
+
+		int slot = ne_texture_find_slot(pointer);
+		if (slot == NE_NO_TEXTURE) {
+			NE_DebugPrint("Chunk without texture");
+			continue;
+		}
+
+		// The upload queue has the address of the texture
+		if (NE_Texture[slot].pending)
+			continue;
+
+		// The address of the index data of compressed textures depends
+		// on the address of the texels, so they are moved together.
+		if (NE_Texture[slot].index_adress != NULL) {
+			int size = ne_texture_defrag_compressed(slot, pointer,
+								dest, moved,
+								max_bytes,
+								&banks_unlocked,
+								&vramTemp);
+			if (size < 0)
+				break;
+
+			moved += size;
+			if (size > 0)
+				pointer = NE_Texture[slot].adress;
+			continue;
+		}
+
+		int size = NE_GetSize(NE_TexAllocList, pointer);
+
+		if (!ne_texture_move_allowed((uintptr_t)pointer, dest, size))
+			continue;
+
+		// Always move at least one texture so that the process can
+		// finish even if some textures are bigger than the budget.
+		if (moved > 0 && moved + size > max_bytes)
+			break;
+
+		if (NE_AllocMove(NE_TexAllocList, pointer, (void *)dest) == 0)
+			break;
+
+		if (!banks_unlocked) {
+			vramTemp = vramSetPrimaryBanks(VRAM_A_LCD, VRAM_B_LCD,
+						       VRAM_C_LCD, VRAM_D_LCD);
+			banks_unlocked = true;
+		}
+
+		// The source and destination may overlap, but the destination
+		// is always before the source, so copying forwards is safe.
+		dmaCopyHalfWords(3, pointer, (void *)dest, size);
+
+		NE_Texture[slot].adress = (void *)dest;
+		NE_Texture[slot].param &= 0xFFFF0000;
+		NE_Texture[slot].param |= (dest >> 3) & 0xFFFF;
+
+		moved += size;
+
+		// Continue after the texture that has just been moved
+		pointer = (void *)dest;
+	}
+
+	if (banks_unlocked)
+		vramRestorePrimaryBanks(vramTemp);
+
+	return moved;
+}
+
+void NE_TextureDefragMem(void)
+{
+	// A single pass is enough to move everything as much as possible.
+	NE_TextureDefragMemStep(INT_MAX);
+}
+
+int NE_TextureTransientArenaInit(int size)
+{
+	if (!ne_texture_system_inited)
+		return 0;
+
+	NE_Assert(size > 0, "Invalid size");
+
+	if (ne_transient_base != 0) {
+		NE_DebugPrint("Transient arena already initialized");
+		return 0;
+	}
+
+	size = (size + 7) & ~7;
+
+	ne_transient_entries = malloc(NE_MAX_TEXTURES
+				      * sizeof(ne_transient_entry_t));
+	if (ne_transient_entries == NULL) {
+		NE_DebugPrint("Not enough memory");
+		return 0;
+	}
+
+	void *addr = ne_texture_alloc(size);
+	if (addr == NULL) {
+		NE_DebugPrint("Not enough memory");
+		free(ne_transient_entries);
+		ne_transient_entries = NULL;
+		return 0;
+	}
+
+	// Lock the chunk so that the defragmentation code doesn't move it
+	NE_AllocSetOwner(NE_TexAllocList, addr, -1, "transient");
+	NE_Lock(NE_TexAllocList, addr);
+
+	ne_transient_base = (uintptr_t)addr;
+	ne_transient_size = size;
+	ne_transient_head = 0;
+	ne_transient_used = 0;
+	ne_transient_first = 0;
+	ne_transient_count = 0;
+
+	return 1;
+}
+
+// Takes the memory of a transient texture back. The texture is drawn without
+// texture until it is loaded again.
+static void ne_transient_reclaim(int slot)
+{
+	ne_textureinfo_t *info = &NE_Texture[slot];
+
+	if (info->pending) {
+		__NE_UploadQueueCancel(info->adress, info->adress + 1);
+		info->pending = false;
+	}
+
+	info->adress = NULL;
+	info->param = 0;
+	info->transient_entry = -1;
+}
+
+void NE_TextureTransientArenaEnd(void)
+{
+	if (!ne_texture_system_inited || ne_transient_base == 0)
+		return;
+
+	// Textures that are still loaded lose their VRAM
+	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
+		if (NE_Texture[i].transient && NE_Texture[i].adress != NULL)
+			ne_transient_reclaim(i);
+	}
+
+	NE_Unlock(NE_TexAllocList, (void *)ne_transient_base);
+	NE_Free(NE_TexAllocList, (void *)ne_transient_base);
+
+	free(ne_transient_entries);
+	ne_transient_entries = NULL;
+
+	ne_transient_base = 0;
+	ne_transient_size = 0;
+}
+
+// Returns the offset inside the arena of the memory allocated for the texture
+// in "slot", or -1 if there isn't enough space.
+static int ne_transient_alloc(int slot, size_t size)
+{
+	if (ne_transient_count == NE_MAX_TEXTURES)
+		return -1;
+
+	size = (size + 7) & ~7;
+
+	// Allocations can't wrap around the end of the arena. If there isn't
+	// enough space at the end, the remaining bytes are wasted.
+	size_t waste = 0;
+	if (ne_transient_head + size > ne_transient_size)
+		waste = ne_transient_size - ne_transient_head;
+
+	if (ne_transient_used + waste + size > ne_transient_size)
+		return -1;
+
+	if (waste > 0)
+		ne_transient_head = 0;
+
+	int offset = ne_transient_head;
+
+	ne_transient_head += size;
+	ne_transient_used += waste + size;
+
+	int index = (ne_transient_first + ne_transient_count) % NE_MAX_TEXTURES;
+	ne_transient_entries[index].slot = slot;
+	ne_transient_entries[index].size = waste + size;
+	ne_transient_entries[index].last_use = ne_texture_frame;
+	ne_transient_count++;
+
+	NE_Texture[slot].transient_entry = index;
+
+	return offset;
+}
+
+int NE_MaterialTexLoadTransient(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
+				int sizeX, int sizeY, int param, void *texture)
+{
+	NE_AssertPointer(tex, "NULL material pointer");
+	NE_AssertPointer(texture, "NULL texture pointer");
+
+	if (ne_transient_base == 0) {
+		NE_DebugPrint("Transient arena not initialized");
+		return 0;
+	}
+
+	if (__NE_GetValidSize(sizeX) != sizeX) {
+		NE_DebugPrint("Width must be a power of 2");
+		return 0;
+	}
+
+	if (type == GL_COMPRESSED) {
+		NE_DebugPrint("Compressed textures can't be transient");
+		return 0;
+	}
+
+	// Remove the previous texture, but keep the material
+	ne_material_tex_release(tex);
+
+	int slot = ne_texture_free_slot();
+	if (slot == NE_NO_TEXTURE) {
+		NE_DebugPrint("No free slots");
+		return 0;
+	}
+
+	u32 size = (sizeX * sizeY << 1) >> __NE_TextureSizeShift[type];
+
+	// The copy is always done by the upload queue during VBL, even if the
+	// queue is disabled, so that the textures being drawn aren't disabled in
+	// the middle of the frame.
+	ne_upload_entry *entry = ne_upload_entry_alloc(false, slot, NULL, size);
+	if (entry == NULL) {
+		NE_DebugPrint("Not enough memory");
+		return 0;
+	}
+
+	int offset = ne_transient_alloc(slot, size);
+	if (offset < 0) {
+		NE_DebugPrint("Not enough memory in transient arena");
+		free(entry->data);
+		free(entry);
+		return 0;
+	}
 
-	return Info.FreePercent;
+	u32 *addr = (u32 *)(ne_transient_base + offset);
+
+	tex->texindex = slot;
+	NE_Texture[slot].adress = (void *)addr;
+	NE_Texture[slot].uses = 1;
+	NE_Texture[slot].sizex = sizeX;
+	NE_Texture[slot].sizey = sizeY;
+	NE_Texture[slot].transient = true;
+	NE_Texture[slot].pending = true;
+
+	// GL_RGB is loaded as GL_RGBA with all alpha bits set
+	NE_MaterialTexParam(tex, sizeX, __NE_GetValidSize(sizeY), addr,
+			    type == GL_RGB ? GL_RGBA : type, param);
+
+	if (type == GL_RGB) {
+		u16 *src = texture;
+		u16 *dest = entry->data;
+		for (u32 i = 0; i < (size >> 1); i++)
+			dest[i] = src[i] | (1 << 15);
+	} else {
+		memcpy(entry->data, texture, size);
+	}
+
+	entry->dest = addr;
+	ne_upload_queue_push(entry);
+
+	return 1;
 }
 
-void NE_TextureDefragMem(void)
+void NE_TextureTransientFence(void)
 {
-	NE_Assert(0, "This function doesn't work");
-	return;
-	/*
-	// REALLY OLD CODE -- DOESN'T WORK
-
-	if (!ne_texture_system_inited)
+	if (ne_transient_base == 0)
 		return;
 
-	uint32 vramTemp = vramSetMainBanks(VRAM_A_LCD, VRAM_B_LCD, VRAM_C_LCD,
-					   VRAM_D_LCD);
+	// Textures used during this frame are going to be drawn by the GPU now.
+	// The rest can be reclaimed, but only in the order they were loaded.
+	while (ne_transient_count > 0) {
+		ne_transient_entry_t *entry =
+			&ne_transient_entries[ne_transient_first];
 
-	bool ok = false;
-	while (!ok) {
-		ok = true;
-		int i;
-		for (i = 0; i < NE_MAX_TEXTURES; i++) {
-			int size = NE_GetSize(NE_TexAllocList,
-					      (void*)NE_Texture[i].adress);
-			NE_Free(NE_TexAllocList,(void*)NE_Texture[i].adress);
-			void *pointer = NE_Alloc(NE_TexAllocList, size, 8);
-
-			NE_AssertPointer(pointer,
-					 "Couldn't reallocate texture");
-
-			if (pointer != NE_Texture[i].adress) {
-				dmaCopy((void*) NE_Texture[i].adress, pointer,
-					size);
-				NE_Texture[i].adress = pointer;
-				NE_Texture[i].param &= 0xFFFF0000;
-				NE_Texture[i].param |=
-					((uint32)pointer >> 3) & 0xFFFF;
-				ok = false;
-			}
-		}
+		if (entry->last_use == ne_texture_frame)
+			break;
+
+		if (entry->slot != NE_NO_TEXTURE)
+			ne_transient_reclaim(entry->slot);
+
+		ne_transient_used -= entry->size;
+		ne_transient_first = (ne_transient_first + 1) % NE_MAX_TEXTURES;
+		ne_transient_count--;
 	}
-	vramRestoreMainBanks(vramTemp);
-	*/
+}
+
+int NE_TextureTransientFreeMem(void)
+{
+	if (ne_transient_base == 0)
+		return 0;
+
+	return ne_transient_size - ne_transient_used;
 }
 
 void NE_TextureSystemEnd(void)
@@ -601,8 +2055,21 @@ void NE_TextureSystemEnd(void)
 	if (!ne_texture_system_inited)
 		return;
 
+	__NE_UploadQueueCancel((void *)0, (void *)UINTPTR_MAX);
+
+	// Canvases should have been deleted, don't update them anymore
+	memset(ne_canvases, 0, sizeof(ne_canvases));
+
 	NE_AllocEnd(NE_TexAllocList);
 
+	free(ne_transient_entries);
+	ne_transient_entries = NULL;
+	ne_transient_base = 0;
+	ne_transient_size = 0;
+
+	for (int i = 0; i < NE_MAX_TEXTURES; i++)
+		free(NE_Texture[i].path);
+
 	free(NE_Texture);
 
 	for (int i = 0; i < NE_MAX_TEXTURES; i++) {
@@ -662,6 +2129,8 @@ int NE_TextureGetSizeX(NE_Material *tex)
 	NE_AssertPointer(tex, "NULL pointer");
 	NE_Assert(tex->texindex != NE_NO_TEXTURE,
 		  "No texture asigned to material");
+	if (tex->subrect)
+		return tex->subw;
 	return NE_Texture[tex->texindex].sizex;
 }
 
@@ -670,6 +2139,8 @@ int NE_TextureGetSizeY(NE_Material *tex)
 	NE_AssertPointer(tex, "NULL pointer");
 	NE_Assert(tex->texindex != NE_NO_TEXTURE,
 		  "No texture asigned to material");
+	if (tex->subrect)
+		return tex->subh;
 	return NE_Texture[tex->texindex].sizey;
 }
 
@@ -709,6 +2180,17 @@ static int drawingtexture_x, drawingtexture_y;
 static int drawingtexture_type;
 static int drawingtexture_realx;
 static u32 ne_vram_saved;
+// Canvas being drawn, or NULL if the texture is being drawn in VRAM
+static NE_Canvas *drawingtexture_canvas = NULL;
+
+static void ne_canvas_add_dirty(NE_Canvas *canvas, int first, int last);
+
+// Marks rows "y" to "y + h - 1" as modified if a canvas is being drawn
+static inline void ne_drawing_dirty(int y, int h)
+{
+	if (drawingtexture_canvas != NULL)
+		ne_canvas_add_dirty(drawingtexture_canvas, y, y + h - 1);
+}
 
 void *NE_TextureDrawingStart(NE_Material *tex)
 {
@@ -719,13 +2201,18 @@ void *NE_TextureDrawingStart(NE_Material *tex)
 	NE_Assert(drawingtexture_adress == NULL,
 		  "Another texture is already active");
 
-	drawingtexture_x = NE_TextureGetSizeX(tex);
+	// The size of sub-materials is the size of their rectangle, but the
+	// address is the one of the whole page, so use the size of the page.
+	drawingtexture_x = NE_Texture[tex->texindex].sizex;
 	drawingtexture_realx = NE_TextureGetRealSizeX(tex);
-	drawingtexture_y = NE_TextureGetSizeY(tex);
+	drawingtexture_y = NE_Texture[tex->texindex].sizey;
 	drawingtexture_adress = (u16 *) ((uintptr_t)VRAM_A
 			+ ((NE_Texture[tex->texindex].param & 0xFFFF) << 3));
 	drawingtexture_type = ((NE_Texture[tex->texindex].param >> 26) & 0x7);
 
+	// The data won't match the hash anymore, don't share it with new loads
+	NE_Texture[tex->texindex].hash = 0;
+
 	ne_vram_saved = vramSetPrimaryBanks(VRAM_A_LCD, VRAM_B_LCD, VRAM_C_LCD,
 					    VRAM_D_LCD);
 
@@ -743,6 +2230,7 @@ void NE_TexturePutPixelRGBA(u32 x, u32 y, u16 color)
 		return;
 
 	drawingtexture_adress[x + (y * drawingtexture_realx)] = color;
+	ne_drawing_dirty(y, 1);
 }
 
 void NE_TexturePutPixelRGB256(u32 x, u32 y, u8 palettecolor)
@@ -760,13 +2248,654 @@ void NE_TexturePutPixelRGB256(u32 x, u32 y, u8 palettecolor)
 
 	drawingtexture_adress[position] &= 0xFF00 >> desp;
 	drawingtexture_adress[position] |= ((u16) palettecolor) << desp;
+	ne_drawing_dirty(y, 1);
+}
+
+// Drawing functions for all formats. Texels are handled as bit fields inside
+// 32-bit words, so there are no 8-bit accesses to VRAM (they are ignored) and
+// only the words at the edges of a span need to be read.
+
+// Spans of at least this number of words are filled with DMA
+#define NE_DRAW_DMA_MIN_WORDS	32
+
+// Returns the bits per texel of the active texture, or 0 if it can't be drawn
+static int ne_drawing_bits(void)
+{
+	NE_AssertPointer(drawingtexture_adress,
+			 "No texture active for drawing");
+
+	int bits = 0;
+	if (drawingtexture_adress != NULL
+	    && drawingtexture_type != GL_COMPRESSED)
+		bits = __NE_TextureDepth[drawingtexture_type];
+
+	NE_Assert(bits != 0, "Active texture can't be drawn");
+
+	return bits;
+}
+
+// Returns a word with "value" repeated in all texels
+static u32 ne_drawing_pattern(u32 value, int bits)
+{
+	u32 pattern = value & (0xFFFFFFFF >> (32 - bits));
+
+	for (int i = bits; i < 32; i <<= 1)
+		pattern |= pattern << i;
+
+	return pattern;
+}
+
+// Fills bits "start" to "end" (not included) of the active texture
+static void ne_drawing_fill_bits(u32 start, u32 end, u32 pattern)
+{
+	u32 *base = (u32 *)drawingtexture_adress;
+	u32 first = start >> 5, last = end >> 5;
+	u32 first_bit = start & 31, last_bit = end & 31;
+
+	if (first == last) {
+		u32 mask = ((1U << (last_bit - first_bit)) - 1) << first_bit;
+		base[first] = (base[first] & ~mask) | (pattern & mask);
+		return;
+	}
+
+	if (first_bit != 0) {
+		u32 mask = 0xFFFFFFFF << first_bit;
+		base[first] = (base[first] & ~mask) | (pattern & mask);
+		first++;
+	}
+
+	// DMA doesn't see the data cache, so it isn't used for canvases in RAM
+	u32 count = last - first;
+	if (count >= NE_DRAW_DMA_MIN_WORDS && drawingtexture_canvas == NULL) {
+		dmaFillWords(pattern, &base[first], count << 2);
+	} else {
+		for (u32 i = first; i < last; i++)
+			base[i] = pattern;
+	}
+
+	if (last_bit != 0) {
+		u32 mask = (1U << last_bit) - 1;
+		base[last] = (base[last] & ~mask) | (pattern & mask);
+	}
+}
+
+// Clips a rectangle to the size of the active texture. Returns false if
+// nothing is left.
+static bool ne_drawing_clip(int *x, int *y, int *w, int *h, int *skip_x,
+			    int *skip_y)
+{
+	*skip_x = 0;
+	*skip_y = 0;
+
+	if (*x < 0) {
+		*skip_x = -*x;
+		*w += *x;
+		*x = 0;
+	}
+	if (*y < 0) {
+		*skip_y = -*y;
+		*h += *y;
+		*y = 0;
+	}
+	if (*x + *w > drawingtexture_x)
+		*w = drawingtexture_x - *x;
+	if (*y + *h > drawingtexture_y)
+		*h = drawingtexture_y - *y;
+
+	return *w > 0 && *h > 0;
+}
+
+void NE_TextureDrawSpan(int x, int y, int length, u32 value)
+{
+	NE_TextureDrawRect(x, y, length, 1, value);
+}
+
+void NE_TextureDrawRect(int x, int y, int w, int h, u32 value)
+{
+	int bits = ne_drawing_bits();
+	if (bits == 0)
+		return;
+
+	int skip_x, skip_y;
+
+	if (!ne_drawing_clip(&x, &y, &w, &h, &skip_x, &skip_y))
+		return;
+
+	ne_drawing_dirty(y, h);
+
+	u32 pattern = ne_drawing_pattern(value, bits);
+	u32 row_bits = drawingtexture_realx * bits;
+	u32 start = y * row_bits + x * bits;
+
+	// If whole rows are filled, the rectangle is a single span
+	if (w == drawingtexture_realx) {
+		ne_drawing_fill_bits(start, start + h * row_bits, pattern);
+		return;
+	}
+
+	for (int j = 0; j < h; j++) {
+		ne_drawing_fill_bits(start, start + w * bits, pattern);
+		start += row_bits;
+	}
+}
+
+void NE_TextureDrawImage(int x, int y, const void *image, int w, int h,
+			 int key)
+{
+	NE_AssertPointer(image, "NULL image pointer");
+
+	int bits = ne_drawing_bits();
+	if (bits == 0)
+		return;
+
+	int image_w = w;
+	int skip_x, skip_y;
+
+	if (!ne_drawing_clip(&x, &y, &w, &h, &skip_x, &skip_y))
+		return;
+
+	ne_drawing_dirty(y, h);
+
+	u32 *base = (u32 *)drawingtexture_adress;
+	u32 texel_mask = 0xFFFFFFFF >> (32 - bits);
+	size_t image_size = ((size_t)image_w * (skip_y + h) * bits + 7) >> 3;
+
+	for (int j = 0; j < h; j++) {
+		u32 dst = ((y + j) * drawingtexture_realx + x) * bits;
+		size_t src = ((size_t)(skip_y + j) * image_w + skip_x) * bits;
+		u32 left = w * bits;
+
+		while (left > 0) {
+			u32 shift = dst & 31;
+			u32 count = 32 - shift;
+			if (count > left)
+				count = left;
+
+			u32 data = ne_texture_read_bits(image, image_size, src,
+							count);
+			u32 mask = count == 32 ? 0xFFFFFFFF
+					       : (1U << count) - 1;
+
+			// Texels equal to the key aren't drawn
+			if (key >= 0) {
+				for (u32 t = 0; t < count; t += bits) {
+					if (((data >> t) & texel_mask)
+					    == (u32)key)
+						mask &= ~(texel_mask << t);
+				}
+			}
+
+			u32 *d = &base[dst >> 5];
+			*d = (*d & ~(mask << shift)) | ((data & mask) << shift);
+
+			dst += count;
+			src += count;
+			left -= count;
+		}
+	}
+}
+
+// Division rounding towards minus infinity. "d" must be positive.
+static int ne_div_floor(int n, int d)
+{
+	if (n >= 0)
+		return n / d;
+	return -((d - 1 - n) / d);
+}
+
+void NE_TextureDrawLine(int x1, int y1, int x2, int y2, u32 value)
+{
+	int bits = ne_drawing_bits();
+	if (bits == 0)
+		return;
+
+	if (y1 == y2) {
+		if (x1 > x2) {
+			int t = x1;
+			x1 = x2;
+			x2 = t;
+		}
+		NE_TextureDrawRect(x1, y1, x2 - x1 + 1, 1, value);
+		return;
+	}
+
+	// The line is drawn one texel at a time along its major axis. The offset
+	// in the minor axis of texel "i" is (2 * i * minor + len) / (2 * len),
+	// so the range of texels inside the texture can be calculated before
+	// drawing and no texel needs to be checked later.
+	int row_bits = drawingtexture_realx * bits;
+	int adx = x2 > x1 ? x2 - x1 : x1 - x2;
+	int ady = y2 > y1 ? y2 - y1 : y1 - y2;
+	int sx = x1 < x2 ? 1 : -1;
+	int sy = y1 < y2 ? 1 : -1;
+
+	int len, minor, m_start, m_size, m_step, n_start, n_size, n_step;
+	int major_bits, minor_bits;
+
+	if (ady > adx) {
+		len = ady;
+		minor = adx;
+		m_start = y1;
+		m_size = drawingtexture_y;
+		m_step = sy;
+		n_start = x1;
+		n_size = drawingtexture_x;
+		n_step = sx;
+		major_bits = sy * row_bits;
+		minor_bits = sx * bits;
+	} else {
+		len = adx;
+		minor = ady;
+		m_start = x1;
+		m_size = drawingtexture_x;
+		m_step = sx;
+		n_start = y1;
+		n_size = drawingtexture_y;
+		n_step = sy;
+		major_bits = sx * bits;
+		minor_bits = sy * row_bits;
+	}
+
+	// Range of texels with the major coordinate inside the texture
+	int first, last;
+	if (m_step > 0) {
+		first = -m_start;
+		last = m_size - 1 - m_start;
+	} else {
+		first = m_start - (m_size - 1);
+		last = m_start;
+	}
+	if (first < 0)
+		first = 0;
+	if (last > len)
+		last = len;
+
+	// Range of minor offsets inside the texture
+	int k_min, k_max;
+	if (n_step > 0) {
+		k_min = -n_start;
+		k_max = n_size - 1 - n_start;
+	} else {
+		k_min = n_start - (n_size - 1);
+		k_max = n_start;
+	}
+
+	if (minor == 0) {
+		if (k_min > 0 || k_max < 0)
+			return;
+	} else {
+		int d = 2 * minor;
+		int k_first = -ne_div_floor(len - 2 * len * k_min, d);
+		int k_last = ne_div_floor(2 * len * k_max + len - 1, d);
+		if (first < k_first)
+			first = k_first;
+		if (last > k_last)
+			last = k_last;
+	}
+
+	if (first > last)
+		return;
+
+	u32 *base = (u32 *)drawingtexture_adress;
+	u32 pattern = ne_drawing_pattern(value, bits);
+	u32 texel_mask = 0xFFFFFFFF >> (32 - bits);
+
+	int err = 2 * first * minor + len;
+	int k = err / (2 * len);
+	err -= k * 2 * len;
+
+	u32 pos = y1 * row_bits + x1 * bits + first * major_bits + k * minor_bits;
+
+	if (drawingtexture_canvas != NULL) {
+		int k_end = (2 * last * minor + len) / (2 * len);
+		u32 end = y1 * row_bits + x1 * bits + last * major_bits
+			+ k_end * minor_bits;
+		int row_a = pos / row_bits, row_b = end / row_bits;
+
+		if (row_a < row_b)
+			ne_drawing_dirty(row_a, row_b - row_a + 1);
+		else
+			ne_drawing_dirty(row_b, row_a - row_b + 1);
+	}
+
+	for (int i = first; i <= last; i++) {
+		u32 mask = texel_mask << (pos & 31);
+		u32 *d = &base[pos >> 5];
+		*d = (*d & ~mask) | (pattern & mask);
+
+		pos += major_bits;
+		err += 2 * minor;
+		if (err >= 2 * len) {
+			err -= 2 * len;
+			pos += minor_bits;
+		}
+	}
 }
 
 void NE_TextureDrawingEnd(void)
 {
 	NE_Assert(drawingtexture_adress != NULL, "No active texture");
 
-	vramRestorePrimaryBanks(ne_vram_saved);
+	if (drawingtexture_canvas == NULL)
+		vramRestorePrimaryBanks(ne_vram_saved);
 
 	drawingtexture_adress = NULL;
+	drawingtexture_canvas = NULL;
+}
+
+//--------------------------------------------------------------------------
+
+// Canvases keep the texture in RAM and two copies of it in VRAM. The material
+// uses one of them (the front copy) while the other one is updated during VBL.
+// Then the material switches to the updated copy, so the GPU never reads a
+// copy while it's being modified and VRAM isn't unmapped outside of VBL.
+
+// Adds rows "first" to "last" to the modified rows of both copies in VRAM
+static void ne_canvas_add_dirty(NE_Canvas *canvas, int first, int last)
+{
+	for (int c = 0; c < 2; c++) {
+		s16 *start = canvas->dirty_start[c];
+		s16 *end = canvas->dirty_end[c];
+		int n = canvas->num_dirty[c];
+		int a = first, b = last;
+
+		// Merge the new range with all the ones it overlaps or touches
+		for (int i = 0; i < n; ) {
+			if (start[i] <= b + 1 && end[i] + 1 >= a) {
+				if (start[i] < a)
+					a = start[i];
+				if (end[i] > b)
+					b = end[i];
+				n--;
+				start[i] = start[n];
+				end[i] = end[n];
+			} else {
+				i++;
+			}
+		}
+
+		// If there's no space left, merge it with the closest range
+		if (n == NE_CANVAS_DIRTY_RANGES) {
+			int closest = 0, closest_gap = INT_MAX;
+
+			for (int i = 0; i < n; i++) {
+				int gap = start[i] > b ? start[i] - b
+						       : a - end[i];
+				if (gap < closest_gap) {
+					closest = i;
+					closest_gap = gap;
+				}
+			}
+
+			if (start[closest] < a)
+				a = start[closest];
+			if (end[closest] > b)
+				b = end[closest];
+			n--;
+			start[closest] = start[n];
+			end[closest] = end[n];
+		}
+
+		start[n] = a;
+		end[n] = b;
+		canvas->num_dirty[c] = n + 1;
+	}
+}
+
+NE_Canvas *NE_CanvasCreate(NE_Material *tex, GL_TEXTURE_TYPE_ENUM type,
+			   int sizeX, int sizeY, int param,
+			   const void *texture)
+{
+	NE_AssertPointer(tex, "NULL material pointer");
+
+	if (type == GL_COMPRESSED) {
+		NE_DebugPrint("Compressed textures can't be canvases");
+		return NULL;
+	}
+
+	int index = -1;
+	for (int i = 0; i < NE_MAX_CANVASES; i++) {
+		if (ne_canvases[i] == NULL) {
+			index = i;
+			break;
+		}
+	}
+
+	if (index == -1) {
+		NE_DebugPrint("No free slots");
+		return NULL;
+	}
+
+	NE_Canvas *canvas = calloc(1, sizeof(NE_Canvas));
+	if (canvas == NULL) {
+		NE_DebugPrint("Not enough memory");
+		return NULL;
+	}
+
+	// GL_RGB textures are GL_RGBA textures with the alpha bit set
+	u32 or_mask = 0;
+	if (type == GL_RGB) {
+		type = GL_RGBA;
+		or_mask = 0x80008000;
+	}
+
+	int bits = __NE_TextureDepth[type];
+	int realx = __NE_GetValidSize(sizeX);
+	size_t size = ((size_t)realx * sizeY * bits) >> 3;
+
+	canvas->material = tex;
+	canvas->type = type;
+	canvas->sizex = sizeX;
+	canvas->sizey = sizeY;
+	canvas->realx = realx;
+	canvas->size = size;
+	canvas->shadow = calloc((size + 3) & ~3, 1);
+	if (canvas->shadow == NULL) {
+		NE_DebugPrint("Not enough memory");
+		free(canvas);
+		return NULL;
+	}
+
+	if (texture != NULL) {
+		ne_texture_copy_padded(canvas->shadow, texture, bits, sizeX,
+				       realx, sizeY, or_mask);
+	}
+
+	// Remove the previous texture, but keep the material
+	ne_material_tex_release(tex);
+
+	// The copies aren't deduplicated, they must not be shared
+	for (int i = 0; i < 2; i++) {
+		NE_Material copy = { 0 };
+		copy.texindex = ne_texture_free_slot();
+		canvas->slot[i] = copy.texindex;
+
+		if (copy.texindex == NE_NO_TEXTURE
+		    || ne_texture_upload(&copy, type, realx, sizeY, param,
+					 canvas->shadow) == 0) {
+			NE_DebugPrint("Can't create copy of canvas");
+			if (i == 1) {
+				copy.texindex = canvas->slot[0];
+				ne_material_tex_release(&copy);
+			}
+			free(canvas->shadow);
+			free(canvas);
+			return NULL;
+		}
+
+		ne_textureinfo_t *info = &NE_Texture[copy.texindex];
+		info->sizex = sizeX;
+		info->uses = 1;
+		info->load_type = type;
+		info->load_param = param;
+		info->hash = 0;
+		info->dedup_refs = 0;
+	}
+
+	// The material is one more user of the front copy
+	canvas->front = 0;
+	tex->texindex = canvas->slot[0];
+	NE_Texture[canvas->slot[0]].uses++;
+
+	ne_canvases[index] = canvas;
+
+	return canvas;
+}
+
+void NE_CanvasDelete(NE_Canvas *canvas)
+{
+	NE_AssertPointer(canvas, "NULL pointer");
+	NE_Assert(drawingtexture_canvas != canvas, "Canvas is being drawn");
+
+	for (int i = 0; i < NE_MAX_CANVASES; i++) {
+		if (ne_canvases[i] == canvas)
+			ne_canvases[i] = NULL;
+	}
+
+	// The material keeps the front copy until it's deleted
+	for (int i = 0; i < 2; i++) {
+		NE_Material copy = { 0 };
+		copy.texindex = canvas->slot[i];
+		ne_material_tex_release(&copy);
+	}
+
+	free(canvas->shadow);
+	free(canvas);
+}
+
+void *NE_CanvasDrawingStart(NE_Canvas *canvas)
+{
+	NE_AssertPointer(canvas, "NULL pointer");
+	NE_Assert(drawingtexture_adress == NULL,
+		  "Another texture is already active");
+
+	drawingtexture_x = canvas->sizex;
+	drawingtexture_realx = canvas->realx;
+	drawingtexture_y = canvas->sizey;
+	drawingtexture_adress = canvas->shadow;
+	drawingtexture_type = canvas->type;
+	drawingtexture_canvas = canvas;
+
+	return canvas->shadow;
+}
+
+void NE_CanvasMarkDirty(NE_Canvas *canvas, int x, int y, int w, int h)
+{
+	NE_AssertPointer(canvas, "NULL pointer");
+
+	// Only the rows matter, they are copied to VRAM as a whole
+	(void)x;
+	(void)w;
+
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	if (y + h > canvas->sizey)
+		h = canvas->sizey - y;
+
+	if (h > 0)
+		ne_canvas_add_dirty(canvas, y, y + h - 1);
+}
+
+void NE_CanvasUpdate(NE_Canvas *canvas)
+{
+	NE_AssertPointer(canvas, "NULL pointer");
+
+	canvas->update = true;
+}
+
+// Copies the modified rows of the back copy of a canvas to VRAM and makes the
+// material use it. VRAM must be mapped to the CPU.
+static int ne_canvas_copy(NE_Canvas *canvas)
+{
+	int back = canvas->front ^ 1;
+	ne_textureinfo_t *info = &NE_Texture[canvas->slot[back]];
+
+	u8 *shadow = canvas->shadow;
+	u8 *vram = (u8 *)info->adress;
+	size_t row_bytes = (canvas->realx * __NE_TextureDepth[canvas->type]) >> 3;
+	int copied = 0;
+
+	for (int i = 0; i < canvas->num_dirty[back]; i++) {
+		// Rows may be 2 bytes long, so the range is extended to whole
+		// words. The end of the texture may not be aligned to 4 bytes.
+		size_t start = (canvas->dirty_start[back][i] * row_bytes) & ~3;
+		size_t end = ((canvas->dirty_end[back][i] + 1) * row_bytes + 3)
+			     & ~3;
+		if (end > canvas->size)
+			end = canvas->size;
+
+		DC_FlushRange(shadow + start, end - start);
+
+		if ((end - start) & 3)
+			dmaCopyHalfWords(3, shadow + start, vram + start,
+					 end - start);
+		else
+			dmaCopyWords(3, shadow + start, vram + start,
+				     end - start);
+
+		copied += end - start;
+	}
+
+	canvas->num_dirty[back] = 0;
+
+	// Switch the material to the updated copy, unless the user has given
+	// it a different texture.
+	NE_Material *tex = canvas->material;
+	if (tex != NULL && tex->texindex == canvas->slot[canvas->front]) {
+		NE_Texture[canvas->slot[canvas->front]].uses--;
+		NE_Texture[canvas->slot[back]].uses++;
+		tex->texindex = canvas->slot[back];
+	}
+
+	canvas->front = back;
+
+	return copied;
+}
+
+int NE_CanvasVBL(void)
+{
+	if (!ne_texture_system_inited)
+		return 0;
+
+	int copied = 0;
+	bool banks_unlocked = false;
+	u32 vramTemp = 0;
+
+	for (int i = 0; i < NE_MAX_CANVASES; i++) {
+		NE_Canvas *canvas = ne_canvases[i];
+
+		if (canvas == NULL || !canvas->update)
+			continue;
+
+		// The contents of the canvas may be incomplete
+		if (drawingtexture_canvas == canvas)
+			continue;
+
+		int back = canvas->front ^ 1;
+
+		// The copy hasn't been copied to VRAM by the upload queue yet
+		if (NE_Texture[canvas->slot[back]].pending)
+			continue;
+
+		canvas->update = false;
+
+		// Both copies are up to date
+		if (canvas->num_dirty[back] == 0)
+			continue;
+
+		if (!banks_unlocked) {
+			vramTemp = vramSetPrimaryBanks(VRAM_A_LCD, VRAM_B_LCD,
+						       VRAM_C_LCD, VRAM_D_LCD);
+			banks_unlocked = true;
+		}
+
+		copied += ne_canvas_copy(canvas);
+	}
+
+	if (banks_unlocked)
+		vramRestorePrimaryBanks(vramTemp);
+
+	return copied;
 }
@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2008-2011, 2019, Antonio Niño Díaz
+//
+// This file is part of Nitro Engine
+
+// Host test of ne_interpolate_vertices(), used to draw interpolated frames of
+// NEA models. On the PC the DSP multiplies are replaced by the C versions of
+// the macros, which are the reference of the ARM code. It checks that the
+// commands sent to the GPU are the same ones sent by the loop that was used
+// before, for every pair of frames and every time from -64 to 64.
+//
+// By default it uses a model with random data. The path of a NEA file (version
+// 2, like the ones created by md2_to_nea -v2) can be passed as argument.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint16_t u16;
+typedef int16_t s16;
+typedef uint32_t u32;
+typedef int32_t s32;
+
+// GPU commands are saved in a log instead of being sent to the GPU
+static u32 command_log[2][1 << 16];
+static u32 *command_ptr;
+
+#define GFX_TEX_COORD	(*command_ptr++)
+#define GFX_NORMAL	(*command_ptr++)
+#define GFX_VERTEX16	(*command_ptr++)
+
+#define ARM_CODE
+#define ITCM_CODE
+
+// ne_interpolate_vertices() and its macros, taken from NEModel.c
+#include "model_interpolation_gen.h"
+
+// Previous implementation, from __ne_drawanimatedmodel_interpolate()
+static void old_interpolate_vertices(u16 *frame_one_ptr, u16 *frame_two_ptr,
+				     u32 vtxcount, s16 *vtxarrayptr,
+				     s16 *normarrayptr, s16 *texcoordsarrayptr,
+				     u32 time)
+{
+	for (u32 i = 0; i < vtxcount; i++) {
+		s32 vector[3];
+		s16 *frame_one_anim, *frame_two_anim;
+
+		// Texture coordinates
+		// -------------------
+
+		frame_one_anim = &texcoordsarrayptr[*frame_one_ptr * 2];
+		GFX_TEX_COORD = ((s32) * frame_one_anim) |
+				(((s32) * (frame_one_anim + 1)) << 16);
+		frame_one_ptr++;
+		frame_two_ptr++;
+
+		// Normal
+		// ------
+
+		frame_one_anim = &normarrayptr[*frame_one_ptr * 3];
+		frame_two_anim = &normarrayptr[*frame_two_ptr * 3];
+		for (int j = 0; j < 3; j++) {
+			vector[j] = (s32) *frame_one_anim;
+			vector[j] += (((s32) *frame_two_anim -
+				       (s32) *frame_one_anim) * time) >> 6;
+			vector[j] &= 0x3FF;
+			frame_one_anim++;
+			frame_two_anim++;
+		}
+		GFX_NORMAL = (vector[0] << 20) | (vector[1] << 10) | vector[2];
+		frame_one_ptr++;
+		frame_two_ptr++;
+
+		// Vertex
+		// ------
+
+		frame_one_anim = &vtxarrayptr[*frame_one_ptr * 3];
+		frame_two_anim = &vtxarrayptr[*frame_two_ptr * 3];
+		for (int j = 0; j < 3; j++) {
+			vector[j] = (s32) *frame_one_anim;
+			vector[j] += (((s32) *frame_two_anim -
+				       (s32) *frame_one_anim) * time) >> 6;
+			vector[j] &= 0xFFFF;
+			frame_one_anim++;
+			frame_two_anim++;
+		}
+		GFX_VERTEX16 = vector[0] | (vector[1] << 16);
+		GFX_VERTEX16 = vector[2];
+		frame_one_ptr++;
+		frame_two_ptr++;
+	}
+}
+
+typedef struct {
+	u32 num_frames;
+	u32 num_vertices;
+	u16 *frames;	// Indices of texcoord, normal and vertex per vertex
+	s16 *vtx;
+	s16 *norm;
+	s16 *texcoords;
+} model_t;
+
+static void *load_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	rewind(f);
+
+	void *data = malloc(size);
+	if (data != NULL && fread(data, 1, size, f) != (size_t)size) {
+		free(data);
+		data = NULL;
+	}
+
+	fclose(f);
+	return data;
+}
+
+static int load_nea(model_t *model, const char *path)
+{
+	u32 *file = load_file(path);
+	if (file == NULL) {
+		printf("Can't read %s\n", path);
+		return 0;
+	}
+
+	if (file[1] != 2) {
+		printf("Only NEA version 2 files are supported\n");
+		return 0;
+	}
+
+	char *base = (char *)file;
+
+	model->num_frames = file[2];
+	model->num_vertices = file[3];
+	model->frames = (u16 *)(base + file[4]);
+	model->vtx = (s16 *)(base + file[5]);
+	model->norm = (s16 *)(base + file[6]);
+	model->texcoords = (s16 *)(base + file[7]);
+
+	return 1;
+}
+
+// Random data, using the whole range of the values
+static int create_random(model_t *model)
+{
+	const int num_values = 512;
+
+	model->num_frames = 8;
+	model->num_vertices = 600;
+	model->frames = malloc(model->num_frames * model->num_vertices * 3
+			       * sizeof(u16));
+	model->vtx = malloc(num_values * 3 * sizeof(s16));
+	model->norm = malloc(num_values * 3 * sizeof(s16));
+	model->texcoords = malloc(num_values * 2 * sizeof(s16));
+
+	if (model->frames == NULL || model->vtx == NULL || model->norm == NULL
+	    || model->texcoords == NULL) {
+		printf("Not enough memory\n");
+		return 0;
+	}
+
+	for (u32 i = 0; i < model->num_frames * model->num_vertices * 3; i++)
+		model->frames[i] = rand() % num_values;
+
+	for (int i = 0; i < num_values * 3; i++) {
+		model->vtx[i] = rand();
+		// Normals are 10-bit values (v10)
+		model->norm[i] = (rand() & 0x3FF) - 0x200;
+	}
+
+	for (int i = 0; i < num_values * 2; i++)
+		model->texcoords[i] = rand();
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	model_t model;
+
+	srand(1234);
+
+	if (argc > 1) {
+		if (!load_nea(&model, argv[1]))
+			return 1;
+	} else {
+		if (!create_random(&model))
+			return 1;
+	}
+
+	if (model.num_vertices * 4 > sizeof(command_log[0]) / sizeof(u32)) {
+		printf("Too many vertices\n");
+		return 1;
+	}
+
+	u32 stride = model.num_vertices * 3;
+	long tests = 0, failed = 0;
+
+	for (u32 one = 0; one < model.num_frames; one++) {
+		for (u32 two = 0; two < model.num_frames; two++) {
+			u16 *frame_one = model.frames + one * stride;
+			u16 *frame_two = model.frames + two * stride;
+
+			for (int time = -64; time <= 64; time++) {
+				command_ptr = command_log[0];
+				old_interpolate_vertices(frame_one, frame_two,
+							 model.num_vertices,
+							 model.vtx, model.norm,
+							 model.texcoords, time);
+				size_t old_size = command_ptr - command_log[0];
+
+				// Same argument as in NEModel.c
+				s32 weights = ((u32)time << 16)
+					      | ((64 - time) & 0xFFFF);
+
+				command_ptr = command_log[1];
+				ne_interpolate_vertices(frame_one, frame_two,
+							model.num_vertices,
+							model.vtx, model.norm,
+							model.texcoords,
+							weights);
+				size_t new_size = command_ptr - command_log[1];
+
+				tests++;
+
+				if (old_size != new_size
+				    || memcmp(command_log[0], command_log[1],
+					      old_size * sizeof(u32)) != 0) {
+					printf("Frames %u and %u, time %d: "
+					       "different commands\n",
+					       one, two, time);
+					failed++;
+				}
+			}
+		}
+	}
+
+	printf("%u frames, %u vertices: %ld tests, %ld failed\n",
+	       model.num_frames, model.num_vertices, tests, failed);
+
+	return failed != 0;
+}
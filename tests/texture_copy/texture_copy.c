@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2008-2011, 2019, Antonio Niño Díaz
+//
+// This file is part of Nitro Engine
+
+// Host test of ne_texture_copy_padded(), used by NE_MaterialTexLoad() to copy
+// textures to VRAM. It checks that the result is byte-identical to the previous
+// implementation: __NE_TextureResizeWidth() followed by the copy to VRAM, that
+// set the alpha bit of GL_RGB textures.
+//
+// The only difference is the value of the padding texels added to the right of
+// textures whose width isn't a power of 2. They used to have whatever was in
+// the temporary buffer allocated with malloc(), now they are always 0 (with the
+// alpha bit set in GL_RGB textures). The old routine is given a buffer filled
+// with zeroes so that the results can be compared byte by byte.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef enum {
+	GL_RGB32_A3 = 1,
+	GL_RGB4 = 2,
+	GL_RGB16 = 3,
+	GL_RGB256 = 4,
+	GL_COMPRESSED = 5,
+	GL_RGB8_A5 = 6,
+	GL_RGBA = 7,
+	GL_RGB = 8
+} GL_TEXTURE_TYPE_ENUM;
+
+#define NE_AssertPointer(ptr, msg)
+
+// __NE_TextureDepth[] and ne_texture_copy_padded(), taken from NETexture.c
+#include "texture_copy_gen.h"
+
+// Previous implementation, from NETexture.c before ne_texture_copy_padded()
+
+static int old_texture_resize_width(void *source, void *dest,
+				    GL_TEXTURE_TYPE_ENUM type, int height,
+				    int width, int newwidth)
+{
+	NE_AssertPointer(source, "NULL source pointer");
+	NE_AssertPointer(dest, "NULL dest pointer");
+
+	int x, y;
+
+	int bits = __NE_TextureDepth[type];
+
+	if (bits == 16) {
+		// GL_RGBA or GL_RGB
+		// -----------------
+
+		// Cast to correct width
+		u16 *d = dest;
+		u16 *s = source;
+
+		for (y = 0; y < height; y++) {
+			for (x = 0; x < newwidth; x++) {
+				if (x < width)
+					*d = *s++;
+				d++;
+			}
+		}
+
+		return 1;
+
+	} else if (bits == 8) {
+		// GL_RGB256, GL_RGB32_A3 or GL_RGB8_A5
+		// ------------------------------------
+
+		// Cast to correct width
+		u8 *d = dest;
+		u8 *s = source;
+
+		for (y = 0; y < height; y++) {
+			for (x = 0; x < newwidth; x++) {
+				if (x < width)
+					*d = *s++;
+				d++;
+			}
+		}
+
+		return 1;
+
+	} else if (bits == 4) {
+		// GL_RGB16
+		// --------
+
+		// Cast to correct width
+		u8 *d = dest;
+		u8 *s = source;
+		int src_idx = 0;
+		int dst_idx = 0;
+
+		for (y = 0; y < height; y++) {
+			for (x = 0; x < newwidth; x++) {
+				if (x < width) {
+					if (dst_idx == 0)
+						*d = 0;
+
+					*d |= ((*s >> (src_idx << 2)) & 0xF)
+						<< (dst_idx << 2);
+
+					if (src_idx == 1)
+						s++;
+					src_idx ^= 1;
+				}
+
+				if (dst_idx == 1)
+					d++;
+
+				dst_idx ^= 1;
+			}
+		}
+
+		return 1;
+
+	} else if (bits == 2) {
+		// GL_RGB4
+		// -------
+
+		// Cast to correct width
+		u8 *d = dest;
+		u8 *s = source;
+		int src_idx = 0;
+		int dst_idx = 0;
+
+		for (y = 0; y < height; y++) {
+			for (x = 0; x < newwidth; x++) {
+				if (x < width) {
+					if (dst_idx == 0)
+						*d = 0;
+
+					*d |= ((*s >> (src_idx << 1)) & 0x3)
+						<< (dst_idx << 1);
+
+					if (src_idx == 3)
+						s++;
+					src_idx = (src_idx + 1) & 3;
+				}
+
+				if (dst_idx == 3)
+					d++;
+				dst_idx = (dst_idx + 1) & 3;
+			}
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static int __NE_GetValidSize(int size)
+{
+	int valid = 8;
+
+	while (valid < size)
+		valid <<= 1;
+
+	return valid;
+}
+
+// Returns 0 if both ways of copying the texture give the same result
+static int test_texture(GL_TEXTURE_TYPE_ENUM type, int width, int height)
+{
+	int bits = __NE_TextureDepth[type];
+	int newwidth = __NE_GetValidSize(width);
+
+	size_t src_size = ((size_t)width * height * bits + 7) >> 3;
+	size_t size = ((size_t)newwidth * height * bits) >> 3;
+
+	// The source of the library is always aligned to 4 bytes
+	u8 *src = malloc((src_size + 3) & ~3);
+	u8 *expected = calloc(size, 1);
+	// Some extra bytes to check that nothing is written after the end
+	u8 *result = malloc(size + 8);
+
+	if (src == NULL || expected == NULL || result == NULL) {
+		printf("Not enough memory\n");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < src_size; i++)
+		src[i] = rand();
+
+	memset(result, 0xCD, size + 8);
+
+	// Old: the width was only expanded if it wasn't a power of 2
+	if (newwidth != width)
+		old_texture_resize_width(src, expected, type, height, width,
+					 newwidth);
+	else
+		memcpy(expected, src, size);
+
+	if (type == GL_RGB) {
+		u16 *texels = (u16 *)expected;
+
+		for (size_t i = 0; i < size / 2; i++)
+			texels[i] |= 1 << 15;
+	}
+
+	// New
+	size_t written = ne_texture_copy_padded(result, src, bits, width,
+						newwidth, height,
+						type == GL_RGB ? 0x80008000 : 0);
+
+	int ret = 0;
+
+	if (written != size) {
+		printf("Type %d, %dx%d: %zu bytes written, expected %zu\n",
+		       type, width, height, written, size);
+		ret = 1;
+	} else if (memcmp(result, expected, size) != 0) {
+		printf("Type %d, %dx%d: different data\n", type, width, height);
+		ret = 1;
+	} else {
+		for (int i = 0; i < 8; i++) {
+			if (result[size + i] != 0xCD) {
+				printf("Type %d, %dx%d: write after the end\n",
+				       type, width, height);
+				ret = 1;
+				break;
+			}
+		}
+	}
+
+	free(src);
+	free(expected);
+	free(result);
+
+	return ret;
+}
+
+int main(void)
+{
+	const GL_TEXTURE_TYPE_ENUM types[] = {
+		GL_RGB32_A3, GL_RGB4, GL_RGB16, GL_RGB256, GL_RGB8_A5, GL_RGBA,
+		GL_RGB
+	};
+
+	int tests = 0;
+	int failed = 0;
+
+	srand(1234);
+
+	for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+		for (int width = 1; width <= 1024; width++) {
+			// All small widths, and some big ones
+			if (width > 72 && (width % 37) != 0
+			    && __NE_GetValidSize(width) != width)
+				continue;
+
+			for (int height = 1; height <= 9; height += 2) {
+				failed += test_texture(types[t], width, height);
+				tests++;
+			}
+		}
+	}
+
+	printf("%d tests, %d failed\n", tests, failed);
+
+	return failed != 0;
+}
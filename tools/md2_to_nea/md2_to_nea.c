@@ -126,13 +126,39 @@ typedef s16 ds_vec3_t[3];
 
 typedef s16 ds_st_t[2];
 
+// Version 3: texture coordinates and the position used by each vertex are
+// stored once. Frames have one word per position with the deltas from a base
+// pose and the index of the normal.
+
+typedef struct {
+	s32 magic;
+	s32 version;
+
+	s32 num_frames;
+	s32 num_vertices;
+	s32 num_positions;
+
+	s32 offset_frames;	// (u32 shifts + u32 per position) per frame
+	s32 offset_base;	// ds_vec3_t per position
+	s32 offset_norm;	// u32 per normal, packed for GFX_NORMAL
+	s32 offset_st;		// u32 per vertex, packed for GFX_TEX_COORD
+	s32 offset_index;	// u16 per vertex, index of the position
+
+} ds_header_v3_t;
+
+#define NUM_ANORMS (sizeof(anorms) / sizeof(anorms[0]))
+
 //-----------------------------------------------------------
 
 void PrintUsage(void)
 {
 	printf("Usage:\n");
-	printf("    md2_to_nea [input.md2] [output.nea] ([float scale])\n");
+	printf("    md2_to_nea (-v2) [input.md2] [output.nea] ([float scale])\n");
 	printf("       ([float translate x] [float translate x] [float translate x])\n");
+	printf("\n");
+	printf("    -v2: Create a version 2 NEA file instead of version 3. Version\n");
+	printf("         3 files are smaller and faster to draw, but positions are\n");
+	printf("         stored with less precision when they move a lot.\n");
 }
 
 int IsValidSize(int size)
@@ -141,9 +167,302 @@ int IsValidSize(int size)
 		size == 128 || size == 256 || size == 512 || size == 1024);
 }
 
+// Saves the frames created by main() in a NEA v2 file. Returns -1 on error.
+int SaveNEA2(md2_header_t *header, const char *outputfilepath)
+{
+	int num_tris = header->num_tris;
+
+	FILE *file = fopen(outputfilepath, "wb+");
+	if (file == NULL) {
+		printf("\nCouldn't create %s file!", outputfilepath);
+		return -1;
+	}
+
+	ds_header_t temp_header;
+	temp_header.magic = 1296123214; // 'NEAM'
+	temp_header.version = 2;
+	temp_header.num_frames = header->num_frames;
+	temp_header.num_vertices = num_tris * 3;
+	printf("\nNumber of vertices: %d - Each frame: %d\n",
+	       GetVerticesNumber(), temp_header.num_vertices);
+	printf("Number of normals: %d\n", GetNormalNumber());
+	printf("Number of texture coordinates: %d\n", GetTexcoordsNumber());
+	printf("Number of frames: %d\n", temp_header.num_frames);
+	temp_header.offset_norm = sizeof(ds_header_t);
+	temp_header.offset_st =
+	    temp_header.offset_norm + (sizeof(ds_vec3_t) * GetNormalNumber());
+	temp_header.offset_vtx =
+	    temp_header.offset_st + (sizeof(ds_st_t) * GetTexcoordsNumber());
+	temp_header.offset_frames =
+	    temp_header.offset_vtx + (sizeof(ds_vec3_t) * GetVerticesNumber());
+	fwrite(&temp_header, sizeof(ds_header_t), 1, file);
+
+	// Normals...
+	ds_vec3_t temp_vector;
+	int number = GetNormalNumber();
+	int i_;
+	for (i_ = 0; i_ < number; i_++) {
+		GetNormal(i_, (u16 *) & temp_vector[0],
+			  (u16 *) & temp_vector[1], (u16 *) & temp_vector[2]);
+		fwrite(&temp_vector, sizeof(ds_vec3_t), 1, file);
+	}
+
+	// Texcoords
+	ds_st_t temp_texcoord;
+	number = GetTexcoordsNumber();
+	for (i_ = 0; i_ < number; i_++) {
+		GetTexCoord(i_, (u16 *) & temp_texcoord[0],
+			    (u16 *) & temp_texcoord[1]);
+		fwrite(&temp_texcoord, sizeof(ds_st_t), 1, file);
+	}
+
+	// Vertices
+	number = GetVerticesNumber();
+	for (i_ = 0; i_ < number; i_++) {
+		GetVertex(i_, (u16 *) & temp_vector[0],
+			  (u16 *) & temp_vector[1], (u16 *) & temp_vector[2]);
+		fwrite(&temp_vector, sizeof(ds_vec3_t), 1, file);
+	}
+
+	printf("\nSize of a frame: %ld\n",
+	       (long int)(GetFrameSize(0) * sizeof(unsigned short)));
+
+	// Frames
+	for (i_ = 0; i_ < header->num_frames; i_++) {
+		fwrite((int *)GetFramePointer(i_), 1,
+		       GetFrameSize(i_) * sizeof(unsigned short), file);
+	}
+
+	fclose(file);
+
+	return 0;
+}
+
+static s16 PackNormalComponent(float n)
+{
+	int v = (int)(n * (1 << 9) + ((n < 0) ? -0.5f : 0.5f));
+
+	if (v > 511)
+		v = 511;
+	if (v < -512)
+		v = -512;
+
+	return v;
+}
+
+static int WriteU32(FILE *file, u32 value)
+{
+	return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+// Saves a NEA v3 file. Returns the max error of the positions of the vertices,
+// in v16 units, or -1 on error.
+int SaveNEA3(md2_header_t *header, int t_w, int t_h, float general_scale,
+	     float general_trans[3], const char *outputfilepath)
+{
+	int num_frames = header->num_frames;
+	int num_positions = header->num_vertices;
+	int num_vertices = header->num_tris * 3;
+
+	md2_texCoord_t *texcoord =
+	    (md2_texCoord_t *) ((uintptr_t)header->offset_st + (uintptr_t)header);
+	md2_triangle_t *triangle =
+	    (md2_triangle_t *) ((uintptr_t)header->offset_tris + (uintptr_t)header);
+
+	// Positions of all frames in v16 format, with the axes swapped like in
+	// version 2 files.
+	int *pos = malloc(sizeof(int) * num_frames * num_positions * 3);
+	u8 *normal = malloc(num_frames * num_positions);
+	ds_vec3_t *base = malloc(sizeof(ds_vec3_t) * num_positions);
+	u32 *frames = malloc(sizeof(u32) * num_frames * (num_positions + 1));
+	if (pos == NULL || normal == NULL || base == NULL || frames == NULL) {
+		printf("\nNot enough memory!\n");
+		free(pos);
+		free(normal);
+		free(base);
+		free(frames);
+		return -1;
+	}
+
+	const int axis[3] = { 0, 2, 1 };
+
+	for (int f = 0; f < num_frames; f++) {
+		md2_frame_t *frame = (md2_frame_t *) ((uintptr_t)header->offset_frames
+					+ (uintptr_t)header + (header->framesize * f));
+		md2_vertex_t *vtx = (md2_vertex_t *) ((uintptr_t)(&(frame->verts)));
+
+		for (int p = 0; p < num_positions; p++) {
+			for (int a = 0; a < 3; a++) {
+				int k = axis[a];
+				float v = ((float)frame->scale[k] * (float)vtx[p].v[k])
+					  + (float)frame->translate[k];
+				v += general_trans[k];
+				v *= general_scale;
+				pos[(f * num_positions + p) * 3 + a] = floattov16(v);
+			}
+			normal[f * num_positions + p] = vtx[p].normalIndex;
+		}
+	}
+
+	// The base pose is the center of the range of each coordinate, so that
+	// deltas are as small as possible.
+	for (int p = 0; p < num_positions; p++) {
+		for (int a = 0; a < 3; a++) {
+			int min = 32767, max = -32768;
+			for (int f = 0; f < num_frames; f++) {
+				int v = pos[(f * num_positions + p) * 3 + a];
+				if (v < min)
+					min = v;
+				if (v > max)
+					max = v;
+			}
+			base[p][a] = (min + max) / 2;
+		}
+	}
+
+	// Each axis of each frame uses the smallest shift that lets all deltas
+	// fit in 8 bits.
+	int max_error = 0;
+
+	for (int f = 0; f < num_frames; f++) {
+		u32 *frame = &frames[f * (num_positions + 1)];
+		int shift[3];
+
+		for (int a = 0; a < 3; a++) {
+			int maxdelta = 0;
+			for (int p = 0; p < num_positions; p++) {
+				int d = pos[(f * num_positions + p) * 3 + a]
+					- base[p][a];
+				if (abs(d) > maxdelta)
+					maxdelta = abs(d);
+			}
+
+			shift[a] = 0;
+			while ((maxdelta + (1 << shift[a] >> 1)) >> shift[a] > 127)
+				shift[a]++;
+		}
+
+		frame[0] = shift[0] | (shift[1] << 8) | (shift[2] << 16);
+
+		for (int p = 0; p < num_positions; p++) {
+			u32 word = (u32)normal[f * num_positions + p] << 24;
+
+			for (int a = 0; a < 3; a++) {
+				int v = pos[(f * num_positions + p) * 3 + a];
+				int d = v - base[p][a];
+				int round = (1 << shift[a]) >> 1;
+				int q = d >= 0 ? (d + round) >> shift[a]
+					       : -((-d + round) >> shift[a]);
+
+				// Don't let the position overflow
+				while (base[p][a] + q * (1 << shift[a]) > 32767)
+					q--;
+				while (base[p][a] + q * (1 << shift[a]) < -32768)
+					q++;
+
+				int error = abs(base[p][a] + q * (1 << shift[a]) - v);
+				if (error > max_error)
+					max_error = error;
+
+				word |= (u32)(q & 0xFF) << (a * 8);
+			}
+
+			frame[p + 1] = word;
+		}
+	}
+
+	free(pos);
+	free(normal);
+
+	FILE *file = fopen(outputfilepath, "wb+");
+	if (file == NULL) {
+		printf("\nCouldn't create %s file!", outputfilepath);
+		free(base);
+		free(frames);
+		return -1;
+	}
+
+	ds_header_v3_t temp_header;
+	temp_header.magic = 1296123214; // 'NEAM'
+	temp_header.version = 3;
+	temp_header.num_frames = num_frames;
+	temp_header.num_vertices = num_vertices;
+	temp_header.num_positions = num_positions;
+	temp_header.offset_norm = sizeof(ds_header_v3_t);
+	temp_header.offset_st =
+	    temp_header.offset_norm + sizeof(u32) * NUM_ANORMS;
+	temp_header.offset_frames =
+	    temp_header.offset_st + sizeof(u32) * num_vertices;
+	temp_header.offset_base =
+	    temp_header.offset_frames
+	    + sizeof(u32) * num_frames * (num_positions + 1);
+	temp_header.offset_index =
+	    temp_header.offset_base + sizeof(ds_vec3_t) * num_positions;
+
+	int ok = fwrite(&temp_header, sizeof(ds_header_v3_t), 1, file) == 1;
+
+	// Normals
+	for (unsigned int i = 0; ok && i < NUM_ANORMS; i++) {
+		u32 x = PackNormalComponent(anorms[i][0]) & 0x3FF;
+		u32 y = PackNormalComponent(anorms[i][1]) & 0x3FF;
+		u32 z = PackNormalComponent(anorms[i][2]) & 0x3FF;
+		ok = WriteU32(file, (x << 20) | (y << 10) | z);
+	}
+
+	// Texture coordinates
+	for (int t = 0; ok && t < header->num_tris; t++) {
+		for (int v = 0; ok && v < 3; v++) {
+			// Change UVs if using a texture size unsupported by DS
+			short s_ = texcoord[triangle[t].st[v]].s;
+			short t_ = texcoord[triangle[t].st[v]].t;
+			s_ = (int)((float)(s_ * t_w) / (float)header->skinwidth);
+			t_ = (int)((float)(t_ * t_h) / (float)header->skinheight);
+
+			ok = WriteU32(file, ((u16)(s_ << 4))
+					    | ((u32)(u16)(t_ << 4) << 16));
+		}
+	}
+
+	// Frames
+	if (ok) {
+		size_t n = num_frames * (num_positions + 1);
+		ok = fwrite(frames, sizeof(u32), n, file) == n;
+	}
+
+	// Base pose
+	if (ok)
+		ok = fwrite(base, sizeof(ds_vec3_t), num_positions, file)
+		     == (size_t)num_positions;
+
+	// Position of each vertex
+	for (int t = 0; ok && t < header->num_tris; t++) {
+		for (int v = 0; ok && v < 3; v++) {
+			u16 index = triangle[t].vertex[v];
+			ok = fwrite(&index, sizeof(index), 1, file) == 1;
+		}
+	}
+
+	fclose(file);
+	free(base);
+	free(frames);
+
+	if (!ok) {
+		printf("\nWrite error!\n");
+		return -1;
+	}
+
+	printf("\nNumber of vertices: %d\n", num_vertices);
+	printf("Number of positions: %d\n", num_positions);
+	printf("Number of frames: %d\n", num_frames);
+	printf("\nSize of a frame: %ld\n",
+	       (long int)(sizeof(u32) * (num_positions + 1)));
+
+	return max_error;
+}
+
 int main(int argc, char *argv[])
 {
-	printf("md2_to_nea v2.1\n");
+	printf("md2_to_nea v3.0\n");
 	printf("\n");
 	printf("Copyright (c) 2008-2011, 2019 Antonio Nino Diaz\n");
 	printf("\n");
@@ -151,6 +470,13 @@ int main(int argc, char *argv[])
 	// DEFAULT VALUES
 	float general_scale = 1;
 	float general_trans[3] = { 0, 0, 0 };
+	int version = 3;
+
+	if (argc > 1 && strcmp(argv[1], "-v2") == 0) {
+		version = 2;
+		argc--;
+		argv++;
+	}
 
 	switch (argc) {
 	case 0:
@@ -356,71 +682,26 @@ int main(int argc, char *argv[])
 
 	printf("\nCreating NEA file...\n");
 
-	// Now, let's save them into a NEA file.
-	FILE *file = fopen(outputfilepath, "wb+");
-	if (file == NULL) {
-		printf("\nCouldn't create %s file!", outputfilepath);
-		EndDynamicLists();
-		return -1;
-	}
-
-	ds_header_t temp_header;
-	temp_header.magic = 1296123214; // 'NEAM'
-	temp_header.version = 2;
-	temp_header.num_frames = header->num_frames;
-	temp_header.num_vertices = num_tris * 3;
-	printf("\nNumber of vertices: %d - Each frame: %d\n",
-	       GetVerticesNumber(), temp_header.num_vertices);
-	printf("Number of normals: %d\n", GetNormalNumber());
-	printf("Number of texture coordinates: %d\n", GetTexcoordsNumber());
-	printf("Number of frames: %d\n", temp_header.num_frames);
-	temp_header.offset_norm = sizeof(ds_header_t);
-	temp_header.offset_st =
-	    temp_header.offset_norm + (sizeof(ds_vec3_t) * GetNormalNumber());
-	temp_header.offset_vtx =
-	    temp_header.offset_st + (sizeof(ds_st_t) * GetTexcoordsNumber());
-	temp_header.offset_frames =
-	    temp_header.offset_vtx + (sizeof(ds_vec3_t) * GetVerticesNumber());
-	fwrite(&temp_header, sizeof(ds_header_t), 1, file);
-
-	// Normals...
-	ds_vec3_t temp_vector;
-	int number = GetNormalNumber();
-	int i_;
-	for (i_ = 0; i_ < number; i_++) {
-		GetNormal(i_, (u16 *) & temp_vector[0],
-			  (u16 *) & temp_vector[1], (u16 *) & temp_vector[2]);
-		fwrite(&temp_vector, sizeof(ds_vec3_t), 1, file);
-	}
+	if (version == 3) {
+		int max_error = SaveNEA3(header, t_w, t_h, general_scale,
+					 general_trans, outputfilepath);
 
-	// Texcoords
-	ds_st_t temp_texcoord;
-	number = GetTexcoordsNumber();
-	for (i_ = 0; i_ < number; i_++) {
-		GetTexCoord(i_, (u16 *) & temp_texcoord[0],
-			    (u16 *) & temp_texcoord[1]);
-		fwrite(&temp_texcoord, sizeof(ds_st_t), 1, file);
-	}
+		EndDynamicLists();
 
-	// Vertices
-	number = GetVerticesNumber();
-	for (i_ = 0; i_ < number; i_++) {
-		GetVertex(i_, (u16 *) & temp_vector[0],
-			  (u16 *) & temp_vector[1], (u16 *) & temp_vector[2]);
-		fwrite(&temp_vector, sizeof(ds_vec3_t), 1, file);
-	}
+		if (max_error < 0)
+			return -1;
 
-	printf("\nSize of a frame: %ld\n",
-	       (long int)(GetFrameSize(0) * sizeof(unsigned short)));
+		printf("Max. position error: %d (%f)\n", max_error,
+		       (float)max_error / (1 << 12));
+	} else {
+		if (SaveNEA2(header, outputfilepath) < 0) {
+			EndDynamicLists();
+			return -1;
+		}
 
-	// Frames
-	for (i_ = 0; i_ < header->num_frames; i_++) {
-		fwrite((int *)GetFramePointer(i_), 1,
-		       GetFrameSize(i_) * sizeof(unsigned short), file);
+		EndDynamicLists();
 	}
 
-	fclose(file);
-
 	FILE *test = fopen(outputfilepath, "rb");
 	fseek(test, 0, SEEK_END);
 	long int size = ftell(test);
@@ -433,7 +714,5 @@ int main(int argc, char *argv[])
 
 	printf("\n\nReady!\n\n");
 
-	EndDynamicLists();
-
 	return 0;
 }
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Copyright (c) 2008-2011, 2019, Antonio Niño Díaz
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dlmaker.h"
+#include "nds.h"
+
+#define MAX_DL 1024
+#define MAX_PARAMS 8
+
+// Size of the buffer of each display list, in words
+#define DEFAULT_DL_WORDS (DEFAULT_DL_SIZE / sizeof(unsigned int))
+
+unsigned int DLSize[MAX_DL];
+unsigned int *DLPointer[MAX_DL];
+int DLcount = 0;
+
+// Set when a display list can't be created. It is returned by FinishDL().
+int DLError = 0;
+
+unsigned char command[4];
+int commands;
+
+unsigned int param[MAX_PARAMS];
+int params;
+
+void NewDL(void)
+{
+	command[0] = command[1] = command[2] = command[3] = 0;
+	param[0] = param[1] = param[2] = param[3] = 0;
+	param[4] = param[5] = param[6] = param[7] = 0;
+	commands = 0;
+	params = 0;
+
+	if (DLError)
+		return;
+
+	if (DLcount >= MAX_DL) {
+		printf("\n\nToo many display lists.\n\n");
+		DLError = 1;
+		return;
+	}
+
+	DLPointer[DLcount] = (unsigned int *)malloc(DEFAULT_DL_SIZE);
+	if (DLPointer[DLcount] == NULL) {
+		printf("\n\nNot enough memory for display list.\n\n");
+		DLError = 1;
+		return;
+	}
+	DLSize[DLcount] = 1;
+}
+
+void NewCommandDL(int id)
+{
+	if (DLError)
+		return;
+
+	command[commands] = id;
+	commands++;
+
+	if (commands == 4) {
+		commands = 0;
+
+		// Check that the packed commands and their parameters fit
+		if (DLSize[DLcount] + 1 + params > DEFAULT_DL_WORDS) {
+			printf("\n\nDisplay list buffer overflow.\n\n");
+			DLError = 1;
+			return;
+		}
+
+		// Save data to display list
+		unsigned int temp;
+		temp =
+		    COMMAND_PACK(command[0], command[1], command[2],
+				 command[3]);
+		command[0] = command[1] = command[2] = command[3] = 0;
+		unsigned int *pointer =
+		    &((DLPointer[DLcount])[DLSize[DLcount]]);
+		// Save commands
+		*pointer = temp;
+		DLSize[DLcount]++;
+		if (params > 0) {
+			pointer = &((DLPointer[DLcount])[DLSize[DLcount]]);
+			int a;
+			for (a = 0; a < params; a++) {
+				// Save commands
+				pointer[a] = param[a];
+				DLSize[DLcount]++;
+			}
+		}
+		param[0] = param[1] = param[2] = param[3] = 0;
+		param[4] = param[5] = param[6] = param[7] = 0;
+		params = 0;
+	}
+}
+
+void NewParamDL(unsigned int param_)
+{
+	if (DLError)
+		return;
+
+	if (params >= MAX_PARAMS) {
+		printf("\n\nToo many parameters in packed commands.\n\n");
+		DLError = 1;
+		return;
+	}
+
+	param[params] = param_;
+	params++;
+}
+
+int FinishDL(void)
+{
+	// Add NOP commands to fill packed commands
+	while (commands > 0 && !DLError)
+		NewCommandDL(ID_NOP);
+
+	if (DLError)
+		return -1;
+
+	// DL real size in 4 bytes packs
+	*DLPointer[DLcount] = DLSize[DLcount] - 1;
+	DLcount++;
+
+	return 0;
+}
+
+int GetDLSize(int num)
+{
+	return DLSize[num];
+}
+
+unsigned int *GetDLPointer(int num)
+{
+	return DLPointer[num];
+}
@@ -0,0 +1,975 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Copyright (c) 2008-2011, 2019, Antonio Niño Díaz
+
+// Converts MD5 models (md5mesh + md5anim) into NEB files. Each vertex is
+// attached to the joint with the largest weight, and its position is stored
+// relative to that joint, so that the matrix of the joint places it.
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dlmaker.h"
+#include "nds.h"
+
+// Must be the same as NE_MAX_BONES
+#define MAX_BONES	24
+
+// Size of the matrix stack of the DS
+#define STACK_SLOTS	31
+
+typedef signed int s32;
+typedef unsigned int u32;
+typedef signed short s16;
+typedef unsigned short u16;
+
+#define absf(x) (((x) > 0) ? (x) : -(x))
+
+//----------------------------------------------------
+//                    MD5 structs
+//----------------------------------------------------
+
+typedef float vec3_t[3];
+typedef float quat_t[4]; // x, y, z, w
+
+typedef struct {
+	int parent;
+	vec3_t pos;
+	quat_t orient;
+
+	// Animation
+	int flags;
+	int start_index;
+
+	// Conversion
+	int used;	// It has vertices or children with vertices
+	int bone;	// Index in the NEB file
+} md5_joint_t;
+
+typedef struct {
+	float s, t;
+	int start, count;	// Weights
+	int joint;		// Joint with the largest weight
+	vec3_t pos;		// Relative to the joint
+	vec3_t normal;		// Relative to the joint
+} md5_vertex_t;
+
+typedef struct {
+	int joint;
+	float bias;
+	vec3_t pos;
+} md5_weight_t;
+
+//----------------------------------------------------
+//                  Converted structs
+//----------------------------------------------------
+
+typedef struct {
+	s32 magic;
+	s32 version;
+
+	s32 num_frames;
+	s32 num_vertices;
+	s32 num_bones;
+	s32 first_slot;
+
+	s32 offset_bones;
+	s32 offset_frames;
+
+} ds_header_t;
+
+typedef struct {
+	s32 parent;
+	s32 offset_list;
+} ds_bone_t;
+
+typedef struct {
+	s16 t[3];
+	s16 q[4];
+	s16 padding;
+} ds_key_t;
+
+//----------------------------------------------------
+//                     Parser
+//----------------------------------------------------
+
+static char *text;
+static char token[256];
+
+// Reads the next token. Parentheses and braces are tokens on their own, and
+// strings are returned without the quotes. Returns 0 at the end of the file.
+static int NextToken(void)
+{
+	while (1) {
+		while (isspace((unsigned char)*text))
+			text++;
+
+		if (text[0] == '/' && text[1] == '/') {
+			while (*text != '\n' && *text != '\0')
+				text++;
+			continue;
+		}
+
+		break;
+	}
+
+	if (*text == '\0')
+		return 0;
+
+	int len = 0;
+
+	if (*text == '"') {
+		text++;
+		while (*text != '"' && *text != '\0') {
+			if (len < (int)sizeof(token) - 1)
+				token[len++] = *text;
+			text++;
+		}
+		if (*text == '"')
+			text++;
+	} else if (strchr("(){}", *text)) {
+		token[len++] = *text++;
+	} else {
+		while (*text != '\0' && !isspace((unsigned char)*text)
+		       && !strchr("(){}\"", *text)) {
+			if (len < (int)sizeof(token) - 1)
+				token[len++] = *text;
+			text++;
+		}
+	}
+
+	token[len] = '\0';
+	return 1;
+}
+
+static int Expect(const char *str)
+{
+	if (NextToken() && strcmp(token, str) == 0)
+		return 1;
+
+	printf("\nParse error: expected \"%s\", found \"%s\"\n", str, token);
+	return 0;
+}
+
+static int ReadInt(int *value)
+{
+	char *end;
+
+	if (!NextToken())
+		return 0;
+	*value = strtol(token, &end, 10);
+	return *end == '\0';
+}
+
+static int ReadFloat(float *value)
+{
+	char *end;
+
+	if (!NextToken())
+		return 0;
+	*value = strtof(token, &end);
+	return *end == '\0';
+}
+
+static int ReadVector(float *v, int n)
+{
+	if (!Expect("("))
+		return 0;
+	for (int i = 0; i < n; i++)
+		if (!ReadFloat(&v[i]))
+			return 0;
+	return Expect(")");
+}
+
+// Skips a block that starts with "{"
+static int SkipBlock(void)
+{
+	if (!Expect("{"))
+		return 0;
+
+	while (NextToken()) {
+		if (strcmp(token, "}") == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static char *LoadText(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		printf("\nCouldn't open %s!!\n\n", path);
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	rewind(f);
+
+	char *data = malloc(size + 1);
+	if (data == NULL) {
+		fclose(f);
+		printf("\nNot enough memory!!\n\n");
+		return NULL;
+	}
+
+	if (fread(data, 1, size, f) != (size_t)size) {
+		fclose(f);
+		free(data);
+		printf("\nCouldn't read %s!!\n\n", path);
+		return NULL;
+	}
+	data[size] = '\0';
+
+	fclose(f);
+	return data;
+}
+
+//----------------------------------------------------
+//                      Math
+//----------------------------------------------------
+
+// The W component isn't stored in MD5 files
+static void QuatComputeW(quat_t q)
+{
+	float t = 1.0f - q[0] * q[0] - q[1] * q[1] - q[2] * q[2];
+	q[3] = (t < 0) ? 0 : -sqrtf(t);
+}
+
+static void QuatRotate(const quat_t q, const vec3_t v, vec3_t out)
+{
+	// out = v + 2 * cross(q.xyz, cross(q.xyz, v) + q.w * v)
+	vec3_t c = {
+		q[1] * v[2] - q[2] * v[1] + q[3] * v[0],
+		q[2] * v[0] - q[0] * v[2] + q[3] * v[1],
+		q[0] * v[1] - q[1] * v[0] + q[3] * v[2]
+	};
+	vec3_t r = {
+		v[0] + 2 * (q[1] * c[2] - q[2] * c[1]),
+		v[1] + 2 * (q[2] * c[0] - q[0] * c[2]),
+		v[2] + 2 * (q[0] * c[1] - q[1] * c[0])
+	};
+
+	out[0] = r[0];
+	out[1] = r[1];
+	out[2] = r[2];
+}
+
+// Normals are saturated to the range of v10
+static int NormalComponent(float n)
+{
+	int v = (int)(n * (1 << 9) + ((n < 0) ? -0.5f : 0.5f));
+
+	if (v > 511)
+		v = 511;
+	if (v < -512)
+		v = -512;
+
+	return v;
+}
+
+static void QuatConjugate(const quat_t q, quat_t out)
+{
+	out[0] = -q[0];
+	out[1] = -q[1];
+	out[2] = -q[2];
+	out[3] = q[3];
+}
+
+// The DS uses the Y axis as up, MD5 models use Z. Swapping both axes is a
+// reflection, so rotations change direction.
+static void SwapAxes(vec3_t v)
+{
+	float y = v[1];
+	v[1] = v[2];
+	v[2] = y;
+}
+
+static void SwapAxesQuat(quat_t q)
+{
+	float y = q[1];
+	q[0] = -q[0];
+	q[1] = -q[2];
+	q[2] = -y;
+}
+
+//-----------------------------------------------------------
+
+void PrintUsage(void)
+{
+	printf("Usage:\n");
+	printf("    md5_to_neb [input.md5mesh] [input.md5anim] [output.neb]\n");
+	printf("       [texture width] [texture height] ([float scale])\n");
+	printf("       ([float translate x] [float translate y] [float translate z])\n");
+}
+
+static md5_joint_t *joints;
+static int num_joints;
+
+static md5_vertex_t *vertices;
+static int num_vertices;
+
+static int *triangles; // 3 vertices each
+static int num_tris;
+
+static md5_weight_t *weights;
+static int num_weights;
+
+static int LoadMesh(const char *path)
+{
+	char *data = LoadText(path);
+	if (data == NULL)
+		return 0;
+
+	text = data;
+
+	int version, num_meshes = 0;
+
+	if (!Expect("MD5Version") || !ReadInt(&version))
+		goto error;
+	if (version != 10) {
+		printf("\nWrong MD5 version: %d\n", version);
+		goto error;
+	}
+
+	while (NextToken()) {
+		if (strcmp(token, "commandline") == 0) {
+			NextToken();
+		} else if (strcmp(token, "numJoints") == 0) {
+			if (!ReadInt(&num_joints))
+				goto error;
+			joints = calloc(num_joints, sizeof(md5_joint_t));
+		} else if (strcmp(token, "numMeshes") == 0) {
+			if (!ReadInt(&num_meshes))
+				goto error;
+		} else if (strcmp(token, "joints") == 0) {
+			if (joints == NULL || !Expect("{"))
+				goto error;
+
+			for (int i = 0; i < num_joints; i++) {
+				md5_joint_t *j = &joints[i];
+
+				NextToken(); // Name
+				if (!ReadInt(&j->parent)
+				    || !ReadVector(j->pos, 3)
+				    || !ReadVector(j->orient, 3))
+					goto error;
+				QuatComputeW(j->orient);
+
+				if (j->parent >= i) {
+					printf("\nJoint %d is before its parent\n",
+					       i);
+					goto error;
+				}
+			}
+
+			if (!Expect("}"))
+				goto error;
+		} else if (strcmp(token, "mesh") == 0) {
+			// All meshes are joined in one model
+			int first_vertex = num_vertices;
+			int first_tri = num_tris;
+			int first_weight = num_weights;
+
+			if (!Expect("{"))
+				goto error;
+
+			while (NextToken() && strcmp(token, "}") != 0) {
+				int n, index;
+
+				if (strcmp(token, "shader") == 0) {
+					NextToken();
+				} else if (strcmp(token, "numverts") == 0) {
+					if (!ReadInt(&n))
+						goto error;
+					vertices = realloc(vertices,
+						(num_vertices + n) * sizeof(md5_vertex_t));
+					memset(&vertices[num_vertices], 0,
+					       n * sizeof(md5_vertex_t));
+					num_vertices += n;
+				} else if (strcmp(token, "vert") == 0) {
+					float st[2];
+					if (!ReadInt(&index) || !ReadVector(st, 2)
+					    || index < 0
+					    || first_vertex + index >= num_vertices)
+						goto error;
+					md5_vertex_t *v = &vertices[first_vertex + index];
+					v->s = st[0];
+					v->t = st[1];
+					if (!ReadInt(&v->start) || !ReadInt(&v->count))
+						goto error;
+					v->start += first_weight;
+				} else if (strcmp(token, "numtris") == 0) {
+					if (!ReadInt(&n))
+						goto error;
+					triangles = realloc(triangles,
+						(num_tris + n) * 3 * sizeof(int));
+					num_tris += n;
+				} else if (strcmp(token, "tri") == 0) {
+					int t[3];
+					if (!ReadInt(&index) || !ReadInt(&t[0])
+					    || !ReadInt(&t[1]) || !ReadInt(&t[2])
+					    || index < 0 || first_tri + index >= num_tris)
+						goto error;
+					int *tri = &triangles[(first_tri + index) * 3];
+					for (int k = 0; k < 3; k++) {
+						if (t[k] < 0 || first_vertex + t[k] >= num_vertices)
+							goto error;
+						tri[k] = first_vertex + t[k];
+					}
+				} else if (strcmp(token, "numweights") == 0) {
+					if (!ReadInt(&n))
+						goto error;
+					weights = realloc(weights,
+						(num_weights + n) * sizeof(md5_weight_t));
+					num_weights += n;
+				} else if (strcmp(token, "weight") == 0) {
+					if (!ReadInt(&index) || index < 0
+					    || first_weight + index >= num_weights)
+						goto error;
+					md5_weight_t *w = &weights[first_weight + index];
+					if (!ReadInt(&w->joint) || !ReadFloat(&w->bias)
+					    || !ReadVector(w->pos, 3)
+					    || w->joint < 0 || w->joint >= num_joints)
+						goto error;
+				} else {
+					printf("\nUnknown token in mesh: %s\n", token);
+					goto error;
+				}
+			}
+		} else {
+			printf("\nUnknown token: %s\n", token);
+			goto error;
+		}
+	}
+
+	free(data);
+
+	if (num_joints == 0 || num_vertices == 0 || num_tris == 0) {
+		printf("\nThe model is empty!!\n");
+		return 0;
+	}
+
+	return 1;
+
+error:
+	free(data);
+	return 0;
+}
+
+static int num_frames;
+static float frame_rate;
+static float *frame_data; // Animated components of all frames
+static int num_components;
+
+static int LoadAnim(const char *path)
+{
+	char *data = LoadText(path);
+	if (data == NULL)
+		return 0;
+
+	text = data;
+
+	int version, frames_read = 0;
+
+	if (!Expect("MD5Version") || !ReadInt(&version))
+		goto error;
+	if (version != 10) {
+		printf("\nWrong MD5 version: %d\n", version);
+		goto error;
+	}
+
+	while (NextToken()) {
+		int n;
+
+		if (strcmp(token, "commandline") == 0) {
+			NextToken();
+		} else if (strcmp(token, "numFrames") == 0) {
+			if (!ReadInt(&num_frames))
+				goto error;
+		} else if (strcmp(token, "numJoints") == 0) {
+			if (!ReadInt(&n))
+				goto error;
+			if (n != num_joints) {
+				printf("\nThe animation has %d joints, the mesh has %d\n",
+				       n, num_joints);
+				goto error;
+			}
+		} else if (strcmp(token, "frameRate") == 0) {
+			if (!ReadFloat(&frame_rate))
+				goto error;
+		} else if (strcmp(token, "numAnimatedComponents") == 0) {
+			if (!ReadInt(&num_components) || num_frames <= 0)
+				goto error;
+			frame_data = calloc(num_frames * num_components + 1,
+					    sizeof(float));
+		} else if (strcmp(token, "hierarchy") == 0) {
+			if (!Expect("{"))
+				goto error;
+
+			for (int i = 0; i < num_joints; i++) {
+				int parent;
+
+				NextToken(); // Name
+				if (!ReadInt(&parent) || !ReadInt(&joints[i].flags)
+				    || !ReadInt(&joints[i].start_index))
+					goto error;
+
+				if (parent != joints[i].parent) {
+					printf("\nThe hierarchy of the animation and the mesh are different\n");
+					goto error;
+				}
+			}
+
+			if (!Expect("}"))
+				goto error;
+		} else if (strcmp(token, "bounds") == 0) {
+			if (!SkipBlock())
+				goto error;
+		} else if (strcmp(token, "baseframe") == 0) {
+			if (!Expect("{"))
+				goto error;
+
+			// Joints in the base frame are relative to their parent
+			for (int i = 0; i < num_joints; i++) {
+				if (!ReadVector(joints[i].pos, 3)
+				    || !ReadVector(joints[i].orient, 3))
+					goto error;
+			}
+
+			if (!Expect("}"))
+				goto error;
+		} else if (strcmp(token, "frame") == 0) {
+			if (!ReadInt(&n) || n < 0 || n >= num_frames
+			    || frame_data == NULL || !Expect("{"))
+				goto error;
+
+			for (int i = 0; i < num_components; i++) {
+				if (!ReadFloat(&frame_data[n * num_components + i]))
+					goto error;
+			}
+
+			if (!Expect("}"))
+				goto error;
+
+			frames_read++;
+		} else {
+			printf("\nUnknown token: %s\n", token);
+			goto error;
+		}
+	}
+
+	free(data);
+
+	if (frames_read != num_frames || num_frames == 0) {
+		printf("\nThe animation has %d frames, found %d\n", num_frames,
+		       frames_read);
+		return 0;
+	}
+
+	return 1;
+
+error:
+	free(data);
+	return 0;
+}
+
+// Calculates the transformation of a joint in a frame, relative to its parent
+static void GetFrameJoint(int frame, int joint, vec3_t pos, quat_t orient)
+{
+	md5_joint_t *j = &joints[joint];
+	const float *data = &frame_data[frame * num_components + j->start_index];
+	int n = 0;
+
+	// Base frame
+	memcpy(pos, j->pos, sizeof(vec3_t));
+	memcpy(orient, j->orient, sizeof(float) * 3);
+
+	for (int k = 0; k < 3; k++) {
+		if (j->flags & (1 << k))
+			pos[k] = data[n++];
+	}
+	for (int k = 0; k < 3; k++) {
+		if (j->flags & (8 << k))
+			orient[k] = data[n++];
+	}
+
+	QuatComputeW(orient);
+}
+
+int main(int argc, char *argv[])
+{
+	printf("md5_to_neb v1.0\n");
+	printf("\n");
+	printf("Copyright (c) 2008-2011, 2019 Antonio Nino Diaz\n");
+	printf("\n");
+
+	// DEFAULT VALUES
+	float general_scale = 1;
+	float general_trans[3] = { 0, 0, 0 };
+
+	switch (argc) {
+	case 6:
+		// Use default modifications
+		break;
+	case 7:
+		// Use default translation and custom scale
+		general_scale = atof(argv[6]);
+		break;
+	case 10:
+		// Custom translation + scale
+		general_scale = atof(argv[6]);
+		general_trans[0] = atof(argv[7]);
+		general_trans[1] = atof(argv[8]);
+		general_trans[2] = atof(argv[9]);
+		break;
+	default:
+		PrintUsage();
+		return -1;
+	}
+
+	int t_w = atoi(argv[4]);
+	int t_h = atoi(argv[5]);
+
+	if (general_scale == 0) {
+		printf("\nScale can't be 0!!");
+		PrintUsage();
+		return -1;
+	}
+
+	printf("Scale:     %f\n", general_scale);
+	printf("Translate: %f, %f, %f\n", general_trans[0], general_trans[1],
+	       general_trans[2]);
+
+	printf("\nLoading MD5 model...\n");
+
+	if (!LoadMesh(argv[1]))
+		return -1;
+
+	// Bind pose: attach each vertex to the joint with the largest weight
+	for (int i = 0; i < num_vertices; i++) {
+		md5_vertex_t *v = &vertices[i];
+		vec3_t pos = { 0, 0, 0 };
+		float best = -1;
+
+		if (v->count == 0 || v->start < 0
+		    || v->start + v->count > num_weights) {
+			printf("\nVertex %d has wrong weights!!\n", i);
+			return -1;
+		}
+
+		for (int w = v->start; w < v->start + v->count; w++) {
+			md5_weight_t *weight = &weights[w];
+			md5_joint_t *j = &joints[weight->joint];
+			vec3_t p;
+
+			QuatRotate(j->orient, weight->pos, p);
+			for (int k = 0; k < 3; k++)
+				pos[k] += (j->pos[k] + p[k]) * weight->bias;
+
+			if (weight->bias > best) {
+				best = weight->bias;
+				v->joint = weight->joint;
+			}
+		}
+
+		// Position relative to the joint, in DS axes
+		md5_joint_t *j = &joints[v->joint];
+		quat_t inverse;
+		vec3_t d;
+
+		QuatConjugate(j->orient, inverse);
+		for (int k = 0; k < 3; k++)
+			d[k] = (pos[k] - j->pos[k]) * general_scale;
+		QuatRotate(inverse, d, v->pos);
+		SwapAxes(v->pos);
+
+		// Save the position of the bind pose temporarily
+		memcpy(v->normal, pos, sizeof(vec3_t));
+		SwapAxes(v->normal);
+
+		joints[v->joint].used = 1;
+	}
+
+	// Normals of the bind pose. Triangles are clockwise in MD5 files, and
+	// counterclockwise after swapping the axes.
+	vec3_t *normals = calloc(num_vertices, sizeof(vec3_t));
+	for (int t = 0; t < num_tris; t++) {
+		int *tri = &triangles[t * 3];
+		float *p0 = vertices[tri[0]].normal;
+		float *p1 = vertices[tri[1]].normal;
+		float *p2 = vertices[tri[2]].normal;
+		vec3_t a, b, n;
+
+		for (int k = 0; k < 3; k++) {
+			a[k] = p1[k] - p0[k];
+			b[k] = p2[k] - p0[k];
+		}
+		n[0] = a[1] * b[2] - a[2] * b[1];
+		n[1] = a[2] * b[0] - a[0] * b[2];
+		n[2] = a[0] * b[1] - a[1] * b[0];
+
+		for (int v = 0; v < 3; v++)
+			for (int k = 0; k < 3; k++)
+				normals[tri[v]][k] += n[k];
+	}
+
+	for (int i = 0; i < num_vertices; i++) {
+		md5_vertex_t *v = &vertices[i];
+		float *n = normals[i];
+		float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+		if (len > 0)
+			for (int k = 0; k < 3; k++)
+				n[k] /= len;
+
+		// Normal relative to the joint
+		quat_t orient, inverse;
+		memcpy(orient, joints[v->joint].orient, sizeof(quat_t));
+		SwapAxesQuat(orient);
+		QuatConjugate(orient, inverse);
+		QuatRotate(inverse, n, v->normal);
+	}
+	free(normals);
+
+	if (!LoadAnim(argv[2]))
+		return -1;
+
+	// Joints without vertices are only needed if their children have them.
+	// Parents are always before their children.
+	for (int i = num_joints - 1; i >= 0; i--) {
+		if (joints[i].used && joints[i].parent >= 0)
+			joints[joints[i].parent].used = 1;
+	}
+
+	int num_bones = 0;
+	for (int i = 0; i < num_joints; i++) {
+		joints[i].bone = joints[i].used ? num_bones++ : -1;
+	}
+
+	printf("\nMD5 Information:\n\n");
+	printf("  Number of joints: %d (%d used)\n", num_joints, num_bones);
+	printf("  Number of vertices: %d\n", num_vertices);
+	printf("  Number of triangles: %d\n", num_tris);
+	printf("  Number of frames: %d (%.1f FPS)\n", num_frames, frame_rate);
+
+	if (num_bones > MAX_BONES) {
+		printf("\nModel has too many joints! The max. is %d.\n",
+		       MAX_BONES);
+		return -1;
+	}
+
+	int first_slot = STACK_SLOTS - num_bones;
+
+	// Keyframes
+
+	ds_key_t *keys = calloc(num_frames * num_bones, sizeof(ds_key_t));
+	float bigvalue = 0;
+
+	for (int f = 0; f < num_frames; f++) {
+		for (int i = 0; i < num_joints; i++) {
+			if (joints[i].bone < 0)
+				continue;
+
+			vec3_t pos;
+			quat_t orient;
+			GetFrameJoint(f, i, pos, orient);
+
+			for (int k = 0; k < 3; k++) {
+				if (joints[i].parent < 0)
+					pos[k] += general_trans[k];
+				pos[k] *= general_scale;
+			}
+			SwapAxes(pos);
+			SwapAxesQuat(orient);
+
+			ds_key_t *key = &keys[f * num_bones + joints[i].bone];
+
+			for (int k = 0; k < 3; k++) {
+				if ((absf(pos[k]) > (float)7.9997)
+				    && (absf(bigvalue) < absf(pos[k])))
+					bigvalue = pos[k];
+				key->t[k] = floattov16(pos[k]);
+			}
+
+			// Keep the rotation in the same hemisphere as in the
+			// previous frame so that interpolation is shorter.
+			if (f > 0) {
+				ds_key_t *prev = key - num_bones;
+				float dot = 0;
+				for (int k = 0; k < 4; k++)
+					dot += prev->q[k] * orient[k];
+				if (dot < 0)
+					for (int k = 0; k < 4; k++)
+						orient[k] = -orient[k];
+			}
+
+			for (int k = 0; k < 4; k++)
+				key->q[k] = floattof32(orient[k]);
+		}
+	}
+
+	// Display lists. Each triangle goes to the list of the bone of its first
+	// vertex, and the matrix is changed in the middle of it if the other
+	// vertices belong to other bones.
+
+	ds_bone_t *bones = calloc(num_bones, sizeof(ds_bone_t));
+	int *lists = calloc(num_bones, sizeof(int));
+	int num_lists = 0;
+
+	for (int i = 0; i < num_joints; i++) {
+		int bone = joints[i].bone;
+		if (bone < 0)
+			continue;
+
+		bones[bone].parent = joints[i].parent < 0 ? -1
+				     : joints[joints[i].parent].bone;
+		lists[bone] = -1;
+
+		int tris = 0;
+		for (int t = 0; t < num_tris; t++)
+			if (vertices[triangles[t * 3]].joint == i)
+				tris++;
+		if (tris == 0)
+			continue;
+
+		NewDL();
+
+		int current = bone;
+		NewParamDL(first_slot + bone);
+		NewCommandDL(ID_RESTORE);
+
+		// Send GL_TRIANGLES command
+		NewParamDL(0);
+		NewCommandDL(ID_BEGIN);
+
+		// Keep track of the last command to avoid useless repetition
+		int olds_ = -1, oldt_ = -1;
+
+		for (int t = 0; t < num_tris; t++) {
+			if (vertices[triangles[t * 3]].joint != i)
+				continue;
+
+			for (int k = 0; k < 3; k++) {
+				md5_vertex_t *v = &vertices[triangles[t * 3 + k]];
+				int vbone = joints[v->joint].bone;
+
+				if (vbone != current) {
+					current = vbone;
+					NewParamDL(first_slot + vbone);
+					NewCommandDL(ID_RESTORE);
+				}
+
+				int s_ = (int)(v->s * t_w);
+				int t_ = (int)(v->t * t_h);
+				if (olds_ != s_ || oldt_ != t_) {
+					olds_ = s_;
+					oldt_ = t_;
+					NewParamDL(TEXTURE_PACK(s_ << 4, t_ << 4));
+					NewCommandDL(ID_TEX_COORD);
+				}
+
+				// Normals are transformed by the matrix that is
+				// active when they are sent, so they can't be
+				// skipped like texture coordinates.
+				NewParamDL(VERTEX_10_PACK(NormalComponent(v->normal[0]),
+							  NormalComponent(v->normal[1]),
+							  NormalComponent(v->normal[2])));
+				NewCommandDL(ID_NORMAL);
+
+				for (int a = 0; a < 3; a++) {
+					if ((absf(v->pos[a]) > (float)7.9997)
+					    && (absf(bigvalue) < absf(v->pos[a])))
+						bigvalue = v->pos[a];
+				}
+
+				NewParamDL(((u32)floattov16(v->pos[1]) << 16) |
+					   (floattov16(v->pos[0]) & 0xFFFF));
+				NewParamDL((floattov16(v->pos[2]) & 0xFFFF));
+				NewCommandDL(ID_VERTEX16);
+			}
+		}
+
+		if (FinishDL() != 0) {
+			printf("\nCouldn't create display list of bone %d\n",
+			       bone);
+			return -1;
+		}
+		lists[bone] = num_lists++;
+	}
+
+	if (absf(bigvalue) > 0) {
+		printf("\nModel too big for DS! Scale it down.\n");
+		printf
+		    ("\nDS max. allowed value: +/-7,9997\nModel max. detected value: %f\n\n",
+		     bigvalue);
+		return -1;
+	}
+
+	printf("\nCreating NEB file...\n");
+
+	ds_header_t header;
+	header.magic = 1296188750; // 'NEBM'
+	header.version = 1;
+	header.num_frames = num_frames;
+	header.num_vertices = num_tris * 3;
+	header.num_bones = num_bones;
+	header.first_slot = first_slot;
+	header.offset_bones = sizeof(ds_header_t);
+	header.offset_frames =
+	    header.offset_bones + sizeof(ds_bone_t) * num_bones;
+
+	int offset = header.offset_frames
+		     + sizeof(ds_key_t) * num_frames * num_bones;
+	for (int b = 0; b < num_bones; b++) {
+		if (lists[b] < 0) {
+			bones[b].offset_list = 0;
+			continue;
+		}
+		bones[b].offset_list = offset;
+		offset += GetDLSize(lists[b]) * sizeof(unsigned int);
+	}
+
+	FILE *file = fopen(argv[3], "wb+");
+	if (file == NULL) {
+		printf("\nCouldn't create %s file!", argv[3]);
+		return -1;
+	}
+
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (ok)
+		ok = fwrite(bones, sizeof(ds_bone_t), num_bones, file)
+		     == (size_t)num_bones;
+	if (ok)
+		ok = fwrite(keys, sizeof(ds_key_t), num_frames * num_bones,
+			    file) == (size_t)(num_frames * num_bones);
+	for (int b = 0; ok && b < num_bones; b++) {
+		if (lists[b] < 0)
+			continue;
+		ok = fwrite(GetDLPointer(lists[b]), sizeof(unsigned int),
+			    GetDLSize(lists[b]), file)
+		     == (size_t)GetDLSize(lists[b]);
+	}
+
+	fclose(file);
+
+	if (!ok) {
+		printf("\nWrite error!\n");
+		return -1;
+	}
+
+	printf("\nNumber of bones: %d (matrix stack slots %d to %d)\n",
+	       num_bones, first_slot - 1, STACK_SLOTS - 1);
+	printf("Size of a frame: %ld\n",
+	       (long int)(sizeof(ds_key_t) * num_bones));
+	printf("\nNEB file size: %d bytes", offset);
+
+	printf("\n\nReady!\n\n");
+
+	return 0;
+}
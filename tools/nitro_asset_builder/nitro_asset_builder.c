@@ -0,0 +1,922 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2008-2009, 2019, Antonio Niño Díaz
+//
+// This file is part of Nitro Engine
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#if defined(__APPLE__)
+# define st_mtim st_mtimespec
+#endif
+
+#define NITRO_ASSET_BUILDER_VERSION "1.0.0"
+
+// Max number of words of a line of the manifest
+#define MAX_ARGS 16
+
+// Max number of files created by a conversion. A conversion with shared
+// palettes creates a texture and at most a palette per input, and a manifest.
+#define MAX_OUTPUTS (2 * MAX_ARGS + 1)
+
+#define CACHE_HEADER "# nitro_asset_builder cache v2"
+
+typedef enum {
+	TOOL_TEXTURE,
+	TOOL_NEA,
+	TOOL_BIN,
+	TOOL_NUMBER
+} tool_t;
+
+typedef struct {
+	const char *name;	// Name used in the manifest
+	const char *option;	// Command line option to change the path
+	const char *path;
+	char full_path[PATH_MAX];
+	uint64_t hash;		// Hash of the executable
+	int used;
+} converter_t;
+
+static converter_t converters[TOOL_NUMBER] = {
+	{ "texture", "-texture", "nitro_texture_converter" },
+	{ "nea", "-nea", "md2_to_nea" },
+	{ "bin", "-bin", "md2_to_bin" },
+};
+
+typedef enum {
+	STATE_PENDING,
+	STATE_UP_TO_DATE,
+	STATE_RUNNING,
+	STATE_DONE,
+	STATE_FAILED
+} state_t;
+
+typedef struct {
+	int line;
+	tool_t tool;
+	char *args[MAX_ARGS];
+	int num_args;
+	char *outputs[MAX_OUTPUTS];	// Files created by the conversion
+	int num_outputs;
+	uint64_t key;		// Hash of the converter, arguments and inputs
+	state_t state;
+	pid_t pid;
+	char log_filename[PATH_MAX];
+	struct timespec start;
+	time_t start_time;	// Used to tell which outputs were created
+	double time_ms;
+} asset_t;
+
+// The content hash of files is saved in the cache with their size and
+// modification time. If they haven't changed, the file isn't read again.
+typedef struct {
+	char *path;
+	long long size;
+	long long mtime_sec, mtime_nsec;
+	uint64_t hash;
+	int used;
+} file_entry_t;
+
+static file_entry_t *files;
+static int num_files, sorted_files;
+
+// Files created by the assets that were built successfully, sorted by key
+typedef struct {
+	uint64_t key;
+	char *path;
+} built_output_t;
+
+static built_output_t *built_outputs;
+static int num_built_outputs;
+
+void PrintUsage(void)
+{
+	printf("Usage:\n");
+	printf("   nitro_asset_builder [options] [manifest]\n\n");
+
+	printf("Options:\n");
+	printf("   -j [jobs]       - Conversions run at the same time (default: "
+	       "number of CPUs)\n");
+	printf("   -f              - Convert everything, ignoring the cache\n");
+	printf("   -texture [path] - nitro_texture_converter executable\n");
+	printf("   -nea [path]     - md2_to_nea executable\n");
+	printf("   -bin [path]     - md2_to_bin executable\n\n");
+
+	printf("Manifest lines: (paths relative to the manifest)\n");
+	printf("   texture [input].png [format] [quality|dither]\n");
+	printf("   texture -shared [format] [max_error] [output] "
+	       "[input].png...\n");
+	printf("   nea [input].md2 [output].nea [scale] [tx] [ty] [tz]\n");
+	printf("   bin [input].md2 [output].bin [scale] [tx] [ty] [tz]\n\n");
+
+	printf("The cache is saved to [manifest].cache\n\n");
+}
+
+// FNV-1a, 64 bit
+
+#define HASH_INIT 0xCBF29CE484222325ULL
+
+static uint64_t HashData(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+static uint64_t HashString(uint64_t hash, const char *string)
+{
+	// Include the terminator so that "ab" "c" and "a" "bc" are different
+	return HashData(hash, string, strlen(string) + 1);
+}
+
+static int CompareFiles(const void *a, const void *b)
+{
+	return strcmp(((const file_entry_t *)a)->path,
+		      ((const file_entry_t *)b)->path);
+}
+
+static file_entry_t *FindFile(const char *path)
+{
+	file_entry_t key = { .path = (char *)path };
+	file_entry_t *f = bsearch(&key, files, sorted_files,
+				  sizeof(file_entry_t), CompareFiles);
+	if (f != NULL)
+		return f;
+
+	// Files that weren't in the cache
+	for (int i = sorted_files; i < num_files; i++) {
+		if (strcmp(files[i].path, path) == 0)
+			return &files[i];
+	}
+
+	return NULL;
+}
+
+static file_entry_t *AddFile(const char *path)
+{
+	file_entry_t *f = realloc(files, (num_files + 1) * sizeof(file_entry_t));
+	if (f == NULL)
+		return NULL;
+	files = f;
+
+	f = &files[num_files++];
+	memset(f, 0, sizeof(file_entry_t));
+	f->path = strdup(path);
+
+	return f;
+}
+
+// Returns 1 on success, 0 if the file can't be read
+static int HashFile(const char *path, uint64_t *hash)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		printf("Couldn't open %s!!\n\n", path);
+		return 0;
+	}
+
+	file_entry_t *f = FindFile(path);
+
+	if (f != NULL && f->size == (long long)st.st_size
+	    && f->mtime_sec == (long long)st.st_mtim.tv_sec
+	    && f->mtime_nsec == (long long)st.st_mtim.tv_nsec) {
+		f->used = 1;
+		*hash = f->hash;
+		return 1;
+	}
+
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		printf("Couldn't open %s!!\n\n", path);
+		return 0;
+	}
+
+	uint64_t h = HASH_INIT;
+	unsigned char buffer[64 * 1024];
+	size_t size;
+
+	while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		h = HashData(h, buffer, size);
+
+	fclose(file);
+
+	if (f == NULL) {
+		f = AddFile(path);
+		if (f == NULL) {
+			printf("Not enough memory!!\n\n");
+			return 0;
+		}
+	}
+
+	f->size = st.st_size;
+	f->mtime_sec = st.st_mtim.tv_sec;
+	f->mtime_nsec = st.st_mtim.tv_nsec;
+	f->hash = h;
+	f->used = 1;
+
+	*hash = h;
+	return 1;
+}
+
+static int CompareKeys(const void *a, const void *b)
+{
+	uint64_t ka = ((const built_output_t *)a)->key;
+	uint64_t kb = ((const built_output_t *)b)->key;
+
+	return ka < kb ? -1 : (ka > kb ? 1 : 0);
+}
+
+// Returns the index of the first output of an asset in the cache, or -1
+static int FindBuilt(uint64_t key)
+{
+	built_output_t k = { .key = key };
+	built_output_t *o = bsearch(&k, built_outputs, num_built_outputs,
+				    sizeof(built_output_t), CompareKeys);
+	if (o == NULL)
+		return -1;
+
+	int i = o - built_outputs;
+	while (i > 0 && built_outputs[i - 1].key == key)
+		i--;
+
+	return i;
+}
+
+// An asset is built if it's in the cache and all the files that it created
+// still exist.
+static int IsBuilt(uint64_t key)
+{
+	int i = FindBuilt(key);
+	if (i < 0)
+		return 0;
+
+	for (; i < num_built_outputs && built_outputs[i].key == key; i++) {
+		struct stat st;
+		if (stat(built_outputs[i].path, &st) != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void LoadCache(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
+		return; // First build
+
+	char line[PATH_MAX + 128];
+
+	if (fgets(line, sizeof(line), f) == NULL
+	    || strncmp(line, CACHE_HEADER, strlen(CACHE_HEADER)) != 0) {
+		printf("Ignoring cache %s with unknown format.\n\n", filename);
+		fclose(f);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		unsigned long long hash;
+		long long size, sec, nsec;
+		int offset;
+
+		if (sscanf(line, "file %llx %lld %lld %lld %n", &hash, &size,
+			   &sec, &nsec, &offset) == 4) {
+			file_entry_t *e = AddFile(line + offset);
+			if (e == NULL)
+				break;
+			e->hash = hash;
+			e->size = size;
+			e->mtime_sec = sec;
+			e->mtime_nsec = nsec;
+		} else if (sscanf(line, "asset %llx %n", &hash, &offset) == 1
+			   && line[offset] != '\0') {
+			built_output_t *o = realloc(built_outputs,
+						    (num_built_outputs + 1)
+						    * sizeof(built_output_t));
+			if (o == NULL)
+				break;
+			built_outputs = o;
+			o = &built_outputs[num_built_outputs++];
+			o->key = hash;
+			o->path = strdup(line + offset);
+		}
+	}
+
+	fclose(f);
+
+	qsort(files, num_files, sizeof(file_entry_t), CompareFiles);
+	sorted_files = num_files;
+	qsort(built_outputs, num_built_outputs, sizeof(built_output_t),
+	      CompareKeys);
+}
+
+static int SaveCache(const char *filename, const asset_t *assets,
+		     int num_assets)
+{
+	// Write to a temporary file first so that an interrupted build doesn't
+	// leave a broken cache.
+	char tmp_filename[PATH_MAX + 16];
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+	FILE *f = fopen(tmp_filename, "w+");
+	if (!f) {
+		printf("Couldn't open %s in write mode!!\n\n", tmp_filename);
+		return 0;
+	}
+
+	fprintf(f, CACHE_HEADER "\n");
+
+	// Only the files and assets of this manifest are kept
+	for (int i = 0; i < num_files; i++) {
+		if (!files[i].used)
+			continue;
+		fprintf(f, "file %016llx %lld %lld %lld %s\n",
+			(unsigned long long)files[i].hash, files[i].size,
+			files[i].mtime_sec, files[i].mtime_nsec, files[i].path);
+	}
+
+	// One line per file created by each asset
+	for (int i = 0; i < num_assets; i++) {
+		const asset_t *a = &assets[i];
+		unsigned long long key = a->key;
+
+		if (a->state == STATE_DONE) {
+			for (int j = 0; j < a->num_outputs; j++)
+				fprintf(f, "asset %016llx %s\n", key,
+					a->outputs[j]);
+		} else if (a->state == STATE_UP_TO_DATE) {
+			for (int j = FindBuilt(a->key);
+			     j < num_built_outputs
+			     && built_outputs[j].key == a->key; j++)
+				fprintf(f, "asset %016llx %s\n", key,
+					built_outputs[j].path);
+		}
+	}
+
+	if (fclose(f) != 0 || rename(tmp_filename, filename) != 0) {
+		printf("Write error!!\n\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+// Finds the executable of a converter. Paths with a '/' are used as they are,
+// the rest are searched in PATH like the shell does.
+static int FindConverter(converter_t *c)
+{
+	if (strchr(c->path, '/') != NULL) {
+		if (realpath(c->path, c->full_path) == NULL
+		    || access(c->full_path, X_OK) != 0)
+			return 0;
+		return 1;
+	}
+
+	const char *env = getenv("PATH");
+	if (env == NULL)
+		return 0;
+
+	char *path = strdup(env);
+	if (path == NULL)
+		return 0;
+
+	int found = 0;
+	char *saveptr;
+	for (char *dir = strtok_r(path, ":", &saveptr); dir != NULL;
+	     dir = strtok_r(NULL, ":", &saveptr)) {
+		snprintf(c->full_path, sizeof(c->full_path), "%s/%s", dir,
+			 c->path);
+		if (access(c->full_path, X_OK) == 0) {
+			found = 1;
+			break;
+		}
+	}
+
+	free(path);
+
+	return found;
+}
+
+// Splits a line in words separated by spaces or tabs. Returns the number of
+// words, or -1 if there are too many.
+static int SplitLine(char *line, char **words)
+{
+	int num = 0;
+	char *saveptr;
+
+	for (char *w = strtok_r(line, " \t\r\n", &saveptr); w != NULL;
+	     w = strtok_r(NULL, " \t\r\n", &saveptr)) {
+		if (num == MAX_ARGS + 1)
+			return -1;
+		words[num++] = w;
+	}
+
+	return num;
+}
+
+// Textures that share palettes are converted together. Their arguments are
+// "-shared [format] [max_error] [output] [input].png...".
+static int IsShared(const asset_t *a)
+{
+	return a->tool == TOOL_TEXTURE && strcmp(a->args[0], "-shared") == 0;
+}
+
+// Range of the arguments that are input files
+static int FirstInput(const asset_t *a)
+{
+	return IsShared(a) ? 4 : 0;
+}
+
+static int LastInput(const asset_t *a)
+{
+	return IsShared(a) ? a->num_args : 1;
+}
+
+// Returns the length of a path without ".png", or -1 if it isn't a PNG file
+static int PNGBaseLength(const char *path)
+{
+	size_t len = strlen(path);
+	if (len < 4 || strcmp(path + len - 4, ".png") != 0)
+		return -1;
+
+	return len - 4;
+}
+
+static int LoadManifest(const char *filename, asset_t **assets_out,
+			int *num_assets_out)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		printf("Couldn't open %s!!\n\n", filename);
+		return 0;
+	}
+
+	asset_t *assets = NULL;
+	int num_assets = 0;
+	char line[4096];
+	int line_number = 0;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		line_number++;
+
+		char *comment = strchr(line, '#');
+		if (comment != NULL)
+			*comment = '\0';
+
+		char *words[MAX_ARGS + 1];
+		int num_words = SplitLine(line, words);
+
+		if (num_words == 0)
+			continue;
+
+		if (num_words < 0) {
+			printf("%s:%d: Too many arguments!\n\n", filename,
+			       line_number);
+			goto error;
+		}
+
+		int tool;
+		for (tool = 0; tool < TOOL_NUMBER; tool++) {
+			if (strcmp(words[0], converters[tool].name) == 0)
+				break;
+		}
+
+		if (tool == TOOL_NUMBER) {
+			printf("%s:%d: Unknown converter %s!\n\n", filename,
+			       line_number, words[0]);
+			goto error;
+		}
+
+		if (num_words < 3) {
+			printf("%s:%d: Not enough arguments!\n\n", filename,
+			       line_number);
+			goto error;
+		}
+
+		asset_t *a = realloc(assets, (num_assets + 1) * sizeof(asset_t));
+		if (a == NULL) {
+			printf("Not enough memory!!\n\n");
+			goto error;
+		}
+		assets = a;
+
+		a = &assets[num_assets++];
+		memset(a, 0, sizeof(asset_t));
+		a->line = line_number;
+		a->tool = tool;
+		a->num_args = num_words - 1;
+		for (int i = 0; i < a->num_args; i++)
+			a->args[i] = strdup(words[i + 1]);
+
+		if (IsShared(a) && a->num_args < 5) {
+			printf("%s:%d: Not enough arguments!\n\n", filename,
+			       line_number);
+			goto error;
+		}
+
+		if (tool == TOOL_TEXTURE) {
+			// The texture converter chooses the names of the files
+			for (int i = FirstInput(a); i < LastInput(a); i++) {
+				if (PNGBaseLength(a->args[i]) < 0) {
+					printf("%s:%d: %s isn't a PNG file!\n\n",
+					       filename, line_number,
+					       a->args[i]);
+					goto error;
+				}
+			}
+		}
+
+		converters[tool].used = 1;
+	}
+
+	fclose(f);
+
+	*assets_out = assets;
+	*num_assets_out = num_assets;
+	return 1;
+
+error:
+	fclose(f);
+	free(assets);
+	return 0;
+}
+
+static double ElapsedMs(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000.0
+	       + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void AssetName(const asset_t *a, char *name, size_t size)
+{
+	int len = snprintf(name, size, "%s", converters[a->tool].name);
+
+	for (int i = 0; i < a->num_args && len < (int)size; i++)
+		len += snprintf(name + len, size - len, " %s", a->args[i]);
+}
+
+static int StartAsset(asset_t *a)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	if (tmpdir == NULL)
+		tmpdir = "/tmp";
+
+	// The output of the converter is only shown if the conversion fails
+	snprintf(a->log_filename, sizeof(a->log_filename),
+		 "%s/nitro_asset_XXXXXX", tmpdir);
+	int fd = mkstemp(a->log_filename);
+	if (fd < 0) {
+		printf("Couldn't create %s!!\n\n", a->log_filename);
+		return 0;
+	}
+
+	char *argv[MAX_ARGS + 2];
+	argv[0] = converters[a->tool].full_path;
+	for (int i = 0; i < a->num_args; i++)
+		argv[i + 1] = a->args[i];
+	argv[a->num_args + 1] = NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &a->start);
+	a->start_time = time(NULL);
+
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fd);
+		unlink(a->log_filename);
+		printf("Couldn't start %s!!\n\n", argv[0]);
+		return 0;
+	}
+
+	if (pid == 0) {
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	close(fd);
+
+	a->pid = pid;
+	a->state = STATE_RUNNING;
+
+	return 1;
+}
+
+static void PrintLog(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
+		return;
+
+	char line[1024];
+	while (fgets(line, sizeof(line), f) != NULL)
+		printf("    %s", line);
+
+	fclose(f);
+}
+
+// Saves a file created by a conversion. Returns 0 if it's required and it
+// doesn't exist. Optional files are only saved if the conversion has written
+// them, so that files left by older conversions aren't required.
+static int AddOutput(asset_t *a, const char *path, int required)
+{
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return !required;
+
+	if (!required && st.st_mtim.tv_sec < a->start_time)
+		return 1;
+
+	if (a->num_outputs == MAX_OUTPUTS)
+		return 0;
+
+	a->outputs[a->num_outputs] = strdup(path);
+	if (a->outputs[a->num_outputs] == NULL)
+		return 0;
+	a->num_outputs++;
+
+	return 1;
+}
+
+// Saves the files created by a conversion. Returns 0 if some file is missing.
+static int CollectOutputs(asset_t *a)
+{
+	char path[PATH_MAX + 32];
+
+	if (a->tool != TOOL_TEXTURE)
+		return AddOutput(a, a->args[1], 1);
+
+	for (int i = FirstInput(a); i < LastInput(a); i++) {
+		int len = PNGBaseLength(a->args[i]);
+
+		snprintf(path, sizeof(path), "%.*s_tex.bin", len, a->args[i]);
+		if (!AddOutput(a, path, 1))
+			return 0;
+
+		// The palette and index data depend on the format
+		if (IsShared(a))
+			continue;
+
+		snprintf(path, sizeof(path), "%.*s_idx.bin", len, a->args[i]);
+		if (!AddOutput(a, path, 0))
+			return 0;
+		snprintf(path, sizeof(path), "%.*s_pal.bin", len, a->args[i]);
+		if (!AddOutput(a, path, 0))
+			return 0;
+	}
+
+	if (!IsShared(a))
+		return 1;
+
+	// The number of palettes depends on the textures
+	const char *output = a->args[3];
+
+	snprintf(path, sizeof(path), "%s_manifest.txt", output);
+	if (!AddOutput(a, path, 1))
+		return 0;
+
+	for (int g = 0; ; g++) {
+		snprintf(path, sizeof(path), "%s_pal%d.bin", output, g);
+
+		int count = a->num_outputs;
+		if (!AddOutput(a, path, 0))
+			return 0;
+		if (a->num_outputs == count)
+			break;
+	}
+
+	return 1;
+}
+
+static void FinishAsset(asset_t *a, int status, int *finished, int total)
+{
+	char name[1024];
+	AssetName(a, name, sizeof(name));
+
+	a->time_ms = ElapsedMs(&a->start);
+
+	int ok = WIFEXITED(status) && WEXITSTATUS(status) == 0
+		 && CollectOutputs(a);
+
+	(*finished)++;
+
+	if (ok) {
+		a->state = STATE_DONE;
+		printf("[%d/%d] %9.1f ms  %s\n", *finished, total, a->time_ms,
+		       name);
+	} else {
+		a->state = STATE_FAILED;
+		printf("[%d/%d] %9.1f ms  %s  -- FAILED (line %d)\n", *finished,
+		       total, a->time_ms, name, a->line);
+		PrintLog(a->log_filename);
+		printf("\n");
+	}
+
+	unlink(a->log_filename);
+}
+
+int main(int argc, char *argv[])
+{
+	printf("Nitro Asset Builder - v" NITRO_ASSET_BUILDER_VERSION "\n");
+	printf("\n");
+	printf("Copyright (c) 2008-2011, 2019 Antonio Nino Diaz\n");
+	printf("\n");
+
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int force = 0;
+	const char *manifest_filename = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		int c;
+		for (c = 0; c < TOOL_NUMBER; c++) {
+			if (strcmp(argv[i], converters[c].option) == 0)
+				break;
+		}
+
+		if (c < TOOL_NUMBER && i + 1 < argc) {
+			converters[c].path = argv[++i];
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			jobs = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-f") == 0) {
+			force = 1;
+		} else if (argv[i][0] != '-' && manifest_filename == NULL) {
+			manifest_filename = argv[i];
+		} else {
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (manifest_filename == NULL || jobs < 1) {
+		PrintUsage();
+		return 1;
+	}
+
+	asset_t *assets;
+	int num_assets;
+	if (!LoadManifest(manifest_filename, &assets, &num_assets))
+		return -1;
+
+	// Converters are searched before changing the working directory, so
+	// relative paths are relative to the current directory.
+	for (int c = 0; c < TOOL_NUMBER; c++) {
+		if (!converters[c].used)
+			continue;
+		if (!FindConverter(&converters[c])) {
+			printf("Couldn't find %s!! Use %s to set its path.\n\n",
+			       converters[c].path, converters[c].option);
+			return -1;
+		}
+	}
+
+	char manifest_path[PATH_MAX];
+	if (realpath(manifest_filename, manifest_path) == NULL) {
+		printf("Couldn't open %s!!\n\n", manifest_filename);
+		return -1;
+	}
+
+	char cache_filename[PATH_MAX + 8];
+	snprintf(cache_filename, sizeof(cache_filename), "%s.cache",
+		 manifest_path);
+
+	// Paths of the manifest are relative to it
+	char *slash = strrchr(manifest_path, '/');
+	*slash = '\0';
+	if (chdir(manifest_path[0] ? manifest_path : "/") != 0) {
+		printf("Couldn't open %s!!\n\n", manifest_path);
+		return -1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	LoadCache(cache_filename);
+
+	for (int c = 0; c < TOOL_NUMBER; c++) {
+		if (converters[c].used
+		    && !HashFile(converters[c].full_path, &converters[c].hash))
+			return -1;
+	}
+
+	// The key of an asset changes if the converter, its arguments or the
+	// input files change.
+	int pending = 0;
+	for (int i = 0; i < num_assets; i++) {
+		asset_t *a = &assets[i];
+		converter_t *c = &converters[a->tool];
+
+		uint64_t key = HashString(HASH_INIT, c->name);
+		key = HashData(key, &c->hash, sizeof(c->hash));
+		for (int j = 0; j < a->num_args; j++)
+			key = HashString(key, a->args[j]);
+
+		for (int j = FirstInput(a); j < LastInput(a); j++) {
+			uint64_t input_hash;
+			if (!HashFile(a->args[j], &input_hash)) {
+				printf("%s:%d: Missing input file!\n\n",
+				       manifest_filename, a->line);
+				return -1;
+			}
+			key = HashData(key, &input_hash, sizeof(input_hash));
+		}
+		a->key = key;
+
+		if (!force && IsBuilt(key)) {
+			a->state = STATE_UP_TO_DATE;
+		} else {
+			a->state = STATE_PENDING;
+			pending++;
+		}
+	}
+
+	printf("%d assets, %d up to date, %d to convert with %ld jobs.\n\n",
+	       num_assets, num_assets - pending, pending, jobs);
+
+	int running = 0, finished = 0, next = 0, failed = 0;
+	double total_ms = 0;
+
+	while (next < num_assets || running > 0) {
+		while (running < jobs && next < num_assets) {
+			asset_t *a = &assets[next++];
+			if (a->state != STATE_PENDING)
+				continue;
+			if (!StartAsset(a)) {
+				a->state = STATE_FAILED;
+				failed++;
+				continue;
+			}
+			running++;
+		}
+
+		if (running == 0)
+			continue;
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (int i = 0; i < num_assets; i++) {
+			asset_t *a = &assets[i];
+			if (a->state != STATE_RUNNING || a->pid != pid)
+				continue;
+
+			FinishAsset(a, status, &finished, pending);
+			if (a->state == STATE_FAILED)
+				failed++;
+			total_ms += a->time_ms;
+			running--;
+			break;
+		}
+	}
+
+	SaveCache(cache_filename, assets, num_assets);
+
+	double wall_ms = ElapsedMs(&start);
+
+	if (pending > 0)
+		printf("\n");
+	printf("Converted %d, failed %d, up to date %d.\n", pending - failed,
+	       failed, num_assets - pending);
+	printf("Time: %.1f ms (%.1f ms of conversions)\n\n", wall_ms, total_ms);
+
+	for (int i = 0; i < num_assets; i++) {
+		for (int j = 0; j < assets[i].num_args; j++)
+			free(assets[i].args[j]);
+		for (int j = 0; j < assets[i].num_outputs; j++)
+			free(assets[i].outputs[j]);
+	}
+	free(assets);
+
+	return failed > 0 ? -1 : 0;
+}
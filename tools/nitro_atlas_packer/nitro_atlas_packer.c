@@ -0,0 +1,456 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2008-2009, 2019, Antonio Niño Díaz
+//
+// This file is part of Nitro Engine
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <png.h>
+
+#define NITRO_ATLAS_PACKER_VERSION "1.0.0"
+
+#if !defined(PNG_SIMPLIFIED_READ_SUPPORTED)
+# error "This code needs libpng 1.6"
+#endif
+
+typedef struct {
+	char *filename;
+	unsigned char *data;	// RGBA, 8 bits per component
+	int width, height;
+	int page, x, y;
+} image_t;
+
+// The skyline of a page is the list of the tops of the columns of used space,
+// from left to right.
+typedef struct {
+	int x, y, width;
+} segment_t;
+
+typedef struct {
+	segment_t *segments;
+	int num_segments;
+	int used_height;
+} page_t;
+
+void PrintUsage(void)
+{
+	printf("Usage:\n");
+	printf("   nitro_atlas_packer [output] [width] [height] [padding] "
+	       "[input].png...\n\n");
+
+	printf("   width   - Width of the pages (power of 2, 8 to 1024)\n");
+	printf("   height  - Max height of the pages (8 to 1024)\n");
+	printf("   padding - Free texels around each image\n\n");
+
+	printf("Output files:\n");
+	printf("   [output]_[page].png - Pages of the atlas\n");
+	printf("   [output]_rects.bin  - Table of rectangles\n");
+	printf("   [output]_rects.h    - Indices of the rectangles in the "
+	       "table\n\n");
+}
+
+static int LoadPNG(image_t *image)
+{
+	png_image png;
+
+	memset(&png, 0, sizeof(png));
+	png.version = PNG_IMAGE_VERSION;
+
+	if (!png_image_begin_read_from_file(&png, image->filename)) {
+		printf("%s: %s\n\n", image->filename, png.message);
+		return -1;
+	}
+
+	png.format = PNG_FORMAT_RGBA;
+
+	image->data = malloc(PNG_IMAGE_SIZE(png));
+	if (image->data == NULL) {
+		png_image_free(&png);
+		printf("Not enough memory!!\n\n");
+		return -1;
+	}
+
+	if (!png_image_finish_read(&png, NULL, image->data, 0, NULL)) {
+		printf("%s: %s\n\n", image->filename, png.message);
+		return -1;
+	}
+
+	image->width = png.width;
+	image->height = png.height;
+
+	return 1;
+}
+
+// Returns the height at which a rectangle of "width" texels would be placed if
+// its left side is at segment "index", or -1 if it doesn't fit.
+static int SkylineFit(page_t *page, int index, int width, int page_width)
+{
+	int x = page->segments[index].x;
+	if (x + width > page_width)
+		return -1;
+
+	int y = 0;
+	int remaining = width;
+
+	while (remaining > 0) {
+		segment_t *s = &page->segments[index];
+		if (s->y > y)
+			y = s->y;
+		remaining -= s->width;
+		index++;
+	}
+
+	return y;
+}
+
+static void SkylineAdd(page_t *page, int index, int x, int y, int width)
+{
+	// Insert the new segment and shrink or remove the ones it covers
+	page->segments = realloc(page->segments,
+				 (page->num_segments + 1) * sizeof(segment_t));
+	memmove(&page->segments[index + 1], &page->segments[index],
+		(page->num_segments - index) * sizeof(segment_t));
+	page->num_segments++;
+
+	page->segments[index].x = x;
+	page->segments[index].y = y;
+	page->segments[index].width = width;
+
+	int i = index + 1;
+	while (i < page->num_segments) {
+		segment_t *s = &page->segments[i];
+		int end = x + width;
+
+		if (s->x >= end)
+			break;
+
+		int shrink = end - s->x;
+		if (shrink < s->width) {
+			s->x += shrink;
+			s->width -= shrink;
+			break;
+		}
+
+		memmove(s, s + 1,
+			(page->num_segments - i - 1) * sizeof(segment_t));
+		page->num_segments--;
+	}
+
+	// Merge segments of the same height
+	for (i = 0; i < page->num_segments - 1; i++) {
+		segment_t *s = &page->segments[i];
+		if (s->y == s[1].y) {
+			s->width += s[1].width;
+			memmove(s + 1, s + 2,
+				(page->num_segments - i - 2)
+				* sizeof(segment_t));
+			page->num_segments--;
+			i--;
+		}
+	}
+}
+
+// Bottom-left placement: the position with the lowest top, then the lowest
+// waste, is used. Returns 1 if the image has been placed in the page.
+static int PackInPage(page_t *page, int page_width, int page_height,
+		      int width, int height, int *x, int *y)
+{
+	int best = -1, best_y = 0, best_top = 0;
+
+	for (int i = 0; i < page->num_segments; i++) {
+		int fit_y = SkylineFit(page, i, width, page_width);
+		if (fit_y < 0)
+			continue;
+
+		int top = fit_y + height;
+		if (top > page_height)
+			continue;
+
+		if (best == -1 || top < best_top) {
+			best = i;
+			best_y = fit_y;
+			best_top = top;
+		}
+	}
+
+	if (best == -1)
+		return 0;
+
+	*x = page->segments[best].x;
+	*y = best_y;
+
+	SkylineAdd(page, best, *x, best_y + height, width);
+
+	if (best_top > page->used_height)
+		page->used_height = best_top;
+
+	return 1;
+}
+
+static int CompareImages(const void *a, const void *b)
+{
+	const image_t *ia = *(const image_t **)a;
+	const image_t *ib = *(const image_t **)b;
+
+	// Tallest first, then widest
+	if (ia->height != ib->height)
+		return ib->height - ia->height;
+	return ib->width - ia->width;
+}
+
+static int WritePage(const char *output, int page_index, image_t *images,
+		     int num_images, int width, int height, int padding)
+{
+	unsigned char *data = calloc(width * height, 4);
+	if (data == NULL) {
+		printf("Not enough memory!!\n\n");
+		return -1;
+	}
+
+	for (int i = 0; i < num_images; i++) {
+		image_t *img = &images[i];
+		if (img->page != page_index)
+			continue;
+
+		int x0 = img->x + padding;
+		int y0 = img->y + padding;
+
+		for (int y = 0; y < img->height; y++) {
+			memcpy(&data[((y0 + y) * width + x0) * 4],
+			       &img->data[y * img->width * 4],
+			       img->width * 4);
+		}
+	}
+
+	char filename[FILENAME_MAX];
+	snprintf(filename, sizeof(filename), "%s_%d.png", output, page_index);
+
+	png_image png;
+	memset(&png, 0, sizeof(png));
+	png.version = PNG_IMAGE_VERSION;
+	png.width = width;
+	png.height = height;
+	png.format = PNG_FORMAT_RGBA;
+
+	int ret = png_image_write_to_file(&png, filename, 0, data, 0, NULL);
+	free(data);
+
+	if (!ret) {
+		printf("%s: %s\n\n", filename, png.message);
+		return -1;
+	}
+
+	printf("Created file: %s (%dx%d)\n", filename, width, height);
+
+	return 1;
+}
+
+static int WriteRects(const char *output, image_t *images, int num_images,
+		      int padding)
+{
+	char filename[FILENAME_MAX];
+	snprintf(filename, sizeof(filename), "%s_rects.bin", output);
+
+	FILE *f = fopen(filename, "wb+");
+	if (!f) {
+		printf("Couldn't open %s in write mode!!\n\n", filename);
+		return -1;
+	}
+
+	// Same layout as NE_AtlasRect, little endian
+	unsigned int count = num_images;
+	unsigned char header[4] = {
+		count & 0xFF, (count >> 8) & 0xFF, (count >> 16) & 0xFF,
+		(count >> 24) & 0xFF
+	};
+	fwrite(header, sizeof(header), 1, f);
+
+	for (int i = 0; i < num_images; i++) {
+		image_t *img = &images[i];
+		unsigned short rect[6] = {
+			img->page, img->x + padding, img->y + padding,
+			img->width, img->height, 0
+		};
+		unsigned char bytes[12];
+
+		for (int j = 0; j < 6; j++) {
+			bytes[j * 2] = rect[j] & 0xFF;
+			bytes[j * 2 + 1] = rect[j] >> 8;
+		}
+
+		if (fwrite(bytes, sizeof(bytes), 1, f) != 1) {
+			fclose(f);
+			printf("Write error!!\n\n");
+			return -1;
+		}
+	}
+
+	fclose(f);
+	printf("Created file: %s\n", filename);
+
+	// Header with one define per image, named after the file
+	snprintf(filename, sizeof(filename), "%s_rects.h", output);
+
+	f = fopen(filename, "w+");
+	if (!f) {
+		printf("Couldn't open %s in write mode!!\n\n", filename);
+		return -1;
+	}
+
+	fprintf(f, "// Generated by nitro_atlas_packer\n\n");
+
+	for (int i = 0; i < num_images; i++) {
+		const char *name = strrchr(images[i].filename, '/');
+		name = name ? name + 1 : images[i].filename;
+
+		fprintf(f, "#define ATLAS_");
+		for (const char *c = name; *c != '\0'; c++) {
+			if (strcmp(c, ".png") == 0)
+				break;
+			fputc(isalnum((unsigned char)*c)
+			      ? toupper((unsigned char)*c) : '_', f);
+		}
+		fprintf(f, " %d\n", i);
+	}
+
+	fclose(f);
+	printf("Created file: %s\n\n", filename);
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	printf("Nitro Atlas Packer - v" NITRO_ATLAS_PACKER_VERSION "\n");
+	printf("\n");
+	printf("Copyright (c) 2008-2011, 2019 Antonio Nino Diaz\n");
+	printf("\n");
+
+	if (argc < 6) {
+		PrintUsage();
+		return 1;
+	}
+
+	const char *output = argv[1];
+	int page_width = atoi(argv[2]);
+	int page_height = atoi(argv[3]);
+	int padding = atoi(argv[4]);
+
+	if (page_width < 8 || page_width > 1024
+	    || (page_width & (page_width - 1)) != 0) {
+		printf("Invalid page width %s!\n\n", argv[2]);
+		PrintUsage();
+		return 1;
+	}
+
+	if (page_height < 8 || page_height > 1024) {
+		printf("Invalid page height %s!\n\n", argv[3]);
+		PrintUsage();
+		return 1;
+	}
+
+	if (padding < 0) {
+		printf("Invalid padding %s!\n\n", argv[4]);
+		PrintUsage();
+		return 1;
+	}
+
+	int num_images = argc - 5;
+	image_t *images = calloc(num_images, sizeof(image_t));
+	image_t **sorted = calloc(num_images, sizeof(image_t *));
+	if (images == NULL || sorted == NULL) {
+		printf("Not enough memory!!\n\n");
+		return -1;
+	}
+
+	for (int i = 0; i < num_images; i++) {
+		images[i].filename = argv[5 + i];
+		if (LoadPNG(&images[i]) < 1)
+			return -1;
+
+		if (images[i].width + padding * 2 > page_width
+		    || images[i].height + padding * 2 > page_height) {
+			printf("%s doesn't fit in a page!\n\n",
+			       images[i].filename);
+			return -1;
+		}
+
+		sorted[i] = &images[i];
+	}
+
+	qsort(sorted, num_images, sizeof(image_t *), CompareImages);
+
+	page_t *pages = NULL;
+	int num_pages = 0;
+
+	for (int i = 0; i < num_images; i++) {
+		image_t *img = sorted[i];
+		int w = img->width + padding * 2;
+		int h = img->height + padding * 2;
+		int p;
+
+		for (p = 0; p < num_pages; p++) {
+			if (PackInPage(&pages[p], page_width, page_height, w, h,
+				       &img->x, &img->y))
+				break;
+		}
+
+		if (p == num_pages) {
+			pages = realloc(pages, (num_pages + 1) * sizeof(page_t));
+			pages[p].segments = malloc(sizeof(segment_t));
+			pages[p].segments[0].x = 0;
+			pages[p].segments[0].y = 0;
+			pages[p].segments[0].width = page_width;
+			pages[p].num_segments = 1;
+			pages[p].used_height = 0;
+			num_pages++;
+
+			PackInPage(&pages[p], page_width, page_height, w, h,
+				   &img->x, &img->y);
+		}
+
+		img->page = p;
+	}
+
+	int used_texels = 0, page_texels = 0;
+
+	for (int i = 0; i < num_images; i++)
+		used_texels += images[i].width * images[i].height;
+
+	for (int p = 0; p < num_pages; p++) {
+		// The height of a texture doesn't need to be a power of 2, so
+		// the unused rows at the bottom of the page aren't saved.
+		int height = pages[p].used_height;
+
+		if (WritePage(output, p, images, num_images, page_width,
+			      height, padding) < 1)
+			return -1;
+
+		page_texels += page_width * height;
+	}
+
+	printf("\n");
+
+	if (WriteRects(output, images, num_images, padding) < 1)
+		return -1;
+
+	printf("%d images packed in %d pages. %d%% of the pages is used.\n\n",
+	       num_images, num_pages, used_texels * 100 / page_texels);
+
+	for (int p = 0; p < num_pages; p++)
+		free(pages[p].segments);
+	free(pages);
+
+	for (int i = 0; i < num_images; i++)
+		free(images[i].data);
+	free(images);
+	free(sorted);
+
+	printf("Done!!\n\n");
+
+	return 0;
+}
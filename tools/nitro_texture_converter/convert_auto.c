@@ -0,0 +1,518 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2008-2009, 2019, Antonio Niño Díaz
+//
+// This file is part of Nitro Engine
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+# define NULL_DEVICE "NUL"
+#else
+# define NULL_DEVICE "/dev/null"
+#endif
+
+// Every candidate format is converted with its normal converter to temporary
+// files, which are decoded and compared with the source image. That way the
+// quality that is measured is the one of the files that are used in the end,
+// including the palette reduction done by the converters.
+
+// Indices in FORMAT_STRINGS
+#define FORMAT_A1RGB5	0
+#define FORMAT_RGB256	1
+#define FORMAT_RGB16	2
+#define FORMAT_RGB4	3
+#define FORMAT_A3RGB32	4
+#define FORMAT_A5RGB8	5
+#define FORMAT_TEX4X4	7
+
+// Candidates, in order of preference if they use the same VRAM
+static const int candidates[] = {
+	FORMAT_A1RGB5, FORMAT_RGB256, FORMAT_A3RGB32, FORMAT_A5RGB8,
+	FORMAT_RGB16, FORMAT_TEX4X4, FORMAT_RGB4
+};
+
+#define NUM_CANDIDATES	(int)(sizeof(candidates) / sizeof(candidates[0]))
+
+// Max PSNR, used when the images are identical
+#define PSNR_MAX	99.0
+
+typedef struct {
+	int format;
+	bool converted;
+	int bytes;		// VRAM used by the texture and its palette
+	double psnr, ssim;
+} result_t;
+
+extern const char *FORMAT_STRINGS[];
+
+int ConvertARGB(int format, void *data, int size, int width,
+		char *texture_filename, char *index_filename,
+		char *palette_filename, int quality);
+
+static int saved_stdout = -1;
+
+// The output of the converters isn't interesting for every candidate
+static void QuietBegin(void)
+{
+	fflush(stdout);
+	saved_stdout = dup(fileno(stdout));
+
+	int null = open(NULL_DEVICE, O_WRONLY);
+	if (null >= 0) {
+		dup2(null, fileno(stdout));
+		close(null);
+	}
+}
+
+static void QuietEnd(void)
+{
+	fflush(stdout);
+	if (saved_stdout >= 0) {
+		dup2(saved_stdout, fileno(stdout));
+		close(saved_stdout);
+		saved_stdout = -1;
+	}
+}
+
+// Returns the contents of a file, or NULL if it doesn't exist
+static unsigned char *ReadFile(const char *filename, long *size)
+{
+	*size = 0;
+
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	unsigned char *buffer = malloc(*size + 1);
+	if (buffer == NULL || fread(buffer, 1, *size, f) != (size_t)*size) {
+		free(buffer);
+		fclose(f);
+		*size = 0;
+		return NULL;
+	}
+
+	fclose(f);
+	return buffer;
+}
+
+static int Expand5(int c)
+{
+	return (c << 3) | (c >> 2);
+}
+
+static void SetColor(unsigned char *out, unsigned short color, int alpha)
+{
+	out[0] = Expand5(color & 31);
+	out[1] = Expand5((color >> 5) & 31);
+	out[2] = Expand5((color >> 10) & 31);
+	out[3] = alpha;
+}
+
+static unsigned short PaletteColor(const unsigned char *pal, long pal_size,
+				   int index)
+{
+	if ((index + 1) * 2 > pal_size)
+		return 0;
+	return pal[index * 2] | (pal[index * 2 + 1] << 8);
+}
+
+// Decodes a block of a TEX4X4 texture like the hardware does it
+static void DecodeBlock4x4(const unsigned char *texels, unsigned short index,
+			   const unsigned char *pal, long pal_size,
+			   unsigned char *out, int width)
+{
+	int base = (index & 0x3FFF) * 2;
+	int mode = index >> 14;
+	int c[4][3] = { { 0 } };
+	bool transparent3 = mode == 0 || mode == 1;
+
+	for (int i = 0; i < 4; i++) {
+		unsigned short color = PaletteColor(pal, pal_size, base + i);
+		c[i][0] = color & 31;
+		c[i][1] = (color >> 5) & 31;
+		c[i][2] = (color >> 10) & 31;
+	}
+
+	for (int k = 0; k < 3; k++) {
+		if (mode == 1) {
+			c[2][k] = (c[0][k] + c[1][k]) / 2;
+		} else if (mode == 3) {
+			int c0 = c[0][k], c1 = c[1][k];
+			c[2][k] = (c0 * 5 + c1 * 3) / 8;
+			c[3][k] = (c0 * 3 + c1 * 5) / 8;
+		}
+	}
+
+	for (int t = 0; t < 16; t++) {
+		int v = (texels[t >> 2] >> ((t & 3) * 2)) & 3;
+		unsigned char *p = &out[((t >> 2) * width + (t & 3)) * 4];
+
+		p[0] = Expand5(c[v][0]);
+		p[1] = Expand5(c[v][1]);
+		p[2] = Expand5(c[v][2]);
+		p[3] = (transparent3 && v == 3) ? 0 : 255;
+	}
+}
+
+// Decodes the files created by a converter to RGBA. Returns NULL on error.
+static unsigned char *Decode(int format, const char *texture_filename,
+			     const char *index_filename,
+			     const char *palette_filename, int width,
+			     int height, bool color0_transparent,
+			     int *bytes)
+{
+	long tex_size, idx_size = 0, pal_size = 0;
+	unsigned char *tex = ReadFile(texture_filename, &tex_size);
+	unsigned char *idx = NULL;
+	unsigned char *pal = NULL;
+	unsigned char *out = NULL;
+
+	if (tex == NULL)
+		goto end;
+
+	if (format == FORMAT_TEX4X4) {
+		idx = ReadFile(index_filename, &idx_size);
+		if (idx == NULL)
+			goto end;
+	}
+
+	if (format != FORMAT_A1RGB5) {
+		pal = ReadFile(palette_filename, &pal_size);
+		if (pal == NULL)
+			goto end;
+	}
+
+	int num = width * height;
+	int bits[] = { 16, 8, 4, 2, 8, 8, 16, 2 };
+	if (tex_size * 8 < (long)num * bits[format])
+		goto end;
+
+	// Rows are padded to a power of 2 when they are loaded to VRAM
+	int realx = 8;
+	while (realx < width)
+		realx <<= 1;
+
+	*bytes = (tex_size + idx_size) * realx / width + pal_size;
+
+	out = malloc(num * 4);
+	if (out == NULL)
+		goto end;
+
+	if (format == FORMAT_TEX4X4) {
+		int blocks_x = width / 4;
+		int num_blocks = num / 16;
+		if (idx_size < num_blocks * 2) {
+			free(out);
+			out = NULL;
+			goto end;
+		}
+
+		for (int b = 0; b < num_blocks; b++) {
+			int x = (b % blocks_x) * 4;
+			int y = (b / blocks_x) * 4;
+			DecodeBlock4x4(&tex[b * 4], idx[b * 2] | (idx[b * 2 + 1] << 8),
+				       pal, pal_size, &out[(y * width + x) * 4],
+				       width);
+		}
+		goto end;
+	}
+
+	for (int i = 0; i < num; i++) {
+		unsigned char *p = &out[i * 4];
+		int v;
+
+		switch (format) {
+		case FORMAT_A1RGB5:
+			v = tex[i * 2] | (tex[i * 2 + 1] << 8);
+			SetColor(p, v, (v & 0x8000) ? 255 : 0);
+			break;
+		case FORMAT_RGB256:
+		case FORMAT_RGB16:
+		case FORMAT_RGB4: {
+			int b = bits[format];
+			int pos = i * b;
+			v = (tex[pos >> 3] >> (pos & 7)) & ((1 << b) - 1);
+			SetColor(p, PaletteColor(pal, pal_size, v),
+				 (color0_transparent && v == 0) ? 0 : 255);
+			break;
+		}
+		case FORMAT_A3RGB32:
+			v = tex[i];
+			SetColor(p, PaletteColor(pal, pal_size, v & 31),
+				 ((v >> 5) << 5) | ((v >> 5) << 2) | (v >> 6));
+			break;
+		case FORMAT_A5RGB8:
+			v = tex[i];
+			SetColor(p, PaletteColor(pal, pal_size, v & 7),
+				 Expand5(v >> 3));
+			break;
+		}
+	}
+
+end:
+	free(tex);
+	free(idx);
+	free(pal);
+	return out;
+}
+
+// Color as it is seen: invisible texels are black, whatever their color is
+static void Premultiply(const unsigned char *p, int *out)
+{
+	for (int k = 0; k < 3; k++)
+		out[k] = p[k] * p[3] / 255;
+	out[3] = p[3];
+}
+
+static int Luma(const unsigned char *p)
+{
+	int c[4];
+	Premultiply(p, c);
+	return (77 * c[0] + 150 * c[1] + 29 * c[2]) >> 8;
+}
+
+// Compares an image with the reference. The PSNR uses the 4 channels, the SSIM
+// is the mean of the SSIM of the luma of 8x8 windows, with a step of 4 texels.
+static void Compare(const unsigned char *ref, const unsigned char *img,
+		    int width, int height, double *psnr, double *ssim)
+{
+	int num = width * height;
+	double error = 0;
+
+	for (int i = 0; i < num; i++) {
+		int a[4], b[4];
+		Premultiply(&ref[i * 4], a);
+		Premultiply(&img[i * 4], b);
+		for (int k = 0; k < 4; k++)
+			error += (a[k] - b[k]) * (a[k] - b[k]);
+	}
+
+	double mse = error / (num * 4.0);
+	if (mse == 0)
+		*psnr = PSNR_MAX;
+	else
+		*psnr = fmin(10.0 * log10(255.0 * 255.0 / mse), PSNR_MAX);
+
+	const double c1 = (0.01 * 255) * (0.01 * 255);
+	const double c2 = (0.03 * 255) * (0.03 * 255);
+	int win_w = width < 8 ? width : 8;
+	int win_h = height < 8 ? height : 8;
+	double total = 0;
+	int windows = 0;
+
+	for (int y = 0; y + win_h <= height; y += 4) {
+		for (int x = 0; x + win_w <= width; x += 4) {
+			double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+			int n = win_w * win_h;
+
+			for (int j = y; j < y + win_h; j++) {
+				for (int i = x; i < x + win_w; i++) {
+					int la = Luma(&ref[(j * width + i) * 4]);
+					int lb = Luma(&img[(j * width + i) * 4]);
+					sa += la;
+					sb += lb;
+					saa += la * la;
+					sbb += lb * lb;
+					sab += la * lb;
+				}
+			}
+
+			double ma = sa / n, mb = sb / n;
+			double va = saa / n - ma * ma;
+			double vb = sbb / n - mb * mb;
+			double cov = sab / n - ma * mb;
+
+			total += ((2 * ma * mb + c1) * (2 * cov + c2))
+				 / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+			windows++;
+		}
+	}
+
+	*ssim = windows > 0 ? total / windows : 1.0;
+}
+
+static void ReplaceFile(const char *from, const char *to)
+{
+	remove(to);
+	if (from != NULL)
+		rename(from, to);
+}
+
+int ConvertARGBintoAUTO(void *data, int size, int width,
+			char *texture_filename, char *index_filename,
+			char *palette_filename, int quality, double min_psnr,
+			double min_ssim, char *report_filename)
+{
+	unsigned char *data_pointer = data;
+	int height = size / 4 / width;
+	int num = width * height;
+
+	printf("AUTO:\n");
+	printf("- Every format is tried, and the one that uses less VRAM\n");
+	printf("  with PSNR >= %.2f dB and SSIM >= %.4f is used.\n",
+	       min_psnr, min_ssim);
+	printf("- If no format is good enough, the best one is used.\n\n");
+
+	// The best the hardware can do is RGB555 with the original alpha
+	unsigned char *ref = malloc(num * 4);
+	if (ref == NULL) {
+		printf("Not enough memory!!\n\n");
+		return -1;
+	}
+
+	bool color0_transparent = false;
+	for (int i = 0; i < num * 4; i += 4) {
+		for (int k = 0; k < 3; k++)
+			ref[i + k] = Expand5(data_pointer[i + k] >> 3);
+		ref[i + 3] = data_pointer[i + 3];
+		if (data_pointer[i + 3] == 0)
+			color0_transparent = true;
+	}
+
+	char tmp_tex[FILENAME_MAX], tmp_idx[FILENAME_MAX], tmp_pal[FILENAME_MAX];
+	snprintf(tmp_tex, sizeof(tmp_tex), "%s.tmp", texture_filename);
+	snprintf(tmp_idx, sizeof(tmp_idx), "%s.tmp", index_filename);
+	snprintf(tmp_pal, sizeof(tmp_pal), "%s.tmp", palette_filename);
+
+	result_t results[NUM_CANDIDATES];
+	int best = -1;
+	bool best_ok = false;
+
+	for (int c = 0; c < NUM_CANDIDATES; c++) {
+		result_t *r = &results[c];
+		r->format = candidates[c];
+		r->converted = false;
+
+		// Compressed textures can't be padded when they are loaded, so
+		// the width must be a power of 2 too.
+		if (r->format == FORMAT_TEX4X4
+		    && ((width & 3) != 0 || (height & 3) != 0
+			|| width < 8 || width > 1024
+			|| (width & (width - 1)) != 0))
+			continue;
+
+		remove(tmp_tex);
+		remove(tmp_idx);
+		remove(tmp_pal);
+
+		QuietBegin();
+		int ret = ConvertARGB(r->format, data, size, width, tmp_tex,
+				      tmp_idx, tmp_pal, quality);
+		QuietEnd();
+
+		if (ret < 1)
+			continue;
+
+		unsigned char *img = Decode(r->format, tmp_tex, tmp_idx,
+					    tmp_pal, width, height,
+					    color0_transparent, &r->bytes);
+		if (img == NULL)
+			continue;
+
+		Compare(ref, img, width, height, &r->psnr, &r->ssim);
+		free(img);
+		r->converted = true;
+
+		bool ok = r->psnr >= min_psnr && r->ssim >= min_ssim;
+		bool better;
+		if (best == -1)
+			better = true;
+		else if (ok != best_ok)
+			better = ok;
+		else if (ok)
+			better = r->bytes < results[best].bytes;
+		else
+			better = r->psnr > results[best].psnr;
+
+		if (!better)
+			continue;
+
+		best = c;
+		best_ok = ok;
+
+		// Keep the files of the best format so far
+		ReplaceFile(tmp_tex, texture_filename);
+		ReplaceFile(r->format == FORMAT_TEX4X4 ? tmp_idx : NULL,
+			    index_filename);
+		ReplaceFile(r->format == FORMAT_A1RGB5 ? NULL : tmp_pal,
+			    palette_filename);
+	}
+
+	remove(tmp_tex);
+	remove(tmp_idx);
+	remove(tmp_pal);
+	free(ref);
+
+	if (best == -1) {
+		printf("No format could be used!!\n\n");
+		return -1;
+	}
+
+	printf("Format    VRAM (bytes)  PSNR (dB)  SSIM\n");
+	for (int c = 0; c < NUM_CANDIDATES; c++) {
+		result_t *r = &results[c];
+		if (!r->converted)
+			continue;
+		printf("%-8s  %12d  %9.2f  %.4f%s\n",
+		       FORMAT_STRINGS[r->format], r->bytes, r->psnr, r->ssim,
+		       c == best ? "  <-" : "");
+	}
+	printf("\n");
+
+	result_t *r = &results[best];
+
+	// A1RGB5 is what would be used without palettes
+	int realx = 8;
+	while (realx < width)
+		realx <<= 1;
+	int reference_bytes = realx * height * 2;
+
+	if (!best_ok)
+		printf("No format is good enough, using the best one.\n");
+	printf("Selected format: %s\n", FORMAT_STRINGS[r->format]);
+	printf("Bytes saved compared to A1RGB5: %d\n\n",
+	       reference_bytes - r->bytes);
+
+	printf("Created file: %s\n", texture_filename);
+	if (r->format == FORMAT_TEX4X4)
+		printf("Created file: %s\n", index_filename);
+	if (r->format != FORMAT_A1RGB5)
+		printf("Created file: %s\n", palette_filename);
+	printf("\n");
+
+	if (report_filename == NULL)
+		return 1;
+
+	// One line per texture, so that it can be shared by many conversions
+	FILE *report = fopen(report_filename, "a");
+	if (report == NULL) {
+		printf("Couldn't open %s in write mode!!\n\n", report_filename);
+		return -1;
+	}
+
+	fseek(report, 0, SEEK_END);
+	if (ftell(report) == 0)
+		fprintf(report, "# texture format bytes a1rgb5_bytes saved "
+				"psnr ssim\n");
+
+	fprintf(report, "%s %s %d %d %d %.2f %.4f\n", texture_filename,
+		FORMAT_STRINGS[r->format], r->bytes, reference_bytes,
+		reference_bytes - r->bytes, r->psnr, r->ssim);
+
+	fclose(report);
+
+	printf("Report updated: %s\n\n", report_filename);
+
+	return 1;
+}
@@ -6,171 +6,107 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "palette.h"
 
-int ConvertARGBintoRGB4(void *data, int size, char *texture_filename,
-			char *palette_filename)
+int ConvertARGBintoRGB4(void *data, int size, int width,
+			char *texture_filename, char *palette_filename,
+			int dither)
 {
 	printf("RGB4:\n");
 	printf("- If image alpha == 0 -> Color index = 0.\n");
 	printf("- If image alpha != 0 -> Color index = actual color.\n");
 	printf("  (Palette color 0 can be transparent.)\n");
-	printf("- If image has more than 4 colors the program will try\n");
-	printf("  to optimize the palette (not recommended).\n\n");
+	printf("- If image has more than 4 colors the program will\n");
+	printf("  reduce the palette (not recommended).\n\n");
 
 	unsigned char *data_pointer = (unsigned char *)data;
 
 	int a;
 	// Check if transparent...
 	bool transparent_image = false;
-	a = 0;
-	while (a < size) {
+	for (a = 0; a < size; a += 4) {
 		if (data_pointer[a + 3] == 0) {
 			transparent_image = true;
 			break;
 		}
-		a += 4;
 	}
 
 	printf("Creating palette...\n\n");
 
-	int colors_used;
-	int optimization = 0;
-
-	// Try to find a palette
-	while (1) {
-		Palette_New(4, optimization);
-
-		// Dummy color for transparence
-		if (transparent_image)
-			Palette_NewColor(255, 255, 255);
-
-		for (a = 0; a < size; a += 4) {
-			// If alpha > 0
-			if (data_pointer[a + 3] > 0) {
-				// Alpha not used in palettes
-				Palette_NewColor((data_pointer[a] >> 3) & 31,
-						 (data_pointer[a + 1] >> 3) & 31,
-						 (data_pointer[a + 2] >> 3) & 31);
-			}
-		}
-
-		colors_used = Palette_GetColorsUsed();
+	Palette_New(4);
 
-		if (colors_used == 1) {
-			printf("Image alpha channel is always 0!!\n\n");
-			return -1;
+	for (a = 0; a < size; a += 4) {
+		// If alpha > 0
+		if (data_pointer[a + 3] > 0) {
+			// Alpha not used in palettes
+			Palette_NewColor((data_pointer[a] >> 3) & 31,
+					 (data_pointer[a + 1] >> 3) & 31,
+					 (data_pointer[a + 2] >> 3) & 31);
 		}
+	}
 
-		if (colors_used != -1)
-			break;	// OK ;)
+	// Dummy color for transparence
+	int colors_used = Palette_Create(transparent_image);
 
-		optimization++;	// Let's try again...
+	if (colors_used == -1) {
+		printf("Not enough memory!!\n\n");
+		return -1;
 	}
 
-	if (optimization > 0)
-		printf("Palette optimized after %d tries.\n\n", optimization);
+	if (colors_used == (transparent_image ? 1 : 0)) {
+		printf("Image alpha channel is always 0!!\n\n");
+		return -1;
+	}
 
 	printf("The palette has got %d colors.\n\n", colors_used);
 
 	// Now, save it to a file...
-	FILE *OUTPUT_FILE = fopen(palette_filename, "wb+");
-
-	if (!OUTPUT_FILE) {
-		printf("Couldn't open %s in write mode!!\n\n",
-		       palette_filename);
+	if (Palette_Save(palette_filename) < 1)
 		return -1;
-	}
-
-	unsigned short color = 0;
-	int red = 0, green = 0, blue = 0;
-
-	int b;
-	for (b = 0; b < colors_used; b++) {
-		Palette_GetColor(b, &red, &green, &blue);
-
-		color = red & 31;
-		color |= (green & 31) << 5;
-		color |= (blue & 31) << 10;
-		// Alpha not used in palettes
-
-		if (fwrite(&color, sizeof(color), 1, OUTPUT_FILE) != 1) {
-			fclose(OUTPUT_FILE);
-			printf("Write error!!\n\n");
-			return -1;
-		}
-	}
-
-	fclose(OUTPUT_FILE);
 
 	printf("Created file: %s\n\n", palette_filename);
 
 	// Palette created. Now, let's generate the texture
 	printf("Creating texture...\n\n");
 
-	OUTPUT_FILE = fopen(texture_filename, "wb+");
+	unsigned char *indices = Palette_MapImage(data_pointer, size, width,
+						  dither);
+	if (indices == NULL) {
+		printf("Not enough memory!!\n\n");
+		return -1;
+	}
+
+	FILE *OUTPUT_FILE = fopen(texture_filename, "wb+");
 
 	if (!OUTPUT_FILE) {
+		free(indices);
 		printf("Couldn't open %s in write mode!!\n\n",
 		       texture_filename);
 		return -1;
 	}
 
-	unsigned char index_[4] = { 0, 0, 0, 0 };
+	int num_texels = size / 4;
 
 	int c;
-	for (c = 0; c < size; c += 16) {
+	for (c = 0; c < num_texels; c += 4) {
 		// 4 colors per byte
-		if (data_pointer[c + 3] > 0) {
-			index_[0] =
-			    Palette_GetIndex((data_pointer[c] >> 3) & 31,
-					     (data_pointer[c + 1] >> 3) & 31,
-					     (data_pointer[c + 2] >> 3) & 31);
-		} else {
-			index_[0] = 0;	// 0 = transparent
-		}
-
-		if (data_pointer[c + 3] > 0) {
-			index_[1] =
-			    Palette_GetIndex((data_pointer[c + 4] >> 3) & 31,
-					     (data_pointer[c + 4 + 1] >> 3) & 31,
-					     (data_pointer[c + 4 + 2] >> 3) & 31);
-		} else {
-			index_[1] = 0;
-		}
-
-		if (data_pointer[c + 3] > 0) {
-			index_[2] =
-			    Palette_GetIndex((data_pointer[c + 8] >> 3) & 31,
-					     (data_pointer[c + 8 + 1] >> 3) & 31,
-					     (data_pointer[c + 8 + 2] >> 3) & 31);
-		} else {
-			index_[2] = 0;
-		}
-
-		if (data_pointer[c + 3] > 0) {
-			index_[3] =
-			    Palette_GetIndex((data_pointer[c + 12] >> 3) & 31,
-					     (data_pointer[c + 12 + 1] >> 3) & 31,
-					     (data_pointer[c + 12 + 2] >> 3) & 31);
-		} else {
-			index_[3] = 0;
-		}
-
-		unsigned char save_to_file =
-		    (index_[0] & 0x3) | ((index_[1] & 0x3) << 2) |
-		    ((index_[2] & 0x3) << 4) | ((index_[3] & 0x3) << 6);
+		unsigned char save_to_file = 0;
+		for (int t = 0; t < 4 && c + t < num_texels; t++)
+			save_to_file |= (indices[c + t] & 0x3) << (t * 2);
 
 		if (fwrite(&save_to_file, sizeof(save_to_file), 1, OUTPUT_FILE)
 		    != 1) {
 			fclose(OUTPUT_FILE);
+			free(indices);
 			printf("Write error!!\n\n");
 			return -1;
 		}
 	}
 
 	fclose(OUTPUT_FILE);
+	free(indices);
 
 	printf("Created file: %s\n\n", texture_filename);
 
@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2008-2009, 2019, Antonio Niño Díaz
+//
+// This file is part of Nitro Engine
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "quantize.h"
+
+// Textures are added one by one, from the one with the most colors to the one
+// with the fewest, to the group whose error increases the least when they are
+// added. A group can only accept a texture if the palette created for all of
+// its textures keeps the error of every one of them within the budget. If no
+// group can accept it, a new group is created.
+
+typedef struct {
+	char *filename;
+	char texture_filename[FILENAME_MAX];
+	unsigned char *data;	// RGBA
+	int size;
+	hist_entry_t *hist;	// Colors of the opaque texels
+	int num_colors;
+	unsigned int texels;	// Number of opaque texels
+	bool transparent;
+	int group;
+	double error;
+} texture_t;
+
+typedef struct {
+	hist_entry_t *hist;
+	int num_colors;
+	int *members;
+	int num_members;
+	bool transparent;	// If true, color 0 is reserved for transparency
+	unsigned short palette[256];
+	int palette_colors;	// Including the transparent color
+	double error;		// Sum of the error of all texels
+} group_t;
+
+void *LoadPNGtoARGB(char *filename, int *buffer_size, int *width);
+
+static int max_palette_colors;
+
+// Mean squared error of one 8-bit component of the opaque texels of a texture
+static double TextureError(const texture_t *t, const unsigned short *palette,
+			   int first, int num_colors)
+{
+	if (t->texels == 0)
+		return 0;
+
+	double error = 0;
+	for (int i = 0; i < t->num_colors; i++) {
+		int n = Palette_Nearest(palette, first, num_colors,
+					t->hist[i].color);
+		error += (double)Color_Distance(palette[n], t->hist[i].color)
+			 * t->hist[i].count;
+	}
+
+	// From RGB555 units to RGB888 units, divided by the 3 components
+	return error / t->texels * (255.0 * 255.0) / (31.0 * 31.0) / 3.0;
+}
+
+// Creates the palette of a group with the colors of its textures
+static int GroupPalette(const hist_entry_t *hist, int num, bool transparent,
+			unsigned short *palette)
+{
+	int first = transparent ? 1 : 0;
+
+	palette[0] = 0; // Dummy color for transparency, if any
+	int colors = Quantize(hist, num, max_palette_colors - first,
+			      palette + first);
+
+	return first + colors;
+}
+
+// Tries to add a texture to a group. Returns the increase of the error of the
+// group, or a negative value if the texture doesn't fit. If "apply" is true,
+// the texture is added.
+static double GroupTryAdd(group_t *g, texture_t *textures, int index,
+			  double max_error, bool apply)
+{
+	texture_t *t = &textures[index];
+	hist_entry_t *hist = malloc((g->num_colors + t->num_colors)
+				    * sizeof(hist_entry_t));
+	if (hist == NULL)
+		return -1;
+
+	int num = Histogram_Merge(g->hist, g->num_colors, t->hist,
+				  t->num_colors, hist);
+	bool transparent = g->transparent || t->transparent;
+	unsigned short palette[256];
+	int colors = GroupPalette(hist, num, transparent, palette);
+	int first = transparent ? 1 : 0;
+
+	double total = 0;
+	bool fits = true;
+
+	for (int m = 0; m <= g->num_members; m++) {
+		texture_t *member = m < g->num_members
+				    ? &textures[g->members[m]] : t;
+		double error = TextureError(member, palette, first, colors);
+		if (error > max_error) {
+			fits = false;
+			break;
+		}
+		total += error * member->texels;
+	}
+
+	if (!fits) {
+		free(hist);
+		return -1;
+	}
+
+	double increase = total - g->error;
+
+	if (!apply) {
+		free(hist);
+		return increase;
+	}
+
+	free(g->hist);
+	g->hist = hist;
+	g->num_colors = num;
+	g->transparent = transparent;
+	memcpy(g->palette, palette, sizeof(palette));
+	g->palette_colors = colors;
+	g->error = total;
+	g->members = realloc(g->members, (g->num_members + 1) * sizeof(int));
+	g->members[g->num_members++] = index;
+
+	return increase;
+}
+
+static int LoadTexture(texture_t *t)
+{
+	int width;
+	t->data = LoadPNGtoARGB(t->filename, &t->size, &width);
+	if (t->data == NULL)
+		return -1;
+
+	unsigned int *counts = calloc(RGB555_COLORS, sizeof(unsigned int));
+	if (counts == NULL) {
+		printf("Not enough memory!!\n\n");
+		return -1;
+	}
+
+	t->texels = 0;
+	t->transparent = false;
+
+	for (int i = 0; i < t->size; i += 4) {
+		unsigned char *p = &t->data[i];
+		if (p[3] == 0) {
+			t->transparent = true;
+			continue;
+		}
+
+		counts[(p[0] >> 3) | ((p[1] >> 3) << 5) | ((p[2] >> 3) << 10)]++;
+		t->texels++;
+	}
+
+	t->hist = malloc(RGB555_COLORS * sizeof(hist_entry_t));
+	if (t->hist == NULL) {
+		free(counts);
+		printf("Not enough memory!!\n\n");
+		return -1;
+	}
+
+	t->num_colors = Histogram_FromCounts(counts, t->hist);
+	free(counts);
+
+	int len = strlen(t->filename) - strlen(".png");
+	snprintf(t->texture_filename, sizeof(t->texture_filename),
+		 "%.*s_tex.bin", len, t->filename);
+
+	return 1;
+}
+
+static int WriteTexture(const texture_t *t, const group_t *g, int bits)
+{
+	FILE *f = fopen(t->texture_filename, "wb+");
+	if (!f) {
+		printf("Couldn't open %s in write mode!!\n\n",
+		       t->texture_filename);
+		return -1;
+	}
+
+	int first = g->transparent ? 1 : 0;
+	unsigned char byte = 0;
+	int shift = 0;
+
+	for (int i = 0; i < t->size; i += 4) {
+		unsigned char *p = &t->data[i];
+		int index = 0; // 0 = transparent
+
+		if (p[3] > 0) {
+			unsigned short c = (p[0] >> 3) | ((p[1] >> 3) << 5)
+					   | ((p[2] >> 3) << 10);
+			index = Palette_Nearest(g->palette, first,
+						g->palette_colors, c);
+		}
+
+		byte |= index << shift;
+		shift += bits;
+
+		if (shift == 8) {
+			if (fwrite(&byte, 1, 1, f) != 1) {
+				fclose(f);
+				printf("Write error!!\n\n");
+				return -1;
+			}
+			byte = 0;
+			shift = 0;
+		}
+	}
+
+	// Last texel of textures with an odd number of texels
+	if (shift != 0 && fwrite(&byte, 1, 1, f) != 1) {
+		fclose(f);
+		printf("Write error!!\n\n");
+		return -1;
+	}
+
+	fclose(f);
+
+	return 1;
+}
+
+static int WritePalette(const char *filename, const group_t *g)
+{
+	FILE *f = fopen(filename, "wb+");
+	if (!f) {
+		printf("Couldn't open %s in write mode!!\n\n", filename);
+		return -1;
+	}
+
+	if (fwrite(g->palette, sizeof(unsigned short), g->palette_colors, f)
+	    != (size_t)g->palette_colors) {
+		fclose(f);
+		printf("Write error!!\n\n");
+		return -1;
+	}
+
+	fclose(f);
+
+	return 1;
+}
+
+static texture_t *sort_textures;
+
+static int CompareTextures(const void *a, const void *b)
+{
+	const texture_t *ta = &sort_textures[*(const int *)a];
+	const texture_t *tb = &sort_textures[*(const int *)b];
+
+	if (ta->num_colors != tb->num_colors)
+		return tb->num_colors - ta->num_colors;
+	return *(const int *)a - *(const int *)b;
+}
+
+int ConvertSharedPalettes(int colors, double max_error, char *output,
+			  int num_textures, char **filenames)
+{
+	max_palette_colors = colors;
+	int bits = colors == 16 ? 4 : 8;
+
+	printf("Shared palettes (%d colors, max MSE %.2f):\n\n", colors,
+	       max_error);
+
+	texture_t *textures = calloc(num_textures, sizeof(texture_t));
+	group_t *groups = calloc(num_textures, sizeof(group_t));
+	int *order = malloc(num_textures * sizeof(int));
+	if (textures == NULL || groups == NULL || order == NULL) {
+		printf("Not enough memory!!\n\n");
+		return -1;
+	}
+
+	for (int i = 0; i < num_textures; i++) {
+		textures[i].filename = filenames[i];
+		if (LoadTexture(&textures[i]) < 1)
+			return -1;
+		order[i] = i;
+	}
+
+	sort_textures = textures;
+	qsort(order, num_textures, sizeof(int), CompareTextures);
+
+	int num_groups = 0;
+
+	for (int o = 0; o < num_textures; o++) {
+		int index = order[o];
+		int best = -1;
+		double best_increase = 0;
+
+		for (int g = 0; g < num_groups; g++) {
+			double increase = GroupTryAdd(&groups[g], textures,
+						      index, max_error, false);
+			if (increase < 0)
+				continue;
+			if (best == -1 || increase < best_increase) {
+				best = g;
+				best_increase = increase;
+			}
+		}
+
+		if (best == -1) {
+			best = num_groups++;
+			// A texture alone always fits, even if it's over the
+			// budget.
+			if (GroupTryAdd(&groups[best], textures, index, 1e30,
+					true) < 0) {
+				printf("Not enough memory!!\n\n");
+				return -1;
+			}
+		} else {
+			GroupTryAdd(&groups[best], textures, index, max_error,
+				    true);
+		}
+
+		textures[index].group = best;
+	}
+
+	// Save everything
+	char manifest_filename[FILENAME_MAX];
+	snprintf(manifest_filename, sizeof(manifest_filename),
+		 "%s_manifest.txt", output);
+
+	FILE *manifest = fopen(manifest_filename, "w+");
+	if (!manifest) {
+		printf("Couldn't open %s in write mode!!\n\n",
+		       manifest_filename);
+		return -1;
+	}
+
+	fprintf(manifest, "# Generated by nitro_texture_converter\n");
+	fprintf(manifest, "palettes %d\n", num_groups);
+
+	int shared_bytes = 0, separate_bytes = 0;
+
+	for (int g = 0; g < num_groups; g++) {
+		char filename[FILENAME_MAX];
+		snprintf(filename, sizeof(filename), "%s_pal%d.bin", output, g);
+
+		if (WritePalette(filename, &groups[g]) < 1) {
+			fclose(manifest);
+			return -1;
+		}
+
+		fprintf(manifest, "%d %s %d\n", g, filename,
+			groups[g].palette_colors);
+		printf("Created file: %s (%d colors)\n", filename,
+		       groups[g].palette_colors);
+
+		shared_bytes += groups[g].palette_colors * 2;
+	}
+
+	fprintf(manifest, "textures %d\n", num_textures);
+	printf("\n");
+
+	for (int i = 0; i < num_textures; i++) {
+		texture_t *t = &textures[i];
+		group_t *g = &groups[t->group];
+
+		if (WriteTexture(t, g, bits) < 1) {
+			fclose(manifest);
+			return -1;
+		}
+
+		t->error = TextureError(t, g->palette, g->transparent ? 1 : 0,
+					g->palette_colors);
+
+		fprintf(manifest, "%s %d\n", t->texture_filename, t->group);
+		printf("Created file: %s (palette %d, MSE %.2f)%s\n",
+		       t->texture_filename, t->group, t->error,
+		       t->error > max_error ? " - over the budget!" : "");
+
+		// What the texture would use with its own palette
+		int own = t->num_colors + (t->transparent ? 1 : 0);
+		separate_bytes += (own < colors ? own : colors) * 2;
+	}
+
+	fclose(manifest);
+
+	printf("\nCreated file: %s\n\n", manifest_filename);
+
+	printf("%d textures, %d palettes.\n", num_textures, num_groups);
+	printf("Palette VRAM: %d bytes (%d bytes with one palette per "
+	       "texture)\n\n", shared_bytes, separate_bytes);
+
+	for (int i = 0; i < num_textures; i++) {
+		free(textures[i].data);
+		free(textures[i].hist);
+	}
+	for (int g = 0; g < num_groups; g++) {
+		free(groups[g].hist);
+		free(groups[g].members);
+	}
+	free(textures);
+	free(groups);
+	free(order);
+
+	return 1;
+}
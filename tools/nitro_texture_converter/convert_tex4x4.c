@@ -0,0 +1,689 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2008-2009, 2019, Antonio Niño Díaz
+//
+// This file is part of Nitro Engine
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Each block of 4x4 texels has 2 bits per texel and 16 bits of index data:
+//
+//   Bits 0-13:  Offset of the palette of the block (in units of 2 colors)
+//   Bits 14-15: Mode
+//
+//   Mode 0: Color 0, color 1, color 2, transparent
+//   Mode 1: Color 0, color 1, (color 0 + color 1) / 2, transparent
+//   Mode 2: Color 0, color 1, color 2, color 3
+//   Mode 3: Color 0, color 1, (color 0 * 5 + color 1 * 3) / 8,
+//           (color 0 * 3 + color 1 * 5) / 8
+
+#define MODE_3_COLORS_TRANSPARENT	0
+#define MODE_HALF_TRANSPARENT		1
+#define MODE_4_COLORS			2
+#define MODE_INTERPOLATED		3
+
+// The palette offset has 14 bits
+#define MAX_PALETTE_UNITS		(1 << 14)
+#define MAX_PALETTE_COLORS_4X4		(MAX_PALETTE_UNITS * 2)
+
+#define HASH_SIZE			(1 << 16)
+
+typedef struct {
+	int r, g, b;
+} color_t;
+
+typedef struct {
+	color_t px[16];		// RGB 8 bits per component
+	bool opaque[16];
+	int num_opaque;
+} block_t;
+
+typedef struct {
+	int mode;
+	int num_colors;		// Number of palette entries used
+	color_t colors[4];	// RGB 5 bits per component
+	unsigned char texel[16];
+	long error;
+} encoding_t;
+
+// Palette shared by all blocks. Each unit of 2 colors is in a hash table
+// indexed by its colors so that block palettes can be reused quickly.
+static unsigned short palette[MAX_PALETTE_COLORS_4X4 + 2];
+static int palette_colors;
+static int hash_first[HASH_SIZE];
+static int hash_next[MAX_PALETTE_UNITS];
+
+static int Expand5(int c)
+{
+	return (c << 3) | (c >> 2);
+}
+
+static int Quantize5(int c)
+{
+	int v = (c * 31 + 127) / 255;
+	if (v < 0)
+		return 0;
+	if (v > 31)
+		return 31;
+	return v;
+}
+
+static unsigned short ColorToRGB15(color_t c)
+{
+	return c.r | (c.g << 5) | (c.b << 10);
+}
+
+static long ColorDistance(color_t a, color_t b)
+{
+	int dr = a.r - b.r;
+	int dg = a.g - b.g;
+	int db = a.b - b.b;
+
+	return dr * dr + dg * dg + db * db;
+}
+
+// Calculates the colors that the hardware uses for a block in this mode
+static void ModeColors(int mode, const color_t *pal, color_t *out,
+		       int *out_count)
+{
+	color_t c0 = pal[0];
+	color_t c1 = pal[1];
+
+	out[0] = c0;
+	out[1] = c1;
+
+	switch (mode) {
+	case MODE_3_COLORS_TRANSPARENT:
+		out[2] = pal[2];
+		*out_count = 3;
+		break;
+	case MODE_HALF_TRANSPARENT:
+		out[2].r = (c0.r + c1.r) / 2;
+		out[2].g = (c0.g + c1.g) / 2;
+		out[2].b = (c0.b + c1.b) / 2;
+		*out_count = 3;
+		break;
+	case MODE_4_COLORS:
+		out[2] = pal[2];
+		out[3] = pal[3];
+		*out_count = 4;
+		break;
+	case MODE_INTERPOLATED:
+		out[2].r = (c0.r * 5 + c1.r * 3) / 8;
+		out[2].g = (c0.g * 5 + c1.g * 3) / 8;
+		out[2].b = (c0.b * 5 + c1.b * 3) / 8;
+		out[3].r = (c0.r * 3 + c1.r * 5) / 8;
+		out[3].g = (c0.g * 3 + c1.g * 5) / 8;
+		out[3].b = (c0.b * 3 + c1.b * 5) / 8;
+		*out_count = 4;
+		break;
+	}
+}
+
+// Picks the best color of the block for each texel and returns the error
+static long EvaluateEncoding(const block_t *blk, encoding_t *enc)
+{
+	color_t colors[4];
+	int count;
+
+	ModeColors(enc->mode, enc->colors, colors, &count);
+
+	for (int i = 0; i < count; i++) {
+		colors[i].r = Expand5(colors[i].r);
+		colors[i].g = Expand5(colors[i].g);
+		colors[i].b = Expand5(colors[i].b);
+	}
+
+	long error = 0;
+
+	for (int t = 0; t < 16; t++) {
+		if (!blk->opaque[t]) {
+			enc->texel[t] = 3; // Transparent in modes 0 and 1
+			continue;
+		}
+
+		int best = 0;
+		long best_distance = ColorDistance(blk->px[t], colors[0]);
+
+		for (int i = 1; i < count; i++) {
+			long d = ColorDistance(blk->px[t], colors[i]);
+			if (d < best_distance) {
+				best_distance = d;
+				best = i;
+			}
+		}
+
+		enc->texel[t] = best;
+		error += best_distance;
+	}
+
+	enc->error = error;
+	return error;
+}
+
+// Returns the principal axis of the opaque colors of the block, and the mean
+static void PrincipalAxis(const block_t *blk, double *mean, double *axis)
+{
+	double cov[6] = { 0 };
+
+	mean[0] = mean[1] = mean[2] = 0;
+
+	for (int t = 0; t < 16; t++) {
+		if (!blk->opaque[t])
+			continue;
+		mean[0] += blk->px[t].r;
+		mean[1] += blk->px[t].g;
+		mean[2] += blk->px[t].b;
+	}
+
+	for (int i = 0; i < 3; i++)
+		mean[i] /= blk->num_opaque;
+
+	for (int t = 0; t < 16; t++) {
+		if (!blk->opaque[t])
+			continue;
+
+		double r = blk->px[t].r - mean[0];
+		double g = blk->px[t].g - mean[1];
+		double b = blk->px[t].b - mean[2];
+
+		cov[0] += r * r;
+		cov[1] += r * g;
+		cov[2] += r * b;
+		cov[3] += g * g;
+		cov[4] += g * b;
+		cov[5] += b * b;
+	}
+
+	// Power iteration
+	axis[0] = axis[1] = axis[2] = 1;
+
+	for (int it = 0; it < 8; it++) {
+		double x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		double y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		double z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+
+		double max = x < 0 ? -x : x;
+		if ((y < 0 ? -y : y) > max)
+			max = y < 0 ? -y : y;
+		if ((z < 0 ? -z : z) > max)
+			max = z < 0 ? -z : z;
+		if (max == 0)
+			break;
+
+		axis[0] = x / max;
+		axis[1] = y / max;
+		axis[2] = z / max;
+	}
+}
+
+static color_t QuantizeColor(double r, double g, double b)
+{
+	color_t c = { Quantize5((int)(r + 0.5)), Quantize5((int)(g + 0.5)),
+		      Quantize5((int)(b + 0.5)) };
+	return c;
+}
+
+// Tries to improve the colors of an encoding by moving each one of them one
+// step in each direction. Returns when there is no improvement or the number
+// of rounds has been reached.
+static void RefineEncoding(const block_t *blk, encoding_t *enc, int num_colors,
+			   int rounds)
+{
+	static const int step[6][3] = {
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 },
+		{ 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+	};
+
+	for (int round = 0; round < rounds && enc->error > 0; round++) {
+		bool improved = false;
+
+		for (int c = 0; c < num_colors; c++) {
+			for (int s = 0; s < 6; s++) {
+				encoding_t test = *enc;
+				color_t *col = &test.colors[c];
+
+				col->r += step[s][0];
+				col->g += step[s][1];
+				col->b += step[s][2];
+
+				if (col->r < 0 || col->r > 31 || col->g < 0
+				    || col->g > 31 || col->b < 0 || col->b > 31)
+					continue;
+
+				if (EvaluateEncoding(blk, &test) < enc->error) {
+					*enc = test;
+					improved = true;
+				}
+			}
+		}
+
+		if (!improved)
+			break;
+	}
+}
+
+// Encodes the block with two colors and the interpolated ones
+static void EncodeInterpolated(const block_t *blk, bool transparent,
+			       int quality, encoding_t *enc)
+{
+	enc->mode = transparent ? MODE_HALF_TRANSPARENT : MODE_INTERPOLATED;
+	enc->num_colors = 2;
+
+	double mean[3], axis[3];
+	PrincipalAxis(blk, mean, axis);
+
+	// The endpoints are the extremes of the projection on the axis
+	double min = 0, max = 0;
+	double len = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+	if (len > 0) {
+		for (int t = 0; t < 16; t++) {
+			if (!blk->opaque[t])
+				continue;
+
+			double p = ((blk->px[t].r - mean[0]) * axis[0]
+				  + (blk->px[t].g - mean[1]) * axis[1]
+				  + (blk->px[t].b - mean[2]) * axis[2]) / len;
+			if (p < min)
+				min = p;
+			if (p > max)
+				max = p;
+		}
+	}
+
+	enc->colors[0] = QuantizeColor(mean[0] + axis[0] * min,
+				       mean[1] + axis[1] * min,
+				       mean[2] + axis[2] * min);
+	enc->colors[1] = QuantizeColor(mean[0] + axis[0] * max,
+				       mean[1] + axis[1] * max,
+				       mean[2] + axis[2] * max);
+	EvaluateEncoding(blk, enc);
+
+	if (quality >= 2) {
+		// Try all pairs of colors of the block as endpoints
+		for (int i = 0; i < 16; i++) {
+			if (!blk->opaque[i])
+				continue;
+
+			for (int j = i + 1; j < 16; j++) {
+				if (!blk->opaque[j])
+					continue;
+
+				encoding_t test = *enc;
+				test.colors[0] = QuantizeColor(blk->px[i].r,
+							       blk->px[i].g,
+							       blk->px[i].b);
+				test.colors[1] = QuantizeColor(blk->px[j].r,
+							       blk->px[j].g,
+							       blk->px[j].b);
+				if (EvaluateEncoding(blk, &test) < enc->error)
+					*enc = test;
+			}
+		}
+	}
+
+	if (quality >= 1)
+		RefineEncoding(blk, enc, 2, quality >= 2 ? 64 : 4);
+}
+
+// Encodes the block with 3 or 4 colors chosen freely
+static void EncodeExplicit(const block_t *blk, bool transparent, int quality,
+			   encoding_t *enc)
+{
+	int k = transparent ? 3 : 4;
+
+	enc->mode = transparent ? MODE_3_COLORS_TRANSPARENT : MODE_4_COLORS;
+	enc->num_colors = k;
+
+	// If there are few enough different colors, use them directly
+	int unique = 0;
+	for (int t = 0; t < 16; t++) {
+		if (!blk->opaque[t])
+			continue;
+
+		color_t c = QuantizeColor(blk->px[t].r, blk->px[t].g,
+					  blk->px[t].b);
+		int i;
+		for (i = 0; i < unique; i++) {
+			if (ColorToRGB15(enc->colors[i]) == ColorToRGB15(c))
+				break;
+		}
+
+		if (i < unique)
+			continue;
+
+		if (unique == k) {
+			unique = k + 1;
+			break;
+		}
+
+		enc->colors[unique++] = c;
+	}
+
+	if (unique <= k) {
+		for (int i = unique; i < k; i++)
+			enc->colors[i] = enc->colors[0];
+		EvaluateEncoding(blk, enc);
+		return;
+	}
+
+	// Start with colors spread along the principal axis, then improve them
+	// with k-means.
+	encoding_t interp;
+	EncodeInterpolated(blk, false, 0, &interp);
+
+	for (int i = 0; i < k; i++) {
+		color_t a = interp.colors[0], b = interp.colors[1];
+		enc->colors[i].r = (a.r * (k - 1 - i) + b.r * i) / (k - 1);
+		enc->colors[i].g = (a.g * (k - 1 - i) + b.g * i) / (k - 1);
+		enc->colors[i].b = (a.b * (k - 1 - i) + b.b * i) / (k - 1);
+	}
+	EvaluateEncoding(blk, enc);
+
+	int iterations = quality == 0 ? 1 : (quality == 1 ? 4 : 16);
+
+	for (int it = 0; it < iterations; it++) {
+		encoding_t test = *enc;
+		int sum[4][3] = { { 0 } };
+		int count[4] = { 0 };
+
+		for (int t = 0; t < 16; t++) {
+			if (!blk->opaque[t])
+				continue;
+
+			int c = enc->texel[t];
+			sum[c][0] += blk->px[t].r;
+			sum[c][1] += blk->px[t].g;
+			sum[c][2] += blk->px[t].b;
+			count[c]++;
+		}
+
+		for (int c = 0; c < k; c++) {
+			if (count[c] == 0)
+				continue;
+
+			test.colors[c] = QuantizeColor(
+					(double)sum[c][0] / count[c],
+					(double)sum[c][1] / count[c],
+					(double)sum[c][2] / count[c]);
+		}
+
+		if (EvaluateEncoding(blk, &test) >= enc->error)
+			break;
+
+		*enc = test;
+	}
+
+	if (quality >= 2)
+		RefineEncoding(blk, enc, k, 16);
+}
+
+// Orders the colors of the block palette so that equal palettes are found
+// even if the colors were chosen in a different order.
+static void CanonicalizeEncoding(encoding_t *enc)
+{
+	int order[4] = { 0, 1, 2, 3 };
+	int n = enc->num_colors;
+
+	if (enc->mode == MODE_HALF_TRANSPARENT || enc->mode == MODE_INTERPOLATED)
+		n = 2;
+
+	for (int i = 1; i < n; i++) {
+		for (int j = i; j > 0; j--) {
+			if (ColorToRGB15(enc->colors[order[j - 1]])
+			    <= ColorToRGB15(enc->colors[order[j]]))
+				break;
+			int tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+	}
+
+	if (order[0] == 0 && order[1] == 1 && order[2] == 2)
+		return;
+
+	// Swapping the endpoints of an interpolated palette also swaps the
+	// interpolated colors.
+	int remap[4];
+	if (n == 2) {
+		remap[0] = 1;
+		remap[1] = 0;
+		remap[2] = enc->mode == MODE_INTERPOLATED ? 3 : 2;
+		remap[3] = enc->mode == MODE_INTERPOLATED ? 2 : 3;
+	} else {
+		for (int i = 0; i < n; i++)
+			remap[order[i]] = i;
+		// With 3 colors, index 3 is transparent and it isn't sorted
+		if (n == 3)
+			remap[3] = 3;
+	}
+
+	color_t colors[4];
+	memcpy(colors, enc->colors, sizeof(colors));
+	for (int i = 0; i < n; i++)
+		enc->colors[i] = colors[order[i]];
+
+	for (int t = 0; t < 16; t++)
+		enc->texel[t] = remap[enc->texel[t]];
+}
+
+static unsigned int HashPair(unsigned short a, unsigned short b)
+{
+	unsigned int h = (a * 31421u) ^ (b * 6927u);
+	return (h ^ (h >> 16)) & (HASH_SIZE - 1);
+}
+
+// Returns the offset of the palette of the block, in units of 2 colors, or -1
+// if the palette is full.
+static int PaletteAddBlock(const encoding_t *enc)
+{
+	unsigned short c[4] = { 0 };
+	for (int i = 0; i < enc->num_colors; i++)
+		c[i] = ColorToRGB15(enc->colors[i]);
+
+	for (int u = hash_first[HashPair(c[0], c[1])]; u != -1;
+	     u = hash_next[u]) {
+		if (palette[u * 2] != c[0] || palette[u * 2 + 1] != c[1])
+			continue;
+
+		if (enc->num_colors == 2)
+			return u;
+
+		if ((u + 1) * 2 >= palette_colors)
+			continue;
+
+		// The 4th color is transparent in mode 0, it can be anything
+		if (palette[u * 2 + 2] == c[2]
+		    && (enc->num_colors == 3 || palette[u * 2 + 3] == c[3]))
+			return u;
+	}
+
+	int units = enc->num_colors == 2 ? 1 : 2;
+	int first = palette_colors / 2;
+
+	if (first + units > MAX_PALETTE_UNITS)
+		return -1;
+
+	if (enc->num_colors == 3)
+		c[3] = c[2];
+
+	for (int i = 0; i < units * 2; i++)
+		palette[palette_colors++] = c[i];
+
+	for (int u = first; u < first + units; u++) {
+		unsigned int h = HashPair(palette[u * 2], palette[u * 2 + 1]);
+		hash_next[u] = hash_first[h];
+		hash_first[h] = u;
+	}
+
+	return first;
+}
+
+static int WriteFile(const char *filename, const void *data, size_t size)
+{
+	FILE *OUTPUT_FILE = fopen(filename, "wb+");
+
+	if (!OUTPUT_FILE) {
+		printf("Couldn't open %s in write mode!!\n\n", filename);
+		return -1;
+	}
+
+	if (fwrite(data, 1, size, OUTPUT_FILE) != size) {
+		fclose(OUTPUT_FILE);
+		printf("Write error!!\n\n");
+		return -1;
+	}
+
+	fclose(OUTPUT_FILE);
+
+	printf("Created file: %s\n\n", filename);
+
+	return 1;
+}
+
+int ConvertARGBintoTEX4X4(void *data, int size, int width,
+			  char *texture_filename, char *index_filename,
+			  char *palette_filename, int quality)
+{
+	printf("TEX4X4:\n");
+	printf("- The image is divided in blocks of 4x4 texels. Each block\n");
+	printf("  has its own palette of 2, 3 or 4 colors, and may have\n");
+	printf("  transparent texels (image alpha == 0).\n");
+	printf("- Quality level %d (0 = fastest, 2 = best).\n\n", quality);
+
+	unsigned char *data_pointer = (unsigned char *)data;
+	int height = size / (width * 4);
+
+	if ((width & 3) || (height & 3)) {
+		printf("Image size must be a multiple of 4!!\n\n");
+		return -1;
+	}
+
+	// NE_MaterialTexLoadCompressed() can't pad the rows of compressed
+	// textures, so the width must be a valid texture width.
+	if (width < 8 || width > 1024 || (width & (width - 1))) {
+		printf("Width must be a power of 2 between 8 and 1024!!\n\n");
+		return -1;
+	}
+
+	int blocks_x = width / 4;
+	int blocks_y = height / 4;
+	int num_blocks = blocks_x * blocks_y;
+
+	unsigned char *texels = malloc(num_blocks * 4);
+	unsigned short *indices = malloc(num_blocks * sizeof(unsigned short));
+	if (texels == NULL || indices == NULL) {
+		free(texels);
+		free(indices);
+		printf("Not enough memory!!\n\n");
+		return -1;
+	}
+
+	palette_colors = 0;
+	memset(hash_first, -1, sizeof(hash_first));
+
+	int mode_count[4] = { 0 };
+	double total_error = 0;
+	int opaque_texels = 0;
+
+	printf("Creating texture...\n\n");
+
+	for (int by = 0; by < blocks_y; by++) {
+		for (int bx = 0; bx < blocks_x; bx++) {
+			block_t blk;
+			blk.num_opaque = 0;
+
+			for (int t = 0; t < 16; t++) {
+				int x = bx * 4 + (t & 3);
+				int y = by * 4 + (t >> 2);
+				unsigned char *p =
+					&data_pointer[(y * width + x) * 4];
+
+				// Reduce the colors to 5 bits like the other
+				// formats, that truncate them, so that the
+				// colors are chosen to match that image.
+				blk.px[t].r = Expand5(p[0] >> 3);
+				blk.px[t].g = Expand5(p[1] >> 3);
+				blk.px[t].b = Expand5(p[2] >> 3);
+				blk.opaque[t] = p[3] > 0;
+				if (blk.opaque[t])
+					blk.num_opaque++;
+			}
+
+			bool transparent = blk.num_opaque < 16;
+			encoding_t enc;
+
+			if (blk.num_opaque == 0) {
+				memset(&enc, 0, sizeof(enc));
+				enc.mode = MODE_HALF_TRANSPARENT;
+				enc.num_colors = 2;
+				EvaluateEncoding(&blk, &enc);
+			} else {
+				encoding_t explicit_enc;
+
+				EncodeInterpolated(&blk, transparent, quality,
+						   &enc);
+				EncodeExplicit(&blk, transparent, quality,
+					       &explicit_enc);
+
+				// Interpolated palettes use half the space
+				if (explicit_enc.error < enc.error)
+					enc = explicit_enc;
+			}
+
+			CanonicalizeEncoding(&enc);
+
+			int offset = PaletteAddBlock(&enc);
+			if (offset < 0) {
+				free(texels);
+				free(indices);
+				printf("The palette is too big!!\n\n");
+				return -1;
+			}
+
+			int b = by * blocks_x + bx;
+
+			for (int row = 0; row < 4; row++) {
+				unsigned char *t = &enc.texel[row * 4];
+				texels[b * 4 + row] = t[0] | (t[1] << 2)
+						    | (t[2] << 4) | (t[3] << 6);
+			}
+
+			indices[b] = offset | (enc.mode << 14);
+
+			mode_count[enc.mode]++;
+			total_error += enc.error;
+			opaque_texels += blk.num_opaque;
+		}
+	}
+
+	printf("Blocks: %d\n", num_blocks);
+	printf("   3 colors + transparent:     %d\n", mode_count[0]);
+	printf("   2 colors + transparent:     %d\n", mode_count[1]);
+	printf("   4 colors:                   %d\n", mode_count[2]);
+	printf("   2 colors + 2 interpolated:  %d\n", mode_count[3]);
+	printf("The palette has got %d colors.\n", palette_colors);
+	if (opaque_texels > 0)
+		printf("Mean squared error: %.2f\n",
+		       total_error / (opaque_texels * 3));
+	printf("VRAM: %d bytes (RGB16: %d, RGB256: %d)\n\n",
+	       num_blocks * 6 + palette_colors * 2, width * height / 2 + 32,
+	       width * height + 512);
+
+	int ret = WriteFile(texture_filename, texels, num_blocks * 4);
+	if (ret == 1)
+		ret = WriteFile(index_filename, indices,
+				num_blocks * sizeof(unsigned short));
+	if (ret == 1)
+		ret = WriteFile(palette_filename, palette,
+				palette_colors * sizeof(unsigned short));
+
+	free(texels);
+	free(indices);
+
+	return ret;
+}
@@ -17,7 +17,7 @@
 # error "This code needs libpng 1.6"
 #endif
 
-void *LoadPNGtoARGB(char *filename, int *buffer_size)
+void *LoadPNGtoARGB(char *filename, int *buffer_size, int *width)
 {
     printf("Loading file %s...\n\n", filename);
 
@@ -62,6 +62,7 @@ void *LoadPNGtoARGB(char *filename, int *buffer_size)
     printf("\n");
 
     *buffer_size = _height * _width * 4;
+    *width = _width;
 
     return buffer;
 }
@@ -8,23 +8,61 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "palette.h"
+
 #define NITRO_TEXTURE_CONVERTER_VERSION "1.1.0"
 
-#define FORMAT_TYPES   7
+#define FORMAT_TYPES   9
+
+#define FORMAT_AUTO    8
 
 const char *FORMAT_STRINGS[FORMAT_TYPES] = {
-	"A1RGB5", "RGB256", "RGB16", "RGB4", "A3RGB32", "A5RGB8", "DEPTHBMP"
+	"A1RGB5", "RGB256", "RGB16", "RGB4", "A3RGB32", "A5RGB8", "DEPTHBMP",
+	"TEX4X4", "AUTO"
 };
 
+// Default quality thresholds of the AUTO format
+#define AUTO_MIN_PSNR  40.0
+#define AUTO_MIN_SSIM  0.98
+
 void PrintUsage(void)
 {
 	printf("Usage:\n");
-	printf("   Nitro_Texture_Converter [input].png [format]\n\n");
+	printf("   Nitro_Texture_Converter [input].png [format] "
+	       "[quality|dither]\n");
+	printf("   Nitro_Texture_Converter [input].png AUTO [psnr] [ssim] "
+	       "[report]\n\n");
 
 	printf("Output files:\n");
 	printf("   [input]_tex.bin - Texture\n");
+	printf("   [input]_idx.bin - Palette index data (TEX4X4 only)\n");
 	printf("   [input]_pal.bin - Palette (if any)\n\n");
 
+	printf("Quality: (TEX4X4, optional)\n");
+	printf("   0 - Fastest\n");
+	printf("   1 - Normal (default)\n");
+	printf("   2 - Best, slowest\n\n");
+
+	printf("Dithering: (paletted formats, optional)\n");
+	printf("   0 - None (default)\n");
+	printf("   1 - Ordered\n");
+	printf("   2 - Error diffusion\n\n");
+
+	printf("Shared palettes:\n");
+	printf("   Nitro_Texture_Converter -shared [format] [max_error] "
+	       "[output] [input].png...\n\n");
+	printf("   format    - RGB16 or RGB256\n");
+	printf("   max_error - Max mean squared error of each texture\n\n");
+
+	printf("   [output]_pal[N].bin  - Palettes\n");
+	printf("   [output]_manifest.txt - Palette used by each texture\n");
+	printf("   [input]_tex.bin      - Textures\n\n");
+
+	printf("AUTO: (all arguments are optional)\n");
+	printf("   psnr   - Min PSNR in dB (default %.1f)\n", AUTO_MIN_PSNR);
+	printf("   ssim   - Min SSIM (default %.2f)\n", AUTO_MIN_SSIM);
+	printf("   report - File where a line with the result is appended\n\n");
+
 	printf("Format list: (Palete format is always RGB5)\n");
 	printf("   A1RGB5   - 1 Alpha, 5 Red Green Blue\n");
 	printf("   RGB256   - 8 Palette (256 colors)\n");
@@ -32,7 +70,9 @@ void PrintUsage(void)
 	printf("   RGB4     - 2 Palette (4 colors)\n");
 	printf("   A3RGB32  - 3 Alpha, 5 Palette (32 colors\n");
 	printf("   A5RGB8   - 5 Alpha, 3 Palette (8 colors\n");
-	printf("   DEPTHBMP - 1 Fog enable, 15 Depth (For clear BMP)\n\n\n");
+	printf("   DEPTHBMP - 1 Fog enable, 15 Depth (For clear BMP)\n");
+	printf("   TEX4X4   - 2 Palette per 4x4 block (Compressed)\n");
+	printf("   AUTO     - Smallest format with enough quality\n\n\n");
 }
 
 int GetFormat(char *string)
@@ -47,20 +87,101 @@ int GetFormat(char *string)
 	return -1;
 }
 
-void *LoadPNGtoARGB(char *filename, int *buffer_size);
+void *LoadPNGtoARGB(char *filename, int *buffer_size, int *width);
 
 int ConvertARGBintoA1RGB5(void *data, int size, char *texture_filename);
-int ConvertARGBintoRGB256(void *data, int size, char *texture_filename,
-			  char *palette_filename);
-int ConvertARGBintoRGB16(void *data, int size, char *texture_filename,
-			 char *palette_filename);
-int ConvertARGBintoRGB4(void *data, int size, char *texture_filename,
-			char *palette_filename);
-int ConvertARGBintoA3RGB32(void *data, int size, char *texture_filename,
-			   char *palette_filename);
-int ConvertARGBintoA5RGB8(void *data, int size, char *texture_filename,
-			  char *palette_filename);
+int ConvertARGBintoRGB256(void *data, int size, int width,
+			  char *texture_filename, char *palette_filename,
+			  int dither);
+int ConvertARGBintoRGB16(void *data, int size, int width,
+			 char *texture_filename, char *palette_filename,
+			 int dither);
+int ConvertARGBintoRGB4(void *data, int size, int width,
+			char *texture_filename, char *palette_filename,
+			int dither);
+int ConvertARGBintoA3RGB32(void *data, int size, int width,
+			   char *texture_filename, char *palette_filename,
+			   int dither);
+int ConvertARGBintoA5RGB8(void *data, int size, int width,
+			  char *texture_filename, char *palette_filename,
+			  int dither);
 int ConvertARGBintoDEPTHBMP(void *data, int size, char *texture_filename);
+int ConvertARGBintoTEX4X4(void *data, int size, int width,
+			  char *texture_filename, char *index_filename,
+			  char *palette_filename, int quality);
+int ConvertARGBintoAUTO(void *data, int size, int width,
+			char *texture_filename, char *index_filename,
+			char *palette_filename, int quality, double min_psnr,
+			double min_ssim, char *report_filename);
+int ConvertSharedPalettes(int colors, double max_error, char *output,
+			  int num_textures, char **filenames);
+
+// Converts raw data into the format requested
+int ConvertARGB(int format, void *data, int size, int width,
+		char *texture_filename, char *index_filename,
+		char *palette_filename, int quality)
+{
+	int returned_value = 0;
+
+	// "quality" is the dithering mode of paletted formats. If it is
+	// negative, the default value of the format is used.
+	int dither = quality < 0 ? DITHER_NONE : quality;
+	if (quality < 0)
+		quality = 1;
+
+	switch (format) {
+	case 0:		// A1RGB5
+		returned_value =
+		    ConvertARGBintoA1RGB5(data, size, texture_filename);
+		break;
+	case 1:		// RGB256
+		returned_value =
+		    ConvertARGBintoRGB256(data, size, width,
+					  texture_filename,
+					  palette_filename, dither);
+		break;
+	case 2:		// RGB16
+		returned_value =
+		    ConvertARGBintoRGB16(data, size, width,
+					 texture_filename,
+					 palette_filename, dither);
+		break;
+	case 3:		// RGB4
+		returned_value =
+		    ConvertARGBintoRGB4(data, size, width,
+					texture_filename,
+					palette_filename, dither);
+		break;
+	case 4:		// A3RGB32
+		returned_value =
+		    ConvertARGBintoA3RGB32(data, size, width,
+					   texture_filename,
+					   palette_filename, dither);
+		break;
+	case 5:		// A5RGB8
+		returned_value =
+		    ConvertARGBintoA5RGB8(data, size, width,
+					  texture_filename,
+					  palette_filename, dither);
+		break;
+	case 6:		// DEPTHBMP
+		returned_value =
+		    ConvertARGBintoDEPTHBMP(data, size, texture_filename);
+		break;
+	case 7:		// TEX4X4
+		returned_value =
+		    ConvertARGBintoTEX4X4(data, size, width, texture_filename,
+					  index_filename, palette_filename,
+					  quality);
+		break;
+	default:
+		//Program should never get here!
+		printf("Please, select a valid format!\n\n");
+		break;
+	}
+
+	return returned_value;
+}
 
 int main(int argc, char *argv[])
 {
@@ -70,7 +191,42 @@ int main(int argc, char *argv[])
 	printf("Copyright (c) 2008-2011, 2019 Antonio Nino Diaz\n");
 	printf("\n");
 
-	if (argc != 3) {
+	if (argc >= 2 && strcmp(argv[1], "-shared") == 0) {
+		if (argc < 6) {
+			PrintUsage();
+			return 1;
+		}
+
+		int colors;
+		if (strcmp(argv[2], "RGB16") == 0) {
+			colors = 16;
+		} else if (strcmp(argv[2], "RGB256") == 0) {
+			colors = 256;
+		} else {
+			printf("Shared palettes need RGB16 or RGB256!\n\n");
+			PrintUsage();
+			return 1;
+		}
+
+		for (int i = 5; i < argc; i++) {
+			size_t len = strlen(argv[i]);
+			if (len < 4 || strcmp(argv[i] + len - 4, ".png") != 0) {
+				printf("Input files must have the name like "
+				       "this: [input].png\n\n");
+				PrintUsage();
+				return -1;
+			}
+		}
+
+		if (ConvertSharedPalettes(colors, atof(argv[3]), argv[4],
+					  argc - 5, &argv[5]) < 1)
+			return -2;
+
+		printf("Done!!\n\n");
+		return 0;
+	}
+
+	if (argc < 3) {
 		PrintUsage();
 		return 1;
 	}
@@ -81,6 +237,35 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if ((OUTPUT_FORMAT == FORMAT_AUTO && argc > 6)
+	    || (OUTPUT_FORMAT != FORMAT_AUTO && argc > 4)) {
+		PrintUsage();
+		return 1;
+	}
+
+	double min_psnr = AUTO_MIN_PSNR;
+	double min_ssim = AUTO_MIN_SSIM;
+	char *report_filename = NULL;
+
+	if (OUTPUT_FORMAT == FORMAT_AUTO) {
+		if (argc > 3)
+			min_psnr = atof(argv[3]);
+		if (argc > 4)
+			min_ssim = atof(argv[4]);
+		if (argc > 5)
+			report_filename = argv[5];
+	}
+
+	int quality = -1; // Default of each format
+	if (argc == 4 && OUTPUT_FORMAT != FORMAT_AUTO) {
+		quality = atoi(argv[3]);
+		if (quality < 0 || quality > 2) {
+			printf("Quality %s unsupported!\n\n", argv[3]);
+			PrintUsage();
+			return 1;
+		}
+	}
+
 	char *test_extension_png = argv[1] + strlen(argv[1]) - strlen(".png");
 	if (strcmp(test_extension_png, ".png") != 0) {
 		printf
@@ -92,73 +277,54 @@ int main(int argc, char *argv[])
 	printf("Converting %s into format %s...\n\n", argv[1], argv[2]);
 
 	int ARGB_BUFFER_SIZE = 0;	//Convert it into ARGB raw data
-	void *ARGB_BUFFER = LoadPNGtoARGB(argv[1], &ARGB_BUFFER_SIZE);
+	int ARGB_BUFFER_WIDTH = 0;
+	void *ARGB_BUFFER = LoadPNGtoARGB(argv[1], &ARGB_BUFFER_SIZE,
+					  &ARGB_BUFFER_WIDTH);
 	if (ARGB_BUFFER == NULL)
 		return -1;
 
 	// Get output filenames
 	int __strlen = strlen(argv[1]) - strlen(".png");
 	char OUTPUT_BASE_FILENAME[FILENAME_MAX];
+	if (__strlen >= FILENAME_MAX) {
+		printf("Input file name is too long\n\n");
+		free(ARGB_BUFFER);
+		return -1;
+	}
 	strncpy(OUTPUT_BASE_FILENAME, argv[1], __strlen);
 	OUTPUT_BASE_FILENAME[__strlen] = '\0';
 
-	char OUTPUT_TEXTURE_FILENAME[FILENAME_MAX];
+	// The output names are the base name plus a suffix like "_tex.bin"
+#define OUTPUT_FILENAME_MAX	(FILENAME_MAX + sizeof("_tex.bin"))
+
+	char OUTPUT_TEXTURE_FILENAME[OUTPUT_FILENAME_MAX];
 	snprintf(OUTPUT_TEXTURE_FILENAME, sizeof(OUTPUT_TEXTURE_FILENAME),
 		 "%s_tex.bin", OUTPUT_BASE_FILENAME);
 
-	char OUTPUT_PALETTE_FILENAME[FILENAME_MAX];
+	char OUTPUT_INDEX_FILENAME[OUTPUT_FILENAME_MAX];
+	snprintf(OUTPUT_INDEX_FILENAME, sizeof(OUTPUT_INDEX_FILENAME),
+		 "%s_idx.bin", OUTPUT_BASE_FILENAME);
+
+	char OUTPUT_PALETTE_FILENAME[OUTPUT_FILENAME_MAX];
 	snprintf(OUTPUT_PALETTE_FILENAME, sizeof(OUTPUT_PALETTE_FILENAME),
 		 "%s_pal.bin", OUTPUT_BASE_FILENAME);
 
-	// Convert raw data into the format requested
-
-	int returned_value = 0;
+	int returned_value;
 
-	switch (OUTPUT_FORMAT) {
-	case 0:		// A1RGB5
+	if (OUTPUT_FORMAT == FORMAT_AUTO) {
 		returned_value =
-		    ConvertARGBintoA1RGB5(ARGB_BUFFER, ARGB_BUFFER_SIZE,
-					  OUTPUT_TEXTURE_FILENAME);
-		break;
-	case 1:		// RGB256
-		returned_value =
-		    ConvertARGBintoRGB256(ARGB_BUFFER, ARGB_BUFFER_SIZE,
-					  OUTPUT_TEXTURE_FILENAME,
-					  OUTPUT_PALETTE_FILENAME);
-		break;
-	case 2:		// RGB16
-		returned_value =
-		    ConvertARGBintoRGB16(ARGB_BUFFER, ARGB_BUFFER_SIZE,
-					 OUTPUT_TEXTURE_FILENAME,
-					 OUTPUT_PALETTE_FILENAME);
-		break;
-	case 3:		// RGB4
-		returned_value =
-		    ConvertARGBintoRGB4(ARGB_BUFFER, ARGB_BUFFER_SIZE,
+		    ConvertARGBintoAUTO(ARGB_BUFFER, ARGB_BUFFER_SIZE,
+					ARGB_BUFFER_WIDTH,
 					OUTPUT_TEXTURE_FILENAME,
-					OUTPUT_PALETTE_FILENAME);
-		break;
-	case 4:		// A3RGB32
+					OUTPUT_INDEX_FILENAME,
+					OUTPUT_PALETTE_FILENAME, quality,
+					min_psnr, min_ssim, report_filename);
+	} else {
 		returned_value =
-		    ConvertARGBintoA3RGB32(ARGB_BUFFER, ARGB_BUFFER_SIZE,
-					   OUTPUT_TEXTURE_FILENAME,
-					   OUTPUT_PALETTE_FILENAME);
-		break;
-	case 5:		// A5RGB8
-		returned_value =
-		    ConvertARGBintoA5RGB8(ARGB_BUFFER, ARGB_BUFFER_SIZE,
-					  OUTPUT_TEXTURE_FILENAME,
-					  OUTPUT_PALETTE_FILENAME);
-		break;
-	case 6:		// DEPTHBMP
-		returned_value =
-		    ConvertARGBintoDEPTHBMP(ARGB_BUFFER, ARGB_BUFFER_SIZE,
-					    OUTPUT_TEXTURE_FILENAME);
-		break;
-	default:
-		//Program should never get here!
-		printf("Please, select a valid format!\n\n");
-		break;
+		    ConvertARGB(OUTPUT_FORMAT, ARGB_BUFFER, ARGB_BUFFER_SIZE,
+				ARGB_BUFFER_WIDTH, OUTPUT_TEXTURE_FILENAME,
+				OUTPUT_INDEX_FILENAME, OUTPUT_PALETTE_FILENAME,
+				quality);
 	}
 
 	free(ARGB_BUFFER);
@@ -4,118 +4,195 @@
 //
 // This file is part of Nitro Engine
 
+#include <math.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "palette.h"
+#include "quantize.h"
+
+// The palette is created from a histogram of the image with median cut and
+// k-means (see quantize.c). Colors are looked up in a k-d tree, and the result
+// is saved in a table indexed by RGB555 color, so each different color of the
+// image is only searched once.
 
 typedef struct {
-	unsigned char red, green, blue;
-} _COLOR_;
+	int index;		// Palette color
+	int axis;
+	int left, right;	// Children, -1 if there isn't one
+} kd_node_t;
+
+static unsigned int histogram[RGB555_COLORS];
+static unsigned short palette_colors[MAX_PALETTE_COLORS];
+static int colors_used, max_colors;
+static bool transparent_color;
 
-_COLOR_ palette_ptr[MAX_PALETTE_COLORS];
-int colors_used, max_colors;
-bool warning_maxcolors;
-bool can_optimize;
-int MAX_COLOR_DIFFERENCE;
+static kd_node_t kd_nodes[MAX_PALETTE_COLORS];
+static int kd_root;
+static int kd_count;
 
-bool palette_error;
+static short lookup[RGB555_COLORS]; // -1 if not calculated yet
 
-static int Square(int number)
+static int Component(unsigned short color, int axis)
 {
-	return number * number;
+	return (color >> (axis * 5)) & 31;
 }
 
-void Palette_New(int maxcolors, int optimize)
+void Palette_New(int maxcolors)
 {
+	memset(histogram, 0, sizeof(histogram));
 	colors_used = 0;
-	warning_maxcolors = false;
 	max_colors = maxcolors;
-	palette_error = false;
+	transparent_color = false;
+}
 
-	if (optimize > 0) {
-		can_optimize = true;
-		MAX_COLOR_DIFFERENCE = optimize;
-	}
+void Palette_NewColorWeighted(unsigned char red, unsigned char green,
+			      unsigned char blue, unsigned int weight)
+{
+	histogram[(red & 31) | ((green & 31) << 5) | ((blue & 31) << 10)] +=
+		weight;
 }
 
 void Palette_NewColor(unsigned char red, unsigned char green,
 		      unsigned char blue)
 {
-	if (palette_error)
-		return;
+	Palette_NewColorWeighted(red, green, blue, 1);
+}
 
-	int a;
-	for (a = 0; a < colors_used; a++) {
-		// If same color
-		if (palette_ptr[a].red == red && palette_ptr[a].green == green
-		    && palette_ptr[a].blue == blue)
-			return;
-	}
+static int sort_axis;
+
+static int CompareIndices(const void *a, const void *b)
+{
+	unsigned short ca = palette_colors[*(const int *)a];
+	unsigned short cb = palette_colors[*(const int *)b];
+	int d = Component(ca, sort_axis) - Component(cb, sort_axis);
+
+	if (d != 0)
+		return d;
+	return *(const int *)a - *(const int *)b;
+}
 
-	// Find if there is a very similar color...
-	if (can_optimize) {
-		// Find the most similar color
-		for (a = 0; a < colors_used; a++) {
-			if (MAX_COLOR_DIFFERENCE >
-			    Square(palette_ptr[a].red - red) +
-			    Square(palette_ptr[a].green - green) +
-			    Square(palette_ptr[a].blue - blue))
-				return;	// Found, don't add the new color
+// Builds a k-d tree with the colors in "indices". Returns the root node.
+static int KdBuild(int *indices, int num)
+{
+	if (num == 0)
+		return -1;
+
+	int min[3] = { 31, 31, 31 }, max[3] = { 0, 0, 0 };
+	for (int i = 0; i < num; i++) {
+		for (int k = 0; k < 3; k++) {
+			int c = Component(palette_colors[indices[i]], k);
+			if (c < min[k])
+				min[k] = c;
+			if (c > max[k])
+				max[k] = c;
 		}
 	}
 
-	// Add the color
-	if (colors_used < max_colors) {
-		palette_ptr[colors_used].red = red;
-		palette_ptr[colors_used].green = green;
-		palette_ptr[colors_used].blue = blue;
-		colors_used++;
-		return;
+	int axis = 0;
+	for (int k = 1; k < 3; k++) {
+		if (max[k] - min[k] > max[axis] - min[axis])
+			axis = k;
 	}
 
-	// Couldn't add a color...
-	palette_error = true;
+	sort_axis = axis;
+	qsort(indices, num, sizeof(int), CompareIndices);
+
+	int mid = num / 2;
+	int node = kd_count++;
+
+	kd_nodes[node].index = indices[mid];
+	kd_nodes[node].axis = axis;
+	kd_nodes[node].left = KdBuild(indices, mid);
+	kd_nodes[node].right = KdBuild(indices + mid + 1, num - mid - 1);
+
+	return node;
 }
 
-int Palette_GetIndex(unsigned char red, unsigned char green, unsigned char blue)
+// Looks for the closest color. If two colors are equally close, the one with
+// the lowest index wins, so the result doesn't depend on the shape of the tree.
+static void KdNearest(int node, unsigned short color, int *best,
+		      int *best_distance)
 {
-	int a;
-	for (a = 0; a < colors_used; a++) {
-		// If same color
-		if (palette_ptr[a].red == red && palette_ptr[a].green == green
-		    && palette_ptr[a].blue == blue)
-			return a;
+	if (node == -1)
+		return;
+
+	kd_node_t *n = &kd_nodes[node];
+	int d = Color_Distance(palette_colors[n->index], color);
+
+	if (d < *best_distance || (d == *best_distance && n->index < *best)) {
+		*best = n->index;
+		*best_distance = d;
 	}
 
-	if (can_optimize) {
-		int difference = 10000000;
-		int chosen_color = -1;
-		// Not found the same color, find a similar one
-		for (a = 0; a < colors_used; a++) {
-			int newdifference =
-			    Square(palette_ptr[a].red - red) +
-			    Square(palette_ptr[a].green - green) +
-			    Square(palette_ptr[a].blue - blue);
-
-			if (difference > newdifference) {
-				chosen_color = a;
-				difference = newdifference;
-			}
-		}
+	int diff = Component(color, n->axis)
+		   - Component(palette_colors[n->index], n->axis);
+	int near = diff < 0 ? n->left : n->right;
+	int far = diff < 0 ? n->right : n->left;
+
+	KdNearest(near, color, best, best_distance);
+
+	// The other side can only have a closer color if the splitting plane
+	// is closer than the best color found
+	if (diff * diff <= *best_distance)
+		KdNearest(far, color, best, best_distance);
+}
+
+int Palette_Create(bool transparent)
+{
+	hist_entry_t *hist = malloc(RGB555_COLORS * sizeof(hist_entry_t));
+	if (hist == NULL)
+		return -1;
+
+	int num = Histogram_FromCounts(histogram, hist);
+	int first = transparent ? 1 : 0;
+
+	// Dummy color for transparency
+	palette_colors[0] = 0x7FFF;
+	transparent_color = transparent;
+
+	colors_used = first + Quantize(hist, num, max_colors - first,
+				       palette_colors + first);
+	free(hist);
+
+	int indices[MAX_PALETTE_COLORS];
+	for (int i = first; i < colors_used; i++)
+		indices[i - first] = i;
+
+	kd_count = 0;
+	kd_root = KdBuild(indices, colors_used - first);
 
-		return chosen_color;
+	memset(lookup, -1, sizeof(lookup));
+
+	return colors_used;
+}
+
+static int Nearest(unsigned short color)
+{
+	if (lookup[color] < 0) {
+		int best = transparent_color ? 1 : 0;
+		int best_distance = 1 << 30;
+
+		KdNearest(kd_root, color, &best, &best_distance);
+		lookup[color] = best;
 	}
 
-	return 0;
+	return lookup[color];
+}
+
+int Palette_GetIndex(unsigned char red, unsigned char green, unsigned char blue)
+{
+	return Nearest((red & 31) | ((green & 31) << 5) | ((blue & 31) << 10));
 }
 
 void Palette_GetColor(int index, int *red, int *green, int *blue)
 {
 	if (index < colors_used) {
-		*red = palette_ptr[index].red;
-		*green = palette_ptr[index].green;
-		*blue = palette_ptr[index].blue;
+		*red = palette_colors[index] & 31;
+		*green = (palette_colors[index] >> 5) & 31;
+		*blue = (palette_colors[index] >> 10) & 31;
 	} else {
 		*red = *green = *blue = 0;
 	}
@@ -123,8 +200,170 @@ void Palette_GetColor(int index, int *red, int *green, int *blue)
 
 int Palette_GetColorsUsed(void)
 {
-	if (palette_error)
+	return colors_used;
+}
+
+int Palette_Save(const char *filename)
+{
+	FILE *f = fopen(filename, "wb+");
+
+	if (!f) {
+		printf("Couldn't open %s in write mode!!\n\n", filename);
 		return -1;
+	}
 
-	return colors_used;
+	for (int i = 0; i < colors_used; i++) {
+		// Little endian, alpha not used in palettes
+		unsigned char color[2] = {
+			palette_colors[i] & 0xFF, palette_colors[i] >> 8
+		};
+
+		if (fwrite(color, sizeof(color), 1, f) != 1) {
+			fclose(f);
+			printf("Write error!!\n\n");
+			return -1;
+		}
+	}
+
+	fclose(f);
+
+	return 1;
+}
+
+// Mean distance between each color and the closest one, in RGB555 units. It
+// is used as the strength of ordered dithering.
+static float PaletteSpacing(void)
+{
+	int first = transparent_color ? 1 : 0;
+	float total = 0;
+	int count = 0;
+
+	for (int i = first; i < colors_used; i++) {
+		int best = 1 << 30;
+		for (int j = first; j < colors_used; j++) {
+			int d = Color_Distance(palette_colors[i],
+					       palette_colors[j]);
+			if (j != i && d > 0 && d < best)
+				best = d;
+		}
+		if (best == 1 << 30)
+			continue;
+
+		// Distance per component
+		total += sqrtf(best / 3.0f);
+		count++;
+	}
+
+	return count > 0 ? total / count : 1;
+}
+
+static int Clamp5(float v)
+{
+	int c = (int)(v + 0.5f);
+	if (c < 0)
+		return 0;
+	if (c > 31)
+		return 31;
+	return c;
+}
+
+unsigned char *Palette_MapImage(const unsigned char *data, int size, int width,
+				int dither)
+{
+	int num = size / 4;
+	int height = num / width;
+	unsigned char *indices = malloc(num);
+	if (indices == NULL)
+		return NULL;
+
+	static const int bayer[4][4] = {
+		{ 0, 8, 2, 10 },
+		{ 12, 4, 14, 6 },
+		{ 3, 11, 1, 9 },
+		{ 15, 7, 13, 5 }
+	};
+
+	float spacing = dither == DITHER_ORDERED ? PaletteSpacing() : 0;
+
+	// Error of the current row and the next one, in RGB555 units, with one
+	// extra element at each side.
+	float *error = NULL;
+	if (dither == DITHER_DIFFUSION) {
+		error = calloc((width + 2) * 2 * 3, sizeof(float));
+		if (error == NULL) {
+			free(indices);
+			return NULL;
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		float *cur = error
+			? &error[((y & 1) * (width + 2) + 1) * 3] : NULL;
+		float *next = error
+			? &error[(((y + 1) & 1) * (width + 2) + 1) * 3] : NULL;
+		if (next != NULL)
+			memset(next - 3, 0, (width + 2) * 3 * sizeof(float));
+
+		// Serpentine order, so that the error doesn't always go right
+		bool reverse = dither == DITHER_DIFFUSION && (y & 1);
+
+		for (int i = 0; i < width; i++) {
+			int x = reverse ? width - 1 - i : i;
+			int dir = reverse ? -1 : 1;
+			const unsigned char *p = &data[(y * width + x) * 4];
+			int t = y * width + x;
+
+			if (p[3] == 0 && transparent_color) {
+				indices[t] = 0;
+				continue;
+			}
+
+			int c[3];
+			float v[3];
+
+			// Without error, rounding gives the same result as p[k] >> 3
+			for (int k = 0; k < 3; k++) {
+				float base = (p[k] - 3.5f) / 8.0f;
+
+				if (dither == DITHER_DIFFUSION && p[3] > 0) {
+					// Don't let the error grow where the palette
+					// can't compensate it
+					v[k] = base + cur[x * 3 + k];
+					if (v[k] < 0)
+						v[k] = 0;
+					else if (v[k] > 31)
+						v[k] = 31;
+					c[k] = Clamp5(v[k]);
+				} else if (dither == DITHER_ORDERED) {
+					v[k] = base + spacing
+					       * ((bayer[y & 3][x & 3] + 0.5f)
+						  / 16.0f - 0.5f);
+					c[k] = Clamp5(v[k]);
+				} else {
+					c[k] = p[k] >> 3;
+				}
+			}
+
+			int index = Palette_GetIndex(c[0], c[1], c[2]);
+			indices[t] = index;
+
+			if (dither != DITHER_DIFFUSION || p[3] == 0)
+				continue;
+
+			int r, g, b;
+			Palette_GetColor(index, &r, &g, &b);
+			float e[3] = { v[0] - r, v[1] - g, v[2] - b };
+
+			for (int k = 0; k < 3; k++) {
+				cur[(x + dir) * 3 + k] += e[k] * 7 / 16;
+				next[(x - dir) * 3 + k] += e[k] * 3 / 16;
+				next[x * 3 + k] += e[k] * 5 / 16;
+				next[(x + dir) * 3 + k] += e[k] * 1 / 16;
+			}
+		}
+	}
+
+	free(error);
+
+	return indices;
 }
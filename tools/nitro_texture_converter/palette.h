@@ -7,14 +7,33 @@
 #ifndef PALETTE_H__
 #define PALETTE_H__
 
+#include <stdbool.h>
+
 // 256 is the max. number of colors for a palette for NDS
 #define MAX_PALETTE_COLORS 256
 
-void Palette_New(int maxcolors, int optimize);
+// Dithering used by Palette_MapImage()
+#define DITHER_NONE		0
+#define DITHER_ORDERED		1 // 4x4 Bayer matrix
+#define DITHER_DIFFUSION	2 // Floyd-Steinberg, serpentine
+
+// Starts a new palette of up to "maxcolors" colors
+void Palette_New(int maxcolors);
 
+// Adds a texel to the histogram of the image. Components are 5 bits.
 void Palette_NewColor(unsigned char red, unsigned char green,
 		      unsigned char blue);
 
+// Like Palette_NewColor(), but the texel counts as "weight" texels. Used to
+// give less importance to texels that are almost transparent.
+void Palette_NewColorWeighted(unsigned char red, unsigned char green,
+			      unsigned char blue, unsigned int weight);
+
+// Creates the palette from the histogram. If "transparent" is true, color 0 is
+// a dummy color for transparent texels and it's never used by other texels.
+// Returns the number of colors, including the dummy one.
+int Palette_Create(bool transparent);
+
 int Palette_GetIndex(unsigned char red, unsigned char green,
 		     unsigned char blue);
 
@@ -22,4 +41,13 @@ void Palette_GetColor(int index, int *red, int *green, int *blue);
 
 int Palette_GetColorsUsed(void);
 
+// Writes the palette in RGB555 format. Returns 1 on success.
+int Palette_Save(const char *filename);
+
+// Returns the palette index of every texel of a RGBA image, or NULL if there
+// isn't enough memory. Texels with alpha 0 get index 0 if the palette has a
+// dummy color for transparency.
+unsigned char *Palette_MapImage(const unsigned char *data, int size, int width,
+				int dither);
+
 #endif // PALETTE_H__
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2008-2009, 2019, Antonio Niño Díaz
+//
+// This file is part of Nitro Engine
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "quantize.h"
+
+// Iterations of k-means done after median cut
+#define KMEANS_ITERATIONS 6
+
+#define RED(c)		((c) & 31)
+#define GREEN(c)	(((c) >> 5) & 31)
+#define BLUE(c)		(((c) >> 10) & 31)
+
+static int Component(unsigned short color, int axis)
+{
+	return (color >> (axis * 5)) & 31;
+}
+
+int Color_Distance(unsigned short a, unsigned short b)
+{
+	int dr = RED(a) - RED(b);
+	int dg = GREEN(a) - GREEN(b);
+	int db = BLUE(a) - BLUE(b);
+
+	return dr * dr + dg * dg + db * db;
+}
+
+int Palette_Nearest(const unsigned short *palette, int first, int num_colors,
+		    unsigned short color)
+{
+	int best = first, best_distance = 1 << 30;
+
+	for (int i = first; i < num_colors; i++) {
+		int d = Color_Distance(palette[i], color);
+		if (d < best_distance) {
+			best = i;
+			best_distance = d;
+			if (d == 0)
+				break;
+		}
+	}
+
+	return best;
+}
+
+int Histogram_FromCounts(const unsigned int *counts, hist_entry_t *hist)
+{
+	int num = 0;
+
+	for (int c = 0; c < RGB555_COLORS; c++) {
+		if (counts[c] == 0)
+			continue;
+		hist[num].color = c;
+		hist[num].count = counts[c];
+		num++;
+	}
+
+	return num;
+}
+
+int Histogram_Merge(const hist_entry_t *a, int num_a, const hist_entry_t *b,
+		    int num_b, hist_entry_t *out)
+{
+	int i = 0, j = 0, num = 0;
+
+	while (i < num_a || j < num_b) {
+		if (j == num_b || (i < num_a && a[i].color < b[j].color)) {
+			out[num++] = a[i++];
+		} else if (i == num_a || b[j].color < a[i].color) {
+			out[num++] = b[j++];
+		} else {
+			out[num].color = a[i].color;
+			out[num].count = a[i].count + b[j].count;
+			num++;
+			i++;
+			j++;
+		}
+	}
+
+	return num;
+}
+
+typedef struct {
+	int start, end;		// Entries of the box
+	int axis;		// Component with the largest range
+	int range;
+} box_t;
+
+static int sort_axis;
+
+static int CompareEntries(const void *a, const void *b)
+{
+	const hist_entry_t *ea = a, *eb = b;
+	int ca = Component(ea->color, sort_axis);
+	int cb = Component(eb->color, sort_axis);
+
+	if (ca != cb)
+		return ca - cb;
+	// Make the order independent from the sort algorithm
+	return ea->color - eb->color;
+}
+
+static void BoxShrink(const hist_entry_t *hist, box_t *box)
+{
+	int min[3] = { 31, 31, 31 }, max[3] = { 0, 0, 0 };
+
+	for (int i = box->start; i < box->end; i++) {
+		for (int k = 0; k < 3; k++) {
+			int c = Component(hist[i].color, k);
+			if (c < min[k])
+				min[k] = c;
+			if (c > max[k])
+				max[k] = c;
+		}
+	}
+
+	box->axis = 0;
+	box->range = max[0] - min[0];
+	for (int k = 1; k < 3; k++) {
+		if (max[k] - min[k] > box->range) {
+			box->axis = k;
+			box->range = max[k] - min[k];
+		}
+	}
+}
+
+static unsigned short BoxMean(const hist_entry_t *hist, int start, int end)
+{
+	double sum[3] = { 0, 0, 0 }, total = 0;
+
+	for (int i = start; i < end; i++) {
+		for (int k = 0; k < 3; k++)
+			sum[k] += (double)Component(hist[i].color, k)
+				  * hist[i].count;
+		total += hist[i].count;
+	}
+
+	unsigned short color = 0;
+	for (int k = 0; k < 3; k++)
+		color |= (int)(sum[k] / total + 0.5) << (k * 5);
+
+	return color;
+}
+
+int Quantize(const hist_entry_t *hist, int num, int max_colors,
+	     unsigned short *palette)
+{
+	if (num <= max_colors) {
+		for (int i = 0; i < num; i++)
+			palette[i] = hist[i].color;
+		return num;
+	}
+
+	hist_entry_t *work = malloc(num * sizeof(hist_entry_t));
+	box_t *boxes = malloc(max_colors * sizeof(box_t));
+	if (work == NULL || boxes == NULL) {
+		free(work);
+		free(boxes);
+		return 0;
+	}
+
+	memcpy(work, hist, num * sizeof(hist_entry_t));
+
+	// Median cut: split the box with the largest range at the median of
+	// the texels along its largest axis.
+	int num_boxes = 1;
+	boxes[0].start = 0;
+	boxes[0].end = num;
+	BoxShrink(work, &boxes[0]);
+
+	while (num_boxes < max_colors) {
+		int split = -1;
+		for (int b = 0; b < num_boxes; b++) {
+			if (boxes[b].end - boxes[b].start < 2)
+				continue;
+			if (split == -1 || boxes[b].range > boxes[split].range)
+				split = b;
+		}
+
+		if (split == -1 || boxes[split].range == 0)
+			break;
+
+		box_t *box = &boxes[split];
+		sort_axis = box->axis;
+		qsort(&work[box->start], box->end - box->start,
+		      sizeof(hist_entry_t), CompareEntries);
+
+		double total = 0, half = 0;
+		for (int i = box->start; i < box->end; i++)
+			total += work[i].count;
+
+		int mid = box->start + 1;
+		for (int i = box->start; i < box->end - 1; i++) {
+			half += work[i].count;
+			mid = i + 1;
+			if (half * 2 >= total)
+				break;
+		}
+
+		boxes[num_boxes].start = mid;
+		boxes[num_boxes].end = box->end;
+		box->end = mid;
+		BoxShrink(work, box);
+		BoxShrink(work, &boxes[num_boxes]);
+		num_boxes++;
+	}
+
+	for (int b = 0; b < num_boxes; b++)
+		palette[b] = BoxMean(work, boxes[b].start, boxes[b].end);
+
+	// K-means, to move the colors to the center of the texels they are used
+	// by. Empty clusters keep their color.
+	double *sum = malloc(num_boxes * 4 * sizeof(double));
+	if (sum != NULL) {
+		for (int it = 0; it < KMEANS_ITERATIONS; it++) {
+			memset(sum, 0, num_boxes * 4 * sizeof(double));
+
+			for (int i = 0; i < num; i++) {
+				int n = Palette_Nearest(palette, 0, num_boxes,
+							hist[i].color);
+				for (int k = 0; k < 3; k++)
+					sum[n * 4 + k] += (double)hist[i].count
+						* Component(hist[i].color, k);
+				sum[n * 4 + 3] += hist[i].count;
+			}
+
+			for (int b = 0; b < num_boxes; b++) {
+				double total = sum[b * 4 + 3];
+				if (total == 0)
+					continue;
+
+				unsigned short color = 0;
+				for (int k = 0; k < 3; k++)
+					color |= (int)(sum[b * 4 + k] / total
+						       + 0.5) << (k * 5);
+				palette[b] = color;
+			}
+		}
+		free(sum);
+	}
+
+	free(work);
+	free(boxes);
+
+	return num_boxes;
+}
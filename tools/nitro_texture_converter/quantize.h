@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2008-2009, 2019, Antonio Niño Díaz
+//
+// This file is part of Nitro Engine
+
+#ifndef QUANTIZE_H__
+#define QUANTIZE_H__
+
+// Colors are RGB555: bits 0-4 red, 5-9 green, 10-14 blue
+
+#define RGB555_COLORS 32768
+
+typedef struct {
+	unsigned short color;
+	unsigned int count;
+} hist_entry_t;
+
+// Creates the list of colors used by an image from a table of RGB555_COLORS
+// counters. Returns the number of entries, sorted by color.
+int Histogram_FromCounts(const unsigned int *counts, hist_entry_t *hist);
+
+// Merges two histograms sorted by color. "out" must have space for
+// num_a + num_b entries. Returns the number of entries.
+int Histogram_Merge(const hist_entry_t *a, int num_a, const hist_entry_t *b,
+		    int num_b, hist_entry_t *out);
+
+// Creates a palette of up to "max_colors" colors for a histogram with median
+// cut followed by k-means. The result only depends on the histogram. Returns
+// the number of colors.
+int Quantize(const hist_entry_t *hist, int num, int max_colors,
+	     unsigned short *palette);
+
+// Squared distance between two colors, in RGB555 units
+int Color_Distance(unsigned short a, unsigned short b);
+
+// Returns the index of the palette color closest to "color", ignoring the
+// colors before "first".
+int Palette_Nearest(const unsigned short *palette, int first, int num_colors,
+		    unsigned short color);
+
+#endif // QUANTIZE_H__